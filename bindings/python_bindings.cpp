@@ -1,32 +1,378 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
+#include <algorithm>
+#include <cstdint>
+#include <map>
 #include "vector_db.hpp"
+#include "search_batcher.hpp"
+#include "vector_file.hpp"
+#include "trace.hpp"
 
 namespace py = pybind11;
 
+// Copies a std::vector into a freshly allocated 1-D numpy array.
+template <typename T>
+static py::array_t<T> to_numpy(const std::vector<T>& v) {
+    py::array_t<T> arr(v.size());
+    std::copy(v.begin(), v.end(), arr.mutable_data());
+    return arr;
+}
+
+// Filter clauses from Python: (column, op) or (column, op, value) tuples; a
+// list or tuple value supplies several operands (for "in").
+static std::vector<AttrCondition> to_conditions(const py::iterable& filter) {
+    std::vector<AttrCondition> out;
+    for (py::handle item : filter) {
+        py::tuple clause(py::reinterpret_borrow<py::object>(item));
+        if (clause.size() < 2 || clause.size() > 3)
+            throw py::value_error("Filter clauses are (column, op) or (column, op, value) tuples.");
+        AttrCondition c{clause[0].cast<std::string>(), clause[1].cast<std::string>(), {}};
+        if (clause.size() == 3) {
+            py::object value = clause[2];
+            if (py::isinstance<py::list>(value) || py::isinstance<py::tuple>(value))
+                for (py::handle v : value) c.values.push_back(v.cast<AttrValue>());
+            else
+                c.values.push_back(value.cast<AttrValue>());
+        }
+        out.push_back(std::move(c));
+    }
+    return out;
+}
+
+// Every core call drops the GIL once its arguments are converted: VectorIndex
+// synchronizes itself, and long builds or file I/O must not stall the other
+// Python threads (the server's event loop, health checks, concurrent searches).
+static const auto nogil = py::call_guard<py::gil_scoped_release>();
+
 PYBIND11_MODULE(veloxdb, m) {
     m.doc() = "VeloxDB: A high-performance vector database written in C++";
 
+    m.def("convert_to_vxv", &convert_to_vxv,
+          "Convert a .fvecs, .bvecs or .npy file to the aligned .vxv format; "
+          "returns the number of vectors written.",
+          py::arg("src"), py::arg("dst"), py::arg("with_norms") = true, nogil);
+    m.def("start_trace", &trace::start,
+          "Start recording spans (builds, epochs, save/load, locks, query stages)", nogil);
+    m.def("stop_trace", &trace::stop,
+          "Stop recording and write the spans as Chrome trace-event JSON; "
+          "returns the number of spans written.",
+          py::arg("path"), nogil);
+    m.def("tracing_compiled_in", &trace::compiled_in,
+          "Whether the module was built with span tracing (VELOX_TRACING)");
+
     py::class_<VectorIndex>(m, "VectorIndex")
         .def(py::init<>())
-        .def("add_vector",  &VectorIndex::add_vector,  "Add a float vector to the index")
-        .def("load_fvecs",  &VectorIndex::load_fvecs,  "Memory-map a .fvecs file")
-        .def("get_vector",  &VectorIndex::get_vector,  "Retrieve a vector by integer ID")
+        .def("add_vector",  &VectorIndex::add_vector,  "Add a float vector to the index", nogil)
+        .def("add_vector_with_id", &VectorIndex::add_vector_with_id,
+             "Add a float vector under a 64-bit external id",
+             py::arg("vector"), py::arg("id"), nogil)
+        .def("internal_id", &VectorIndex::internal_id,
+             "Row id of an external id", py::arg("id"), nogil)
+        .def("load_fvecs",  &VectorIndex::load_fvecs,  "Memory-map a .fvecs file",
+             py::arg("filename"), py::arg("populate") = false, py::arg("advice") = "normal",
+             py::arg("huge_pages") = false, py::arg("lock") = false, nogil)
+        .def("load_vxv",    &VectorIndex::load_vxv,    "Memory-map an aligned .vxv file",
+             py::arg("filename"), py::arg("populate") = false, py::arg("advice") = "normal",
+             py::arg("huge_pages") = false, py::arg("lock") = false, nogil)
+        .def("get_vector",  &VectorIndex::get_vector,  "Retrieve a vector by integer ID", nogil)
         .def("build_index", &VectorIndex::build_index, "Build IVF index via K-Means clustering.",
-             py::arg("num_clusters"), py::arg("epochs") = 10, py::arg("metric") = "eucl")
+             py::arg("num_clusters"), py::arg("epochs") = 10, py::arg("metric") = "eucl",
+             py::arg("quantizer") = "flat", py::arg("quantizer_ef") = 64,
+             py::arg("spill") = "none", py::arg("spill_ratio") = 1.1f,
+             py::arg("list_encoding") = "raw", nogil)
         .def("build_index_hnsw", &VectorIndex::build_index_hnsw, "Build an HNSW index.",
-             py::arg("M") = 16, py::arg("ef_construction") = 200, py::arg("metric") = "eucl")
-        .def("write_fvecs", &VectorIndex::write_fvecs, "Export in-memory vectors to disk")
-        .def("save_index",  &VectorIndex::save_index,  "Save the active index to file")
-        .def("load_index",  &VectorIndex::load_index,  "Load an index from file")
+             py::arg("M") = 16, py::arg("ef_construction") = 200, py::arg("metric") = "eucl",
+             py::arg("reorder") = "none", py::arg("selection") = "simple",
+             py::arg("extend_candidates") = false, py::arg("keep_pruned") = false, nogil)
+        .def("build_index_disk", &VectorIndex::build_index_disk,
+             "Build a disk-resident Vamana graph index written to graph_path.",
+             py::arg("graph_path"), py::arg("R") = 32, py::arg("L") = 75,
+             py::arg("alpha") = 1.2f, py::arg("metric") = "eucl", py::arg("beam_width") = 4,
+             nogil)
+        .def("write_fvecs", &VectorIndex::write_fvecs, "Export in-memory vectors to disk", nogil)
+        .def("prefetch", &VectorIndex::prefetch,
+             "Read ahead (or mlock) the mmap'd vectors an IVF search for `query` will scan.",
+             py::arg("query"), py::arg("nprobe") = 1, py::arg("metric") = "eucl",
+             py::arg("lock") = false, nogil)
+        .def("save_index",  &VectorIndex::save_index,  "Save the active index to file", nogil)
+        .def("load_index",  &VectorIndex::load_index,  "Load an index from file", nogil)
+        .def("open", &VectorIndex::open,
+             "Restore a saved data directory (vectors.fvecs + index.ivf + deltas) natively.",
+             py::arg("dir"), py::arg("with_index") = true, py::arg("use_mmap") = true,
+             py::arg("prefault") = true, nogil)
+        .def("is_ready", &VectorIndex::is_ready,
+             "False while open() is still faulting in the mapped vectors.")
+        .def("checkpoint", &VectorIndex::checkpoint,
+             "Persist `dir` incrementally: a base snapshot the first time, then only "
+             "what changed since the last checkpoint. Returns 'base', 'delta' or 'none'.",
+             py::arg("dir"), nogil)
+        .def("consolidate", &VectorIndex::consolidate,
+             "Fold the checkpointed directory's deltas into a new base.", nogil)
+        .def("start_consolidation", &VectorIndex::start_consolidation,
+             "Consolidate on a background thread every interval_seconds once "
+             "min_deltas deltas have accumulated.",
+             py::arg("interval_seconds"), py::arg("min_deltas") = 1, nogil)
+        .def("stop_consolidation", &VectorIndex::stop_consolidation, nogil)
+        .def("size", &VectorIndex::size, "Number of stored vectors", nogil)
+        // IVF balance/drift report as a dict (see ClusterStats).
+        .def("cluster_stats",
+             [](const VectorIndex& self) {
+                 ClusterStats s;
+                 {
+                     py::gil_scoped_release release;
+                     s = self.cluster_stats();
+                 }
+                 py::dict d;
+                 d["num_lists"] = s.num_lists;
+                 d["num_vectors"] = s.num_vectors;
+                 d["inserted"] = s.inserted;
+                 d["spilled"] = s.spilled;
+                 d["min_list"] = s.min_list;
+                 d["max_list"] = s.max_list;
+                 d["imbalance"] = s.imbalance;
+                 d["mean_drift"] = s.mean_drift;
+                 d["max_drift"] = s.max_drift;
+                 d["list_sizes"] = s.list_sizes;
+                 d["drift"] = s.drift;
+                 return d;
+             })
+        .def("rebalance_index", &VectorIndex::rebalance_index,
+             "Split overgrown IVF lists, merge tiny ones and (with drift_threshold > 0) "
+             "re-center drifted centroids.",
+             py::arg("split_factor") = 2.0f, py::arg("merge_factor") = 0.25f,
+             py::arg("drift_threshold") = 0.0f, nogil)
+        .def("merge", &VectorIndex::merge,
+             "Append another index's vectors and fold its IVF or HNSW index into this one "
+             "without retraining.",
+             py::arg("other"), py::arg("metric") = "eucl", nogil)
+        .def("build_index_from", &VectorIndex::build_index_from,
+             "Build an IVF index against another index's frozen centroids (no k-means).",
+             py::arg("trained"), nogil)
+        // Graph diagnostics as a dict: num_nodes, max_level, nodes_per_layer,
+        // mean_degree, degree_histogram (layer 0) and unreachable ids.
+        .def("graph_stats",
+             [](const VectorIndex& self) {
+                 GraphStats s;
+                 {
+                     py::gil_scoped_release release;
+                     s = self.graph_stats();
+                 }
+                 py::dict d;
+                 d["num_nodes"] = s.num_nodes;
+                 d["max_level"] = s.max_level;
+                 d["nodes_per_layer"] = s.nodes_per_layer;
+                 d["mean_degree"] = s.mean_degree;
+                 d["degree_histogram"] = s.degree_histogram;
+                 d["unreachable"] = s.unreachable;
+                 return d;
+             })
+        // Per-component heap bytes plus mapped/resident file bytes.
+        .def("memory_usage",
+             [](const VectorIndex& self) {
+                 MemoryUsage u;
+                 {
+                     py::gil_scoped_release release;
+                     u = self.memory_usage();
+                 }
+                 py::dict components;
+                 for (const auto& [name, bytes] : u.components) components[name.c_str()] = bytes;
+                 py::dict d;
+                 d["components"] = components;
+                 d["heap_bytes"] = u.heap_bytes();
+                 d["mapped_bytes"] = u.mapped_bytes;
+                 d["resident_bytes"] = u.resident_bytes;
+                 return d;
+             })
+        // Per lock mode: acquisitions, contended, wait_ns, max_wait_ns.
+        .def("lock_stats",
+             [](const VectorIndex& self) {
+                 LockStats s;
+                 {
+                     py::gil_scoped_release release;
+                     s = self.lock_stats();
+                 }
+                 auto mode = [](const LockWaitStats& m) {
+                     py::dict d;
+                     d["acquisitions"] = m.acquisitions;
+                     d["contended"] = m.contended;
+                     d["wait_ns"] = m.wait_ns;
+                     d["max_wait_ns"] = m.max_wait_ns;
+                     return d;
+                 };
+                 py::dict d;
+                 d["shared"] = mode(s.shared);
+                 d["exclusive"] = mode(s.exclusive);
+                 return d;
+             })
+        .def("reset_lock_stats", &VectorIndex::reset_lock_stats, nogil)
+        .def("set_memory_budget", &VectorIndex::set_memory_budget,
+             "Cap heap bytes: builds that would exceed it go lean or fail early (0 = off).",
+             py::arg("bytes"), nogil)
         .def("get_index_type", &VectorIndex::get_index_type,
-             "Returns \"none\", \"ivf\", or \"hnsw\" depending on the active index.")
-        .def("set_simd",    &VectorIndex::set_simd)
+             "Returns \"none\", \"ivf\", \"hnsw\" or \"disk\" depending on the active index.", nogil)
+        .def("set_simd",    &VectorIndex::set_simd, nogil)
+        .def("set_storage_encoding", &VectorIndex::set_storage_encoding,
+             "Keep vectors as \"float32\", \"sq8\" or \"fp16\"; search runs on the compressed codes.",
+             py::arg("encoding"), py::arg("keep_float") = true, nogil)
+        .def("set_rerank", &VectorIndex::set_rerank,
+             "Re-rank this many approximate candidates with exact float distances (0 = off).",
+             py::arg("candidates"), nogil)
+        .def("set_binary_prefilter", &VectorIndex::set_binary_prefilter,
+             "Pre-filter brute-force search by Hamming distance on 1-bit codes "
+             "to `shortlist` candidates, then re-rank exactly (0 = off).",
+             py::arg("shortlist"), nogil)
+        .def("set_search_shards", &VectorIndex::set_search_shards,
+             "Search each heavy query as num_shards parallel pieces on a shared pool (1 = off).",
+             py::arg("num_shards"), nogil)
         // Returns list of (id, distance) tuples sorted nearest-first.
         // k          — number of results to return.
         // nprobe     — number of IVF clusters to probe (higher = better recall, slower).
         // ef_search  — HNSW search breadth (higher = better recall, slower). -1 = default.
         .def("search", &VectorIndex::search,
              py::arg("query"), py::arg("k") = 1, py::arg("nprobe") = 1,
-             py::arg("metric") = "eucl", py::arg("ef_search") = -1);
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1, nogil)
+        .def("search_ids", &VectorIndex::search_ids,
+             py::arg("query"), py::arg("k") = 1, py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1, nogil)
+        // One result list per query; scans the index once for the whole batch.
+        .def("search_batch", &VectorIndex::search_batch,
+             py::arg("queries"), py::arg("k") = 1, py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1, nogil)
+        // Returns every (id, distance) within `radius`, sorted nearest-first.
+        // radius is in metric units: squared L2 for "eucl", 1 - cos for "cos".
+        .def("range_search", &VectorIndex::range_search,
+             py::arg("query"), py::arg("radius"), py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1, nogil)
+        // Returns (lims, ids, distances) numpy arrays in CSR layout: hits for
+        // query i are ids[lims[i]:lims[i+1]].
+        .def("range_search_batch",
+             [](VectorIndex& self, const std::vector<std::vector<float>>& queries,
+                float radius, int nprobe, const std::string& metric, int ef_search) {
+                 RangeSearchResult r;
+                 {
+                     py::gil_scoped_release release;
+                     r = self.range_search_batch(queries, radius, nprobe, metric, ef_search);
+                 }
+                 std::vector<int64_t> lims(r.lims.begin(), r.lims.end());
+                 return py::make_tuple(to_numpy(lims), to_numpy(r.ids), to_numpy(r.distances));
+             },
+             py::arg("queries"), py::arg("radius"), py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1)
+        .def("add_attribute", &VectorIndex::add_attribute,
+             "Add a typed attribute column: 'int', 'tag', 'timestamp' or 'text'.",
+             py::arg("name"), py::arg("type"), nogil)
+        // values: {column: int | str | None}; None clears a value.
+        .def("set_attributes",
+             [](VectorIndex& self, int row, const std::map<std::string, AttrValue>& values) {
+                 std::vector<std::pair<std::string, AttrValue>> pairs(values.begin(), values.end());
+                 py::gil_scoped_release release;
+                 self.set_attributes(row, pairs);
+             },
+             py::arg("row"), py::arg("values"))
+        // One {field: value} dict per row, None where unset; every column
+        // when `fields` is empty.
+        .def("get_attributes",
+             [](const VectorIndex& self, const std::vector<int>& rows,
+                std::vector<std::string> fields) {
+                 std::vector<std::vector<AttrValue>> values;
+                 {
+                     py::gil_scoped_release release;
+                     if (fields.empty())
+                         for (const auto& column : self.attribute_schema())
+                             fields.push_back(column.first);
+                     values = self.get_attributes(rows, fields);
+                 }
+                 py::list out;
+                 for (const auto& row : values) {
+                     py::dict d;
+                     for (size_t i = 0; i < fields.size(); i++) d[fields[i].c_str()] = py::cast(row[i]);
+                     out.append(d);
+                 }
+                 return out;
+             },
+             py::arg("rows"), py::arg("fields") = std::vector<std::string>{})
+        .def("attribute_schema", &VectorIndex::attribute_schema,
+             "(name, type) of every attribute column.", nogil)
+        .def("find_rows",
+             [](const VectorIndex& self, const py::iterable& filter, int offset, int limit) {
+                 std::vector<AttrCondition> conditions = to_conditions(filter);
+                 py::gil_scoped_release release;
+                 return self.find_rows(conditions, offset, limit);
+             },
+             "Rows matching every filter clause, ascending.",
+             py::arg("filter"), py::arg("offset") = 0, py::arg("limit") = -1)
+        .def("count_rows",
+             [](const VectorIndex& self, const py::iterable& filter) {
+                 std::vector<AttrCondition> conditions = to_conditions(filter);
+                 py::gil_scoped_release release;
+                 return self.count_rows(conditions);
+             },
+             py::arg("filter"))
+        .def("save_attributes", &VectorIndex::save_attributes,
+             "Write the attribute columns to a .vxa file", py::arg("filename"), nogil)
+        .def("load_attributes", &VectorIndex::load_attributes,
+             "Load (or memory-map) a .vxa attribute file for the stored vectors",
+             py::arg("filename"), py::arg("use_mmap") = true, nogil)
+        // Returns [{"id", "distance", <field>: value, ...}] nearest-first, over
+        // the rows matching every (column, op[, value]) clause of `filter`.
+        .def("search_filtered",
+             [](VectorIndex& self, const std::vector<float>& query, int k,
+                const py::iterable& filter, const std::vector<std::string>& fields,
+                int nprobe, const std::string& metric, int ef_search) {
+                 std::vector<AttrCondition> conditions = to_conditions(filter);
+                 std::vector<SearchHit> hits;
+                 {
+                     py::gil_scoped_release release;
+                     hits = self.search_filtered(query, k, conditions, fields, nprobe, metric,
+                                                 ef_search);
+                 }
+                 py::list out;
+                 for (const SearchHit& h : hits) {
+                     py::dict d;
+                     d["id"] = h.id;
+                     d["distance"] = h.distance;
+                     for (size_t i = 0; i < fields.size(); i++)
+                         d[fields[i].c_str()] = py::cast(h.fields[i]);
+                     out.append(d);
+                 }
+                 return out;
+             },
+             py::arg("query"), py::arg("k") = 1, py::arg("filter") = py::list(),
+             py::arg("fields") = std::vector<std::string>{}, py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1)
+        // Returns (ids, distances) as (N, k) int32 / float32 numpy arrays.
+        .def("knn_graph",
+             [](const VectorIndex& self, int k, const std::string& mode, const std::string& metric,
+                int nprobe, int ef_search, int num_threads) {
+                 KnnGraph g;
+                 {
+                     py::gil_scoped_release release;
+                     g = self.knn_graph(k, mode, metric, nprobe, ef_search, num_threads);
+                 }
+                 auto ids = to_numpy(g.ids);
+                 auto dists = to_numpy(g.distances);
+                 std::vector<py::ssize_t> shape{g.n, g.k};
+                 return py::make_tuple(ids.reshape(shape), dists.reshape(shape));
+             },
+             py::arg("k"), py::arg("mode") = "exact", py::arg("metric") = "eucl",
+             py::arg("nprobe") = 1, py::arg("ef_search") = -1, py::arg("num_threads") = 0)
+        .def("write_knn_graph", &VectorIndex::write_knn_graph,
+             "Stream the kNN graph to a file (header, then N x k int32 ids, then "
+             "N x k float32 distances); returns the number of rows.",
+             py::arg("path"), py::arg("k"), py::arg("mode") = "exact", py::arg("metric") = "eucl",
+             py::arg("nprobe") = 1, py::arg("ef_search") = -1, py::arg("num_threads") = 0, nogil);
+
+    // Coalesces concurrent single-query searches into micro-batches; callers on
+    // other Python threads (e.g. the server's request threads) queue up behind
+    // one another while each waits without the GIL.
+    py::class_<SearchBatcher>(m, "SearchBatcher")
+        .def(py::init<VectorIndex&, int, int, int>(),
+             py::arg("index"), py::arg("max_batch") = 32, py::arg("max_wait_us") = 200,
+             py::arg("num_workers") = 0,
+             py::keep_alive<1, 2>())
+        .def("search", &SearchBatcher::search,
+             py::arg("query"), py::arg("k") = 1, py::arg("nprobe") = 1,
+             py::arg("metric") = "eucl", py::arg("ef_search") = -1, nogil)
+        .def("batches_dispatched", &SearchBatcher::batches_dispatched);
 }
@@ -0,0 +1,182 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "storage.hpp"
+
+// Column types of an AttributeStore: "int" and "timestamp" (int64, with
+// INT64_MIN reserved for null; a timestamp is by convention microseconds
+// since the epoch), "tag" (a short categorical string, dictionary-encoded)
+// and "text" (free text).
+enum class AttrType : uint32_t { Int = 0, Tag = 1, Timestamp = 2, Text = 3 };
+
+AttrType attr_type_from_name(const std::string& name);
+const char* attr_type_name(AttrType type);
+
+// One attribute value: null, an integer (int and timestamp columns) or a
+// string (tag and text columns).
+using AttrValue = std::variant<std::monostate, int64_t, std::string>;
+
+// One clause of a filtered search, `column op values`. op is one of "==",
+// "!=", "<", "<=", ">", ">=" (one operand), "in" (any of the operands),
+// "contains" (text columns: substring) or "exists" (no operand: not null).
+// Ordering ops compare int and timestamp columns numerically and text
+// columns bytewise; tag columns only support equality and "in". A null
+// value satisfies no condition.
+struct AttrCondition {
+    std::string column;
+    std::string op;
+    std::vector<AttrValue> values;
+};
+
+// Typed per-row attributes kept column by column, row-aligned with a
+// VectorStorage (row i describes vector i). Every column is one flat array
+// — int64 values, uint32 tag codes, or (offset, length) references into a
+// byte heap for text — so a predicate over one column scans just that
+// array. A saved file can be mmap'd and filtered in place; the first write
+// copies it into RAM, as VectorStorage does. Not thread-safe on its own:
+// VectorIndex guards it with its index lock.
+class AttributeStore {
+public:
+    static constexpr int64_t kNullInt = std::numeric_limits<int64_t>::min();
+    static constexpr uint32_t kNullTag = std::numeric_limits<uint32_t>::max();
+    static constexpr uint64_t kNullText = std::numeric_limits<uint64_t>::max();
+
+    struct TextRef {
+        uint64_t offset;  // kNullText for null
+        uint64_t length;
+    };
+
+    AttributeStore() = default;
+    ~AttributeStore();
+    AttributeStore(const AttributeStore&) = delete;
+    AttributeStore& operator=(const AttributeStore&) = delete;
+
+    // Adds an empty column; existing rows read as null. Throws if the name
+    // is taken.
+    void add_column(const std::string& name, AttrType type);
+    int num_columns() const { return static_cast<int>(columns_.size()); }
+    // Column index by name, or -1.
+    int find_column(const std::string& name) const;
+    const std::string& column_name(int c) const { return columns_[c].name; }
+    AttrType column_type(int c) const { return columns_[c].type; }
+    // Same column names and types, in the same order.
+    bool same_schema(const AttributeStore& other) const;
+
+    // Rows with storage; set() grows the store (with nulls) to cover `row`.
+    int size() const { return num_rows_; }
+    // Grows to `rows` rows of nulls; never shrinks.
+    void extend(int rows);
+    // Whether `value` fits column c: null, or an integer for int and
+    // timestamp columns and a string for tag and text columns.
+    bool accepts(int c, const AttrValue& value) const;
+    // Throws std::runtime_error when the value does not fit the column.
+    void set(int c, int row, const AttrValue& value);
+    // Null for rows past size().
+    AttrValue get(int c, int row) const;
+
+    // Unchecked typed reads for predicates; row must be < size().
+    int64_t int_at(int c, int row) const { return columns_[c].ints[row]; }
+    uint32_t tag_at(int c, int row) const { return columns_[c].codes[row]; }
+    bool text_null(int c, int row) const { return columns_[c].refs[row].offset == kNullText; }
+    std::string_view text_at(int c, int row) const;
+    // Dictionary code of tag `value` in column c, or kNullTag when no row
+    // has ever held it.
+    uint32_t tag_code(int c, const std::string& value) const;
+
+    // Appends other's rows (same schema) starting at row `offset`, padding
+    // with nulls up to it.
+    void append(const AttributeStore& other, int offset);
+
+    // Writes the .vxa format (see VxaHeader) via a temporary file and a
+    // rename; text heaps are compacted to the referenced strings.
+    void save(const std::string& filename) const;
+    void load(const std::string& filename, bool use_mmap = true);
+    void clear();
+    bool is_mapped() const { return mmap_ptr_ != nullptr; }
+
+    // Heap bytes by column ("<prefix>.<column>"), plus the mapping's size
+    // and residency when mapped.
+    void memory_usage(MemoryUsage& usage, const std::string& prefix = "attributes") const;
+
+    // Incremental checkpoints (see IndexAlgorithm::mark_checkpoint): a delta
+    // is every cell of the rows appended or changed since the mark. Adding
+    // a column changes the schema and needs a full save.
+    void mark_checkpoint();
+    bool can_save_delta() const { return checkpoint_rows_ >= 0; }
+    bool changed_since_checkpoint() const;
+    void save_delta(std::ofstream& out) const;
+    void load_delta(std::ifstream& in);
+
+private:
+    struct Column {
+        std::string name;
+        AttrType type = AttrType::Int;
+        // Owned row data; only the vector matching `type` is used, and it
+        // is empty while the column is served from the mapping.
+        std::vector<int64_t> owned_ints;
+        std::vector<uint32_t> owned_codes;
+        std::vector<TextRef> owned_refs;
+        std::vector<char> owned_text;
+        // Read pointers: into the owned vectors or into the mapping.
+        const int64_t* ints = nullptr;
+        const uint32_t* codes = nullptr;
+        const TextRef* refs = nullptr;
+        const char* text = nullptr;
+        size_t text_bytes = 0;
+        // Tag dictionary (always in RAM).
+        std::vector<std::string> dict;
+        std::unordered_map<std::string, uint32_t> dict_index;
+
+        void bind();
+    };
+
+    // Copies mapped columns into RAM and releases the mapping.
+    void materialize();
+    void unmap();
+    void mark_dirty(int row);
+
+    std::vector<Column> columns_;
+    int num_rows_ = 0;
+    void* mmap_ptr_ = nullptr;
+    size_t mmap_size_ = 0;
+
+    int checkpoint_rows_ = -1;         // size() at mark_checkpoint(); -1 = full save needed
+    std::vector<int> dirty_rows_;      // rows below checkpoint_rows_ changed since the mark
+    std::vector<bool> dirty_;          // [row < checkpoint_rows_] listed in dirty_rows_
+};
+
+// Conditions compiled against one AttributeStore: column names resolved,
+// tag operands turned into dictionary codes and operands type-checked, so
+// matches() is a few array reads per clause. Throws std::runtime_error for
+// an unknown column, op or an operand of the wrong kind. The store must
+// outlive the filter and not change while it is in use.
+class AttributeFilter {
+public:
+    AttributeFilter(const AttributeStore& store, const std::vector<AttrCondition>& conditions);
+
+    // True when every condition holds for `row` (rows past the store's size
+    // have only nulls).
+    bool matches(int row) const;
+    bool empty() const { return clauses_.empty(); }
+
+private:
+    enum class Op { Eq, Ne, Lt, Le, Gt, Ge, In, Contains, Exists };
+    struct Clause {
+        int column;
+        AttrType type;
+        Op op;
+        std::vector<int64_t> ints;         // int/timestamp operands, tag codes
+        std::vector<std::string> strings;  // text operands
+    };
+    bool clause_matches(const Clause& c, int row) const;
+
+    const AttributeStore& store_;
+    std::vector<Clause> clauses_;
+};
@@ -0,0 +1,102 @@
+#pragma once
+#include "index_base.hpp"
+#include "quantizer.hpp"
+#include "thread_pool.hpp"
+#include <memory>
+#include <random>
+
+// Disk-resident Vamana graph (DiskANN). The graph is built in memory over
+// VectorStorage, then written to its own file in which every node's full
+// vector and fixed-degree adjacency list share one 4 KB-aligned record
+// (several nodes per sector when they fit). Only a product-quantized copy of
+// the vectors stays in RAM; queries run a beam search that reads
+// `beam_width` node records per round trip through a pread thread pool and
+// re-ranks the visited nodes with the exact vectors read from disk.
+class DiskIndex : public IndexAlgorithm {
+public:
+    DiskIndex() = default;
+    ~DiskIndex() override;
+
+    // Builds the graph and writes it to params.disk_path, then opens it.
+    void build(const VectorStorage& storage, const IndexParams& params) override;
+
+    std::vector<std::pair<int, float>> search(
+        const VectorStorage& storage, const float* query, int k,
+        const IndexParams& params, bool use_simd) const override;
+
+    // Exact distances are only known for nodes the beam search visits, so
+    // this is approximate: it returns the visited nodes within the radius.
+    std::vector<std::pair<int, float>> range_search(
+        const VectorStorage& storage, const float* query, float radius,
+        const IndexParams& params, bool use_simd) const override;
+
+    // Index file payload: absolute path of the graph file, beam width, PQ
+    // codebooks and codes.
+    void save(std::ofstream& out) const override;
+    void load(std::ifstream& in, int dim, int version) override;
+
+    bool is_built() const override { return built_; }
+    const char* type_name() const override { return "disk"; }
+    bool self_contained() const override { return true; }
+    int size() const override { return num_nodes_; }
+    // In-RAM state only: the PQ codes and codebooks (the graph is on disk).
+    void memory_usage(MemoryUsage& usage) const override;
+
+    static constexpr size_t kSectorSize = 4096;
+
+private:
+    struct Layout {
+        uint32_t node_bytes = 0;
+        uint32_t nodes_per_sector = 0;  // 0 when a node spans several sectors
+        uint32_t sectors_per_node = 1;
+    };
+
+    // One node record read from disk; the pointers alias `buffer`.
+    struct NodeRecord {
+        std::shared_ptr<char> buffer;
+        const float* vec = nullptr;
+        uint32_t degree = 0;
+        const int* neighbors = nullptr;
+    };
+
+    static Layout compute_layout(int dim, int max_degree);
+
+    // In-memory greedy search used during build. Returns every node it
+    // visited as (distance, id) — the candidate pool for robust_prune.
+    std::vector<std::pair<float, int>> greedy_search_mem(
+        const VectorStorage& storage, const std::vector<std::vector<int>>& graph,
+        const float* query, int start, int list_size, bool use_simd,
+        const std::string& metric) const;
+
+    void robust_prune(const VectorStorage& storage, std::vector<std::vector<int>>& graph,
+                      int p, std::vector<std::pair<float, int>> candidates, float alpha,
+                      int max_degree, bool use_simd, const std::string& metric) const;
+
+    void write_graph(const VectorStorage& storage,
+                     const std::vector<std::vector<int>>& graph) const;
+    void open_graph();
+    void close_graph();
+
+    // Reads the records of `ids` concurrently; one pread per node.
+    std::vector<NodeRecord> read_nodes(const std::vector<int>& ids) const;
+
+    // Beam search returning (exact distance, id) for every expanded node,
+    // sorted nearest-first.
+    std::vector<std::pair<float, int>> beam_search(
+        const float* query, int list_size, bool use_simd, const std::string& metric) const;
+
+    std::string path_;  // absolute
+    int fd_ = -1;
+    int dim_ = 0;
+    int num_nodes_ = 0;
+    int max_degree_ = 0;
+    int medoid_ = -1;
+    int beam_width_ = 4;  // node records read per round trip
+    Layout layout_;
+
+    ProductQuantizer pq_;
+    std::vector<uint8_t> codes_;  // num_nodes_ x pq_.code_size()
+
+    std::unique_ptr<ThreadPool> io_pool_;
+    bool built_ = false;
+};
@@ -1,12 +1,13 @@
 #pragma once
 #include "index_base.hpp"
 #include <random>
+#include <cstdint>
 
 // Hierarchical Navigable Small World graph (Malkov & Yashunin). Builds a
 // multi-layer proximity graph; higher layers are sparser "express lanes"
 // used to greedily descend toward a good entry point before an
-// exhaustive-ish search at layer 0. Neighbor selection uses simple
-// closest-M pruning rather than the paper's diversity heuristic.
+// exhaustive-ish search at layer 0. Neighbor selection is either simple
+// closest-M pruning or the paper's diversity heuristic (see IndexParams).
 class HNSWIndex : public IndexAlgorithm {
 public:
     void build(const VectorStorage& storage, const IndexParams& params) override;
@@ -14,33 +15,151 @@ public:
     std::vector<std::pair<int, float>> search(
         const VectorStorage& storage, const float* query, int k,
         const IndexParams& params, bool use_simd) const override;
+    // Layer 0 is traversed through non-matching nodes too, so the graph
+    // stays connected, but only matching ones are kept as results.
+    bool supports_filter() const override { return true; }
+
+    std::vector<std::pair<int, float>> range_search(
+        const VectorStorage& storage, const float* query, float radius,
+        const IndexParams& params, bool use_simd) const override;
 
     void save(std::ofstream& out) const override;
-    void load(std::ifstream& in, int dim) override;
+    void load(std::ifstream& in, int dim, int version) override;
 
     bool is_built() const override { return built_; }
     const char* type_name() const override { return "hnsw"; }
+    int size() const override { return static_cast<int>(levels_.size()); }
+
+    // Relabels nodes so that graph neighbors get nearby ids: "bfs" numbers
+    // them in breadth-first order from the entry point, "rcm" in reverse
+    // Cuthill-McKee order (BFS from a low-degree node, visiting neighbors by
+    // ascending degree). The vectors are copied in the new order and search
+    // runs over that copy, mapping results back to the storage's ids.
+    void reorder(const VectorStorage& storage, const std::string& method);
+    bool is_reordered() const { return !ext_ids_.empty(); }
+
+    void bind_storage(const VectorStorage& storage) override;
+
+    // Merging needs the same M and graphs that are not reordered.
+    void check_merge(const IndexAlgorithm& other) const override;
+    void merge(const VectorStorage& storage, const IndexAlgorithm& other,
+               const IndexParams& params) override;
+
+    GraphStats graph_stats() const override;
+    void memory_usage(MemoryUsage& usage) const override;
+
+    // A delta holds the nodes added since the mark (by merge) and every
+    // block of kDirtyBlock nodes whose lists have been rewritten since;
+    // a rebuild or reorder needs a full save.
+    void mark_checkpoint() override;
+    bool can_save_delta() const override { return checkpoint_nodes_ >= 0; }
+    void save_delta(std::ofstream& out) const override;
+    void load_delta(std::ifstream& in, const VectorStorage& storage) override;
 
 private:
-    struct Node {
-        int level = 0;
-        std::vector<std::vector<int>> neighbors; // neighbors[layer] = adjacent node ids
+    // Epoch-stamped visited marks, one per node, reused across search_layer
+    // calls so none of them allocates or clears: one set per build, and one
+    // per search thread (sized to the largest graph it has searched).
+    struct VisitMarks {
+        std::vector<uint32_t> mark;
+        uint32_t epoch = 0;
+        void next() {
+            if (++epoch == 0) { std::fill(mark.begin(), mark.end(), 0); epoch = 1; }
+        }
+        bool insert(int id) {
+            if (mark[id] == epoch) return false;
+            mark[id] = epoch;
+            return true;
+        }
     };
 
+    // The calling thread's marks, grown to cover `n` nodes.
+    static VisitMarks& thread_marks(int n);
+
     // Best-first search within a single layer, starting from `entry`.
     // Returns up to `ef` (distance, id) pairs sorted nearest-first.
     std::vector<std::pair<float, int>> search_layer(
-        const VectorStorage& storage, const float* query, int entry, int ef,
-        int layer, bool use_simd, const std::string& metric) const;
+        const QueryDistance& dist_to, int entry, int ef, int layer,
+        VisitMarks& marks) const;
+    // search_layer on layer 0 keeping only nodes `filter` matches (by
+    // external id) among the `ef` results.
+    std::vector<std::pair<float, int>> search_layer0_filtered(
+        const QueryDistance& dist_to, int entry, int ef, const AttributeFilter& filter,
+        VisitMarks& marks) const;
 
     int random_level();
 
-    std::vector<Node> nodes_;
+    // Reusable buffers for one build (or merge) over `n` nodes.
+    struct BuildScratch {
+        BuildScratch(int n, int dim) : vec(dim), row(dim), neighbor_row(dim) {
+            marks.mark.assign(n, 0);
+        }
+        VisitMarks marks;
+        std::vector<std::pair<float, int>> pool, kept, discarded;
+        std::vector<float> vec, row, neighbor_row;  // float_vec scratch
+    };
+    // Inserts node i (its level already allocated) into the graph.
+    void link_node(const VectorStorage& storage, int i, const IndexParams& params,
+                   BuildScratch& scratch);
+    // Copies every list of `src` into this arena, ids shifted by `offset`.
+    void copy_links(const HNSWIndex& src, int offset);
+    // Picks up to `m` neighbors at `layer` for node `self` (whose distances
+    // dist_to measures) from scratch.pool, sorted nearest-first, into
+    // scratch.kept according to params.neighbor_selection.
+    void select_neighbors(const VectorStorage& storage, const QueryDistance& dist_to,
+                          int self, int layer, int m, const IndexParams& params,
+                          BuildScratch& scratch) const;
+
+    // Neighbor list of `node` at `layer`: list[0] is the count, followed by
+    // the layer's fixed number of slots.
+    const int* links(int node, int layer) const {
+        return layer == 0
+            ? level0_.data() + static_cast<size_t>(node) * (M_max0_ + 1)
+            : upper_.data() + upper_offset_[node] + static_cast<size_t>(layer - 1) * (M_ + 1);
+    }
+    int* links(int node, int layer) {
+        return const_cast<int*>(static_cast<const HNSWIndex*>(this)->links(node, layer));
+    }
+    // Sizes the arena for nodes with the given levels; every list starts empty.
+    void allocate(std::vector<int> levels);
+    // Appends a node with the given level and empty lists to the arena.
+    void append_node(int level);
+    // Records that `node`'s lists changed since the last checkpoint.
+    void touch(int node) {
+        if (node < checkpoint_nodes_) dirty_blocks_[node / kDirtyBlock] = 1;
+    }
+
+    // Storage the graph's node ids index: the reordered copy, if any.
+    const VectorStorage& data(const VectorStorage& storage) const {
+        return ext_ids_.empty() ? storage : vectors_;
+    }
+    int external_id(int node) const { return ext_ids_.empty() ? node : ext_ids_[node]; }
+    void copy_reordered(const VectorStorage& storage);
+
+    // Adjacency arena, sized once from the node levels so no list ever
+    // reallocates: layer-0 lists (M_max0_ slots) form one block indexed by
+    // node; a node's upper-layer lists (M_ slots each) are consecutive in
+    // upper_ from upper_offset_[node].
+    std::vector<int> levels_;
+    std::vector<int> level0_;
+    std::vector<int> upper_;
+    std::vector<size_t> upper_offset_;
     int entry_point_ = -1;
     int max_level_ = -1;
     int M_ = 16;
     int M_max0_ = 32;
     int ef_construction_ = 200;
     bool built_ = false;
+
+    // Checkpoint state: nodes covered by the last mark (-1 = full save
+    // needed) and one flag per block of kDirtyBlock nodes below that.
+    static constexpr int kDirtyBlock = 64;
+    int checkpoint_nodes_ = -1;
+    std::vector<uint8_t> dirty_blocks_;
+
+    // After reorder(): ext_ids_[node] is the storage id of `node`, and
+    // vectors_ holds the vectors in node order. Both empty otherwise.
+    std::vector<int> ext_ids_;
+    VectorStorage vectors_;
     std::mt19937 rng_{std::random_device{}()};
 };
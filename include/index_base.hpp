@@ -3,8 +3,13 @@
 #include <utility>
 #include <string>
 #include <fstream>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
 #include "storage.hpp"
 #include "metrics.hpp"
+#include "query_distance.hpp"
 
 // Shared distance dispatch used by every index algorithm implementation.
 inline float compute_dist(const float* a, const float* b, int n,
@@ -14,8 +19,11 @@ inline float compute_dist(const float* a, const float* b, int n,
     return use_simd ? euclidean_dist_simd(a, b, n) : euclidean_dist(a, b, n);
 }
 
-// Flat hyperparameter bag covering both current index algorithms (IVF and
-// HNSW). Each concrete IndexAlgorithm reads only the fields it needs.
+class ThreadPool;
+class AttributeFilter;
+
+// Flat hyperparameter bag covering every index algorithm (IVF, HNSW and the
+// on-disk graph). Each concrete IndexAlgorithm reads only the fields it needs.
 struct IndexParams {
     std::string metric = "eucl";
     bool use_simd = false;
@@ -24,11 +32,149 @@ struct IndexParams {
     int num_clusters = 0;
     int epochs = 10;
     int nprobe = 1;
+    // Coarse quantizer: "flat" scores every centroid; "hnsw" indexes the
+    // centroids with an HNSWIndex, used for the training assignment pass,
+    // inserts and probing, searched with quantizer_ef (at least nprobe).
+    std::string coarse_quantizer = "flat";
+    int quantizer_ef = 64;
+    // Spilled secondary assignment: "none"; "ratio" also stores a vector in
+    // its second-closest list when that centroid is within spill_ratio x
+    // the primary distance; "soar" stores every vector in the list that
+    // best covers the primary's residual (orthogonality-amplified, SOAR).
+    std::string spill = "none";
+    float spill_ratio = 1.1f;
+    // "raw" int lists, or "packed": sorted, delta-encoded, bit-packed
+    // blocks (PackedIds), about 2.5-3x smaller at 256-1024 lists, decoded
+    // during scans.
+    std::string list_encoding = "raw";
+    // Partial re-clustering (IVFIndex::rebalance): split lists longer than
+    // split_factor x the mean length, fold lists shorter than merge_factor x
+    // the mean into their neighbors, and re-center lists whose centroid has
+    // drifted more than drift_threshold (metric units) from their mean;
+    // <= 0 disables re-centering.
+    float split_factor = 2.0f;
+    float merge_factor = 0.25f;
+    float drift_threshold = 0.0f;
+
+    // Bytes a build may allocate on top of what is already held (see
+    // VectorIndex::set_memory_budget). A build whose estimate exceeds it
+    // switches to a leaner strategy where it has one, or throws before
+    // allocating anything (check_memory_budget).
+    size_t memory_budget = std::numeric_limits<size_t>::max();
 
     // HNSW
     int M = 16;
     int ef_construction = 200;
     int ef_search = 50;
+    // Neighbor selection while building: "simple" keeps the closest M;
+    // "heuristic" is the paper's diversity rule (a candidate is kept only if
+    // it is closer to the new node than to every neighbor kept so far).
+    // extend_candidates widens the pool with the candidates' own neighbors;
+    // keep_pruned tops lists back up to M from the rejected candidates.
+    std::string neighbor_selection = "simple";
+    bool extend_candidates = false;
+    bool keep_pruned = false;
+    // Post-build node relabelling for cache locality: "none", "bfs" or "rcm"
+    // (reverse Cuthill-McKee). See HNSWIndex::reorder.
+    std::string reorder = "none";
+
+    // Disk graph (Vamana). Search list size reuses ef_search.
+    int max_degree = 32;
+    int build_list_size = 75;
+    float alpha = 1.2f;
+    int beam_width = 4;  // build only; the index keeps it for its searches
+    int pq_subspaces = 0;  // 0 = min(dim, 32)
+    std::string disk_path;
+
+    // Intra-query sharding (search only): when pool is set and num_shards > 1,
+    // algorithms may split one query's scan across the pool.
+    ThreadPool* pool = nullptr;
+    int num_shards = 1;
+
+    // Attribute predicate (search only): when set, algorithms that
+    // supports_filter() return only the rows it matches, skipping the
+    // others as they meet them instead of post-filtering the top-k.
+    const AttributeFilter* filter = nullptr;
+};
+
+// Sharded (scatter-gather) searches give every shard at least this many
+// candidate vectors; below that, sharding costs more than it saves.
+constexpr int kMinShardVectors = 4096;
+
+// Merges per-shard nearest-first result lists into the global top-k.
+inline std::vector<std::pair<int, float>> merge_topk(
+    const std::vector<std::vector<std::pair<int, float>>>& parts, int k)
+{
+    std::vector<std::pair<int, float>> all;
+    for (const auto& p : parts) all.insert(all.end(), p.begin(), p.end());
+    auto by_dist = [](const auto& a, const auto& b) { return a.second < b.second; };
+    int take = std::min(k, static_cast<int>(all.size()));
+    std::partial_sort(all.begin(), all.begin() + take, all.end(), by_dist);
+    all.resize(take);
+    return all;
+}
+
+// Throws when a build estimated to need `need` bytes would exceed the
+// budget, before it allocates any of them.
+inline void check_memory_budget(const IndexParams& params, size_t need, const char* what) {
+    if (need <= params.memory_budget) return;
+    auto mib = [](size_t b) { return std::to_string((b + (1 << 20) - 1) >> 20); };
+    throw std::runtime_error(std::string(what) + " needs about " + mib(need) +
+                             " MiB, more than the " + mib(params.memory_budget) +
+                             " MiB left in the memory budget.");
+}
+
+// Variable-length results of a batched range search, in CSR layout: the hits
+// for query i are ids/distances[lims[i] .. lims[i+1]), sorted nearest-first.
+struct RangeSearchResult {
+    std::vector<size_t> lims{0};
+    std::vector<int> ids;
+    std::vector<float> distances;
+
+    void append(const std::vector<std::pair<int, float>>& hits) {
+        for (const auto& [id, d] : hits) {
+            ids.push_back(id);
+            distances.push_back(d);
+        }
+        lims.push_back(ids.size());
+    }
+};
+
+// All-nearest-neighbors graph (VectorIndex::knn_graph), row-major: the k
+// neighbors of stored vector i, itself excluded and nearest-first, are
+// ids/distances[i*k .. i*k+k). Rows short of k neighbors are padded with
+// id -1 and distance +inf.
+struct KnnGraph {
+    int n = 0;
+    int k = 0;
+    std::vector<int> ids;
+    std::vector<float> distances;
+};
+
+// Structural report on a graph index (see IndexAlgorithm::graph_stats).
+struct GraphStats {
+    int num_nodes = 0;
+    int max_level = -1;
+    std::vector<int> nodes_per_layer;    // [layer] nodes present on that layer
+    std::vector<double> mean_degree;     // [layer] mean out-degree
+    std::vector<int> degree_histogram;   // [d] layer-0 nodes with out-degree d
+    std::vector<int> unreachable;        // ids layer-0 search cannot reach from the entry point
+};
+
+// List balance and centroid drift of a clustered index (see
+// IndexAlgorithm::cluster_stats).
+struct ClusterStats {
+    int num_lists = 0;
+    int num_vectors = 0;
+    int inserted = 0;             // vectors assigned incrementally since the last build/load
+    int spilled = 0;              // secondary copies held in spill lists
+    int min_list = 0;
+    int max_list = 0;
+    double imbalance = 0.0;       // num_lists * sum(len^2) / num_vectors^2; 1.0 = perfectly even
+    double mean_drift = 0.0;
+    double max_drift = 0.0;
+    std::vector<int> list_sizes;  // [list]
+    std::vector<float> drift;     // [list] distance from the centroid to its members' mean
 };
 
 // Interface implemented by each concrete index algorithm (IVF, HNSW, ...).
@@ -44,11 +190,114 @@ public:
         const VectorStorage& storage, const float* query, int k,
         const IndexParams& params, bool use_simd) const = 0;
 
+    // Whether search() honors IndexParams::filter. The facade scans the
+    // matching rows exactly for algorithms that do not.
+    virtual bool supports_filter() const { return false; }
+
+    // Top-k for several queries at once. The default runs them one by one;
+    // algorithms override it when they can share memory traffic across the
+    // batch.
+    virtual std::vector<std::vector<std::pair<int, float>>> search_batch(
+        const VectorStorage& storage, const std::vector<const float*>& queries, int k,
+        const IndexParams& params, bool use_simd) const
+    {
+        std::vector<std::vector<std::pair<int, float>>> out;
+        out.reserve(queries.size());
+        for (const float* q : queries) out.push_back(search(storage, q, k, params, use_simd));
+        return out;
+    }
+
+    // Every indexed vector within `radius` of the query (in the metric's own
+    // units, i.e. squared L2 for "eucl"), sorted nearest-first.
+    virtual std::vector<std::pair<int, float>> range_search(
+        const VectorStorage& storage, const float* query, float radius,
+        const IndexParams& params, bool use_simd) const = 0;
+
+    // Hints the storage to bring in (lock=true: pin) the vectors a search
+    // for `query` is about to scan. Default: nothing to hint.
+    virtual void prefetch(const VectorStorage& /*storage*/, const float* /*query*/,
+                          const IndexParams& /*params*/, bool /*use_simd*/,
+                          bool /*lock*/) const {}
+
+    // Makes vector `id`, just appended to the storage, searchable without a
+    // rebuild. Returns false when the algorithm cannot insert incrementally
+    // (the vector then stays unindexed until the next build).
+    virtual bool insert(const VectorStorage& /*storage*/, int /*id*/, bool /*use_simd*/) {
+        return false;
+    }
+
     // Persist/restore algorithm-specific state only; the facade owns the
-    // common file header (magic, version, type discriminator, dim).
+    // common file header (magic, version, type discriminator, dim) and
+    // passes the file's format version to load.
     virtual void save(std::ofstream& out) const = 0;
-    virtual void load(std::ifstream& in, int dim) = 0;
+    virtual void load(std::ifstream& in, int dim, int version) = 0;
+
+    // Called after load() once the index has been checked against the
+    // storage it will search, for algorithms that derive state from it.
+    virtual void bind_storage(const VectorStorage& /*storage*/) {}
 
     virtual bool is_built() const = 0;
     virtual const char* type_name() const = 0;
+
+    // Number of vectors the structure covers (ids 0 .. size()-1); checked
+    // against the storage when an index file is loaded.
+    virtual int size() const = 0;
+
+    // Appends the heap bytes the structure holds, by component
+    // ("<type>.<part>"), to `usage`.
+    virtual void memory_usage(MemoryUsage& usage) const = 0;
+
+    // Degree distribution and connectivity of graph indexes.
+    virtual GraphStats graph_stats() const {
+        throw std::runtime_error(std::string("Graph diagnostics are not available for ") +
+                                 type_name() + " indexes.");
+    }
+
+    // List-size balance and centroid drift of clustered indexes.
+    virtual ClusterStats cluster_stats() const {
+        throw std::runtime_error(std::string("Cluster statistics are not available for ") +
+                                 type_name() + " indexes.");
+    }
+
+    // Partial re-clustering driven by cluster_stats() (see IndexParams).
+    // Returns the number of lists split, merged away or re-centered.
+    virtual int rebalance(const VectorStorage& /*storage*/, const IndexParams& /*params*/) {
+        throw std::runtime_error(std::string("Rebalancing is not available for ") +
+                                 type_name() + " indexes.");
+    }
+
+    // Folds `other`, an index of the same kind built independently, into
+    // this one without retraining. By the time merge runs, other's vectors
+    // have been appended to `storage` after the ones this index covers, so
+    // other's id i is now size() + i. check_merge throws (before anything
+    // changes) when the two cannot be combined.
+    virtual void check_merge(const IndexAlgorithm& /*other*/) const {
+        throw std::runtime_error(std::string("Merging is not available for ") +
+                                 type_name() + " indexes.");
+    }
+    virtual void merge(const VectorStorage& /*storage*/, const IndexAlgorithm& /*other*/,
+                       const IndexParams& /*params*/) {
+        throw std::runtime_error(std::string("Merging is not available for ") +
+                                 type_name() + " indexes.");
+    }
+
+    // Incremental checkpoints (VectorIndex::checkpoint). mark_checkpoint()
+    // records the current structure as saved. While can_save_delta() holds,
+    // save_delta writes just what changed since the mark, and load_delta
+    // replays that onto the structure as it was at the mark, once the
+    // vectors appended since are in `storage`. can_save_delta() is false
+    // before the first mark and after any change a delta cannot express (a
+    // rebuild, a rebalance moving existing entries); the facade then writes
+    // a full snapshot.
+    virtual void mark_checkpoint() {}
+    virtual bool can_save_delta() const { return false; }
+    virtual void save_delta(std::ofstream& /*out*/) const {}
+    virtual void load_delta(std::ifstream& /*in*/, const VectorStorage& /*storage*/) {
+        throw std::runtime_error(std::string("Delta checkpoints are not available for ") +
+                                 type_name() + " indexes.");
+    }
+
+    // True for algorithms that keep their own copy of the vectors (the
+    // on-disk graph) and can serve queries with an empty VectorStorage.
+    virtual bool self_contained() const { return false; }
 };
@@ -1,19 +1,77 @@
 #pragma once
 #include "index_base.hpp"
+#include "hnsw_index.hpp"
+#include "packed_ids.hpp"
+#include <memory>
 
 // K-Means inverted-file index: partitions vectors into num_clusters
 // centroids and, at search time, probes the nprobe closest centroids'
-// inverted lists instead of scanning every vector.
+// inverted lists instead of scanning every vector. Vectors added after the
+// build are appended to their nearest centroid's list; per-list sums track
+// how far each centroid has drifted from its members so rebalance() can
+// split, merge or re-center just the affected lists. With a very large
+// number of lists the centroids can themselves be indexed by an HNSW graph
+// (coarse_quantizer = "hnsw") so that neither training nor probing has to
+// score every centroid. Optionally, vectors near a boundary are also
+// listed (as a spill entry) under a second centroid, so a low nprobe still
+// reaches them; a spill entry is skipped whenever its primary list is
+// probed too, which keeps results duplicate-free. With list_encoding =
+// "packed" the primary lists are held delta-encoded and bit-packed (see
+// PackedIds) and decoded as each one is scanned.
 class IVFIndex : public IndexAlgorithm {
 public:
     void build(const VectorStorage& storage, const IndexParams& params) override;
+    // Indexes `storage` against `trained`'s centroids (and its quantizer,
+    // spill and list-encoding settings) without running k-means.
+    void build_from(const VectorStorage& storage, const IVFIndex& trained,
+                    const IndexParams& params);
 
     std::vector<std::pair<int, float>> search(
         const VectorStorage& storage, const float* query, int k,
         const IndexParams& params, bool use_simd) const override;
+    // Non-matching ids are skipped during the list scans.
+    bool supports_filter() const override { return true; }
+
+    // Scans each probed list once for every query in the batch that probes
+    // it, instead of once per query.
+    std::vector<std::vector<std::pair<int, float>>> search_batch(
+        const VectorStorage& storage, const std::vector<const float*>& queries, int k,
+        const IndexParams& params, bool use_simd) const override;
+
+    // Read-ahead (or mlock) of the mapped rows in the lists `query` would probe.
+    void prefetch(const VectorStorage& storage, const float* query,
+                  const IndexParams& params, bool use_simd, bool lock) const override;
+
+    std::vector<std::pair<int, float>> range_search(
+        const VectorStorage& storage, const float* query, float radius,
+        const IndexParams& params, bool use_simd) const override;
+
+    bool insert(const VectorStorage& storage, int id, bool use_simd) override;
+    ClusterStats cluster_stats() const override;
+    int rebalance(const VectorStorage& storage, const IndexParams& params) override;
+    void memory_usage(MemoryUsage& usage) const override;
+
+    // Needs the same dim and training metric. With identical centroids
+    // (both partitions built from the same frozen codebook) the inverted
+    // lists are concatenated; otherwise other's vectors are assigned to
+    // this index's centroids as inserts.
+    void check_merge(const IndexAlgorithm& other) const override;
+    void merge(const VectorStorage& storage, const IndexAlgorithm& other,
+               const IndexParams& params) override;
+
+    // Recomputes the per-list sums from the storage after a load.
+    void bind_storage(const VectorStorage& storage) override;
+
+    // Inserts and merges only append ids past the marked size, so a delta
+    // is the list and spill entries holding those ids; a rebalance (or a
+    // rebuild) moves existing entries and needs a full save.
+    void mark_checkpoint() override { checkpoint_size_ = size(); }
+    bool can_save_delta() const override { return checkpoint_size_ >= 0; }
+    void save_delta(std::ofstream& out) const override;
+    void load_delta(std::ifstream& in, const VectorStorage& storage) override;
 
     void save(std::ofstream& out) const override;
-    void load(std::ifstream& in, int dim) override;
+    void load(std::ifstream& in, int dim, int version) override;
 
     // Reads the pre-VELOX_VERSION-2 payload layout (num_clusters/dim were
     // already consumed by the facade before this is called).
@@ -21,10 +79,77 @@ public:
 
     bool is_built() const override { return built_; }
     const char* type_name() const override { return "ivf"; }
+    int size() const override;
 
 private:
+    // Up to `m` (distance, list) pairs for the centroids closest to `vec`,
+    // nearest-first, via the graph quantizer when there is one.
+    std::vector<std::pair<float, int>> nearest_lists(const float* vec, int m, bool use_simd,
+                                                     const std::string& metric) const;
+    // Ids of the `nprobe` centroids closest to the query, nearest-first.
+    std::vector<int> probe_lists(const float* query, int nprobe,
+                                 bool use_simd, const std::string& metric) const;
+
+    // Top-k over the union of `lists` (one shard of a search). `probed` is
+    // the query's full probe set, sorted, for spill de-duplication.
+    std::vector<std::pair<int, float>> scan_lists(
+        const VectorStorage& storage, const float* query, const std::vector<int>& lists,
+        const std::vector<int>& probed, int k, const IndexParams& params, bool use_simd) const;
+
+    // Secondary list for a vector whose primary list is `primary`, or -1.
+    int pick_spill(const float* vec, int primary, bool use_simd) const;
+    void add_spill(int list, int id, int primary);
+    // Recomputes every spill entry from the primary lists.
+    void assign_spills(const VectorStorage& storage, bool use_simd);
+
+    // Members of list c: the raw list, or the packed one decoded into `buf`.
+    const std::vector<int>& list_ids(int c, std::vector<int>& buf) const;
+    size_t list_size(int c) const;
+    // Moves every list between inverted_lists_ and packed_lists_.
+    void pack_lists();
+    void unpack_lists();
+
+    // Linear scan over all centroids.
+    int nearest_centroid(const float* vec, DistFn dist) const;
+    // Nearest centroid through the graph quantizer when there is one.
+    int assign(const float* vec, bool use_simd) const;
+    // (Re)builds the centroid graph over the current centroids.
+    void build_quantizer(bool use_simd);
+    // Adds (sign=1) or removes (sign=-1) `vec` from list c's running sum.
+    void accumulate(int c, const float* vec, double sign);
+    // Rebuilds sums_ from the lists' current members.
+    void recompute_sums(const VectorStorage& storage);
+    // Splits list c in two with 2-means over its members; false if it
+    // cannot be split (fewer than two distinct members).
+    bool split_list(const VectorStorage& storage, int c, DistFn dist);
+
+    const DistKernels* kernels_ = &dist_kernels(0);  // bound to dim_ at build/load
     std::vector<std::vector<float>> centroids_;
+    // Primary lists: inverted_lists_ when raw; packed_lists_ (and an empty
+    // inverted_lists_) when packed_.
     std::vector<std::vector<int>> inverted_lists_;
+    std::vector<PackedIds> packed_lists_;
+    bool packed_ = false;
+    std::vector<std::vector<double>> sums_;  // [list] sum of member vectors
+    std::string metric_ = "eucl";            // metric the centroids were trained with
+
+    // Graph coarse quantizer; null for "flat". Node ids are centroid ids.
+    std::unique_ptr<HNSWIndex> quantizer_;
+    VectorStorage centroid_store_;
+    int quantizer_ef_ = 64;
+
+    // Spill entries: spill_ids_[c] are vectors whose primary list is
+    // spill_primary_[c][i] but which are also scanned with list c.
+    std::vector<std::vector<int>> spill_ids_;
+    std::vector<std::vector<int>> spill_primary_;
+    std::string spill_ = "none";
+    float spill_ratio_ = 1.1f;
+    static constexpr int kSpillCandidates = 8;  // lists SOAR considers
+    static constexpr float kSoarLambda = 1.0f;
+    static constexpr int kQuantizerM = 16;
+    static constexpr int kQuantizerEfConstruction = 100;
+    int inserted_ = 0;
+    int checkpoint_size_ = -1;  // size() at mark_checkpoint(); -1 = full save needed
     bool built_ = false;
     int dim_ = 0;
 };
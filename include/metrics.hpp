@@ -1,4 +1,6 @@
+#pragma once
 #include<iostream>
+#include<cstdint>
 
 float euclidean_dist(const float *a, const float *b, int n);
 
@@ -6,4 +8,67 @@ float euclidean_dist_simd(const float *a, const float *b, int n);
 
 float cosine_dist(const float *a, const float *b, int n);
 
-float cosine_dist_simd(const float *a, const float *b, int n);
\ No newline at end of file
+float cosine_dist_simd(const float *a, const float *b, int n);
+
+// Float32 SIMD kernels bound to one dimensionality. dist_kernels(dim)
+// returns the compile-time specialised pair (trip count fixed, four
+// independent FMA accumulators, no tail) for the common embedding sizes
+// 128, 256, 384, 512, 768, 1024 and 1536, and the generic
+// euclidean_dist_simd / cosine_dist_simd otherwise. Resolve it once, when
+// the dim becomes known, and call through the pointers in hot loops.
+using DistFn = float (*)(const float *a, const float *b, int n);
+
+struct DistKernels {
+    DistFn l2;
+    DistFn cosine;
+    bool specialized;
+};
+
+const DistKernels& dist_kernels(int dim);
+
+// The distance function for one (kernels, simd, metric) combination, to be
+// resolved once per build / query rather than dispatched on every call.
+inline DistFn select_dist(const DistKernels& kernels, bool use_simd, bool cosine) {
+    if (cosine) return use_simd ? kernels.cosine : cosine_dist;
+    return use_simd ? kernels.l2 : euclidean_dist;
+}
+
+// Kernels for padded, aligned rows (.vxv storage): both pointers 32-byte
+// aligned and n a multiple of 16, so they use aligned loads, two
+// accumulators and no tail loop. Zero padding does not change the result.
+float l2_aligned_simd(const float *a, const float *b, int n);
+
+float dot_aligned_simd(const float *a, const float *b, int n);
+
+// IEEE half <-> float conversion (round-to-nearest-even on the way down).
+float half_to_float(uint16_t h);
+
+uint16_t float_to_half(float f);
+
+// SQ8 kernels on per-dimension scaled uint8 codes, where the decoded value
+// is vmin[d] + code[d] * scale[d]. The caller folds vmin into the query:
+// sq8_l2 takes q_shift = query - vmin and returns the squared L2 distance;
+// sq8_dot takes w = query * scale and returns sum(w[d] * code[d]).
+float sq8_l2(const float *q_shift, const float *scale, const uint8_t *code, int n);
+
+float sq8_l2_simd(const float *q_shift, const float *scale, const uint8_t *code, int n);
+
+float sq8_dot(const float *w, const uint8_t *code, int n);
+
+float sq8_dot_simd(const float *w, const uint8_t *code, int n);
+
+// fp16 kernels: float query against a half-precision stored vector.
+float fp16_euclidean_dist(const float *q, const uint16_t *x, int n);
+
+float fp16_euclidean_dist_simd(const float *q, const uint16_t *x, int n);
+
+float fp16_cosine_dist(const float *q, const uint16_t *x, int n);
+
+float fp16_cosine_dist_simd(const float *q, const uint16_t *x, int n);
+
+
+// Hamming distance between two bit-packed binary codes of `words` uint64s.
+// The SIMD variant uses the AVX2 nibble-lookup popcount (vpshufb + vpsadbw).
+int hamming_dist(const uint64_t *a, const uint64_t *b, int words);
+
+int hamming_dist_simd(const uint64_t *a, const uint64_t *b, int words);
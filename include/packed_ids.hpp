@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+
+// Compressed set of non-negative int ids (an IVF inverted list). Ids are
+// stored in blocks of kBlock: each block is sorted and keeps its first id
+// followed by the gaps to the next ids, bit-packed at the width of the
+// block's largest gap. Appended ids collect in an uncompressed tail until
+// it fills a block. Order is not preserved — the list is a set.
+class PackedIds {
+public:
+    static constexpr int kBlock = 128;
+
+    // Replaces the contents with `ids`.
+    void assign(std::vector<int> ids);
+    void push_back(int id);
+    void clear();
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // Decodes every id into `out`, resized to size().
+    void decode(std::vector<int>& out) const;
+    // Heap bytes held by the encoded blocks and the tail.
+    size_t bytes() const;
+
+    void save(std::ofstream& out) const;
+    void load(std::ifstream& in);
+
+private:
+    // Sorts ids[0, kBlock) and appends them as one block.
+    void pack_block(int* ids);
+    // Decodes the block starting at data_[offset] into out[0, kBlock).
+    void unpack_block(size_t offset, int* out) const;
+    // Encoded size of a block whose gaps are `width` bits wide.
+    static size_t block_bytes(int width);
+
+    std::vector<uint8_t> data_;     // blocks back to back, then kPad zero bytes
+    std::vector<size_t> offsets_;   // start of each block in data_
+    std::vector<int> tail_;
+    size_t size_ = 0;
+    // Slack after the last block so the decoder's word loads stay in bounds.
+    static constexpr size_t kPad = 8;
+};
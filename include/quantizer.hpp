@@ -0,0 +1,53 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include "storage.hpp"
+
+// Product quantizer: splits each vector into m contiguous sub-vectors and
+// replaces every sub-vector with the id of its nearest of (up to) 256
+// sub-centroids, so a vector compresses to m bytes. Distances from a float
+// query to a code are computed asymmetrically via per-query lookup tables.
+class ProductQuantizer {
+public:
+    // Per-query lookup tables. For "eucl" `table[j*ksub + c]` is the squared
+    // L2 distance between query sub-vector j and sub-centroid c; for "cos" it
+    // is their dot product and `norms` holds each sub-centroid's squared norm.
+    struct Tables {
+        std::vector<float> table;
+        bool cosine = false;
+        float query_norm = 0.0f;
+    };
+
+    // Trains on at most `max_samples` vectors drawn uniformly from storage.
+    void train(const VectorStorage& storage, int m, int max_samples = 16384);
+
+    void encode(const float* vec, uint8_t* code) const;
+    void compute_tables(const float* query, const std::string& metric, Tables& t) const;
+    float distance(const Tables& t, const uint8_t* code) const;
+
+    int code_size() const { return m_; }
+    size_t heap_bytes() const {
+        return (centroids_.capacity() + centroid_norms_.capacity()) * sizeof(float) +
+               sub_offsets_.capacity() * sizeof(int);
+    }
+    bool is_trained() const { return m_ > 0; }
+
+    void save(std::ofstream& out) const;
+    void load(std::ifstream& in);
+
+private:
+    int sub_dim(int j) const { return sub_offsets_[j + 1] - sub_offsets_[j]; }
+    const float* sub_centroid(int j, int c) const {
+        return centroids_.data() + static_cast<size_t>(ksub_) * sub_offsets_[j] +
+               static_cast<size_t>(c) * sub_dim(j);
+    }
+
+    int dim_ = 0;
+    int m_ = 0;
+    int ksub_ = 0;
+    std::vector<int> sub_offsets_;       // m_+1 boundaries into [0, dim_)
+    std::vector<float> centroids_;       // subspace j: ksub_ x sub_dim(j), row-major
+    std::vector<float> centroid_norms_;  // m_ x ksub_ squared norms (for "cos")
+};
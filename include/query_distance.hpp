@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <string>
+#include "storage.hpp"
+#include "metrics.hpp"
+
+// Distance from one fixed query to stored vectors by id, reading whichever
+// encoding the storage holds. Per-query setup (SQ8 query folding, metric and
+// encoding dispatch) is done once in the constructor rather than per call.
+class QueryDistance {
+public:
+    QueryDistance(const VectorStorage& storage, const float* query,
+                  bool use_simd, const std::string& metric);
+
+    // Not copyable: q_aligned_ points into this object's own q_pad_.
+    QueryDistance(const QueryDistance&) = delete;
+    QueryDistance(QueryDistance&&) = default;
+
+    float operator()(int id) const;
+
+    const float* query() const { return query_; }
+
+private:
+    const VectorStorage& storage_;
+    const float* query_;
+    int dim_;
+    bool use_simd_;
+    bool cosine_;
+    StorageEncoding encoding_;
+    DistFn float_dist_;  // Float32 rows: bound once from storage.kernels()
+
+    // SQ8: query - vmin (L2), query * scale (cosine), sum(query * vmin)
+    // and |query| (cosine).
+    std::vector<float> q_shift_;
+    std::vector<float> q_scaled_;
+    float q_bias_ = 0.0f;
+    float q_norm_ = 0.0f;
+
+    // Aligned storage (padded_dim > 0): the query zero-padded to padded_dim
+    // floats at a 32-byte boundary inside q_pad_, and |query| for cosine.
+    std::vector<float> q_pad_;
+    const float* q_aligned_ = nullptr;
+    int padded_dim_ = 0;
+};
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+// Per-dimension scalar quantizer: each component is mapped linearly from
+// its observed [vmin, vmax] range onto a uint8 code, so a vector decodes as
+// vmin[d] + code[d] * scale[d]. Values outside the trained range clamp.
+class ScalarQuantizer {
+public:
+    // Starts a new training pass with empty ranges.
+    void reset(int dim);
+    // Widens the per-dimension ranges to cover `vec`.
+    void update_range(const float* vec);
+    // Derives scales from the observed ranges; call after the last update.
+    void finalize();
+
+    void encode(const float* vec, uint8_t* code) const;
+    void decode(const uint8_t* code, float* out) const;
+
+    int dim() const { return dim_; }
+    const float* vmin() const { return vmin_.data(); }
+    const float* scale() const { return scale_.data(); }
+
+private:
+    int dim_ = 0;
+    std::vector<float> vmin_;
+    std::vector<float> vmax_;
+    std::vector<float> scale_;
+};
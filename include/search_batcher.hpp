@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <memory>
+#include <utility>
+#include "vector_db.hpp"
+#include "thread_pool.hpp"
+
+// Dynamic micro-batching in front of a VectorIndex. Concurrent callers
+// submit single queries; a dispatcher thread coalesces them into batches
+// (flushed at max_batch requests or max_wait_us after the first one
+// arrived), groups each batch by search parameters, and runs every group
+// through VectorIndex::search_batch on a worker pool, completing one future
+// per request.
+class SearchBatcher {
+public:
+    using Result = std::vector<std::pair<int, float>>;
+
+    explicit SearchBatcher(VectorIndex& index, int max_batch = 32,
+                           int max_wait_us = 200, int num_workers = 0);
+    ~SearchBatcher();
+
+    SearchBatcher(const SearchBatcher&) = delete;
+    SearchBatcher& operator=(const SearchBatcher&) = delete;
+
+    std::future<Result> submit(std::vector<float> query, int k = 1, int nprobe = 1,
+                               const std::string& metric = "eucl", int ef_search = -1);
+
+    // submit() and wait.
+    Result search(std::vector<float> query, int k = 1, int nprobe = 1,
+                  const std::string& metric = "eucl", int ef_search = -1);
+
+    // Number of batches dispatched so far (for tuning max_wait_us).
+    size_t batches_dispatched() const;
+
+private:
+    struct Request {
+        std::vector<float> query;
+        int k;
+        int nprobe;
+        std::string metric;
+        int ef_search;
+        std::promise<Result> promise;
+    };
+
+    void dispatch_loop();
+    void run_group(std::vector<std::shared_ptr<Request>> group);
+
+    VectorIndex& index_;
+    const int max_batch_;
+    const int max_wait_us_;
+
+    std::unique_ptr<ThreadPool> workers_;
+    std::deque<std::shared_ptr<Request>> queue_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    size_t batches_ = 0;
+    std::thread dispatcher_;
+};
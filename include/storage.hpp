@@ -1,6 +1,48 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include "scalar_quantizer.hpp"
+#include "vector_file.hpp"
+#include "metrics.hpp"
+
+// How VectorStorage keeps vectors for search-time distance computation.
+// SQ8 and FP16 hold a compressed copy of every vector next to (or instead
+// of) the float32 data; see VectorStorage::set_encoding.
+enum class StorageEncoding { Float32, SQ8, FP16 };
+
+// Access-pattern hint passed to madvise for a mapped .fvecs file.
+enum class MmapAdvice { Normal, Random, Sequential, WillNeed };
+
+// How load_fvecs maps its file. populate pre-faults the whole mapping at
+// mmap time (MAP_POPULATE); huge_pages asks for transparent huge pages
+// (MADV_HUGEPAGE, only honoured where the kernel supports file THP); lock
+// pins the mapping in RAM (mlock — subject to RLIMIT_MEMLOCK, a failure is
+// reported and ignored).
+struct MmapOptions {
+    bool populate = false;
+    bool huge_pages = false;
+    MmapAdvice advice = MmapAdvice::Normal;
+    bool lock = false;
+};
+
+// Memory held by a VectorIndex, as reported by memory_usage(): heap bytes
+// per named component, plus the size of the mmap'd vector file and how much
+// of it is currently resident (mincore).
+struct MemoryUsage {
+    std::vector<std::pair<std::string, size_t>> components;
+    size_t mapped_bytes = 0;
+    size_t resident_bytes = 0;
+
+    void add(std::string name, size_t bytes) { components.emplace_back(std::move(name), bytes); }
+    size_t heap_bytes() const {
+        size_t total = 0;
+        for (const auto& c : components) total += c.second;
+        return total;
+    }
+};
 
 // Owns raw vector storage: either an in-RAM flat buffer (populated via
 // add_vector) or a read-only mmap'd .fvecs file (populated via load_fvecs).
@@ -14,29 +56,152 @@ public:
     VectorStorage(const VectorStorage&) = delete;
     VectorStorage& operator=(const VectorStorage&) = delete;
 
+    // Appending to mmap'd storage first copies the mapping into RAM, after
+    // which the file is no longer referenced.
     void add_vector(const std::vector<float>& vec);
-    void load_fvecs(const std::string& filename);
+    // Replaces whatever the storage held (vectors, codes, binary codes) with
+    // the mapped file, re-encoded in the current encoding. A rejected file
+    // leaves the storage empty.
+    void load_fvecs(const std::string& filename, const MmapOptions& opts = {});
+    // Maps a native aligned .vxv file (see vector_file.hpp): rows start on
+    // 64-byte boundaries and are zero-padded to padded_dim() floats.
+    void load_vxv(const std::string& filename, const MmapOptions& opts = {});
+    // Bulk-reads a whole .fvecs file into the in-RAM buffer (writable,
+    // unlike load_fvecs' mapping). Validates every row's dim header.
+    void read_fvecs(const std::string& filename);
+    // Writes to a temporary file and renames it over `filename`, so a file
+    // that is currently mmap'd (by this or another storage) stays intact.
     void write_fvecs(const std::string& filename) const;
 
+    // Drops the vectors (and codes) from row `rows` on, copying a mapping
+    // into RAM first. No-op when size() <= rows.
+    void truncate(int rows);
+
+    // Drops every vector and code, unmapping any file. The encoding setting
+    // is kept (SQ8 is retrained on the next data).
+    void clear();
+
+    // Faults in the mapped pages holding rows [begin, end). No-op for
+    // in-RAM storage.
+    void prefault(int begin, int end) const;
+
+    // Asynchronous read-ahead (MADV_WILLNEED) of the pages holding the given
+    // rows, issued as one call per run of adjacent pages; with lock=true the
+    // pages are mlock'ed instead, pinning them as a hot region. No-op for
+    // in-RAM storage.
+    void advise_rows(const int* ids, size_t n, bool lock = false) const;
+
+    // Adds this storage's heap buffers to `usage` as "<prefix>.float",
+    // ".sq8", ".fp16" and ".binary", and its mapping's size and resident
+    // bytes (mincore over the mapped pages).
+    void memory_usage(MemoryUsage& usage, const std::string& prefix = "storage") const;
+    // Heap bytes held (no mapping).
+    size_t heap_bytes() const;
+
     // Bounds-checked copy of vector `index`. Throws std::out_of_range.
     std::vector<float> get_vector(int index) const;
 
     // Zero-copy pointer to vector `index`'s float data. Caller must ensure
-    // index is in range — no bounds check (hot path for build/search loops).
+    // index is in range and has_float_data() — no checks (hot path for
+    // build/search loops).
     const float* raw_vec_ptr(int index) const;
 
+    // Re-encodes every stored vector (and every vector added later) as
+    // `enc`. SQ8 ranges are trained on the vectors present at this call;
+    // later vectors clamp into them. Selected on empty storage, SQ8 waits
+    // for kSq8TrainRows added vectors or a loaded file, holding float32
+    // rows (and reporting Float32) until then. With keep_float=false the
+    // in-RAM float32 buffer is released; mmap'd float data is never dropped
+    // and stays usable for re-ranking. Once released, selecting the same
+    // encoding again is a no-op and any other one throws.
+    void set_encoding(StorageEncoding enc, bool keep_float = true);
+    StorageEncoding encoding() const { return encoding_; }
+    bool has_float_data() const { return use_mmap_ || !float_dropped_; }
+
+    // Vector `index` as float32: zero-copy when float data is held,
+    // otherwise decoded into `scratch` (which must hold dim() floats).
+    const float* float_vec(int index, float* scratch) const;
+
+    const uint8_t* sq8_code(int index) const { return sq8_codes_.data() + static_cast<size_t>(index) * dim_; }
+    const uint16_t* fp16_code(int index) const { return fp16_codes_.data() + static_cast<size_t>(index) * dim_; }
+    // Squared norm of the decoded SQ8 vector (for cosine distance).
+    float sq8_norm_sq(int index) const { return sq8_norms_[index]; }
+    const ScalarQuantizer& sq8_quantizer() const { return sq8_; }
+
+    // Sign-bit binary companion codes: bit d of vector i is set when
+    // component d exceeds the per-dimension mean at build time (1 bit per
+    // dim, packed into uint64 words). Maintained for later add_vector calls
+    // until cleared.
+    void build_binary_codes();
+    void clear_binary_codes();
+    bool has_binary_codes() const { return binary_words_ > 0; }
+    int binary_words() const { return binary_words_; }
+    const uint64_t* binary_code(int index) const {
+        return binary_codes_.data() + static_cast<size_t>(index) * binary_words_;
+    }
+    // Encodes an arbitrary (query) vector with the same thresholds.
+    void encode_binary(const float* vec, uint64_t* out) const;
+
+    // Most rows a storage holds: row ids are ints. Row offsets are computed
+    // in size_t, so any row below this is addressable at any dim.
+    static constexpr int kMaxRows = std::numeric_limits<int>::max();
+    // Vectors added before SQ8 selected on empty storage trains its ranges.
+    static constexpr int kSq8TrainRows = 1024;
+
     int dim() const { return dim_; }
     int size() const { return num_vectors_; }
     bool is_mmapped() const { return use_mmap_; }
 
+    // SIMD distance kernels for dim(), picked when the dim is fixed (first
+    // vector or file load) — specialised for common embedding sizes.
+    const DistKernels& kernels() const { return *kernels_; }
+
+    // Row length in floats when every raw_vec_ptr row is 64-byte aligned and
+    // zero-padded (a mapped .vxv file), else 0.
+    int padded_dim() const { return padded_dim_; }
+    // Precomputed L2 norm of each row, or nullptr when the file has none.
+    const float* row_norms() const { return mmap_norms_; }
+
 private:
+    void encode_row(const float* vec);
+    void encode_loaded_rows();
+    void materialize();
+    void set_dim(int dim) {
+        dim_ = dim;
+        kernels_ = &dist_kernels(dim);
+    }
+    void map_file(const std::string& filename, const MmapOptions& opts);
+    void unmap();
+    // Byte offset of row `index`'s floats within the mapping.
+    size_t row_offset(int index) const {
+        return mmap_data_offset_ + static_cast<size_t>(index) * mmap_row_bytes_;
+    }
+
     // Flat row-major storage: element [i][d] is at flat_database_[i*dim_ + d].
     std::vector<float> flat_database_;
 
     bool use_mmap_ = false;
     void* mmap_ptr_ = nullptr;
     size_t mmap_size_ = 0;
+    size_t mmap_data_offset_ = 0;
+    size_t mmap_row_bytes_ = 0;
+    const float* mmap_norms_ = nullptr;
+    int padded_dim_ = 0;
+
+    StorageEncoding encoding_ = StorageEncoding::Float32;
+    bool float_dropped_ = false;
+    bool keep_float_ = true;     // keep_float of the last set_encoding
+    bool sq8_deferred_ = false;  // SQ8 selected, waiting for kSq8TrainRows rows
+    ScalarQuantizer sq8_;
+    std::vector<uint8_t> sq8_codes_;
+    std::vector<float> sq8_norms_;
+    std::vector<uint16_t> fp16_codes_;
+
+    int binary_words_ = 0;
+    std::vector<float> binary_thresholds_;
+    std::vector<uint64_t> binary_codes_;
 
     int dim_ = 0;
+    const DistKernels* kernels_ = &dist_kernels(0);
     int num_vectors_ = 0;
 };
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Lightweight span tracing. VELOX_TRACE_SCOPE("name") records the time from
+// that line to the end of the enclosing scope, on the calling thread,
+// while a trace is running (trace::start .. trace::stop); stop() writes
+// every span as Chrome trace-event JSON, viewable in chrome://tracing or
+// Perfetto. With no trace running a span costs one relaxed atomic load.
+//
+// Build flags: VELOX_TRACING=0 compiles every span out entirely (the
+// default is 1). VELOX_USDT additionally emits veloxdb:span_begin /
+// veloxdb:span_end USDT probes (name as argument) for perf and bpftrace,
+// independent of start/stop; it needs <sys/sdt.h> (systemtap-sdt-dev).
+#ifndef VELOX_TRACING
+#define VELOX_TRACING 1
+#endif
+
+#if defined(VELOX_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define VELOX_USDT_PROBE(probe, name) DTRACE_PROBE1(veloxdb, probe, name)
+#endif
+#endif
+#ifndef VELOX_USDT_PROBE
+#define VELOX_USDT_PROBE(probe, name) ((void)0)
+#endif
+
+namespace trace {
+
+// Starts recording spans, discarding any from an earlier trace.
+void start();
+// Stops recording and writes the spans recorded since start() to `path`.
+// Returns the number of spans written.
+size_t stop(const std::string& path);
+// Whether spans were compiled in (VELOX_TRACING).
+bool compiled_in();
+
+namespace detail {
+extern std::atomic<bool> active;
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns);
+inline uint64_t now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+}  // namespace detail
+
+inline bool active() { return detail::active.load(std::memory_order_relaxed); }
+
+// One span; `name` must outlive the trace (a string literal).
+class Span {
+public:
+    explicit Span(const char* name) : name_(name), recording_(active()) {
+        VELOX_USDT_PROBE(span_begin, name_);
+        if (recording_) begin_ns_ = detail::now_ns();
+    }
+    ~Span() {
+        if (recording_) detail::record(name_, begin_ns_, detail::now_ns());
+        VELOX_USDT_PROBE(span_end, name_);
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name_;
+    bool recording_;
+    uint64_t begin_ns_ = 0;
+};
+
+}  // namespace trace
+
+#if VELOX_TRACING
+#define VELOX_TRACE_CONCAT_(a, b) a##b
+#define VELOX_TRACE_CONCAT(a, b) VELOX_TRACE_CONCAT_(a, b)
+#define VELOX_TRACE_SCOPE(name) ::trace::Span VELOX_TRACE_CONCAT(velox_span_, __LINE__)(name)
+#else
+#define VELOX_TRACE_SCOPE(name) ((void)0)
+#endif
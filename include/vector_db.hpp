@@ -3,12 +3,44 @@
 #include <string>
 #include <memory>
 #include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 #include <utility>
+#include <cstdint>
+#include <unordered_map>
+#include <functional>
 #include "storage.hpp"
 #include "index_base.hpp"
+#include "attribute_store.hpp"
 
-// Facade: owns raw vector storage plus whichever IndexAlgorithm (IVF or
-// HNSW) is currently active, and guards both with a single coarse
+class ThreadPool;
+
+// Acquisitions of one mode of the facade lock and the time callers spent
+// blocked on it. Uncontended acquisitions are counted but not timed.
+struct LockWaitStats {
+    uint64_t acquisitions = 0;
+    uint64_t contended = 0;    // had to wait for another holder
+    uint64_t wait_ns = 0;      // total time blocked
+    uint64_t max_wait_ns = 0;
+};
+
+struct LockStats {
+    LockWaitStats shared;     // searches, saves, stats
+    LockWaitStats exclusive;  // inserts, builds, loads, setters
+};
+
+// One result of VectorIndex::search_filtered: the row id, its distance and
+// the requested attribute fields, in request order.
+struct SearchHit {
+    int id;
+    float distance;
+    std::vector<AttrValue> fields;
+};
+
+// Facade: owns raw vector storage plus whichever IndexAlgorithm (IVF, HNSW
+// or the on-disk graph) is currently active, and guards both with a single coarse
 // shared_mutex (shared lock for reads, unique lock for writes/rebuilds).
 class VectorIndex {
 public:
@@ -16,13 +48,78 @@ public:
     ~VectorIndex();
 
     void add_vector(const std::vector<float>& vec);
-    void load_fvecs(const std::string& filename);
+    // Adds a vector under a caller-chosen 64-bit id, kept alongside the
+    // compact int row id the indexes use. Once ids are in use every vector
+    // needs one (rows added before the first id keep their row number as
+    // id); ids must be unique. Saved with the index file.
+    void add_vector_with_id(const std::vector<float>& vec, int64_t id);
+    // Row id of external id `id`; throws std::out_of_range if unknown.
+    int internal_id(int64_t id) const;
+    // Maps a .fvecs file read-only. advice is "normal", "random",
+    // "sequential" or "willneed"; see MmapOptions for the other flags.
+    void load_fvecs(const std::string& filename, bool populate = false,
+                    const std::string& advice = "normal", bool huge_pages = false,
+                    bool lock = false);
+    // Same, for the native aligned .vxv format (see convert_to_vxv).
+    void load_vxv(const std::string& filename, bool populate = false,
+                  const std::string& advice = "normal", bool huge_pages = false,
+                  bool lock = false);
     void write_fvecs(const std::string& filename);
     std::vector<float> get_vector(int index);
     void set_simd(bool enable);
 
-    void build_index(int num_clusters, int epochs = 10, const std::string& metric = "eucl");
-    void build_index_hnsw(int M = 16, int ef_construction = 200, const std::string& metric = "eucl");
+    // "float32", "sq8" (per-dimension scaled uint8, 4x smaller) or "fp16"
+    // (2x smaller). Search distances are then computed directly on the
+    // compressed codes; keep_float=false releases the in-RAM float copy.
+    void set_storage_encoding(const std::string& encoding, bool keep_float = true);
+
+    // With a compressed encoding and float data available, fetch this many
+    // candidates on approximate distances and re-rank them exactly before
+    // returning the top k. 0 disables re-ranking.
+    void set_rerank(int candidates);
+
+    // Builds 1-bit-per-dim sign codes and makes the brute-force path (no
+    // index built) pre-filter by Hamming distance to `shortlist` candidates
+    // before re-ranking them exactly. 0 disables and frees the codes. The
+    // codes are rebuilt for the new rows whenever a vector file is loaded.
+    void set_binary_prefilter(int shortlist);
+
+    // Splits each heavy query (brute-force scan, IVF list scan) into
+    // `num_shards` pieces searched concurrently on a pool shared by all
+    // queries, merging the per-shard top-k at the end. 1 disables.
+    void set_search_shards(int num_shards);
+
+    // quantizer = "hnsw" indexes the centroids with an HNSW graph (searched
+    // with quantizer_ef) for training assignment and probing; use it for
+    // tens of thousands of clusters, where scoring every centroid dominates.
+    // spill = "ratio" or "soar" also files each vector in a second list
+    // (see IndexParams::spill) to lift recall at small nprobe.
+    // list_encoding = "packed" compresses the inverted lists (PackedIds).
+    void build_index(int num_clusters, int epochs = 10, const std::string& metric = "eucl",
+                     const std::string& quantizer = "flat", int quantizer_ef = 64,
+                     const std::string& spill = "none", float spill_ratio = 1.1f,
+                     const std::string& list_encoding = "raw");
+    // IVF over this index's vectors using `trained`'s centroids (frozen, no
+    // k-means) and list settings; `trained` must have an IVF index. Builds
+    // of several partitions from one codebook merge by concatenation.
+    void build_index_from(const VectorIndex& trained);
+    // reorder = "bfs" or "rcm" relabels the built graph so neighbors sit close
+    // together in memory, searching a reordered copy of the vectors (ids
+    // returned are unchanged). Costs one extra copy of the vectors.
+    // selection = "simple" or "heuristic"; see IndexParams::neighbor_selection.
+    void build_index_hnsw(int M = 16, int ef_construction = 200, const std::string& metric = "eucl",
+                          const std::string& reorder = "none",
+                          const std::string& selection = "simple",
+                          bool extend_candidates = false, bool keep_pruned = false);
+
+    // Builds a disk-resident Vamana graph at `graph_path` (see DiskIndex).
+    // Once saved, the index can be loaded and searched without the vectors
+    // being present in VectorStorage; a relative `graph_path` is recorded as
+    // absolute. beam_width is how many node records a search reads per
+    // round trip, and is saved with the index.
+    void build_index_disk(const std::string& graph_path, int R = 32, int L = 75,
+                          float alpha = 1.2f, const std::string& metric = "eucl",
+                          int beam_width = 4);
 
     // Returns up to k nearest neighbors as (id, distance) pairs, sorted nearest-first.
     // nprobe controls IVF cluster probing; ef_search controls HNSW search breadth.
@@ -35,15 +132,300 @@ public:
         int ef_search = -1
     );
 
+    // search() returning external ids (see add_vector_with_id); rows
+    // without one report their row id.
+    std::vector<std::pair<int64_t, float>> search_ids(
+        const std::vector<float>& query,
+        int k = 1,
+        int nprobe = 1,
+        const std::string& metric = "eucl",
+        int ef_search = -1
+    );
+
+    // search() for several queries under one lock acquisition, using the
+    // batched brute-force / IVF scans that share memory traffic across queries.
+    std::vector<std::vector<std::pair<int, float>>> search_batch(
+        const std::vector<std::vector<float>>& queries,
+        int k = 1,
+        int nprobe = 1,
+        const std::string& metric = "eucl",
+        int ef_search = -1
+    );
+
+    // Every stored vector within `radius` of the query, as (id, distance)
+    // pairs sorted nearest-first. Radius is in the metric's own units
+    // (squared L2 for "eucl", 1 - cosine similarity for "cos").
+    std::vector<std::pair<int, float>> range_search(
+        const std::vector<float>& query,
+        float radius,
+        int nprobe = 1,
+        const std::string& metric = "eucl",
+        int ef_search = -1
+    );
+
+    // Batched range search under a single lock acquisition; results are
+    // returned in CSR form (see RangeSearchResult).
+    RangeSearchResult range_search_batch(
+        const std::vector<std::vector<float>>& queries,
+        float radius,
+        int nprobe = 1,
+        const std::string& metric = "eucl",
+        int ef_search = -1
+    );
+
+    // Typed per-row attributes (see AttributeStore), written by checkpoint()
+    // and restored by open(). type is "int", "tag", "timestamp" or "text".
+    // Replacing the vectors (load_fvecs, load_vxv) drops them.
+    void add_attribute(const std::string& name, const std::string& type);
+    // Sets attributes of stored row `row` by column name (a null value
+    // clears one). Every value is checked before any is written.
+    void set_attributes(int row, const std::vector<std::pair<std::string, AttrValue>>& values);
+    // `fields` of each of `rows`, row by row; null where unset.
+    std::vector<std::vector<AttrValue>> get_attributes(
+        const std::vector<int>& rows, const std::vector<std::string>& fields) const;
+    // (name, type) of every attribute column, in creation order.
+    std::vector<std::pair<std::string, std::string>> attribute_schema() const;
+    // Rows whose attributes satisfy every condition, ascending: up to
+    // `limit` (-1 = all) after skipping the first `offset`.
+    std::vector<int> find_rows(const std::vector<AttrCondition>& filter,
+                               int offset = 0, int limit = -1) const;
+    int count_rows(const std::vector<AttrCondition>& filter) const;
+    // Standalone attribute file (.vxa format, see VxaHeader); load it after
+    // the vectors it describes.
+    void save_attributes(const std::string& filename);
+    void load_attributes(const std::string& filename, bool use_mmap = true);
+
+    // search() restricted to rows whose attributes satisfy every condition,
+    // returning the requested attribute `fields` of each hit with it. The
+    // filter's selectivity is estimated on a sample of rows: below
+    // kExactFilterFraction (or when the index cannot filter) the matching
+    // rows are scanned exactly; otherwise the IVF or HNSW index skips
+    // non-matching candidates as it meets them, with an exact scan as the
+    // fallback when that finds fewer than k hits.
+    std::vector<SearchHit> search_filtered(
+        const std::vector<float>& query,
+        int k,
+        const std::vector<AttrCondition>& filter,
+        const std::vector<std::string>& fields = {},
+        int nprobe = 1,
+        const std::string& metric = "eucl",
+        int ef_search = -1
+    );
+
+    // The k nearest neighbors of every stored vector (see KnnGraph). mode
+    // "exact" scans every vector in tiles (a block of query rows against a
+    // cache-resident block of stored rows); "approx" queries the built
+    // index with nprobe / ef_search. Tiles of rows run on num_threads
+    // workers (0 = one per core). Ids are row ids.
+    KnnGraph knn_graph(int k, const std::string& mode = "exact",
+                       const std::string& metric = "eucl", int nprobe = 1,
+                       int ef_search = -1, int num_threads = 0) const;
+    // knn_graph() streamed to `path` a chunk of rows at a time (format in
+    // vector_file.hpp), so memory stays bounded for large N. Returns the
+    // number of rows written.
+    int write_knn_graph(const std::string& path, int k, const std::string& mode = "exact",
+                        const std::string& metric = "eucl", int nprobe = 1,
+                        int ef_search = -1, int num_threads = 0) const;
+
+    // Starts read-ahead of the mmap'd vectors an IVF search for `query`
+    // would scan (lock=true pins them instead, for hot regions), so a search
+    // issued shortly after does not stall on page faults. No-op for other
+    // index types or in-RAM storage.
+    void prefetch(const std::vector<float>& query, int nprobe = 1,
+                  const std::string& metric = "eucl", bool lock = false);
+
     void save_index(const std::string& filename);
     void load_index(const std::string& filename);
 
-    // "none" if untrained, otherwise "ivf" or "hnsw".
+    // Layout of a saved data directory, as written by write_fvecs/save_index.
+    static constexpr const char* kVectorsFile = "vectors.fvecs";
+    static constexpr const char* kIndexFile = "index.ivf";
+    static constexpr const char* kAttributesFile = "attributes.vxa";
+
+    // Restores `dir` into this (empty) VectorIndex: maps the vectors file
+    // (use_mmap) or bulk-reads it, then loads the index file if present and
+    // with_index is set, checking its dim and vector count against the data,
+    // loads the attribute file if present (mapped likewise), and replays any
+    // checkpoint deltas (see checkpoint()).
+    // Throws and leaves the instance empty on any mismatch. With a mapping
+    // and prefault, pages are faulted in on a background thread; search works
+    // meanwhile and is_ready() reports when the pass has finished.
+    void open(const std::string& dir, bool with_index = true,
+              bool use_mmap = true, bool prefault = true);
+    bool is_ready() const;
+
+    // Incremental persistence of a data directory. The first checkpoint to
+    // `dir` (and the first after a rebuild, rebalance or reload) writes a
+    // base snapshot, the vectors, index and attribute files above, and
+    // drops any deltas. Each later one that added vectors only appends a
+    // delta file (delta-<n>.vxd) with the vectors added since the previous
+    // checkpoint, their external ids, the attributes of new and updated
+    // rows and the index entries that changed: new IVF list and spill
+    // entries, or new HNSW nodes and the adjacency blocks they rewired.
+    // Attribute updates with no new vectors (or a new attribute column)
+    // get a base. open() replays the deltas onto the base in order. Returns
+    // "base", "delta", or "none" when nothing changed.
+    std::string checkpoint(const std::string& dir);
+    // Rewrites the last checkpointed directory as a single base, folding
+    // its deltas in. Throws if nothing has been checkpointed or opened.
+    void consolidate();
+    // Consolidates on a background thread every interval_seconds, whenever
+    // at least min_deltas deltas have accumulated. Replaces a running
+    // schedule; stop_consolidation() or destruction ends it.
+    void start_consolidation(double interval_seconds, int min_deltas = 1);
+    void stop_consolidation();
+
+    int size() const;
+
+    // List balance and centroid drift of the active IVF index, including
+    // vectors inserted by add_vector since the build. Throws without one.
+    ClusterStats cluster_stats() const;
+
+    // Partial IVF re-clustering: splits lists longer than split_factor x the
+    // mean, dissolves lists shorter than merge_factor x the mean into their
+    // neighbors, and moves centroids that drifted more than drift_threshold
+    // to their members' mean (0, the default, leaves centroids in place).
+    // Returns the number of lists changed.
+    int rebalance_index(float split_factor = 2.0f, float merge_factor = 0.25f,
+                        float drift_threshold = 0.0f);
+
+    // Appends every vector of `other` (ids continue from size(); external
+    // ids are kept) and folds other's index into this one without
+    // retraining: IVF indexes with the same centroids concatenate their
+    // lists, IVF indexes with different ones assign other's vectors to
+    // ours, and HNSW links the smaller graph's nodes into the larger graph,
+    // starting from their existing edges. Both need the same kind of index
+    // built over all their vectors. `metric` is the one the HNSW graphs
+    // were built with (IVF uses its training metric).
+    void merge(const VectorIndex& other, const std::string& metric = "eucl");
+
+    // Degree distribution and unreachable nodes of the active HNSW graph.
+    // Throws when no graph index is built.
+    GraphStats graph_stats() const;
+
+    // Heap bytes by component (storage buffers, index structures, the
+    // external id map, attribute columns) and the mapped vector file's size and resident bytes.
+    MemoryUsage memory_usage() const;
+
+    // Caps what the process may hold: a build that would take heap usage
+    // past `bytes` uses a leaner strategy (IVF over compressed-only storage
+    // decodes rows on the fly instead of copying them) or fails before
+    // allocating. 0 removes the cap. Mapped file pages are not counted.
+    void set_memory_budget(size_t bytes);
+
+    // "none" if untrained, otherwise "ivf", "hnsw" or "disk".
     std::string get_index_type() const;
 
+    // Lock contention since construction or the last reset_lock_stats().
+    LockStats lock_stats() const;
+    void reset_lock_stats();
+    // Total time the calling thread has spent blocked on any VectorIndex
+    // lock; sample it around a call to attribute waits to that call.
+    static uint64_t thread_lock_wait_ns();
+
 private:
+    struct LockCounters {
+        std::atomic<uint64_t> acquisitions{0}, contended{0}, wait_ns{0}, max_wait_ns{0};
+        void record_wait(uint64_t ns);
+        LockWaitStats snapshot() const;
+        void reset();
+    };
+
+    // Take rw_mutex_, counting acquisitions and timing any wait.
+    std::shared_lock<std::shared_mutex> read_lock() const;
+    std::unique_lock<std::shared_mutex> write_lock() const;
+    // This index exclusively and `other` shared, locked in address order
+    // so two opposite calls cannot deadlock.
+    std::pair<std::unique_lock<std::shared_mutex>, std::shared_lock<std::shared_mutex>>
+    lock_with(const VectorIndex& other) const;
+
+    // Callers must hold rw_mutex_ (shared is enough).
+    IndexParams search_params(int nprobe, const std::string& metric, int ef_search) const;
+    void check_query_dim(size_t query_dim) const;
+    // exact: scan every row (those params.filter matches, if set) even with
+    // an index built.
+    std::vector<std::pair<int, float>> search_locked(
+        const float* query, int k, const IndexParams& params, bool exact = false) const;
+    std::vector<std::pair<int, float>> brute_force_search(
+        const float* query, int k, const std::string& metric,
+        const AttributeFilter* filter = nullptr) const;
+    std::vector<std::vector<std::pair<int, float>>> brute_force_batch(
+        const std::vector<const float*>& queries, int k, const std::string& metric) const;
+    std::vector<std::pair<int, float>> brute_force_shard(
+        const float* query, int begin, int end, int k, const std::string& metric,
+        const AttributeFilter* filter = nullptr) const;
+    // Column index of each field name; throws on an unknown one.
+    std::vector<int> attribute_columns(const std::vector<std::string>& fields) const;
+    std::vector<std::pair<int, float>> binary_prefilter_search(
+        const float* query, int k, const std::string& metric) const;
+    void rerank_exact(const float* query, std::vector<std::pair<int, float>>& results,
+                      const std::string& metric) const;
+    std::vector<std::pair<int, float>> range_search_locked(
+        const float* query, float radius, const IndexParams& params) const;
+    // Computes knn_graph rows chunk by chunk, handing each finished chunk
+    // of rows [begin, end) (k ids / distances per row) to `sink`.
+    using KnnSink = std::function<void(int begin, int end, const int* ids, const float* distances)>;
+    void knn_graph_locked(int k, const std::string& mode, const IndexParams& params,
+                          int num_threads, const KnnSink& sink) const;
+    // Caller must hold rw_mutex_ exclusively.
+    void load_index_locked(const std::string& filename);
+    // Caller must hold rw_mutex_ (shared is enough).
+    void save_index_locked(const std::string& filename) const;
+    // Checkpoint writers; callers hold rw_mutex_ (shared) and checkpoint_mutex_.
+    void write_base_locked(const std::string& dir);
+    void write_delta_locked(const std::string& path) const;
+    void mark_checkpoint_locked(const std::string& dir, int deltas);
+    bool consolidate_checkpoint(int min_deltas);
+    // Caller must hold rw_mutex_ exclusively. Appends one delta's vectors
+    // and ids, and its index changes when apply_index; false if the base
+    // already covers it (a consolidation was interrupted).
+    bool apply_delta_locked(const std::string& path, bool apply_index);
+    void check_index_size(const IndexAlgorithm& algo) const;
+    void prefault_storage();
+    // Caller must hold rw_mutex_. Heap bytes a build may still allocate.
+    size_t build_headroom() const;
+    void memory_usage_locked(MemoryUsage& usage) const;
+    // Inserts the last stored row into the active index, when it supports that.
+    void index_appended_row();
+    // Drops the external id map (the storage was replaced).
+    void clear_external_ids();
+
     VectorStorage storage_;
     std::unique_ptr<IndexAlgorithm> algo_;
+    int algo_dim_ = 0;  // dim the active algorithm was built/loaded with
+    // External ids by row, and rows by external id; both empty until
+    // add_vector_with_id is first used.
+    std::vector<int64_t> external_ids_;
+    std::unordered_map<int64_t, int> rows_by_id_;
+    AttributeStore attributes_;  // row-aligned with storage_, never longer
     bool use_simd_ = false;
+    int rerank_ = 0;
+    int binary_shortlist_ = 0;
+    int num_shards_ = 1;
+    size_t memory_budget_ = 0;  // 0 = unlimited
+    std::unique_ptr<ThreadPool> search_pool_;
+    // search_filtered planning: filters estimated to match less than this
+    // fraction of the rows (on a sample of kFilterSampleRows) are scanned
+    // exactly instead of through the index.
+    static constexpr double kExactFilterFraction = 0.01;
+    static constexpr int kFilterSampleRows = 1024;
     mutable std::shared_mutex rw_mutex_;
+    mutable LockCounters shared_waits_, exclusive_waits_;
+
+    std::thread prefault_thread_;
+    std::atomic<bool> ready_{true};
+    std::atomic<bool> stop_prefault_{false};
+
+    // Last checkpoint (see checkpoint()); guarded by checkpoint_mutex_
+    // under the shared lock, or by the exclusive lock alone.
+    std::mutex checkpoint_mutex_;
+    std::string checkpoint_dir_;  // empty: the next checkpoint writes a base
+    int checkpoint_rows_ = 0;
+    size_t checkpoint_ids_ = 0;
+    int checkpoint_deltas_ = 0;   // delta files on top of the base
+
+    std::thread consolidate_thread_;
+    std::mutex consolidate_mutex_;
+    std::condition_variable consolidate_cv_;
+    bool stop_consolidate_ = false;
 };
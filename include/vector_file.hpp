@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Native aligned vector file (.vxv). A single 64-byte header is followed by
+// the rows, each zero-padded to a multiple of 16 floats (64 bytes), so every
+// row starts on a cache-line boundary of a page-aligned mapping and SIMD
+// kernels can use aligned loads with no tail loop. Zero padding leaves L2
+// distances and dot products unchanged. An optional array of per-row L2
+// norms follows the rows (for cosine without re-reading the stored norm).
+//
+//   [VxvHeader][row 0 .. padded_dim floats][row 1]...[norms: num_vectors floats]
+struct VxvHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t dim;
+    uint32_t padded_dim;
+    uint64_t num_vectors;
+    uint64_t data_offset;   // byte offset of row 0
+    uint64_t norms_offset;  // 0 when the file carries no norms
+    uint8_t reserved[24];
+};
+static_assert(sizeof(VxvHeader) == 64, "VxvHeader must stay one cache line");
+
+static constexpr uint32_t VXV_MAGIC   = 0x56584C56; // 'V','L','X','V'
+static constexpr uint32_t VXV_VERSION = 1;
+static constexpr int kVxvRowAlignFloats = 16;
+
+inline int vxv_padded_dim(int dim) {
+    return (dim + kVxvRowAlignFloats - 1) / kVxvRowAlignFloats * kVxvRowAlignFloats;
+}
+
+// kNN graph file (VectorIndex::write_knn_graph): a 32-byte header, then
+// the n x k int32 id matrix, then the n x k float32 distance matrix, both
+// row-major, so each can be np.memmap'ed at its offset.
+//
+//   [KnnFileHeader][ids: n*k int32 at ids_offset][distances: n*k float32 at distances_offset]
+struct KnnFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t n;
+    uint32_t k;
+    uint32_t ids_offset;
+    uint64_t distances_offset;
+};
+static_assert(sizeof(KnnFileHeader) == 32, "KnnFileHeader layout");
+
+static constexpr uint32_t KNN_MAGIC   = 0x4E4E4B56; // 'V','K','N','N'
+static constexpr uint32_t KNN_VERSION = 1;
+
+// Attribute file (AttributeStore::save): a 64-byte header, a directory of
+// num_columns 64-byte VxaColumn entries, then each column's name, row array
+// and heap, every section starting on a 64-byte boundary so a mapping can
+// be scanned in place. The row array holds num_rows int64 values (int and
+// timestamp columns), uint32 dictionary codes (tag) or (offset, length)
+// uint64 pairs into the heap (text); a tag column's heap is its dictionary,
+// one (uint32 length, bytes) entry per code.
+//
+//   [VxaHeader][VxaColumn x num_columns][name][rows][heap][name][rows][heap]...
+struct VxaHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t num_rows;
+    uint32_t num_columns;
+    uint8_t reserved[44];
+};
+static_assert(sizeof(VxaHeader) == 64, "VxaHeader must stay one cache line");
+
+struct VxaColumn {
+    uint32_t type;          // AttrType
+    uint32_t name_length;
+    uint64_t name_offset;
+    uint64_t rows_offset;
+    uint64_t rows_bytes;
+    uint64_t heap_offset;
+    uint64_t heap_bytes;
+    uint8_t reserved[16];
+};
+static_assert(sizeof(VxaColumn) == 64, "VxaColumn must stay one cache line");
+
+static constexpr uint32_t VXA_MAGIC   = 0x41584C56; // 'V','L','X','A'
+static constexpr uint32_t VXA_VERSION = 1;
+
+// Converts `src` to a .vxv file at `dst`. The source format is taken from
+// its extension: .fvecs (float32 rows), .bvecs (uint8 rows, widened to
+// float) or .npy (2-D C-order '<f4' or '|u1' array). Returns the number of
+// vectors written. Throws std::runtime_error on malformed input.
+size_t convert_to_vxv(const std::string& src, const std::string& dst, bool with_norms = true);
@@ -2,18 +2,18 @@ from fastapi import FastAPI, HTTPException, Query
 from fastapi.middleware.cors import CORSMiddleware
 
 from server import embedder, state
-from server.fvecs_io import read_fvecs
-from server.metadata import MetadataStore
+from server.metadata import CREATED_AT, TEXT, MetadataStore, to_micros
 from server.schemas import (
     BatchDocumentsPayload,
     DocumentPayload,
     EmbedPayload,
+    FilterClause,
     SearchPayload,
     TrainPayload,
     VectorPayload,
 )
 
-metadata = MetadataStore(state.METADATA_FILE)
+metadata = MetadataStore(state.db, state.METADATA_FILE)
 
 app = FastAPI(title="VeloxDB API")
 
@@ -58,25 +58,27 @@ async def startup_event():
     state.DATA_DIR.mkdir(parents=True, exist_ok=True)
 
     if state.DATA_FILE.exists():
-        print("Hydrating vectors from disk into RAM...")
+        print("Opening saved vectors and index...")
         try:
-            vectors = read_fvecs(state.DATA_FILE)
-            for vec in vectors:
-                state.db.add_vector(vec)
-            state.vector_count = len(vectors)
+            try:
+                state.db.open(str(state.DATA_DIR))
+            except Exception as e:
+                # Usually a stale index (vectors added after it was saved):
+                # keep the vectors and fall back to brute force.
+                print(f"Error loading index: {e}")
+                state.db.open(str(state.DATA_DIR), with_index=False)
+            state.vector_count = state.db.size()
+            state.is_indexed = state.db.get_index_type() != "none"
             state.refresh_stats()
-            print(f"Loaded {state.vector_count} vectors (dim={state.dim}).")
+            print(
+                f"Loaded {state.vector_count} vectors (dim={state.dim}), "
+                f"index: {state.db.get_index_type()}."
+            )
         except Exception as e:
-            print(f"Error hydrating vectors: {e}")
+            print(f"Error opening saved state: {e}")
 
-    if state.INDEX_FILE.exists() and state.vector_count > 0:
-        try:
-            state.db.load_index(str(state.INDEX_FILE))
-            state.is_indexed = True
-            print("IVF index loaded successfully.")
-        except Exception as e:
-            print(f"Error loading index: {e}")
-            state.is_indexed = False
+    if state.CONSOLIDATE_SECONDS > 0:
+        state.db.start_consolidation(state.CONSOLIDATE_SECONDS)
 
     metadata.load()
     if metadata.count() != state.vector_count:
@@ -95,6 +97,7 @@ def _health_payload() -> dict:
         "vector_count": state.vector_count,
         "dim": state.dim,
         "is_indexed": state.is_indexed,
+        "ready": state.db.is_ready(),
         "expected_embedding_dim": embedder.embedding_dim(),
     }
 
@@ -109,6 +112,13 @@ def health():
     return _health_payload()
 
 
+@app.get("/memory")
+def memory():
+    usage = state.db.memory_usage()
+    usage["budget_bytes"] = state.MEMORY_BUDGET_MB << 20
+    return usage
+
+
 @app.post("/embed")
 def embed_text(payload: EmbedPayload):
     try:
@@ -123,7 +133,7 @@ def add_document(payload: DocumentPayload):
     try:
         vector = embedder.embed(payload.text)
         doc_id = _add_vector_to_db(vector)
-        metadata.add(doc_id, payload.text)
+        metadata.add(doc_id, payload.text, payload.attributes)
         return {"status": "success", "id": doc_id, "dim": len(vector)}
     except HTTPException:
         raise
@@ -155,14 +165,12 @@ def list_documents(
     offset: int = Query(0, ge=0),
     limit: int = Query(50, ge=1, le=200),
 ):
-    docs = metadata.list_all()
-    page = docs[offset : offset + limit]
     return {
         "status": "success",
-        "total": len(docs),
+        "total": metadata.count(),
         "offset": offset,
         "limit": limit,
-        "documents": page,
+        "documents": metadata.page(offset, limit),
     }
 
 
@@ -217,6 +225,25 @@ def train_index(payload: TrainPayload):
         raise HTTPException(status_code=500, detail=str(e)) from e
 
 
+def _filter_value(field: str, value: int | str) -> int | str:
+    if field == CREATED_AT and isinstance(value, str):
+        return to_micros(value)
+    return value
+
+
+def _filter_tuples(clauses: list[FilterClause]) -> list[tuple]:
+    out = []
+    for clause in clauses:
+        if clause.value is None:
+            out.append((clause.field, clause.op))
+        elif isinstance(clause.value, list):
+            out.append((clause.field, clause.op,
+                        [_filter_value(clause.field, v) for v in clause.value]))
+        else:
+            out.append((clause.field, clause.op, _filter_value(clause.field, clause.value)))
+    return out
+
+
 @app.post("/search")
 def search(payload: SearchPayload):
     if state.vector_count == 0:
@@ -227,20 +254,37 @@ def search(payload: SearchPayload):
         else:
             query_vector = payload.query_vector
         _check_dim(len(query_vector))
-        matches = state.db.search(
-            query_vector,
-            k=payload.k,
-            nprobe=payload.nprobe,
-            metric=payload.metric,
-        )
-        results = []
-        for match_id, distance in matches:
-            meta = metadata.get(match_id)
-            results.append({
-                "id": match_id,
-                "text": meta["text"] if meta else None,
-                "distance": distance,
-            })
+        if payload.filter or payload.fields:
+            # Filter, search and projection in one native call.
+            fields = [TEXT] + [f for f in payload.fields if f != TEXT]
+            hits = state.db.search_filtered(
+                query_vector,
+                k=payload.k,
+                filter=_filter_tuples(payload.filter),
+                fields=fields,
+                nprobe=payload.nprobe,
+                metric=payload.metric,
+            )
+            results = []
+            for hit in hits:
+                result = {"id": hit["id"], "text": hit[TEXT], "distance": hit["distance"]}
+                if payload.fields:
+                    result["attributes"] = {f: hit[f] for f in payload.fields}
+                results.append(result)
+        else:
+            # Unfiltered queries go through the micro-batcher; the texts of
+            # all hits are then read in one call.
+            matches = state.batcher.search(
+                query_vector,
+                k=payload.k,
+                nprobe=payload.nprobe,
+                metric=payload.metric,
+            )
+            texts = metadata.texts([match_id for match_id, _ in matches])
+            results = [
+                {"id": match_id, "text": text, "distance": distance}
+                for (match_id, distance), text in zip(matches, texts)
+            ]
         return {"status": "success", "results": results, "is_indexed": state.is_indexed}
     except HTTPException:
         raise
@@ -253,16 +297,14 @@ def save_state():
     if state.vector_count == 0:
         raise HTTPException(status_code=400, detail="No vectors to save")
     try:
-        state.db.write_fvecs(str(state.DATA_FILE))
-        if state.is_indexed:
-            state.db.save_index(str(state.INDEX_FILE))
-        metadata.save()
-        files = [str(state.DATA_FILE), str(state.METADATA_FILE)]
-        if state.is_indexed:
-            files.append(str(state.INDEX_FILE))
+        # A full snapshot the first time, then only what changed since;
+        # document text and attributes are saved with the vectors.
+        kind = state.db.checkpoint(str(state.DATA_DIR))
+        files = sorted(str(p) for p in state.DATA_DIR.iterdir() if p.is_file())
         return {
             "status": "success",
             "message": "State saved successfully.",
+            "checkpoint": kind,
             "files": files,
         }
     except Exception as e:
@@ -1,44 +1,94 @@
-"""Sidecar JSON store mapping vector IDs to source text."""
+"""Document text and attributes, stored as native columns next to the vectors."""
 
 import json
 from datetime import datetime, timezone
 from pathlib import Path
 from typing import Any
 
+TEXT = "text"
+CREATED_AT = "created_at"  # timestamp column: microseconds since the epoch
+RESERVED = (TEXT, CREATED_AT)
+_HAS_TEXT = [(TEXT, "exists")]
+
+
+def to_micros(value: datetime | str) -> int:
+    if isinstance(value, str):
+        value = datetime.fromisoformat(value)
+    if value.tzinfo is None:
+        value = value.replace(tzinfo=timezone.utc)
+    return int(value.timestamp() * 1_000_000)
+
+
+def from_micros(micros: int | None) -> str | None:
+    if micros is None:
+        return None
+    return datetime.fromtimestamp(micros / 1_000_000, tz=timezone.utc).isoformat()
+
 
 class MetadataStore:
-    def __init__(self, path: str | Path) -> None:
-        self.path = Path(path)
-        self._docs: dict[str, dict[str, Any]] = {}
+    """Per-document fields held in the VectorIndex's attribute columns, so
+    searches can filter on them and return them without leaving C++, and
+    checkpoints persist them with the vectors. A metadata.json sidecar from
+    earlier versions is imported the first time the columns are created."""
+
+    def __init__(self, db: Any, legacy_path: str | Path) -> None:
+        self.db = db
+        self.legacy_path = Path(legacy_path)
 
     def load(self) -> None:
-        if not self.path.exists():
-            self._docs = {}
+        if TEXT in dict(self.db.attribute_schema()):
+            return
+        self.db.add_attribute(TEXT, "text")
+        self.db.add_attribute(CREATED_AT, "timestamp")
+        if not self.legacy_path.exists():
             return
-        with self.path.open(encoding="utf-8") as f:
+        with self.legacy_path.open(encoding="utf-8") as f:
             raw = json.load(f)
-        self._docs = {str(k): v for k, v in raw.items()}
+        imported = 0
+        for key, value in raw.items():
+            row = int(key)
+            if not 0 <= row < self.db.size():
+                continue
+            created = value.get("created_at")
+            self.db.set_attributes(row, {
+                TEXT: value.get("text"),
+                CREATED_AT: to_micros(created) if created else None,
+            })
+            imported += 1
+        print(f"Imported {imported} documents from {self.legacy_path}")
 
-    def save(self) -> None:
-        self.path.parent.mkdir(parents=True, exist_ok=True)
-        with self.path.open("w", encoding="utf-8") as f:
-            json.dump(self._docs, f, indent=2)
-
-    def add(self, doc_id: int, text: str) -> None:
-        self._docs[str(doc_id)] = {
-            "text": text,
-            "created_at": datetime.now(timezone.utc).isoformat(),
+    def add(self, doc_id: int, text: str, attributes: dict[str, int | str] | None = None) -> None:
+        """Stores a document's text and creation time plus any extra
+        attributes; a new attribute becomes an int column for integers and a
+        tag column for strings."""
+        values: dict[str, Any] = {
+            TEXT: text,
+            CREATED_AT: to_micros(datetime.now(timezone.utc)),
         }
+        if attributes:
+            schema = dict(self.db.attribute_schema())
+            for name, value in attributes.items():
+                if name not in schema:
+                    self.db.add_attribute(name, "int" if isinstance(value, int) else "tag")
+                values[name] = value
+        self.db.set_attributes(doc_id, values)
 
     def get(self, doc_id: int) -> dict[str, Any] | None:
-        return self._docs.get(str(doc_id))
+        row = self.db.get_attributes([doc_id], [TEXT, CREATED_AT])[0]
+        if row[TEXT] is None:
+            return None
+        return {"text": row[TEXT], "created_at": from_micros(row[CREATED_AT])}
+
+    def texts(self, doc_ids: list[int]) -> list[str | None]:
+        return [row[TEXT] for row in self.db.get_attributes(doc_ids, [TEXT])]
 
-    def list_all(self) -> list[dict[str, Any]]:
-        items = []
-        for key, value in self._docs.items():
-            items.append({"id": int(key), **value})
-        items.sort(key=lambda x: x["id"])
-        return items
+    def page(self, offset: int, limit: int) -> list[dict[str, Any]]:
+        ids = self.db.find_rows(_HAS_TEXT, offset, limit)
+        rows = self.db.get_attributes(ids, [TEXT, CREATED_AT])
+        return [
+            {"id": doc_id, "text": row[TEXT], "created_at": from_micros(row[CREATED_AT])}
+            for doc_id, row in zip(ids, rows)
+        ]
 
     def count(self) -> int:
-        return len(self._docs)
+        return self.db.count_rows(_HAS_TEXT)
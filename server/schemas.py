@@ -1,4 +1,8 @@
-from pydantic import BaseModel, Field, model_validator
+from typing import Literal
+
+from pydantic import BaseModel, Field, field_validator, model_validator
+
+from server.metadata import RESERVED
 
 
 class VectorPayload(BaseModel):
@@ -11,12 +15,25 @@ class TrainPayload(BaseModel):
     metric: str = "eucl"
 
 
+class FilterClause(BaseModel):
+    """One attribute predicate: `field op value`. "in" takes a list,
+    "exists" no value; created_at accepts ISO-8601 strings."""
+
+    field: str
+    op: Literal["==", "!=", "<", "<=", ">", ">=", "in", "contains", "exists"] = "=="
+    value: int | str | list[int | str] | None = None
+
+
 class SearchPayload(BaseModel):
     query_vector: list[float] | None = None
     query_text: str | None = None
     metric: str = "eucl"
     k: int = Field(default=5, ge=1, le=100)
     nprobe: int = Field(default=1, ge=1, le=100)
+    # Every clause must hold; evaluated inside the index search.
+    filter: list[FilterClause] = Field(default_factory=list, max_length=16)
+    # Extra attributes returned with each result.
+    fields: list[str] = Field(default_factory=list, max_length=16)
 
     @model_validator(mode="after")
     def require_query(self):
@@ -29,6 +46,16 @@ class SearchPayload(BaseModel):
 
 class DocumentPayload(BaseModel):
     text: str = Field(min_length=1)
+    # Filterable attributes: integers become int columns, strings tags.
+    attributes: dict[str, int | str] = Field(default_factory=dict)
+
+    @field_validator("attributes")
+    @classmethod
+    def no_reserved_names(cls, value: dict[str, int | str]) -> dict[str, int | str]:
+        taken = [name for name in value if name in RESERVED]
+        if taken:
+            raise ValueError(f"Reserved attribute names: {', '.join(taken)}")
+        return value
 
 
 class BatchDocumentsPayload(BaseModel):
@@ -15,9 +15,22 @@ import veloxdb  # noqa: E402
 DATA_DIR = _REPO_ROOT / "data"
 DATA_FILE = DATA_DIR / "vectors.fvecs"
 INDEX_FILE = DATA_DIR / "index.ivf"
+# Sidecar of earlier versions; document text now lives in attributes.vxa.
 METADATA_FILE = DATA_DIR / "metadata.json"
 
 db = veloxdb.VectorIndex()
+# Builds that would take the process past this many MiB of heap fail early.
+MEMORY_BUDGET_MB = int(os.environ.get("VELOX_MEMORY_BUDGET_MB", "0"))
+db.set_memory_budget(MEMORY_BUDGET_MB << 20)
+# /save writes checkpoint deltas; fold them into a new base this often
+# (0 disables background consolidation).
+CONSOLIDATE_SECONDS = float(os.environ.get("VELOX_CONSOLIDATE_SECONDS", "3600"))
+# Concurrent /search requests are coalesced into micro-batches in C++.
+batcher = veloxdb.SearchBatcher(
+    db,
+    max_batch=int(os.environ.get("VELOX_BATCH_MAX", "32")),
+    max_wait_us=int(os.environ.get("VELOX_BATCH_WAIT_US", "200")),
+)
 is_indexed = False
 vector_count = 0
 dim: int | None = None
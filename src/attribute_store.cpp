@@ -0,0 +1,646 @@
+#include "attribute_store.hpp"
+#include "vector_file.hpp"
+#include "trace.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+constexpr size_t kVxaAlign = 64;
+
+size_t align_up(size_t n) { return (n + kVxaAlign - 1) / kVxaAlign * kVxaAlign; }
+
+bool is_int_type(AttrType t) { return t == AttrType::Int || t == AttrType::Timestamp; }
+
+size_t row_width(AttrType t) {
+    switch (t) {
+        case AttrType::Int:
+        case AttrType::Timestamp: return sizeof(int64_t);
+        case AttrType::Tag:       return sizeof(uint32_t);
+        case AttrType::Text:      return sizeof(AttributeStore::TextRef);
+    }
+    return 0;
+}
+
+// Delta cell encoding.
+enum CellKind : uint8_t { kCellNull = 0, kCellInt = 1, kCellString = 2 };
+
+template <typename T>
+void write_pod(std::ofstream& out, const T& v) {
+    out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T>
+T read_pod(std::ifstream& in) {
+    T v{};
+    in.read(reinterpret_cast<char*>(&v), sizeof(T));
+    if (!in) throw std::runtime_error("Truncated attribute delta.");
+    return v;
+}
+
+}  // namespace
+
+AttrType attr_type_from_name(const std::string& name) {
+    if (name == "int") return AttrType::Int;
+    if (name == "tag") return AttrType::Tag;
+    if (name == "timestamp") return AttrType::Timestamp;
+    if (name == "text") return AttrType::Text;
+    throw std::runtime_error("Unknown attribute type '" + name +
+                             "' (expected int, tag, timestamp or text).");
+}
+
+const char* attr_type_name(AttrType type) {
+    switch (type) {
+        case AttrType::Int:       return "int";
+        case AttrType::Tag:       return "tag";
+        case AttrType::Timestamp: return "timestamp";
+        case AttrType::Text:      return "text";
+    }
+    return "unknown";
+}
+
+void AttributeStore::Column::bind() {
+    ints = owned_ints.data();
+    codes = owned_codes.data();
+    refs = owned_refs.data();
+    text = owned_text.data();
+    text_bytes = owned_text.size();
+}
+
+AttributeStore::~AttributeStore() { unmap(); }
+
+void AttributeStore::add_column(const std::string& name, AttrType type) {
+    if (name.empty()) throw std::runtime_error("Attribute names must not be empty.");
+    if (find_column(name) >= 0)
+        throw std::runtime_error("Attribute '" + name + "' already exists.");
+    materialize();
+    Column col;
+    col.name = name;
+    col.type = type;
+    switch (type) {
+        case AttrType::Int:
+        case AttrType::Timestamp: col.owned_ints.assign(num_rows_, kNullInt); break;
+        case AttrType::Tag:       col.owned_codes.assign(num_rows_, kNullTag); break;
+        case AttrType::Text:      col.owned_refs.assign(num_rows_, TextRef{kNullText, 0}); break;
+    }
+    columns_.push_back(std::move(col));
+    for (Column& c : columns_) c.bind();  // push_back may have moved earlier columns
+    checkpoint_rows_ = -1;
+}
+
+int AttributeStore::find_column(const std::string& name) const {
+    for (size_t c = 0; c < columns_.size(); c++)
+        if (columns_[c].name == name) return static_cast<int>(c);
+    return -1;
+}
+
+bool AttributeStore::same_schema(const AttributeStore& other) const {
+    if (columns_.size() != other.columns_.size()) return false;
+    for (size_t c = 0; c < columns_.size(); c++)
+        if (columns_[c].name != other.columns_[c].name ||
+            columns_[c].type != other.columns_[c].type)
+            return false;
+    return true;
+}
+
+void AttributeStore::extend(int rows) {
+    if (rows <= num_rows_) return;
+    materialize();
+    for (Column& c : columns_) {
+        switch (c.type) {
+            case AttrType::Int:
+            case AttrType::Timestamp: c.owned_ints.resize(rows, kNullInt); break;
+            case AttrType::Tag:       c.owned_codes.resize(rows, kNullTag); break;
+            case AttrType::Text:      c.owned_refs.resize(rows, TextRef{kNullText, 0}); break;
+        }
+        c.bind();
+    }
+    num_rows_ = rows;
+}
+
+bool AttributeStore::accepts(int c, const AttrValue& value) const {
+    if (std::holds_alternative<std::monostate>(value)) return true;
+    return std::holds_alternative<int64_t>(value) == is_int_type(columns_[c].type);
+}
+
+void AttributeStore::set(int c, int row, const AttrValue& value) {
+    if (c < 0 || c >= num_columns()) throw std::out_of_range("Attribute column out of range.");
+    if (row < 0) throw std::out_of_range("Attribute row out of range.");
+    Column& col = columns_[c];
+    if (!accepts(c, value))
+        throw std::runtime_error("Attribute '" + col.name + "' is a " + attr_type_name(col.type) +
+                                 " column; got " +
+                                 (std::holds_alternative<int64_t>(value) ? "an integer." : "a string."));
+    bool is_null = std::holds_alternative<std::monostate>(value);
+
+    extend(row + 1);
+    materialize();
+    mark_dirty(row);
+    switch (col.type) {
+        case AttrType::Int:
+        case AttrType::Timestamp:
+            col.owned_ints[row] = is_null ? kNullInt : std::get<int64_t>(value);
+            break;
+        case AttrType::Tag: {
+            if (is_null) {
+                col.owned_codes[row] = kNullTag;
+                break;
+            }
+            const std::string& s = std::get<std::string>(value);
+            auto it = col.dict_index.find(s);
+            uint32_t code;
+            if (it != col.dict_index.end()) {
+                code = it->second;
+            } else {
+                if (col.dict.size() >= kNullTag)
+                    throw std::runtime_error("Too many distinct values for tag '" + col.name + "'.");
+                code = static_cast<uint32_t>(col.dict.size());
+                col.dict.push_back(s);
+                col.dict_index.emplace(s, code);
+            }
+            col.owned_codes[row] = code;
+            break;
+        }
+        case AttrType::Text: {
+            if (is_null) {
+                col.owned_refs[row] = TextRef{kNullText, 0};
+                break;
+            }
+            // Overwritten strings stay in the heap until the next save().
+            const std::string& s = std::get<std::string>(value);
+            col.owned_refs[row] = TextRef{col.owned_text.size(), s.size()};
+            col.owned_text.insert(col.owned_text.end(), s.begin(), s.end());
+            break;
+        }
+    }
+    col.bind();
+}
+
+AttrValue AttributeStore::get(int c, int row) const {
+    if (c < 0 || c >= num_columns()) throw std::out_of_range("Attribute column out of range.");
+    if (row < 0 || row >= num_rows_) return std::monostate{};
+    const Column& col = columns_[c];
+    switch (col.type) {
+        case AttrType::Int:
+        case AttrType::Timestamp:
+            if (col.ints[row] == kNullInt) return std::monostate{};
+            return col.ints[row];
+        case AttrType::Tag: {
+            uint32_t code = col.codes[row];
+            if (code == kNullTag) return std::monostate{};
+            if (code >= col.dict.size())
+                throw std::runtime_error("Corrupt tag code in attribute '" + col.name + "'.");
+            return col.dict[code];
+        }
+        case AttrType::Text:
+            if (text_null(c, row)) return std::monostate{};
+            return std::string(text_at(c, row));
+    }
+    return std::monostate{};
+}
+
+std::string_view AttributeStore::text_at(int c, int row) const {
+    const Column& col = columns_[c];
+    const TextRef& ref = col.refs[row];
+    if (ref.offset == kNullText) return {};
+    if (ref.offset > col.text_bytes || ref.length > col.text_bytes - ref.offset)
+        throw std::runtime_error("Corrupt text reference in attribute '" + col.name + "'.");
+    return std::string_view(col.text + ref.offset, ref.length);
+}
+
+uint32_t AttributeStore::tag_code(int c, const std::string& value) const {
+    const Column& col = columns_[c];
+    auto it = col.dict_index.find(value);
+    return it == col.dict_index.end() ? kNullTag : it->second;
+}
+
+void AttributeStore::append(const AttributeStore& other, int offset) {
+    if (!same_schema(other))
+        throw std::runtime_error("Cannot append attributes with a different schema.");
+    extend(offset);
+    extend(offset + other.num_rows_);
+    materialize();
+    for (int c = 0; c < num_columns(); c++)
+        for (int r = 0; r < other.num_rows_; r++) {
+            AttrValue v = other.get(c, r);
+            if (!std::holds_alternative<std::monostate>(v)) set(c, offset + r, v);
+        }
+}
+
+void AttributeStore::save(const std::string& filename) const {
+    VELOX_TRACE_SCOPE("attributes.save");
+    // Compacted text heaps and their refs; tag dictionaries as heaps.
+    std::vector<std::vector<char>> heaps(columns_.size());
+    std::vector<std::vector<TextRef>> refs(columns_.size());
+    std::vector<VxaColumn> dir(columns_.size());
+
+    size_t pos = align_up(sizeof(VxaHeader) + columns_.size() * sizeof(VxaColumn));
+    for (size_t c = 0; c < columns_.size(); c++) {
+        const Column& col = columns_[c];
+        std::vector<char>& heap = heaps[c];
+        if (col.type == AttrType::Text) {
+            refs[c].resize(num_rows_);
+            for (int r = 0; r < num_rows_; r++) {
+                if (col.refs[r].offset == kNullText) {
+                    refs[c][r] = TextRef{kNullText, 0};
+                    continue;
+                }
+                std::string_view s = text_at(static_cast<int>(c), r);
+                refs[c][r] = TextRef{heap.size(), s.size()};
+                heap.insert(heap.end(), s.begin(), s.end());
+            }
+        } else if (col.type == AttrType::Tag) {
+            for (const std::string& s : col.dict) {
+                uint32_t len = static_cast<uint32_t>(s.size());
+                const char* p = reinterpret_cast<const char*>(&len);
+                heap.insert(heap.end(), p, p + sizeof(len));
+                heap.insert(heap.end(), s.begin(), s.end());
+            }
+        }
+        VxaColumn& d = dir[c];
+        std::memset(&d, 0, sizeof(d));
+        d.type = static_cast<uint32_t>(col.type);
+        d.name_length = static_cast<uint32_t>(col.name.size());
+        d.name_offset = pos;
+        pos = align_up(pos + col.name.size());
+        d.rows_offset = pos;
+        d.rows_bytes = static_cast<uint64_t>(num_rows_) * row_width(col.type);
+        pos = align_up(pos + d.rows_bytes);
+        d.heap_offset = pos;
+        d.heap_bytes = heap.size();
+        pos = align_up(pos + heap.size());
+    }
+
+    std::string tmp = filename + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open output file: " + tmp);
+    size_t written = 0;
+    auto put = [&](const void* p, size_t n) {
+        out.write(static_cast<const char*>(p), n);
+        written += n;
+    };
+    auto pad_to = [&](size_t off) {
+        static const char zeros[kVxaAlign] = {};
+        while (written < off) put(zeros, std::min(kVxaAlign, off - written));
+    };
+
+    VxaHeader h{};
+    h.magic = VXA_MAGIC;
+    h.version = VXA_VERSION;
+    h.num_rows = static_cast<uint64_t>(num_rows_);
+    h.num_columns = static_cast<uint32_t>(columns_.size());
+    put(&h, sizeof(h));
+    for (const VxaColumn& d : dir) put(&d, sizeof(d));
+    for (size_t c = 0; c < columns_.size(); c++) {
+        const Column& col = columns_[c];
+        const VxaColumn& d = dir[c];
+        pad_to(d.name_offset);
+        put(col.name.data(), col.name.size());
+        pad_to(d.rows_offset);
+        switch (col.type) {
+            case AttrType::Int:
+            case AttrType::Timestamp: put(col.ints, d.rows_bytes); break;
+            case AttrType::Tag:       put(col.codes, d.rows_bytes); break;
+            case AttrType::Text:      put(refs[c].data(), d.rows_bytes); break;
+        }
+        pad_to(d.heap_offset);
+        put(heaps[c].data(), heaps[c].size());
+    }
+    pad_to(pos);
+    out.close();
+    if (!out || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Failed to write " + filename);
+    }
+}
+
+void AttributeStore::load(const std::string& filename, bool use_mmap) {
+    VELOX_TRACE_SCOPE("attributes.load");
+    clear();
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) throw std::runtime_error("Could not open file: " + filename);
+    struct stat sb;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        throw std::runtime_error("Could not stat file: " + filename);
+    }
+    mmap_size_ = static_cast<size_t>(sb.st_size);
+    mmap_ptr_ = mmap_size_ ? mmap(nullptr, mmap_size_, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mmap_ptr_ == MAP_FAILED) {
+        mmap_ptr_ = nullptr;
+        mmap_size_ = 0;
+        throw std::runtime_error("Not a valid attribute file (empty or unmappable): " + filename);
+    }
+
+    const char* base = static_cast<const char*>(mmap_ptr_);
+    auto reject = [&](const std::string& why) {
+        clear();
+        throw std::runtime_error("Not a valid attribute file (" + why + "): " + filename);
+    };
+    auto in_file = [&](uint64_t off, uint64_t n) {
+        return off <= mmap_size_ && n <= mmap_size_ - off;
+    };
+
+    VxaHeader h{};
+    if (mmap_size_ >= sizeof(h)) std::memcpy(&h, base, sizeof(h));
+    if (h.magic != VXA_MAGIC || h.version != VXA_VERSION) reject("bad header");
+    if (h.num_rows > static_cast<uint64_t>(VectorStorage::kMaxRows)) reject("too many rows");
+    if (!in_file(sizeof(h), static_cast<uint64_t>(h.num_columns) * sizeof(VxaColumn)))
+        reject("truncated directory");
+    num_rows_ = static_cast<int>(h.num_rows);
+
+    for (uint32_t c = 0; c < h.num_columns; c++) {
+        VxaColumn d;
+        std::memcpy(&d, base + sizeof(h) + c * sizeof(VxaColumn), sizeof(d));
+        if (d.type > static_cast<uint32_t>(AttrType::Text)) reject("unknown column type");
+        AttrType type = static_cast<AttrType>(d.type);
+        if (!in_file(d.name_offset, d.name_length) || !in_file(d.rows_offset, d.rows_bytes) ||
+            !in_file(d.heap_offset, d.heap_bytes) || d.rows_offset % kVxaAlign != 0 ||
+            d.rows_bytes != h.num_rows * row_width(type))
+            reject("truncated or misaligned column");
+
+        Column col;
+        col.name.assign(base + d.name_offset, d.name_length);
+        col.type = type;
+        const char* rows = base + d.rows_offset;
+        const char* heap = base + d.heap_offset;
+        switch (type) {
+            case AttrType::Int:
+            case AttrType::Timestamp:
+                col.ints = reinterpret_cast<const int64_t*>(rows);
+                break;
+            case AttrType::Tag: {
+                col.codes = reinterpret_cast<const uint32_t*>(rows);
+                size_t off = 0;
+                while (off < d.heap_bytes) {
+                    uint32_t len;
+                    if (d.heap_bytes - off < sizeof(len)) reject("truncated tag dictionary");
+                    std::memcpy(&len, heap + off, sizeof(len));
+                    off += sizeof(len);
+                    if (d.heap_bytes - off < len) reject("truncated tag dictionary");
+                    col.dict_index.emplace(std::string(heap + off, len),
+                                           static_cast<uint32_t>(col.dict.size()));
+                    col.dict.emplace_back(heap + off, len);
+                    off += len;
+                }
+                break;
+            }
+            case AttrType::Text:
+                col.refs = reinterpret_cast<const TextRef*>(rows);
+                col.text = heap;
+                col.text_bytes = d.heap_bytes;
+                break;
+        }
+        if (find_column(col.name) >= 0) reject("duplicate column '" + col.name + "'");
+        columns_.push_back(std::move(col));
+    }
+    if (!use_mmap) materialize();
+    std::cout << "[VeloxDB] Loaded " << columns_.size() << " attribute columns for "
+              << num_rows_ << " rows" << (use_mmap ? " via mmap.\n" : ".\n");
+}
+
+void AttributeStore::materialize() {
+    if (mmap_ptr_ == nullptr) return;
+    for (Column& c : columns_) {
+        switch (c.type) {
+            case AttrType::Int:
+            case AttrType::Timestamp: c.owned_ints.assign(c.ints, c.ints + num_rows_); break;
+            case AttrType::Tag:       c.owned_codes.assign(c.codes, c.codes + num_rows_); break;
+            case AttrType::Text:
+                c.owned_refs.assign(c.refs, c.refs + num_rows_);
+                c.owned_text.assign(c.text, c.text + c.text_bytes);
+                break;
+        }
+        c.bind();
+    }
+    unmap();
+}
+
+void AttributeStore::unmap() {
+    if (mmap_ptr_ != nullptr) munmap(mmap_ptr_, mmap_size_);
+    mmap_ptr_ = nullptr;
+    mmap_size_ = 0;
+}
+
+void AttributeStore::clear() {
+    unmap();
+    columns_.clear();
+    num_rows_ = 0;
+    checkpoint_rows_ = -1;
+    dirty_rows_.clear();
+    dirty_.clear();
+}
+
+void AttributeStore::memory_usage(MemoryUsage& usage, const std::string& prefix) const {
+    for (const Column& c : columns_) {
+        size_t bytes = c.owned_ints.capacity() * sizeof(int64_t) +
+                       c.owned_codes.capacity() * sizeof(uint32_t) +
+                       c.owned_refs.capacity() * sizeof(TextRef) + c.owned_text.capacity();
+        for (const std::string& s : c.dict) bytes += 2 * (sizeof(std::string) + s.capacity());
+        usage.add(prefix + "." + c.name, bytes);
+    }
+    if (mmap_ptr_ == nullptr) return;
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> resident((mmap_size_ + page - 1) / page);
+    usage.mapped_bytes += mmap_size_;
+    if (mincore(mmap_ptr_, mmap_size_, resident.data()) == 0) {
+        size_t pages = 0;
+        for (unsigned char r : resident) pages += r & 1;
+        usage.resident_bytes += std::min(mmap_size_, pages * page);
+    }
+}
+
+void AttributeStore::mark_checkpoint() {
+    checkpoint_rows_ = num_rows_;
+    dirty_rows_.clear();
+    dirty_.assign(num_rows_, false);
+}
+
+void AttributeStore::mark_dirty(int row) {
+    if (row >= checkpoint_rows_ || dirty_[row]) return;
+    dirty_[row] = true;
+    dirty_rows_.push_back(row);
+}
+
+bool AttributeStore::changed_since_checkpoint() const {
+    return checkpoint_rows_ < 0 || num_rows_ != checkpoint_rows_ || !dirty_rows_.empty();
+}
+
+// [u32 num_columns][u32 type x num_columns][u64 num_rows][u64 count]
+// then `count` x ([i32 row][cell x num_columns]), a cell being a CellKind
+// byte followed by an int64 or a (u64 length, bytes) string.
+void AttributeStore::save_delta(std::ofstream& out) const {
+    write_pod(out, static_cast<uint32_t>(columns_.size()));
+    for (const Column& c : columns_) write_pod(out, static_cast<uint32_t>(c.type));
+    std::vector<int> rows = dirty_rows_;
+    for (int r = std::max(checkpoint_rows_, 0); r < num_rows_; r++) rows.push_back(r);
+    write_pod(out, static_cast<uint64_t>(num_rows_));
+    write_pod(out, static_cast<uint64_t>(rows.size()));
+    for (int r : rows) {
+        write_pod(out, static_cast<int32_t>(r));
+        for (int c = 0; c < num_columns(); c++) {
+            AttrValue v = get(c, r);
+            if (std::holds_alternative<int64_t>(v)) {
+                write_pod(out, static_cast<uint8_t>(kCellInt));
+                write_pod(out, std::get<int64_t>(v));
+            } else if (std::holds_alternative<std::string>(v)) {
+                const std::string& s = std::get<std::string>(v);
+                write_pod(out, static_cast<uint8_t>(kCellString));
+                write_pod(out, static_cast<uint64_t>(s.size()));
+                out.write(s.data(), s.size());
+            } else {
+                write_pod(out, static_cast<uint8_t>(kCellNull));
+            }
+        }
+    }
+}
+
+void AttributeStore::load_delta(std::ifstream& in) {
+    uint32_t num_columns = read_pod<uint32_t>(in);
+    bool schema_ok = num_columns == columns_.size();
+    for (uint32_t c = 0; c < num_columns; c++) {
+        uint32_t type = read_pod<uint32_t>(in);
+        if (schema_ok && type != static_cast<uint32_t>(columns_[c].type)) schema_ok = false;
+    }
+    if (!schema_ok) throw std::runtime_error("Attribute delta does not match the column schema.");
+    uint64_t rows = read_pod<uint64_t>(in);
+    uint64_t count = read_pod<uint64_t>(in);
+    if (rows > static_cast<uint64_t>(VectorStorage::kMaxRows) || count > rows)
+        throw std::runtime_error("Corrupt attribute delta.");
+    extend(static_cast<int>(rows));
+    for (uint64_t i = 0; i < count; i++) {
+        int32_t r = read_pod<int32_t>(in);
+        if (r < 0 || static_cast<uint64_t>(r) >= rows)
+            throw std::runtime_error("Corrupt attribute delta.");
+        for (int c = 0; c < static_cast<int>(num_columns); c++) {
+            uint8_t kind = read_pod<uint8_t>(in);
+            if (kind == kCellInt) {
+                set(c, r, read_pod<int64_t>(in));
+            } else if (kind == kCellString) {
+                uint64_t len = read_pod<uint64_t>(in);
+                std::string s(len, '\0');
+                in.read(s.data(), static_cast<std::streamsize>(len));
+                if (!in) throw std::runtime_error("Truncated attribute delta.");
+                set(c, r, s);
+            } else if (kind == kCellNull) {
+                set(c, r, std::monostate{});
+            } else {
+                throw std::runtime_error("Corrupt attribute delta.");
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+AttributeFilter::AttributeFilter(const AttributeStore& store,
+                                 const std::vector<AttrCondition>& conditions)
+    : store_(store)
+{
+    static const std::pair<const char*, Op> kOps[] = {
+        {"==", Op::Eq}, {"!=", Op::Ne}, {"<", Op::Lt}, {"<=", Op::Le}, {">", Op::Gt},
+        {">=", Op::Ge}, {"in", Op::In}, {"contains", Op::Contains}, {"exists", Op::Exists}};
+
+    for (const AttrCondition& cond : conditions) {
+        Clause clause;
+        clause.column = store.find_column(cond.column);
+        if (clause.column < 0)
+            throw std::runtime_error("Unknown attribute '" + cond.column + "' in filter.");
+        clause.type = store.column_type(clause.column);
+        auto op = std::find_if(std::begin(kOps), std::end(kOps),
+                               [&](const auto& o) { return cond.op == o.first; });
+        if (op == std::end(kOps))
+            throw std::runtime_error("Unknown filter operator '" + cond.op + "'.");
+        clause.op = op->second;
+
+        std::string where = "Filter on '" + cond.column + "' (" + cond.op + ")";
+        size_t n = cond.values.size();
+        if (clause.op == Op::Exists ? n != 0 : clause.op == Op::In ? n == 0 : n != 1)
+            throw std::runtime_error(where + " has the wrong number of operands.");
+        bool ordering = clause.op == Op::Lt || clause.op == Op::Le || clause.op == Op::Gt ||
+                        clause.op == Op::Ge;
+        if ((clause.type == AttrType::Tag && (ordering || clause.op == Op::Contains)) ||
+            (is_int_type(clause.type) && clause.op == Op::Contains))
+            throw std::runtime_error(where + " is not supported for " +
+                                     attr_type_name(clause.type) + " columns.");
+
+        for (const AttrValue& v : cond.values) {
+            if (std::holds_alternative<std::monostate>(v))
+                throw std::runtime_error(where + " has a null operand.");
+            bool is_int = std::holds_alternative<int64_t>(v);
+            if (is_int != is_int_type(clause.type))
+                throw std::runtime_error(where + ": expected " +
+                                         (is_int_type(clause.type) ? "an integer" : "a string") +
+                                         " operand.");
+            if (is_int_type(clause.type)) {
+                clause.ints.push_back(std::get<int64_t>(v));
+            } else if (clause.type == AttrType::Tag) {
+                // A value no row holds becomes -1, which no stored code equals.
+                uint32_t code = store.tag_code(clause.column, std::get<std::string>(v));
+                clause.ints.push_back(code == AttributeStore::kNullTag ? -1
+                                                                       : static_cast<int64_t>(code));
+            } else {
+                clause.strings.push_back(std::get<std::string>(v));
+            }
+        }
+        clauses_.push_back(std::move(clause));
+    }
+}
+
+bool AttributeFilter::matches(int row) const {
+    for (const Clause& c : clauses_)
+        if (!clause_matches(c, row)) return false;
+    return true;
+}
+
+bool AttributeFilter::clause_matches(const Clause& c, int row) const {
+    if (row >= store_.size()) return false;  // every value null
+    if (c.type == AttrType::Text) {
+        if (store_.text_null(c.column, row)) return false;
+        std::string_view s = store_.text_at(c.column, row);
+        switch (c.op) {
+            case Op::Exists:   return true;
+            case Op::Eq:       return s == c.strings[0];
+            case Op::Ne:       return s != c.strings[0];
+            case Op::Lt:       return s < c.strings[0];
+            case Op::Le:       return s <= c.strings[0];
+            case Op::Gt:       return s > c.strings[0];
+            case Op::Ge:       return s >= c.strings[0];
+            case Op::Contains: return s.find(c.strings[0]) != std::string_view::npos;
+            case Op::In:
+                return std::find(c.strings.begin(), c.strings.end(), s) != c.strings.end();
+        }
+        return false;
+    }
+
+    int64_t v;
+    if (c.type == AttrType::Tag) {
+        uint32_t code = store_.tag_at(c.column, row);
+        if (code == AttributeStore::kNullTag) return false;
+        v = code;
+    } else {
+        v = store_.int_at(c.column, row);
+        if (v == AttributeStore::kNullInt) return false;
+    }
+    switch (c.op) {
+        case Op::Exists: return true;
+        case Op::Eq:     return v == c.ints[0];
+        case Op::Ne:     return v != c.ints[0];
+        case Op::Lt:     return v < c.ints[0];
+        case Op::Le:     return v <= c.ints[0];
+        case Op::Gt:     return v > c.ints[0];
+        case Op::Ge:     return v >= c.ints[0];
+        case Op::In:     return std::find(c.ints.begin(), c.ints.end(), v) != c.ints.end();
+        case Op::Contains: return false;
+    }
+    return false;
+}
@@ -0,0 +1,508 @@
+#include "disk_index.hpp"
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <stdexcept>
+#include <iostream>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.hpp"
+
+namespace {
+
+constexpr uint32_t DISK_MAGIC   = 0x44584C56; // 'V','L','X','D'
+constexpr uint32_t DISK_VERSION = 1;
+
+// `path` made absolute against the working directory, so a saved index
+// finds its graph file wherever it is loaded from.
+std::string absolute_path(const std::string& path) {
+    if (path.empty() || path[0] == '/') return path;
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == nullptr)
+        throw std::runtime_error("Cannot resolve disk graph path: " + path);
+    return std::string(cwd) + "/" + path;
+}
+
+// Occupies the first sector of the graph file; node records start at sector 1.
+struct DiskHeader {
+    uint32_t magic;
+    uint32_t version;
+    int32_t dim;
+    int32_t num_nodes;
+    int32_t max_degree;
+    int32_t medoid;
+    uint32_t node_bytes;
+    uint32_t nodes_per_sector;
+    uint32_t sectors_per_node;
+};
+
+std::shared_ptr<char> aligned_buffer(size_t bytes) {
+    void* p = nullptr;
+    if (posix_memalign(&p, DiskIndex::kSectorSize, bytes) != 0)
+        throw std::bad_alloc();
+    std::memset(p, 0, bytes);
+    return std::shared_ptr<char>(static_cast<char*>(p), [](char* q) { free(q); });
+}
+
+void pread_fully(int fd, char* dst, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, dst + done, len - done, offset + static_cast<off_t>(done));
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("pread failed on disk graph file.");
+        }
+        if (r == 0) throw std::runtime_error("Unexpected EOF in disk graph file.");
+        done += static_cast<size_t>(r);
+    }
+}
+
+} // namespace
+
+DiskIndex::~DiskIndex() {
+    close_graph();
+}
+
+DiskIndex::Layout DiskIndex::compute_layout(int dim, int max_degree) {
+    Layout l;
+    l.node_bytes = static_cast<uint32_t>(dim * sizeof(float) + sizeof(uint32_t) + max_degree * sizeof(int));
+    if (l.node_bytes <= kSectorSize) {
+        l.nodes_per_sector = static_cast<uint32_t>(kSectorSize / l.node_bytes);
+        l.sectors_per_node = 1;
+    } else {
+        l.nodes_per_sector = 0;
+        l.sectors_per_node = static_cast<uint32_t>((l.node_bytes + kSectorSize - 1) / kSectorSize);
+    }
+    return l;
+}
+
+// ---------------------------------------------------------------------------
+// greedy_search_mem — Vamana's GreedySearch over the in-memory build graph:
+// repeatedly expand the closest unexpanded node of a list capped at
+// `list_size`, returning every expanded node.
+// ---------------------------------------------------------------------------
+std::vector<std::pair<float, int>> DiskIndex::greedy_search_mem(
+    const VectorStorage& storage, const std::vector<std::vector<int>>& graph,
+    const float* query, int start, int list_size, bool use_simd,
+    const std::string& metric) const
+{
+    auto dist_to = [&](int id) {
+        return compute_dist(storage.raw_vec_ptr(id), query, dim_, use_simd, metric);
+    };
+
+    using Entry = std::pair<float, int>;
+    std::vector<Entry> list{{dist_to(start), start}};
+    std::unordered_set<int> evaluated{start};
+    std::unordered_set<int> expanded;
+    std::vector<Entry> visited;
+
+    for (;;) {
+        auto it = std::find_if(list.begin(), list.end(),
+                               [&](const Entry& e) { return !expanded.count(e.second); });
+        if (it == list.end()) break;
+
+        Entry cur = *it;
+        expanded.insert(cur.second);
+        visited.push_back(cur);
+
+        for (int nb : graph[cur.second]) {
+            if (!evaluated.insert(nb).second) continue;
+            Entry e{dist_to(nb), nb};
+            if (static_cast<int>(list.size()) >= list_size && e >= list.back()) continue;
+            list.insert(std::upper_bound(list.begin(), list.end(), e), e);
+            if (static_cast<int>(list.size()) > list_size) list.pop_back();
+        }
+    }
+    return visited;
+}
+
+// ---------------------------------------------------------------------------
+// robust_prune — Vamana's RobustPrune: keep candidates closest-first, but
+// drop any candidate c already "covered" by a kept neighbor r, i.e.
+// alpha * d(r, c) <= d(p, c). alpha > 1 keeps longer-range edges.
+// ---------------------------------------------------------------------------
+void DiskIndex::robust_prune(const VectorStorage& storage, std::vector<std::vector<int>>& graph,
+                             int p, std::vector<std::pair<float, int>> candidates, float alpha,
+                             int max_degree, bool use_simd, const std::string& metric) const
+{
+    const float* pvec = storage.raw_vec_ptr(p);
+    for (int nb : graph[p])
+        candidates.emplace_back(compute_dist(pvec, storage.raw_vec_ptr(nb), dim_, use_simd, metric), nb);
+
+    std::sort(candidates.begin(), candidates.end(),
+              [](const auto& a, const auto& b) { return a.second < b.second; });
+    candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                                 [](const auto& a, const auto& b) { return a.second == b.second; }),
+                     candidates.end());
+    std::sort(candidates.begin(), candidates.end());
+
+    std::vector<int> kept;
+    kept.reserve(max_degree);
+    for (const auto& [d, c] : candidates) {
+        if (c == p) continue;
+        bool covered = false;
+        const float* cvec = storage.raw_vec_ptr(c);
+        for (int r : kept) {
+            if (alpha * compute_dist(storage.raw_vec_ptr(r), cvec, dim_, use_simd, metric) <= d) {
+                covered = true;
+                break;
+            }
+        }
+        if (covered) continue;
+        kept.push_back(c);
+        if (static_cast<int>(kept.size()) >= max_degree) break;
+    }
+    graph[p] = std::move(kept);
+}
+
+// ---------------------------------------------------------------------------
+// build — Vamana: start from a random R-regular graph, then make two passes
+// over the nodes (alpha = 1, then alpha = params.alpha), each time replacing
+// a node's edges with the robust-pruned set visited by a greedy search from
+// the medoid and adding back-edges. The result is written to disk and only
+// the PQ codes are kept in memory.
+// ---------------------------------------------------------------------------
+void DiskIndex::memory_usage(MemoryUsage& usage) const {
+    usage.add("disk.pq", codes_.capacity() + pq_.heap_bytes());
+}
+
+void DiskIndex::build(const VectorStorage& storage, const IndexParams& params) {
+    VELOX_TRACE_SCOPE("disk.build");
+    int n = storage.size();
+    dim_ = storage.dim();
+    if (n == 0)
+        throw std::runtime_error("Cannot build a disk index over empty storage.");
+    if (params.disk_path.empty())
+        throw std::runtime_error("Disk index requires a graph file path.");
+    if (!storage.has_float_data())
+        throw std::runtime_error("Disk index needs float32 vectors; storage only holds compressed codes.");
+
+    // The in-memory graph (lists may reach about twice R before a prune)
+    // and the PQ codes kept for search.
+    int pq_m = params.pq_subspaces > 0 ? params.pq_subspaces : std::min(dim_, 32);
+    check_memory_budget(params,
+                        static_cast<size_t>(n) * (sizeof(std::vector<int>) +
+                                                  2 * params.max_degree * sizeof(int) + pq_m),
+                        "Disk index build");
+
+    close_graph();
+    path_ = absolute_path(params.disk_path);
+    num_nodes_ = n;
+    max_degree_ = params.max_degree;
+    beam_width_ = std::max(1, params.beam_width);
+
+    std::cout << "Building disk graph: " << n << " nodes, R=" << max_degree_
+              << ", L=" << params.build_list_size << ", alpha=" << params.alpha << ".\n";
+
+    std::vector<double> mean(dim_, 0.0);
+    for (int i = 0; i < n; i++) {
+        const float* v = storage.raw_vec_ptr(i);
+        for (int d = 0; d < dim_; d++) mean[d] += v[d];
+    }
+    std::vector<float> meanf(dim_);
+    for (int d = 0; d < dim_; d++) meanf[d] = static_cast<float>(mean[d] / n);
+
+    medoid_ = 0;
+    float best = compute_dist(storage.raw_vec_ptr(0), meanf.data(), dim_, params.use_simd, params.metric);
+    for (int i = 1; i < n; i++) {
+        float d = compute_dist(storage.raw_vec_ptr(i), meanf.data(), dim_, params.use_simd, params.metric);
+        if (d < best) { best = d; medoid_ = i; }
+    }
+
+    std::mt19937 rng(std::random_device{}());
+    std::vector<std::vector<int>> graph(n);
+    int init_degree = std::min(max_degree_, n - 1);
+    for (int i = 0; i < n; i++) {
+        std::unordered_set<int> picked;
+        while (static_cast<int>(picked.size()) < init_degree) {
+            int j = static_cast<int>(rng() % n);
+            if (j != i) picked.insert(j);
+        }
+        graph[i].assign(picked.begin(), picked.end());
+    }
+
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+
+    for (float alpha : {1.0f, params.alpha}) {
+        std::shuffle(order.begin(), order.end(), rng);
+        for (int p : order) {
+            const float* pvec = storage.raw_vec_ptr(p);
+            auto visited = greedy_search_mem(storage, graph, pvec, medoid_, params.build_list_size,
+                                             params.use_simd, params.metric);
+            robust_prune(storage, graph, p, std::move(visited), alpha, max_degree_,
+                         params.use_simd, params.metric);
+
+            for (int j : graph[p]) {
+                auto& nj = graph[j];
+                if (std::find(nj.begin(), nj.end(), p) != nj.end()) continue;
+                if (static_cast<int>(nj.size()) < max_degree_) {
+                    nj.push_back(p);
+                } else {
+                    std::vector<std::pair<float, int>> cand{
+                        {compute_dist(storage.raw_vec_ptr(j), pvec, dim_, params.use_simd, params.metric), p}};
+                    robust_prune(storage, graph, j, std::move(cand), alpha, max_degree_,
+                                 params.use_simd, params.metric);
+                }
+            }
+        }
+        std::cout << "Vamana pass (alpha=" << alpha << ") done.\n";
+    }
+
+    write_graph(storage, graph);
+
+    int m = params.pq_subspaces > 0 ? params.pq_subspaces : std::min(dim_, 32);
+    pq_.train(storage, m);
+    codes_.resize(static_cast<size_t>(n) * pq_.code_size());
+    for (int i = 0; i < n; i++)
+        pq_.encode(storage.raw_vec_ptr(i), codes_.data() + static_cast<size_t>(i) * pq_.code_size());
+
+    open_graph();
+    built_ = true;
+    std::cout << "Disk graph written to " << path_ << "\n";
+}
+
+void DiskIndex::write_graph(const VectorStorage& storage,
+                            const std::vector<std::vector<int>>& graph) const
+{
+    std::ofstream out(path_, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open disk graph file for writing: " + path_);
+
+    Layout layout = compute_layout(dim_, max_degree_);
+
+    auto header_buf = aligned_buffer(kSectorSize);
+    DiskHeader h{DISK_MAGIC, DISK_VERSION, dim_, num_nodes_, max_degree_, medoid_,
+                 layout.node_bytes, layout.nodes_per_sector, layout.sectors_per_node};
+    std::memcpy(header_buf.get(), &h, sizeof(h));
+    out.write(header_buf.get(), kSectorSize);
+
+    auto fill_record = [&](char* dst, int id) {
+        std::memcpy(dst, storage.raw_vec_ptr(id), dim_ * sizeof(float));
+        uint32_t degree = static_cast<uint32_t>(graph[id].size());
+        std::memcpy(dst + dim_ * sizeof(float), &degree, sizeof(uint32_t));
+        int* nbrs = reinterpret_cast<int*>(dst + dim_ * sizeof(float) + sizeof(uint32_t));
+        std::fill(nbrs, nbrs + max_degree_, -1);
+        std::copy(graph[id].begin(), graph[id].end(), nbrs);
+    };
+
+    if (layout.nodes_per_sector > 0) {
+        auto sector = aligned_buffer(kSectorSize);
+        for (int base = 0; base < num_nodes_; base += layout.nodes_per_sector) {
+            std::memset(sector.get(), 0, kSectorSize);
+            int end = std::min(num_nodes_, base + static_cast<int>(layout.nodes_per_sector));
+            for (int id = base; id < end; id++)
+                fill_record(sector.get() + static_cast<size_t>(id - base) * layout.node_bytes, id);
+            out.write(sector.get(), kSectorSize);
+        }
+    } else {
+        size_t span = static_cast<size_t>(layout.sectors_per_node) * kSectorSize;
+        auto block = aligned_buffer(span);
+        for (int id = 0; id < num_nodes_; id++) {
+            std::memset(block.get(), 0, span);
+            fill_record(block.get(), id);
+            out.write(block.get(), span);
+        }
+    }
+
+    if (!out) throw std::runtime_error("Failed writing disk graph file: " + path_);
+}
+
+void DiskIndex::open_graph() {
+    close_graph();
+
+    // Bypass the page cache where the filesystem allows it; every read is
+    // sector-aligned into sector-aligned buffers, as O_DIRECT requires.
+    fd_ = open(path_.c_str(), O_RDONLY | O_DIRECT);
+    if (fd_ == -1) fd_ = open(path_.c_str(), O_RDONLY);
+    if (fd_ == -1)
+        throw std::runtime_error("Could not open disk graph file: " + path_);
+
+    auto buf = aligned_buffer(kSectorSize);
+    pread_fully(fd_, buf.get(), kSectorSize, 0);
+    DiskHeader h;
+    std::memcpy(&h, buf.get(), sizeof(h));
+
+    if (h.magic != DISK_MAGIC || h.version != DISK_VERSION) {
+        close_graph();
+        throw std::runtime_error("Not a VeloxDB disk graph file: " + path_);
+    }
+
+    dim_ = h.dim;
+    num_nodes_ = h.num_nodes;
+    max_degree_ = h.max_degree;
+    medoid_ = h.medoid;
+    layout_ = {h.node_bytes, h.nodes_per_sector, h.sectors_per_node};
+
+    io_pool_ = std::make_unique<ThreadPool>(std::max(1, beam_width_));
+}
+
+void DiskIndex::close_graph() {
+    io_pool_.reset();
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+std::vector<DiskIndex::NodeRecord> DiskIndex::read_nodes(const std::vector<int>& ids) const {
+    std::vector<std::future<NodeRecord>> pending;
+    pending.reserve(ids.size());
+
+    for (int id : ids) {
+        pending.push_back(io_pool_->submit([this, id] {
+            off_t offset;
+            size_t len, within;
+            if (layout_.nodes_per_sector > 0) {
+                offset = static_cast<off_t>(1 + id / layout_.nodes_per_sector) * kSectorSize;
+                len = kSectorSize;
+                within = static_cast<size_t>(id % layout_.nodes_per_sector) * layout_.node_bytes;
+            } else {
+                offset = static_cast<off_t>(1 + static_cast<size_t>(id) * layout_.sectors_per_node) * kSectorSize;
+                len = static_cast<size_t>(layout_.sectors_per_node) * kSectorSize;
+                within = 0;
+            }
+
+            NodeRecord rec;
+            rec.buffer = aligned_buffer(len);
+            pread_fully(fd_, rec.buffer.get(), len, offset);
+
+            const char* base = rec.buffer.get() + within;
+            rec.vec = reinterpret_cast<const float*>(base);
+            std::memcpy(&rec.degree, base + dim_ * sizeof(float), sizeof(uint32_t));
+            rec.neighbors = reinterpret_cast<const int*>(base + dim_ * sizeof(float) + sizeof(uint32_t));
+            return rec;
+        }));
+    }
+
+    std::vector<NodeRecord> records;
+    records.reserve(ids.size());
+    for (auto& f : pending) records.push_back(f.get());
+    return records;
+}
+
+// ---------------------------------------------------------------------------
+// beam_search — the candidate list is ordered by PQ distance (no I/O); each
+// round reads the beam_width_ closest unexpanded candidates in parallel,
+// records their exact distances from the full vectors in those records, and
+// scores their neighbors with PQ.
+// ---------------------------------------------------------------------------
+std::vector<std::pair<float, int>> DiskIndex::beam_search(
+    const float* query, int list_size, bool use_simd, const std::string& metric) const
+{
+    ProductQuantizer::Tables tables;
+    pq_.compute_tables(query, metric, tables);
+    int cs = pq_.code_size();
+    auto approx = [&](int id) {
+        return pq_.distance(tables, codes_.data() + static_cast<size_t>(id) * cs);
+    };
+
+    struct Candidate {
+        float dist;
+        int id;
+        bool expanded;
+    };
+    auto by_dist = [](const Candidate& a, const Candidate& b) { return a.dist < b.dist; };
+
+    std::vector<Candidate> list{{approx(medoid_), medoid_, false}};
+    std::unordered_set<int> seen{medoid_};
+    std::vector<std::pair<float, int>> exact;
+
+    std::vector<int> batch;
+    for (;;) {
+        batch.clear();
+        for (auto& c : list) {
+            if (c.expanded) continue;
+            c.expanded = true;
+            batch.push_back(c.id);
+            if (static_cast<int>(batch.size()) >= beam_width_) break;
+        }
+        if (batch.empty()) break;
+
+        auto records = read_nodes(batch);
+        for (size_t r = 0; r < records.size(); r++) {
+            const NodeRecord& rec = records[r];
+            exact.emplace_back(compute_dist(rec.vec, query, dim_, use_simd, metric), batch[r]);
+
+            for (uint32_t e = 0; e < rec.degree; e++) {
+                int nb = rec.neighbors[e];
+                if (!seen.insert(nb).second) continue;
+                Candidate c{approx(nb), nb, false};
+                if (static_cast<int>(list.size()) >= list_size && c.dist >= list.back().dist) continue;
+                list.insert(std::upper_bound(list.begin(), list.end(), c, by_dist), c);
+                if (static_cast<int>(list.size()) > list_size) list.pop_back();
+            }
+        }
+    }
+
+    std::sort(exact.begin(), exact.end());
+    return exact;
+}
+
+std::vector<std::pair<int, float>> DiskIndex::search(
+    const VectorStorage& /*storage*/, const float* query, int k,
+    const IndexParams& params, bool use_simd) const
+{
+    VELOX_TRACE_SCOPE("disk.search");
+    if (!built_) return {};
+    int list_size = std::max(params.ef_search, k);
+    auto exact = beam_search(query, list_size, use_simd, params.metric);
+
+    int take = std::min(k, static_cast<int>(exact.size()));
+    std::vector<std::pair<int, float>> results;
+    results.reserve(take);
+    for (int i = 0; i < take; i++)
+        results.emplace_back(exact[i].second, exact[i].first);
+    return results;
+}
+
+std::vector<std::pair<int, float>> DiskIndex::range_search(
+    const VectorStorage& /*storage*/, const float* query, float radius,
+    const IndexParams& params, bool use_simd) const
+{
+    if (!built_) return {};
+    auto exact = beam_search(query, params.ef_search, use_simd, params.metric);
+
+    std::vector<std::pair<int, float>> results;
+    for (const auto& [d, id] : exact) {
+        if (d > radius) break;
+        results.emplace_back(id, d);
+    }
+    return results;
+}
+
+void DiskIndex::save(std::ofstream& out) const {
+    int path_len = static_cast<int>(path_.size());
+    out.write(reinterpret_cast<const char*>(&path_len), sizeof(int));
+    out.write(path_.data(), path_len);
+    out.write(reinterpret_cast<const char*>(&beam_width_), sizeof(int));
+
+    pq_.save(out);
+    size_t num_codes = codes_.size();
+    out.write(reinterpret_cast<const char*>(&num_codes), sizeof(size_t));
+    out.write(reinterpret_cast<const char*>(codes_.data()), num_codes);
+}
+
+void DiskIndex::load(std::ifstream& in, int dim, int /*version*/) {
+    int path_len;
+    in.read(reinterpret_cast<char*>(&path_len), sizeof(int));
+    path_.resize(path_len);
+    in.read(path_.data(), path_len);
+    in.read(reinterpret_cast<char*>(&beam_width_), sizeof(int));
+
+    pq_.load(in);
+    size_t num_codes;
+    in.read(reinterpret_cast<char*>(&num_codes), sizeof(size_t));
+    codes_.resize(num_codes);
+    in.read(reinterpret_cast<char*>(codes_.data()), num_codes);
+    if (!in) throw std::runtime_error("Truncated disk index payload.");
+
+    open_graph();
+    if (dim_ != dim || codes_.size() != static_cast<size_t>(num_nodes_) * pq_.code_size())
+        throw std::runtime_error("Disk graph file " + path_ + " does not match the index file.");
+
+    built_ = true;
+}
@@ -3,6 +3,9 @@
 #include <cmath>
 #include <queue>
 #include <unordered_set>
+#include <stdexcept>
+#include "attribute_store.hpp"
+#include "trace.hpp"
 
 int HNSWIndex::random_level() {
     double r = std::uniform_real_distribution<double>(0.0, 1.0)(rng_);
@@ -10,6 +13,12 @@ int HNSWIndex::random_level() {
     return static_cast<int>(std::floor(-std::log(r) * level_mult));
 }
 
+HNSWIndex::VisitMarks& HNSWIndex::thread_marks(int n) {
+    thread_local VisitMarks marks;
+    if (static_cast<int>(marks.mark.size()) < n) marks.mark.resize(n, 0);
+    return marks;
+}
+
 // ---------------------------------------------------------------------------
 // search_layer — best-first traversal of a single layer's graph.
 // Maintains a min-heap of candidates to expand and a max-heap of the best
@@ -17,21 +26,15 @@ int HNSWIndex::random_level() {
 // candidate is farther than the current worst kept result.
 // ---------------------------------------------------------------------------
 std::vector<std::pair<float, int>> HNSWIndex::search_layer(
-    const VectorStorage& storage, const float* query, int entry, int ef,
-    int layer, bool use_simd, const std::string& metric) const
+    const QueryDistance& dist_to, int entry, int ef, int layer, VisitMarks& marks) const
 {
-    int dim = storage.dim();
-    auto dist_to = [&](int id) {
-        return compute_dist(storage.raw_vec_ptr(id), query, dim, use_simd, metric);
-    };
-
     using Entry = std::pair<float, int>;
     std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> candidates;
     std::priority_queue<Entry> results; // max-heap: top() = worst of the best-ef
 
-    std::unordered_set<int> visited;
+    marks.next();
     float entry_dist = dist_to(entry);
-    visited.insert(entry);
+    marks.insert(entry);
     candidates.emplace(entry_dist, entry);
     results.emplace(entry_dist, entry);
 
@@ -42,9 +45,10 @@ std::vector<std::pair<float, int>> HNSWIndex::search_layer(
         if (static_cast<int>(results.size()) >= ef && cur_dist > results.top().first)
             break;
 
-        for (int neighbor : nodes_[cur_id].neighbors[layer]) {
-            if (visited.count(neighbor)) continue;
-            visited.insert(neighbor);
+        const int* list = links(cur_id, layer);
+        for (int j = 1; j <= list[0]; j++) {
+            int neighbor = list[j];
+            if (!marks.insert(neighbor)) continue;
 
             float d = dist_to(neighbor);
             if (static_cast<int>(results.size()) < ef || d < results.top().first) {
@@ -66,81 +70,480 @@ std::vector<std::pair<float, int>> HNSWIndex::search_layer(
     return out;
 }
 
+// Same traversal, but every reached node stays a candidate for expansion
+// while only matching nodes enter `results`; with a selective filter the
+// walk therefore visits more of the graph before `ef` matches are found.
+std::vector<std::pair<float, int>> HNSWIndex::search_layer0_filtered(
+    const QueryDistance& dist_to, int entry, int ef, const AttributeFilter& filter,
+    VisitMarks& marks) const
+{
+    using Entry = std::pair<float, int>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> candidates;
+    std::priority_queue<Entry> results;
+    auto keep = [&](float d, int node) {
+        if (!filter.matches(external_id(node))) return;
+        results.emplace(d, node);
+        if (static_cast<int>(results.size()) > ef) results.pop();
+    };
+
+    marks.next();
+    float entry_dist = dist_to(entry);
+    marks.insert(entry);
+    candidates.emplace(entry_dist, entry);
+    keep(entry_dist, entry);
+
+    while (!candidates.empty()) {
+        auto [cur_dist, cur_id] = candidates.top();
+        candidates.pop();
+
+        if (static_cast<int>(results.size()) >= ef && cur_dist > results.top().first)
+            break;
+
+        const int* list = links(cur_id, 0);
+        for (int j = 1; j <= list[0]; j++) {
+            int neighbor = list[j];
+            if (!marks.insert(neighbor)) continue;
+
+            float d = dist_to(neighbor);
+            if (static_cast<int>(results.size()) < ef || d < results.top().first) {
+                candidates.emplace(d, neighbor);
+                keep(d, neighbor);
+            }
+        }
+    }
+
+    std::vector<Entry> out;
+    out.reserve(results.size());
+    while (!results.empty()) {
+        out.push_back(results.top());
+        results.pop();
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+void HNSWIndex::allocate(std::vector<int> levels) {
+    levels_ = std::move(levels);
+    size_t n = levels_.size();
+    level0_.assign(n * (M_max0_ + 1), 0);
+    upper_offset_.resize(n);
+    size_t upper_total = 0;
+    for (size_t i = 0; i < n; i++) {
+        upper_offset_[i] = upper_total;
+        upper_total += static_cast<size_t>(levels_[i]) * (M_ + 1);
+    }
+    upper_.assign(upper_total, 0);
+}
+
+void HNSWIndex::append_node(int level) {
+    levels_.push_back(level);
+    level0_.resize(level0_.size() + M_max0_ + 1, 0);
+    upper_offset_.push_back(upper_.size());
+    upper_.resize(upper_.size() + static_cast<size_t>(level) * (M_ + 1), 0);
+}
+
 // ---------------------------------------------------------------------------
 // build — insert vectors one at a time: descend greedily from the current
 // entry point down to the new node's level, then at each layer from that
 // level down to 0, find ef_construction candidates and connect to the
-// closest M (M_max0 at layer 0), pruning any neighbor that overflows its cap.
+// closest M (M_max0 at layer 0). Levels are drawn up front so the arena is
+// allocated once; a neighbor whose list is full keeps its closest cap
+// entries by overwriting its farthest slot in place.
 // ---------------------------------------------------------------------------
 void HNSWIndex::build(const VectorStorage& storage, const IndexParams& params) {
+    VELOX_TRACE_SCOPE("hnsw.build");
     int n = storage.size();
     M_ = params.M;
     M_max0_ = 2 * M_;
     ef_construction_ = params.ef_construction;
 
-    nodes_.assign(n, Node{});
+    // Level-0 lists, the expected upper-layer lists (about 1/(M-1) of a
+    // level per node), levels, offsets and visit marks; plus the relabelled
+    // copy of the vectors if the graph is to be reordered.
+    size_t need = static_cast<size_t>(n) *
+        ((M_max0_ + 1) * sizeof(int) + (M_ + 1) * sizeof(int) / std::max(1, M_ - 1) +
+         2 * sizeof(int) + sizeof(size_t));
+    if (params.reorder != "none")
+        need += static_cast<size_t>(n) * (storage.dim() * sizeof(float) + sizeof(int));
+    check_memory_budget(params, need, "HNSW build");
+
+    std::vector<int> levels(n);
+    for (int& level : levels) level = random_level();
+    allocate(std::move(levels));
     entry_point_ = -1;
     max_level_ = -1;
+    ext_ids_.clear();
+    vectors_.clear();
+    checkpoint_nodes_ = -1;
+
+    BuildScratch scratch(n, storage.dim());
+    // Inserts are grouped into batches only so a trace shows build progress
+    // without one span per node.
+    constexpr int kTraceBatch = 1024;
+    for (int batch = 0; batch < n; batch += kTraceBatch) {
+        VELOX_TRACE_SCOPE("hnsw.insert_batch");
+        for (int i = batch; i < std::min(n, batch + kTraceBatch); i++)
+            link_node(storage, i, params, scratch);
+    }
 
-    for (int i = 0; i < n; i++) {
-        int level = random_level();
-        nodes_[i].level = level;
-        nodes_[i].neighbors.resize(level + 1);
+    built_ = true;
+    if (params.reorder != "none") reorder(storage, params.reorder);
+}
+
+// ---------------------------------------------------------------------------
+// link_node — one insertion: descend greedily from the entry point to the
+// node's level, then at each layer from there down to 0 connect it to the
+// best of ef_construction candidates and add the reverse edges. Whatever
+// links the node already has (none during a build; its own graph's edges
+// during a merge) compete with the candidates, so a merged node keeps the
+// good edges it came with.
+// ---------------------------------------------------------------------------
+void HNSWIndex::link_node(const VectorStorage& storage, int i, const IndexParams& params,
+                          BuildScratch& scratch)
+{
+    int level = levels_[i];
+    if (entry_point_ == -1) {
+        entry_point_ = i;
+        max_level_ = level;
+        return;
+    }
+
+    const float* vec_i = storage.float_vec(i, scratch.row.data());
+    QueryDistance dist_i(storage, vec_i, params.use_simd, params.metric);
+    bool heuristic = (params.neighbor_selection == "heuristic");
 
-        const float* vec_i = storage.raw_vec_ptr(i);
+    int ep = entry_point_;
+    for (int lc = max_level_; lc > level; lc--) {
+        auto res = search_layer(dist_i, ep, 1, lc, scratch.marks);
+        if (!res.empty()) ep = res.front().second;
+    }
 
-        if (entry_point_ == -1) {
-            entry_point_ = i;
-            max_level_ = level;
-            continue;
+    for (int lc = std::min(level, max_level_); lc >= 0; lc--) {
+        auto candidates = search_layer(dist_i, ep, ef_construction_, lc, scratch.marks);
+        int* own = links(i, lc);
+        auto& pool = scratch.pool;
+        pool.clear();
+        for (const auto& c : candidates)
+            if (c.second != i) pool.push_back(c);
+        if (own[0] > 0) {
+            for (int j = 1; j <= own[0]; j++) {
+                bool found = std::any_of(candidates.begin(), candidates.end(),
+                                         [&](const auto& c) { return c.second == own[j]; });
+                if (!found) pool.emplace_back(dist_i(own[j]), own[j]);
+            }
+            std::sort(pool.begin(), pool.end());
+        }
+        if (pool.empty()) continue;
+        int next_ep = pool.front().second;
+
+        int cap = (lc == 0) ? M_max0_ : M_;
+        select_neighbors(storage, dist_i, i, lc, cap, params, scratch);
+        touch(i);
+        own[0] = 0;
+        for (const auto& picked : scratch.kept) own[++own[0]] = picked.second;
+
+        for (int t = 1; t <= own[0]; t++) {
+            int neighbor_id = own[t];
+            int* nlist = links(neighbor_id, lc);
+            if (std::find(nlist + 1, nlist + 1 + nlist[0], i) != nlist + 1 + nlist[0]) continue;
+            touch(neighbor_id);
+            if (nlist[0] < cap) {
+                nlist[++nlist[0]] = i;
+                continue;
+            }
+            const float* nvec = storage.float_vec(neighbor_id, scratch.neighbor_row.data());
+            QueryDistance dist_n(storage, nvec, params.use_simd, params.metric);
+            if (heuristic) {
+                // Re-select the full list plus the new node with the same rule.
+                pool.clear();
+                for (int j = 1; j <= cap; j++) pool.emplace_back(dist_n(nlist[j]), nlist[j]);
+                pool.emplace_back(dist_n(i), i);
+                std::sort(pool.begin(), pool.end());
+                select_neighbors(storage, dist_n, neighbor_id, lc, cap, params, scratch);
+                nlist[0] = 0;
+                for (const auto& picked : scratch.kept) nlist[++nlist[0]] = picked.second;
+                continue;
+            }
+            int worst_slot = 1;
+            float worst = dist_n(nlist[1]);
+            for (int j = 2; j <= cap; j++) {
+                float d = dist_n(nlist[j]);
+                if (d > worst) { worst = d; worst_slot = j; }
+            }
+            if (dist_n(i) < worst) nlist[worst_slot] = i;
         }
 
-        int ep = entry_point_;
-        for (int lc = max_level_; lc > level; lc--) {
-            auto res = search_layer(storage, vec_i, ep, 1, lc, params.use_simd, params.metric);
-            if (!res.empty()) ep = res.front().second;
+        ep = next_ep;
+    }
+
+    if (level > max_level_) {
+        entry_point_ = i;
+        max_level_ = level;
+    }
+}
+
+void HNSWIndex::check_merge(const IndexAlgorithm& other_algo) const {
+    const auto* other = dynamic_cast<const HNSWIndex*>(&other_algo);
+    if (!other || !other->built_)
+        throw std::runtime_error("Only a built HNSW index can be merged into an HNSW index.");
+    if (other->M_ != M_)
+        throw std::runtime_error("Cannot merge HNSW graphs built with different M (" +
+                                 std::to_string(M_) + " and " + std::to_string(other->M_) + ").");
+    if (is_reordered() || other->is_reordered())
+        throw std::runtime_error("Cannot merge reordered HNSW graphs; reorder after merging.");
+}
+
+void HNSWIndex::copy_links(const HNSWIndex& src, int offset) {
+    for (int node = 0; node < src.size(); node++) {
+        for (int lc = 0; lc <= src.levels_[node]; lc++) {
+            const int* from = src.links(node, lc);
+            int* to = links(node + offset, lc);
+            to[0] = from[0];
+            for (int j = 1; j <= from[0]; j++) to[j] = from[j] + offset;
         }
+    }
+}
 
-        for (int lc = std::min(level, max_level_); lc >= 0; lc--) {
-            auto candidates = search_layer(storage, vec_i, ep, ef_construction_, lc, params.use_simd, params.metric);
-            if (candidates.empty()) continue;
-
-            int cap = (lc == 0) ? M_max0_ : M_;
-            int take = std::min(cap, static_cast<int>(candidates.size()));
-
-            for (int t = 0; t < take; t++) {
-                int neighbor_id = candidates[t].second;
-                nodes_[i].neighbors[lc].push_back(neighbor_id);
-
-                auto& nlist = nodes_[neighbor_id].neighbors[lc];
-                nlist.push_back(i);
-
-                int neighbor_cap = (lc == 0) ? M_max0_ : M_;
-                if (static_cast<int>(nlist.size()) > neighbor_cap) {
-                    const float* nvec = storage.raw_vec_ptr(neighbor_id);
-                    std::vector<std::pair<float, int>> scored;
-                    scored.reserve(nlist.size());
-                    for (int nb : nlist)
-                        scored.emplace_back(
-                            compute_dist(nvec, storage.raw_vec_ptr(nb), storage.dim(), params.use_simd, params.metric),
-                            nb);
-                    std::sort(scored.begin(), scored.end());
-                    nlist.clear();
-                    for (int t2 = 0; t2 < neighbor_cap; t2++)
-                        nlist.push_back(scored[t2].second);
-                }
-            }
+// ---------------------------------------------------------------------------
+// merge — both graphs are copied into one arena unchanged (other's node ids
+// shifted past ours, matching where its vectors were appended), then each
+// node of the smaller graph is re-linked into the larger one with
+// link_node, starting from the larger graph's entry point. Costs about
+// min(n_a, n_b) insertions instead of n_a + n_b for a rebuild.
+// ---------------------------------------------------------------------------
+void HNSWIndex::merge(const VectorStorage& storage, const IndexAlgorithm& other_algo,
+                      const IndexParams& params)
+{
+    VELOX_TRACE_SCOPE("hnsw.merge");
+    check_merge(other_algo);
+    const auto& other = static_cast<const HNSWIndex&>(other_algo);
+    int n_a = size(), n_b = other.size(), n = n_a + n_b;
+
+    HNSWIndex mine;
+    mine.M_ = M_;
+    mine.M_max0_ = M_max0_;
+    mine.levels_.swap(levels_);
+    mine.level0_.swap(level0_);
+    mine.upper_.swap(upper_);
+    mine.upper_offset_.swap(upper_offset_);
+    mine.entry_point_ = entry_point_;
+    mine.max_level_ = max_level_;
+
+    std::vector<int> levels = mine.levels_;
+    levels.insert(levels.end(), other.levels_.begin(), other.levels_.end());
+    allocate(std::move(levels));
+    copy_links(mine, 0);
+    copy_links(other, n_a);
+
+    bool mine_larger = n_a >= n_b;
+    const HNSWIndex& larger = mine_larger ? mine : other;
+    entry_point_ = larger.entry_point_ == -1 ? -1
+                 : larger.entry_point_ + (mine_larger ? 0 : n_a);
+    max_level_ = larger.max_level_;
+
+    BuildScratch scratch(n, storage.dim());
+    int begin = mine_larger ? n_a : 0, end = mine_larger ? n : n_a;
+    for (int i = begin; i < end; i++) link_node(storage, i, params, scratch);
+}
 
-            ep = candidates.front().second;
+// ---------------------------------------------------------------------------
+// select_neighbors — "simple" takes the m nearest candidates. "heuristic" is
+// Algorithm 4 of the paper: walk the candidates nearest-first and keep one
+// only if it is closer to `self` than to every neighbor already kept, which
+// favours edges in different directions over a tight cluster of near-
+// duplicates and keeps clustered data connected.
+// ---------------------------------------------------------------------------
+void HNSWIndex::select_neighbors(const VectorStorage& storage, const QueryDistance& dist_to,
+                                 int self, int layer, int m, const IndexParams& params,
+                                 BuildScratch& scratch) const
+{
+    auto& pool = scratch.pool;
+    auto& kept = scratch.kept;
+    kept.clear();
+    if (params.neighbor_selection != "heuristic") {
+        kept.assign(pool.begin(), pool.begin() + std::min<size_t>(m, pool.size()));
+        return;
+    }
+
+    if (params.extend_candidates) {
+        scratch.marks.next();
+        scratch.marks.insert(self);
+        for (const auto& c : pool) scratch.marks.insert(c.second);
+        size_t base = pool.size();
+        for (size_t c = 0; c < base; c++) {
+            const int* list = links(pool[c].second, layer);
+            for (int j = 1; j <= list[0]; j++)
+                if (scratch.marks.insert(list[j])) pool.emplace_back(dist_to(list[j]), list[j]);
         }
+        std::sort(pool.begin(), pool.end());
+    }
 
-        if (level > max_level_) {
-            entry_point_ = i;
-            max_level_ = level;
+    auto& discarded = scratch.discarded;
+    discarded.clear();
+    for (const auto& [d, e] : pool) {
+        if (static_cast<int>(kept.size()) >= m) break;
+        bool diverse = true;
+        if (!kept.empty()) {
+            const float* ve = storage.float_vec(e, scratch.vec.data());
+            QueryDistance dist_e(storage, ve, params.use_simd, params.metric);
+            for (const auto& r : kept)
+                if (dist_e(r.second) < d) { diverse = false; break; }
         }
+        (diverse ? kept : discarded).emplace_back(d, e);
     }
+    if (params.keep_pruned)
+        for (size_t j = 0; j < discarded.size() && static_cast<int>(kept.size()) < m; j++)
+            kept.push_back(discarded[j]);
+}
 
-    built_ = true;
+void HNSWIndex::memory_usage(MemoryUsage& usage) const {
+    usage.add("hnsw.graph", (levels_.capacity() + level0_.capacity() + upper_.capacity()) * sizeof(int) +
+                            upper_offset_.capacity() * sizeof(size_t));
+    if (is_reordered())
+        usage.add("hnsw.reordered", ext_ids_.capacity() * sizeof(int) + vectors_.heap_bytes());
+}
+
+// ---------------------------------------------------------------------------
+// graph_stats — per-layer node counts and mean degree, the layer-0 degree
+// histogram, and the nodes a layer-0 traversal from the entry point never
+// reaches (searches can only return those by chance of being the entry).
+// ---------------------------------------------------------------------------
+GraphStats HNSWIndex::graph_stats() const {
+    GraphStats stats;
+    int n = size();
+    stats.num_nodes = n;
+    stats.max_level = max_level_;
+    if (n == 0) return stats;
+
+    stats.nodes_per_layer.assign(max_level_ + 1, 0);
+    std::vector<size_t> edges(max_level_ + 1, 0);
+    stats.degree_histogram.assign(M_max0_ + 1, 0);
+    for (int node = 0; node < n; node++) {
+        for (int lc = 0; lc <= levels_[node]; lc++) {
+            stats.nodes_per_layer[lc]++;
+            edges[lc] += links(node, lc)[0];
+        }
+        stats.degree_histogram[links(node, 0)[0]]++;
+    }
+    stats.mean_degree.resize(max_level_ + 1);
+    for (int lc = 0; lc <= max_level_; lc++)
+        stats.mean_degree[lc] = stats.nodes_per_layer[lc]
+            ? static_cast<double>(edges[lc]) / stats.nodes_per_layer[lc] : 0.0;
+
+    std::vector<char> reached(n, 0);
+    std::vector<int> frontier{entry_point_};
+    reached[entry_point_] = 1;
+    while (!frontier.empty()) {
+        int cur = frontier.back();
+        frontier.pop_back();
+        const int* list = links(cur, 0);
+        for (int j = 1; j <= list[0]; j++)
+            if (!reached[list[j]]) { reached[list[j]] = 1; frontier.push_back(list[j]); }
+    }
+    for (int node = 0; node < n; node++)
+        if (!reached[node]) stats.unreachable.push_back(external_id(node));
+    std::sort(stats.unreachable.begin(), stats.unreachable.end());
+    return stats;
+}
+
+// ---------------------------------------------------------------------------
+// reorder — compute a new numbering over the layer-0 graph (which contains
+// every node), then rewrite the node array and every adjacency list under
+// it. Nodes unreachable from the first start are numbered by further BFS
+// passes so the result is always a full permutation.
+// ---------------------------------------------------------------------------
+void HNSWIndex::reorder(const VectorStorage& storage, const std::string& method) {
+    if (method != "bfs" && method != "rcm")
+        throw std::runtime_error("Unknown reorder method: " + method);
+    int n = size();
+    if (n == 0) return;
+    VELOX_TRACE_SCOPE("hnsw.reorder");
+    checkpoint_nodes_ = -1;
+
+    auto degree = [&](int v) { return links(v, 0)[0]; };
+    bool rcm = (method == "rcm");
+
+    // Candidate BFS roots, in the order they are tried.
+    std::vector<int> roots(n);
+    for (int i = 0; i < n; i++) roots[i] = i;
+    if (rcm)
+        std::stable_sort(roots.begin(), roots.end(),
+                         [&](int a, int b) { return degree(a) < degree(b); });
+    else
+        std::swap(roots[0], roots[entry_point_]);
+
+    std::vector<int> order;  // order[new_id] = old_id
+    order.reserve(n);
+    std::vector<char> seen(n, 0);
+    std::vector<int> next;
+    for (int root : roots) {
+        if (seen[root]) continue;
+        seen[root] = 1;
+        size_t head = order.size();
+        order.push_back(root);
+        while (head < order.size()) {
+            int v = order[head++];
+            next.clear();
+            const int* list = links(v, 0);
+            for (int j = 1; j <= list[0]; j++)
+                if (!seen[list[j]]) { seen[list[j]] = 1; next.push_back(list[j]); }
+            if (rcm)
+                std::stable_sort(next.begin(), next.end(),
+                                 [&](int a, int b) { return degree(a) < degree(b); });
+            order.insert(order.end(), next.begin(), next.end());
+        }
+    }
+    if (rcm) std::reverse(order.begin(), order.end());
+
+    std::vector<int> new_id(n);
+    for (int i = 0; i < n; i++) new_id[order[i]] = i;
+
+    // Move the old arena aside, allocate one for the new numbering and copy
+    // every list across, translating the ids it holds.
+    HNSWIndex old;
+    old.M_ = M_;
+    old.M_max0_ = M_max0_;
+    old.levels_ = std::move(levels_);
+    old.level0_ = std::move(level0_);
+    old.upper_ = std::move(upper_);
+    old.upper_offset_ = std::move(upper_offset_);
+
+    std::vector<int> levels(n);
+    std::vector<int> ext(n);
+    for (int i = 0; i < n; i++) {
+        levels[i] = old.levels_[order[i]];
+        ext[i] = external_id(order[i]);
+    }
+    allocate(std::move(levels));
+    for (int i = 0; i < n; i++) {
+        for (int lc = 0; lc <= levels_[i]; lc++) {
+            const int* src = old.links(order[i], lc);
+            int* dst = links(i, lc);
+            dst[0] = src[0];
+            for (int j = 1; j <= src[0]; j++) dst[j] = new_id[src[j]];
+        }
+    }
+    ext_ids_ = std::move(ext);
+    entry_point_ = new_id[entry_point_];
+    copy_reordered(storage);
+}
+
+void HNSWIndex::bind_storage(const VectorStorage& storage) {
+    if (!ext_ids_.empty()) copy_reordered(storage);
+}
+
+// Rebuilds vectors_ from the storage in node order, in the storage's
+// encoding (compressed copies drop the float data, as search reads codes).
+void HNSWIndex::copy_reordered(const VectorStorage& storage) {
+    vectors_.clear();
+    vectors_.set_encoding(StorageEncoding::Float32);
+    std::vector<float> row(storage.dim());
+    for (int ext : ext_ids_) {
+        const float* v = storage.float_vec(ext, row.data());
+        vectors_.add_vector(std::vector<float>(v, v + storage.dim()));
+    }
+    if (storage.encoding() != StorageEncoding::Float32)
+        vectors_.set_encoding(storage.encoding(), /*keep_float=*/false);
 }
 
 // ---------------------------------------------------------------------------
@@ -153,20 +556,84 @@ std::vector<std::pair<int, float>> HNSWIndex::search(
 {
     if (entry_point_ == -1) return {};
 
+    QueryDistance dist_to(data(storage), query, use_simd, params.metric);
+    VisitMarks& marks = thread_marks(size());
     int ep = entry_point_;
-    for (int lc = max_level_; lc > 0; lc--) {
-        auto res = search_layer(storage, query, ep, 1, lc, use_simd, params.metric);
-        if (!res.empty()) ep = res.front().second;
+    {
+        VELOX_TRACE_SCOPE("hnsw.upper_layers");
+        for (int lc = max_level_; lc > 0; lc--) {
+            auto res = search_layer(dist_to, ep, 1, lc, marks);
+            if (!res.empty()) ep = res.front().second;
+        }
     }
 
     int ef = std::max(params.ef_search, k);
-    auto candidates = search_layer(storage, query, ep, ef, 0, use_simd, params.metric);
+    std::vector<std::pair<float, int>> candidates;
+    {
+        VELOX_TRACE_SCOPE("hnsw.layer0");
+        candidates = params.filter != nullptr
+            ? search_layer0_filtered(dist_to, ep, ef, *params.filter, marks)
+            : search_layer(dist_to, ep, ef, 0, marks);
+    }
 
     int take = std::min(k, static_cast<int>(candidates.size()));
     std::vector<std::pair<int, float>> results;
     results.reserve(take);
     for (int i = 0; i < take; i++)
-        results.emplace_back(candidates[i].second, candidates[i].first);
+        results.emplace_back(external_id(candidates[i].second), candidates[i].first);
+    return results;
+}
+
+// ---------------------------------------------------------------------------
+// range_search — run the usual ef_search-bounded search to land inside the
+// ball, then keep expanding layer 0 from every hit for as long as the
+// neighbors it reaches are themselves within the radius.
+// ---------------------------------------------------------------------------
+std::vector<std::pair<int, float>> HNSWIndex::range_search(
+    const VectorStorage& storage, const float* query, float radius,
+    const IndexParams& params, bool use_simd) const
+{
+    if (entry_point_ == -1) return {};
+
+    QueryDistance dist_to(data(storage), query, use_simd, params.metric);
+    VisitMarks& marks = thread_marks(size());
+    int ep = entry_point_;
+    for (int lc = max_level_; lc > 0; lc--) {
+        auto res = search_layer(dist_to, ep, 1, lc, marks);
+        if (!res.empty()) ep = res.front().second;
+    }
+
+    auto seeds = search_layer(dist_to, ep, params.ef_search, 0, marks);
+
+    std::unordered_set<int> visited;
+    std::vector<int> frontier;
+    std::vector<std::pair<int, float>> results;
+    for (const auto& [d, id] : seeds) {
+        visited.insert(id);
+        if (d <= radius) {
+            results.emplace_back(id, d);
+            frontier.push_back(id);
+        }
+    }
+
+    while (!frontier.empty()) {
+        int cur = frontier.back();
+        frontier.pop_back();
+        const int* list = links(cur, 0);
+        for (int j = 1; j <= list[0]; j++) {
+            int neighbor = list[j];
+            if (!visited.insert(neighbor).second) continue;
+            float d = dist_to(neighbor);
+            if (d <= radius) {
+                results.emplace_back(neighbor, d);
+                frontier.push_back(neighbor);
+            }
+        }
+    }
+
+    for (auto& hit : results) hit.first = external_id(hit.first);
+    std::sort(results.begin(), results.end(),
+              [](const auto& a, const auto& b) { return a.second < b.second; });
     return results;
 }
 
@@ -177,22 +644,29 @@ void HNSWIndex::save(std::ofstream& out) const {
     out.write(reinterpret_cast<const char*>(&entry_point_), sizeof(int));
     out.write(reinterpret_cast<const char*>(&max_level_), sizeof(int));
 
-    int num_nodes = static_cast<int>(nodes_.size());
+    int num_nodes = size();
     out.write(reinterpret_cast<const char*>(&num_nodes), sizeof(int));
 
-    for (const auto& node : nodes_) {
-        out.write(reinterpret_cast<const char*>(&node.level), sizeof(int));
-        int num_layers = static_cast<int>(node.neighbors.size());
+    // Per node: level, layer count, then each layer's count and ids (the
+    // list layout in links() minus the unused slots).
+    for (int node = 0; node < num_nodes; node++) {
+        int level = levels_[node];
+        int num_layers = level + 1;
+        out.write(reinterpret_cast<const char*>(&level), sizeof(int));
         out.write(reinterpret_cast<const char*>(&num_layers), sizeof(int));
-        for (const auto& layer_neighbors : node.neighbors) {
-            int cnt = static_cast<int>(layer_neighbors.size());
-            out.write(reinterpret_cast<const char*>(&cnt), sizeof(int));
-            out.write(reinterpret_cast<const char*>(layer_neighbors.data()), cnt * sizeof(int));
+        for (int lc = 0; lc <= level; lc++) {
+            const int* list = links(node, lc);
+            out.write(reinterpret_cast<const char*>(list), (list[0] + 1) * sizeof(int));
         }
     }
+
+    // Format v3: node -> storage id map (count 0 = not reordered).
+    int num_ext = static_cast<int>(ext_ids_.size());
+    out.write(reinterpret_cast<const char*>(&num_ext), sizeof(int));
+    out.write(reinterpret_cast<const char*>(ext_ids_.data()), num_ext * sizeof(int));
 }
 
-void HNSWIndex::load(std::ifstream& in, int /*dim*/) {
+void HNSWIndex::load(std::ifstream& in, int /*dim*/, int version) {
     in.read(reinterpret_cast<char*>(&M_), sizeof(int));
     in.read(reinterpret_cast<char*>(&M_max0_), sizeof(int));
     in.read(reinterpret_cast<char*>(&ef_construction_), sizeof(int));
@@ -202,19 +676,127 @@ void HNSWIndex::load(std::ifstream& in, int /*dim*/) {
     int num_nodes;
     in.read(reinterpret_cast<char*>(&num_nodes), sizeof(int));
 
-    nodes_.assign(num_nodes, Node{});
-    for (auto& node : nodes_) {
-        in.read(reinterpret_cast<char*>(&node.level), sizeof(int));
-        int num_layers;
+    // Levels precede each node's lists, so the upper-layer arena grows as
+    // nodes are read; layer 0 is sized up front.
+    levels_.assign(num_nodes, 0);
+    level0_.assign(static_cast<size_t>(num_nodes) * (M_max0_ + 1), 0);
+    upper_offset_.assign(num_nodes, 0);
+    upper_.clear();
+    for (int node = 0; node < num_nodes; node++) {
+        int level, num_layers;
+        in.read(reinterpret_cast<char*>(&level), sizeof(int));
         in.read(reinterpret_cast<char*>(&num_layers), sizeof(int));
-        node.neighbors.resize(num_layers);
-        for (auto& layer_neighbors : node.neighbors) {
-            int cnt;
-            in.read(reinterpret_cast<char*>(&cnt), sizeof(int));
-            layer_neighbors.resize(cnt);
-            in.read(reinterpret_cast<char*>(layer_neighbors.data()), cnt * sizeof(int));
+        if (!in || level < 0 || num_layers != level + 1)
+            throw std::runtime_error("Corrupt HNSW node in index file.");
+        levels_[node] = level;
+        upper_offset_[node] = upper_.size();
+        upper_.resize(upper_.size() + static_cast<size_t>(level) * (M_ + 1), 0);
+        for (int lc = 0; lc <= level; lc++) {
+            int* list = links(node, lc);
+            in.read(reinterpret_cast<char*>(list), sizeof(int));
+            if (list[0] < 0 || list[0] > (lc == 0 ? M_max0_ : M_))
+                throw std::runtime_error("Corrupt HNSW neighbor list in index file.");
+            in.read(reinterpret_cast<char*>(list + 1), list[0] * sizeof(int));
         }
     }
 
+    // The reordered vector copy is rebuilt in bind_storage().
+    ext_ids_.clear();
+    vectors_.clear();
+    checkpoint_nodes_ = -1;
+    if (version >= 3) {
+        int num_ext;
+        in.read(reinterpret_cast<char*>(&num_ext), sizeof(int));
+        if (num_ext != 0 && num_ext != num_nodes)
+            throw std::runtime_error("Corrupt HNSW id map in index file.");
+        ext_ids_.resize(num_ext);
+        in.read(reinterpret_cast<char*>(ext_ids_.data()), num_ext * sizeof(int));
+    }
+
     built_ = true;
 }
+
+void HNSWIndex::mark_checkpoint() {
+    checkpoint_nodes_ = size();
+    dirty_blocks_.assign((checkpoint_nodes_ + kDirtyBlock - 1) / kDirtyBlock, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Delta — entry point, level and node count, the levels of the nodes added
+// since the mark, then (node, lists) for every node in a dirty block and
+// every new node, in the save() list layout.
+// ---------------------------------------------------------------------------
+void HNSWIndex::save_delta(std::ofstream& out) const {
+    VELOX_TRACE_SCOPE("hnsw.save_delta");
+    int num_nodes = size(), first = checkpoint_nodes_;
+    out.write(reinterpret_cast<const char*>(&entry_point_), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&max_level_), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&first), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&num_nodes), sizeof(int));
+    out.write(reinterpret_cast<const char*>(levels_.data() + first),
+              (num_nodes - first) * sizeof(int));
+
+    std::vector<int> nodes;
+    for (size_t b = 0; b < dirty_blocks_.size(); b++) {
+        if (!dirty_blocks_[b]) continue;
+        int end = std::min(first, static_cast<int>(b + 1) * kDirtyBlock);
+        for (int node = static_cast<int>(b) * kDirtyBlock; node < end; node++) nodes.push_back(node);
+    }
+    for (int node = first; node < num_nodes; node++) nodes.push_back(node);
+    uint64_t num_listed = nodes.size();
+    out.write(reinterpret_cast<const char*>(&num_listed), sizeof(uint64_t));
+    for (int node : nodes) {
+        out.write(reinterpret_cast<const char*>(&node), sizeof(int));
+        for (int lc = 0; lc <= levels_[node]; lc++) {
+            const int* list = links(node, lc);
+            out.write(reinterpret_cast<const char*>(list), (list[0] + 1) * sizeof(int));
+        }
+    }
+}
+
+void HNSWIndex::load_delta(std::ifstream& in, const VectorStorage& storage) {
+    VELOX_TRACE_SCOPE("hnsw.load_delta");
+    int entry_point, max_level, first, num_nodes;
+    in.read(reinterpret_cast<char*>(&entry_point), sizeof(int));
+    in.read(reinterpret_cast<char*>(&max_level), sizeof(int));
+    in.read(reinterpret_cast<char*>(&first), sizeof(int));
+    in.read(reinterpret_cast<char*>(&num_nodes), sizeof(int));
+    if (!in || first != size() || num_nodes < first || num_nodes > storage.size() ||
+        entry_point < -1 || entry_point >= num_nodes)
+        throw std::runtime_error("Corrupt HNSW delta in checkpoint file.");
+    if (num_nodes > first && is_reordered())
+        throw std::runtime_error("Corrupt HNSW delta in checkpoint file (reordered graph grew).");
+
+    std::vector<int> levels(num_nodes - first);
+    in.read(reinterpret_cast<char*>(levels.data()), levels.size() * sizeof(int));
+    if (!in) throw std::runtime_error("Truncated HNSW delta in checkpoint file.");
+    for (int level : levels) {
+        if (level < 0 || level > max_level)
+            throw std::runtime_error("Corrupt HNSW delta in checkpoint file.");
+        append_node(level);
+    }
+
+    uint64_t num_listed = 0;
+    in.read(reinterpret_cast<char*>(&num_listed), sizeof(uint64_t));
+    if (!in || num_listed > static_cast<uint64_t>(num_nodes))
+        throw std::runtime_error("Corrupt HNSW delta in checkpoint file.");
+    for (uint64_t n = 0; n < num_listed; n++) {
+        int node;
+        in.read(reinterpret_cast<char*>(&node), sizeof(int));
+        if (!in || node < 0 || node >= num_nodes)
+            throw std::runtime_error("Corrupt HNSW delta in checkpoint file.");
+        for (int lc = 0; lc <= levels_[node]; lc++) {
+            int* list = links(node, lc);
+            in.read(reinterpret_cast<char*>(list), sizeof(int));
+            if (!in || list[0] < 0 || list[0] > (lc == 0 ? M_max0_ : M_))
+                throw std::runtime_error("Corrupt HNSW neighbor list in checkpoint file.");
+            in.read(reinterpret_cast<char*>(list + 1), list[0] * sizeof(int));
+            for (int j = 1; j <= list[0]; j++)
+                if (list[j] < 0 || list[j] >= num_nodes)
+                    throw std::runtime_error("Corrupt HNSW neighbor list in checkpoint file.");
+        }
+    }
+    if (!in) throw std::runtime_error("Truncated HNSW delta in checkpoint file.");
+    entry_point_ = entry_point;
+    max_level_ = max_level;
+}
@@ -1,126 +1,997 @@
 #include "vector_db.hpp"
 #include "ivf_index.hpp"
 #include "hnsw_index.hpp"
+#include "disk_index.hpp"
 #include <stdexcept>
 #include <fstream>
 #include <iostream>
 #include <queue>
 #include <algorithm>
 #include <mutex>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
 // Magic bytes written at the start of every index file so we can detect
 // stale or corrupted files instead of silently misreading them. Version 2
 // adds a 1-byte index_type discriminator; version 1 files (IVF-only, no
 // discriminator) are still readable via the legacy path in load_index.
+// Version 3 appends the HNSW node relabelling (external id map); version 2
+// files load as un-reordered graphs. Version 4 appends the IVF training
+// metric (earlier IVF files are taken as "eucl"). Version 5 appends the
+// optional HNSW coarse quantizer over the IVF centroids; version 6 the IVF
+// spill mode and secondary list entries. Version 7 adds the IVF list
+// encoding (raw or packed) and, after the algorithm payload, the 64-bit
+// external id of every row (count 0 when none are in use).
 static constexpr uint32_t VELOX_MAGIC   = 0x564C5846; // 'V','L','X','F'
-static constexpr uint16_t VELOX_VERSION = 2;
+static constexpr uint16_t VELOX_VERSION = 7;
+
+// Version-2 index_type discriminator values.
+static uint8_t type_id_for(const std::string& type_name) {
+    if (type_name == "hnsw") return 1;
+    if (type_name == "disk") return 2;
+    return 0;
+}
+
+// Checkpoint delta files: magic, version, dim, the rows [from_row, to_row)
+// appended since the previous checkpoint as floats, the external ids from
+// row from_id on (count 0 when none are in use), then the index type id
+// (kNoIndexDelta without an index) and the algorithm's delta payload.
+// Version 2 inserts the attribute delta (AttributeStore::save_delta) before
+// the index type id; version 1 files carry no attributes.
+static constexpr uint32_t VELOX_DELTA_MAGIC   = 0x56584C44; // 'V','X','L','D'
+static constexpr uint16_t VELOX_DELTA_VERSION = 2;
+static constexpr uint8_t kNoIndexDelta = 0xFF;
+
+static std::string delta_path(const std::string& dir, int n) {
+    return dir + "/delta-" + std::to_string(n) + ".vxd";
+}
+
+// Every acquisition of rw_mutex_ goes through these, so time spent waiting
+// for it shows up as its own span in a trace.
+// Blocked time of the calling thread across every VectorIndex.
+static thread_local uint64_t tls_lock_wait_ns = 0;
+
+void VectorIndex::LockCounters::record_wait(uint64_t ns) {
+    contended.fetch_add(1, std::memory_order_relaxed);
+    wait_ns.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t seen = max_wait_ns.load(std::memory_order_relaxed);
+    while (ns > seen && !max_wait_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {}
+    tls_lock_wait_ns += ns;
+}
+
+LockWaitStats VectorIndex::LockCounters::snapshot() const {
+    LockWaitStats s;
+    s.acquisitions = acquisitions.load(std::memory_order_relaxed);
+    s.contended = contended.load(std::memory_order_relaxed);
+    s.wait_ns = wait_ns.load(std::memory_order_relaxed);
+    s.max_wait_ns = max_wait_ns.load(std::memory_order_relaxed);
+    return s;
+}
+
+void VectorIndex::LockCounters::reset() {
+    acquisitions.store(0, std::memory_order_relaxed);
+    contended.store(0, std::memory_order_relaxed);
+    wait_ns.store(0, std::memory_order_relaxed);
+    max_wait_ns.store(0, std::memory_order_relaxed);
+}
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - since).count());
+}
+
+// Try first so the uncontended path pays no clock reads.
+std::shared_lock<std::shared_mutex> VectorIndex::read_lock() const {
+    VELOX_TRACE_SCOPE("lock.shared");
+    std::shared_lock lock(rw_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        shared_waits_.record_wait(elapsed_ns(start));
+    }
+    shared_waits_.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    return lock;
+}
+
+std::pair<std::unique_lock<std::shared_mutex>, std::shared_lock<std::shared_mutex>>
+VectorIndex::lock_with(const VectorIndex& other) const {
+    if (this < &other) {
+        auto mine = write_lock();
+        return {std::move(mine), other.read_lock()};
+    }
+    auto theirs = other.read_lock();
+    return {write_lock(), std::move(theirs)};
+}
+
+std::unique_lock<std::shared_mutex> VectorIndex::write_lock() const {
+    VELOX_TRACE_SCOPE("lock.unique");
+    std::unique_lock lock(rw_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        exclusive_waits_.record_wait(elapsed_ns(start));
+    }
+    exclusive_waits_.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    return lock;
+}
+
+LockStats VectorIndex::lock_stats() const {
+    return {shared_waits_.snapshot(), exclusive_waits_.snapshot()};
+}
+
+void VectorIndex::reset_lock_stats() {
+    shared_waits_.reset();
+    exclusive_waits_.reset();
+}
+
+uint64_t VectorIndex::thread_lock_wait_ns() { return tls_lock_wait_ns; }
 
 VectorIndex::VectorIndex() {
     std::cout << "VectorIndex initialised!\n";
 }
 
-VectorIndex::~VectorIndex() = default;
+VectorIndex::~VectorIndex() {
+    stop_consolidation();
+    stop_prefault_ = true;
+    if (prefault_thread_.joinable()) prefault_thread_.join();
+}
 
+// With an index built, the new vector is also inserted into it when the
+// algorithm supports that (IVF); otherwise it stays unindexed until the
+// next build.
 void VectorIndex::add_vector(const std::vector<float>& vec) {
-    std::unique_lock lock(rw_mutex_);
+    auto lock = write_lock();
+    if (!external_ids_.empty())
+        throw std::runtime_error("This index uses external ids; add vectors with add_vector_with_id.");
+    storage_.add_vector(vec);
+    index_appended_row();
+}
+
+void VectorIndex::index_appended_row() {
+    int row = storage_.size() - 1;
+    if (algo_ && algo_->is_built() && algo_dim_ == storage_.dim() && algo_->size() == row)
+        algo_->insert(storage_, row, use_simd_);
+}
+
+void VectorIndex::add_vector_with_id(const std::vector<float>& vec, int64_t id) {
+    auto lock = write_lock();
+    bool taken = external_ids_.empty() ? (id >= 0 && id < storage_.size())
+                                       : rows_by_id_.count(id) > 0;
+    if (taken) throw std::runtime_error("Duplicate external id: " + std::to_string(id));
     storage_.add_vector(vec);
+    int row = storage_.size() - 1;
+    if (external_ids_.empty()) {
+        external_ids_.reserve(row + 1);
+        for (int r = 0; r < row; r++) {
+            external_ids_.push_back(r);
+            rows_by_id_.emplace(r, r);
+        }
+    }
+    external_ids_.push_back(id);
+    rows_by_id_.emplace(id, row);
+    index_appended_row();
+}
+
+int VectorIndex::internal_id(int64_t id) const {
+    auto lock = read_lock();
+    if (external_ids_.empty()) {
+        if (id < 0 || id >= storage_.size()) throw std::out_of_range("Unknown external id");
+        return static_cast<int>(id);
+    }
+    auto it = rows_by_id_.find(id);
+    if (it == rows_by_id_.end()) throw std::out_of_range("Unknown external id");
+    return it->second;
+}
+
+void VectorIndex::clear_external_ids() {
+    external_ids_.clear();
+    rows_by_id_.clear();
+}
+
+static MmapOptions mmap_options(bool populate, const std::string& advice,
+                                bool huge_pages, bool lock)
+{
+    MmapOptions opts;
+    opts.populate = populate;
+    opts.huge_pages = huge_pages;
+    opts.lock = lock;
+    if (advice == "normal")          opts.advice = MmapAdvice::Normal;
+    else if (advice == "random")     opts.advice = MmapAdvice::Random;
+    else if (advice == "sequential") opts.advice = MmapAdvice::Sequential;
+    else if (advice == "willneed")   opts.advice = MmapAdvice::WillNeed;
+    else throw std::runtime_error("Unknown mmap advice: " + advice);
+    return opts;
+}
+
+void VectorIndex::load_fvecs(const std::string& filename, bool populate,
+                             const std::string& advice, bool huge_pages, bool lock)
+{
+    MmapOptions opts = mmap_options(populate, advice, huge_pages, lock);
+    auto guard = write_lock();
+    storage_.load_fvecs(filename, opts);
+    if (binary_shortlist_ > 0) storage_.build_binary_codes();
+    clear_external_ids();
+    attributes_.clear();
+    checkpoint_dir_.clear();
 }
 
-void VectorIndex::load_fvecs(const std::string& filename) {
-    std::unique_lock lock(rw_mutex_);
-    storage_.load_fvecs(filename);
+void VectorIndex::load_vxv(const std::string& filename, bool populate,
+                           const std::string& advice, bool huge_pages, bool lock)
+{
+    MmapOptions opts = mmap_options(populate, advice, huge_pages, lock);
+    auto guard = write_lock();
+    storage_.load_vxv(filename, opts);
+    if (binary_shortlist_ > 0) storage_.build_binary_codes();
+    clear_external_ids();
+    attributes_.clear();
+    checkpoint_dir_.clear();
 }
 
 void VectorIndex::write_fvecs(const std::string& filename) {
-    std::shared_lock lock(rw_mutex_);
+    auto lock = read_lock();
     storage_.write_fvecs(filename);
 }
 
 std::vector<float> VectorIndex::get_vector(int index) {
-    std::shared_lock lock(rw_mutex_);
+    auto lock = read_lock();
     return storage_.get_vector(index);
 }
 
 void VectorIndex::set_simd(bool enable) {
-    std::unique_lock lock(rw_mutex_);
+    auto lock = write_lock();
     use_simd_ = enable;
     std::cout << "SIMD: " << (use_simd_ ? "enabled" : "disabled") << "\n";
 }
 
-void VectorIndex::build_index(int num_clusters, int epochs, const std::string& metric) {
-    std::unique_lock lock(rw_mutex_);
+void VectorIndex::set_storage_encoding(const std::string& encoding, bool keep_float) {
+    auto lock = write_lock();
+    StorageEncoding enc;
+    if (encoding == "float32")   enc = StorageEncoding::Float32;
+    else if (encoding == "sq8")  enc = StorageEncoding::SQ8;
+    else if (encoding == "fp16") enc = StorageEncoding::FP16;
+    else throw std::runtime_error("Unknown storage encoding: " + encoding);
+
+    storage_.set_encoding(enc, keep_float);
+    std::cout << "Storage encoding: " << encoding
+              << (keep_float || storage_.is_mmapped() ? " (float32 kept)" : "") << "\n";
+}
+
+void VectorIndex::set_rerank(int candidates) {
+    auto lock = write_lock();
+    rerank_ = std::max(0, candidates);
+}
+
+void VectorIndex::set_binary_prefilter(int shortlist) {
+    auto lock = write_lock();
+    binary_shortlist_ = std::max(0, shortlist);
+    if (binary_shortlist_ == 0) {
+        storage_.clear_binary_codes();
+    } else if (!storage_.has_binary_codes()) {
+        storage_.build_binary_codes();
+    }
+}
+
+void VectorIndex::set_search_shards(int num_shards) {
+    auto lock = write_lock();
+    num_shards_ = std::max(1, num_shards);
+    if (num_shards_ == 1) {
+        search_pool_.reset();
+    } else if (!search_pool_ || static_cast<int>(search_pool_->size()) != num_shards_) {
+        search_pool_ = std::make_unique<ThreadPool>(num_shards_);
+    }
+}
+
+void VectorIndex::build_index(int num_clusters, int epochs, const std::string& metric,
+                              const std::string& quantizer, int quantizer_ef,
+                              const std::string& spill, float spill_ratio,
+                              const std::string& list_encoding) {
+    if (quantizer != "flat" && quantizer != "hnsw")
+        throw std::runtime_error("Unknown coarse quantizer: " + quantizer);
+    if (spill != "none" && spill != "ratio" && spill != "soar")
+        throw std::runtime_error("Unknown spill mode: " + spill);
+    if (list_encoding != "raw" && list_encoding != "packed")
+        throw std::runtime_error("Unknown list encoding: " + list_encoding);
+    auto lock = write_lock();
     IndexParams params;
     params.metric = metric;
     params.use_simd = use_simd_;
+    params.memory_budget = build_headroom();
     params.num_clusters = num_clusters;
     params.epochs = epochs;
+    params.coarse_quantizer = quantizer;
+    params.quantizer_ef = quantizer_ef;
+    params.spill = spill;
+    params.spill_ratio = spill_ratio;
+    params.list_encoding = list_encoding;
 
     auto ivf = std::make_unique<IVFIndex>();
     ivf->build(storage_, params);
     algo_ = std::move(ivf);
+    algo_dim_ = storage_.dim();
+}
+
+void VectorIndex::build_index_from(const VectorIndex& trained) {
+    if (&trained == this) throw std::runtime_error("An index cannot be rebuilt from itself.");
+    auto locks = lock_with(trained);
+    const auto* codebook = dynamic_cast<const IVFIndex*>(trained.algo_.get());
+    if (!codebook || !codebook->is_built())
+        throw std::runtime_error("build_index_from needs an index with a built IVF.");
+    if (storage_.size() == 0) throw std::runtime_error("No vectors to index.");
+    IndexParams params;
+    params.use_simd = use_simd_;
+    params.memory_budget = build_headroom();
+
+    auto ivf = std::make_unique<IVFIndex>();
+    ivf->build_from(storage_, *codebook, params);
+    algo_ = std::move(ivf);
+    algo_dim_ = storage_.dim();
 }
 
-void VectorIndex::build_index_hnsw(int M, int ef_construction, const std::string& metric) {
-    std::unique_lock lock(rw_mutex_);
+void VectorIndex::build_index_hnsw(int M, int ef_construction, const std::string& metric,
+                                   const std::string& reorder, const std::string& selection,
+                                   bool extend_candidates, bool keep_pruned) {
+    if (reorder != "none" && reorder != "bfs" && reorder != "rcm")
+        throw std::runtime_error("Unknown reorder method: " + reorder);
+    if (selection != "simple" && selection != "heuristic")
+        throw std::runtime_error("Unknown neighbor selection: " + selection);
+    auto lock = write_lock();
     IndexParams params;
     params.metric = metric;
     params.use_simd = use_simd_;
+    params.memory_budget = build_headroom();
     params.M = M;
     params.ef_construction = ef_construction;
+    params.reorder = reorder;
+    params.neighbor_selection = selection;
+    params.extend_candidates = extend_candidates;
+    params.keep_pruned = keep_pruned;
 
     auto hnsw = std::make_unique<HNSWIndex>();
     hnsw->build(storage_, params);
     algo_ = std::move(hnsw);
+    algo_dim_ = storage_.dim();
+}
+
+void VectorIndex::build_index_disk(const std::string& graph_path, int R, int L,
+                                   float alpha, const std::string& metric, int beam_width) {
+    auto lock = write_lock();
+    IndexParams params;
+    params.metric = metric;
+    params.use_simd = use_simd_;
+    params.memory_budget = build_headroom();
+    params.max_degree = R;
+    params.build_list_size = L;
+    params.alpha = alpha;
+    params.beam_width = beam_width;
+    params.disk_path = graph_path;
+
+    auto disk = std::make_unique<DiskIndex>();
+    disk->build(storage_, params);
+    algo_ = std::move(disk);
+    algo_dim_ = storage_.dim();
 }
 
 std::vector<std::pair<int, float>> VectorIndex::search(
     const std::vector<float>& query, int k, int nprobe,
     const std::string& metric, int ef_search)
 {
-    std::shared_lock lock(rw_mutex_);
+    auto lock = read_lock();
+    check_query_dim(query.size());
 
-    if (static_cast<int>(query.size()) != storage_.dim())
-        throw std::runtime_error(
-            "Query dim=" + std::to_string(query.size()) +
-            " != index dim=" + std::to_string(storage_.dim()));
+    IndexParams params = search_params(nprobe, metric, ef_search);
 
-    if (!algo_ || !algo_->is_built()) {
-        // Brute-force fallback over every stored vector (algorithm-agnostic,
-        // so it lives here rather than in either concrete IndexAlgorithm).
-        int num_vectors = storage_.size();
-        using Entry = std::pair<float, int>;
-        std::priority_queue<Entry> heap;
+    return search_locked(query.data(), k, params);
+}
 
-        for (int vid = 0; vid < num_vectors; vid++) {
-            float d = compute_dist(storage_.raw_vec_ptr(vid), query.data(), storage_.dim(), use_simd_, metric);
-            if (static_cast<int>(heap.size()) < k) {
-                heap.emplace(d, vid);
-            } else if (d < heap.top().first) {
-                heap.pop();
-                heap.emplace(d, vid);
+std::vector<std::pair<int64_t, float>> VectorIndex::search_ids(
+    const std::vector<float>& query, int k, int nprobe,
+    const std::string& metric, int ef_search)
+{
+    auto lock = read_lock();
+    check_query_dim(query.size());
+
+    std::vector<std::pair<int64_t, float>> out;
+    for (const auto& [row, d] : search_locked(query.data(), k, search_params(nprobe, metric, ef_search)))
+        out.emplace_back(external_ids_.empty() ? row : external_ids_[row], d);
+    return out;
+}
+
+std::vector<std::pair<int, float>> VectorIndex::search_locked(
+    const float* query, int k, const IndexParams& params, bool exact) const
+{
+    // Compressed storage ranks with approximate distances, so over-fetch
+    // and re-rank the shortlist exactly when float data is available.
+    bool rerank = rerank_ > 0 && storage_.encoding() != StorageEncoding::Float32 &&
+                  storage_.has_float_data();
+    int fetch = rerank ? std::max(k, rerank_) : k;
+
+    bool indexed = !exact && algo_ && algo_->is_built() &&
+                   (params.filter == nullptr || algo_->supports_filter());
+    std::vector<std::pair<int, float>> results =
+        indexed ? algo_->search(storage_, query, fetch, params, use_simd_)
+                : brute_force_search(query, fetch, params.metric, params.filter);
+
+    if (rerank) {
+        VELOX_TRACE_SCOPE("query.rerank");
+        rerank_exact(query, results, params.metric);
+        if (static_cast<int>(results.size()) > k) results.resize(k);
+    }
+    return results;
+}
+
+std::vector<std::vector<std::pair<int, float>>> VectorIndex::search_batch(
+    const std::vector<std::vector<float>>& queries, int k, int nprobe,
+    const std::string& metric, int ef_search)
+{
+    auto lock = read_lock();
+    std::vector<const float*> ptrs;
+    ptrs.reserve(queries.size());
+    for (const auto& q : queries) {
+        check_query_dim(q.size());
+        ptrs.push_back(q.data());
+    }
+    IndexParams params = search_params(nprobe, metric, ef_search);
+
+    bool rerank = rerank_ > 0 && storage_.encoding() != StorageEncoding::Float32 &&
+                  storage_.has_float_data();
+    int fetch = rerank ? std::max(k, rerank_) : k;
+
+    std::vector<std::vector<std::pair<int, float>>> results;
+    if (algo_ && algo_->is_built()) {
+        results = algo_->search_batch(storage_, ptrs, fetch, params, use_simd_);
+    } else if (binary_shortlist_ > 0 || search_pool_) {
+        // These brute-force modes have their own per-query fast paths.
+        for (const float* q : ptrs) results.push_back(brute_force_search(q, fetch, metric));
+    } else {
+        results = brute_force_batch(ptrs, fetch, metric);
+    }
+
+    if (rerank) {
+        VELOX_TRACE_SCOPE("query.rerank");
+        for (size_t i = 0; i < results.size(); i++) {
+            rerank_exact(ptrs[i], results[i], metric);
+            if (static_cast<int>(results[i].size()) > k) results[i].resize(k);
+        }
+    }
+    return results;
+}
+
+// Many-to-many brute force: stored vectors are visited in blocks and every
+// query scores a block while it is still in cache, so the dataset streams
+// through memory once per batch rather than once per query.
+std::vector<std::vector<std::pair<int, float>>> VectorIndex::brute_force_batch(
+    const std::vector<const float*>& queries, int k, const std::string& metric) const
+{
+    size_t nq = queries.size();
+    std::vector<QueryDistance> dists;
+    dists.reserve(nq);
+    for (const float* q : queries) dists.emplace_back(storage_, q, use_simd_, metric);
+
+    using Entry = std::pair<float, int>;
+    std::vector<std::priority_queue<Entry>> heaps(nq);
+
+    constexpr int kBlock = 256;
+    int num_vectors = storage_.size();
+    for (int b = 0; b < num_vectors; b += kBlock) {
+        int e = std::min(num_vectors, b + kBlock);
+        for (size_t q = 0; q < nq; q++) {
+            auto& heap = heaps[q];
+            for (int vid = b; vid < e; vid++) {
+                float d = dists[q](vid);
+                if (static_cast<int>(heap.size()) < k) {
+                    heap.emplace(d, vid);
+                } else if (d < heap.top().first) {
+                    heap.pop();
+                    heap.emplace(d, vid);
+                }
             }
         }
+    }
 
-        std::vector<std::pair<int, float>> results;
-        results.reserve(heap.size());
+    std::vector<std::vector<std::pair<int, float>>> out(nq);
+    for (size_t q = 0; q < nq; q++) {
+        auto& heap = heaps[q];
+        out[q].reserve(heap.size());
         while (!heap.empty()) {
-            results.emplace_back(heap.top().second, heap.top().first);
+            out[q].emplace_back(heap.top().second, heap.top().first);
+            heap.pop();
+        }
+        std::reverse(out[q].begin(), out[q].end());
+    }
+    return out;
+}
+
+// Brute-force fallback over every stored vector (algorithm-agnostic, so it
+// lives here rather than in either concrete IndexAlgorithm).
+std::vector<std::pair<int, float>> VectorIndex::brute_force_search(
+    const float* query, int k, const std::string& metric, const AttributeFilter* filter) const
+{
+    VELOX_TRACE_SCOPE("query.flat_scan");
+    if (filter == nullptr && binary_shortlist_ > 0 && storage_.has_binary_codes())
+        return binary_prefilter_search(query, k, metric);
+
+    int num_vectors = storage_.size();
+    // Scatter contiguous id ranges across the search pool, but only when
+    // every shard still gets a meaningful amount of work.
+    int shards = search_pool_ ? std::min(num_shards_, num_vectors / kMinShardVectors) : 1;
+    if (shards <= 1)
+        return brute_force_shard(query, 0, num_vectors, k, metric, filter);
+
+    std::vector<std::future<std::vector<std::pair<int, float>>>> pending;
+    pending.reserve(shards);
+    for (int s = 0; s < shards; s++) {
+        int begin = static_cast<int>(static_cast<long long>(num_vectors) * s / shards);
+        int end = static_cast<int>(static_cast<long long>(num_vectors) * (s + 1) / shards);
+        pending.push_back(search_pool_->submit([this, query, begin, end, k, &metric, filter] {
+            return brute_force_shard(query, begin, end, k, metric, filter);
+        }));
+    }
+
+    std::vector<std::vector<std::pair<int, float>>> parts;
+    parts.reserve(shards);
+    for (auto& f : pending) parts.push_back(f.get());
+    return merge_topk(parts, k);
+}
+
+std::vector<std::pair<int, float>> VectorIndex::brute_force_shard(
+    const float* query, int begin, int end, int k, const std::string& metric,
+    const AttributeFilter* filter) const
+{
+    QueryDistance dist_to(storage_, query, use_simd_, metric);
+    using Entry = std::pair<float, int>;
+    std::priority_queue<Entry> heap;
+
+    for (int vid = begin; vid < end; vid++) {
+        if (filter != nullptr && !filter->matches(vid)) continue;
+        float d = dist_to(vid);
+        if (static_cast<int>(heap.size()) < k) {
+            heap.emplace(d, vid);
+        } else if (d < heap.top().first) {
             heap.pop();
+            heap.emplace(d, vid);
         }
-        std::reverse(results.begin(), results.end());
-        return results;
     }
 
+    std::vector<std::pair<int, float>> results;
+    results.reserve(heap.size());
+    while (!heap.empty()) {
+        results.emplace_back(heap.top().second, heap.top().first);
+        heap.pop();
+    }
+    std::reverse(results.begin(), results.end());
+    return results;
+}
+
+// Hamming scan over the binary codes keeps the binary_shortlist_ closest
+// vectors, which are then re-ranked with exact distances.
+std::vector<std::pair<int, float>> VectorIndex::binary_prefilter_search(
+    const float* query, int k, const std::string& metric) const
+{
+    int words = storage_.binary_words();
+    std::vector<uint64_t> qcode(words);
+    storage_.encode_binary(query, qcode.data());
+
+    int shortlist = std::max(binary_shortlist_, k);
+    using Entry = std::pair<int, int>;  // (hamming, id)
+    std::priority_queue<Entry> heap;
+    int num_vectors = storage_.size();
+    for (int vid = 0; vid < num_vectors; vid++) {
+        const uint64_t* code = storage_.binary_code(vid);
+        int h = use_simd_ ? hamming_dist_simd(qcode.data(), code, words)
+                          : hamming_dist(qcode.data(), code, words);
+        if (static_cast<int>(heap.size()) < shortlist) {
+            heap.emplace(h, vid);
+        } else if (h < heap.top().first) {
+            heap.pop();
+            heap.emplace(h, vid);
+        }
+    }
+
+    std::vector<std::pair<int, float>> results;
+    results.reserve(heap.size());
+    while (!heap.empty()) {
+        results.emplace_back(heap.top().second, 0.0f);
+        heap.pop();
+    }
+
+    if (storage_.has_float_data()) {
+        rerank_exact(query, results, metric);
+    } else {
+        QueryDistance dist_to(storage_, query, use_simd_, metric);
+        for (auto& [id, d] : results) d = dist_to(id);
+        std::sort(results.begin(), results.end(),
+                  [](const auto& a, const auto& b) { return a.second < b.second; });
+    }
+    if (static_cast<int>(results.size()) > k) results.resize(k);
+    return results;
+}
+
+void VectorIndex::rerank_exact(const float* query, std::vector<std::pair<int, float>>& results,
+                               const std::string& metric) const
+{
+    for (auto& [id, d] : results)
+        d = compute_dist(storage_.raw_vec_ptr(id), query, storage_.dim(), use_simd_, metric);
+    std::sort(results.begin(), results.end(),
+              [](const auto& a, const auto& b) { return a.second < b.second; });
+}
+
+IndexParams VectorIndex::search_params(int nprobe, const std::string& metric, int ef_search) const {
     IndexParams params;
     params.metric = metric;
     params.nprobe = nprobe;
     params.ef_search = ef_search < 0 ? 50 : ef_search;
+    params.pool = search_pool_.get();
+    params.num_shards = num_shards_;
+    return params;
+}
 
-    return algo_->search(storage_, query.data(), k, params, use_simd_);
+void VectorIndex::check_query_dim(size_t query_dim) const {
+    // A self-contained index (disk graph) may be searched with no vectors
+    // loaded, in which case its own dim is authoritative.
+    int dim = (storage_.size() == 0 && algo_ && algo_->self_contained())
+                  ? algo_dim_ : storage_.dim();
+    if (static_cast<int>(query_dim) != dim)
+        throw std::runtime_error(
+            "Query dim=" + std::to_string(query_dim) +
+            " != index dim=" + std::to_string(dim));
+}
+
+std::vector<std::pair<int, float>> VectorIndex::range_search_locked(
+    const float* query, float radius, const IndexParams& params) const
+{
+    std::vector<std::pair<int, float>> results;
+    if (algo_ && algo_->is_built()) {
+        results = algo_->range_search(storage_, query, radius, params, use_simd_);
+    } else {
+        QueryDistance dist_to(storage_, query, use_simd_, params.metric);
+        int num_vectors = storage_.size();
+        for (int vid = 0; vid < num_vectors; vid++) {
+            float d = dist_to(vid);
+            if (d <= radius) results.emplace_back(vid, d);
+        }
+        std::sort(results.begin(), results.end(),
+                  [](const auto& a, const auto& b) { return a.second < b.second; });
+    }
+
+    // Hits were selected on approximate distances; report exact ones.
+    if (rerank_ > 0 && storage_.encoding() != StorageEncoding::Float32 && storage_.has_float_data()) {
+        rerank_exact(query, results, params.metric);
+        while (!results.empty() && results.back().second > radius) results.pop_back();
+    }
+    return results;
+}
+
+std::vector<std::pair<int, float>> VectorIndex::range_search(
+    const std::vector<float>& query, float radius, int nprobe,
+    const std::string& metric, int ef_search)
+{
+    auto lock = read_lock();
+    check_query_dim(query.size());
+
+    IndexParams params = search_params(nprobe, metric, ef_search);
+
+    return range_search_locked(query.data(), radius, params);
+}
+
+RangeSearchResult VectorIndex::range_search_batch(
+    const std::vector<std::vector<float>>& queries, float radius, int nprobe,
+    const std::string& metric, int ef_search)
+{
+    auto lock = read_lock();
+    for (const auto& q : queries) check_query_dim(q.size());
+
+    IndexParams params = search_params(nprobe, metric, ef_search);
+
+    RangeSearchResult result;
+    result.lims.reserve(queries.size() + 1);
+    for (const auto& q : queries)
+        result.append(range_search_locked(q.data(), radius, params));
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Attributes — typed columns in attributes_, row-aligned with storage_. They
+// follow the vectors through checkpoint/open and merge, and are dropped when
+// the vectors are replaced wholesale.
+// ---------------------------------------------------------------------------
+void VectorIndex::add_attribute(const std::string& name, const std::string& type) {
+    AttrType t = attr_type_from_name(type);
+    auto lock = write_lock();
+    attributes_.add_column(name, t);
+}
+
+void VectorIndex::set_attributes(int row,
+                                 const std::vector<std::pair<std::string, AttrValue>>& values)
+{
+    auto lock = write_lock();
+    if (row < 0 || row >= storage_.size())
+        throw std::out_of_range("Row " + std::to_string(row) + " out of range.");
+    std::vector<int> columns;
+    for (const auto& [name, value] : values) {
+        int c = attributes_.find_column(name);
+        if (c < 0) throw std::runtime_error("Unknown attribute '" + name + "'.");
+        if (!attributes_.accepts(c, value))
+            throw std::runtime_error(std::string("Attribute '") + name + "' is a " +
+                                     attr_type_name(attributes_.column_type(c)) +
+                                     " column; got a value of another kind.");
+        columns.push_back(c);
+    }
+    for (size_t i = 0; i < values.size(); i++) attributes_.set(columns[i], row, values[i].second);
+}
+
+std::vector<std::vector<AttrValue>> VectorIndex::get_attributes(
+    const std::vector<int>& rows, const std::vector<std::string>& fields) const
+{
+    auto lock = read_lock();
+    std::vector<int> columns = attribute_columns(fields);
+    std::vector<std::vector<AttrValue>> out;
+    out.reserve(rows.size());
+    for (int row : rows) {
+        if (row < 0 || row >= storage_.size())
+            throw std::out_of_range("Row " + std::to_string(row) + " out of range.");
+        std::vector<AttrValue>& values = out.emplace_back();
+        values.reserve(columns.size());
+        for (int c : columns) values.push_back(attributes_.get(c, row));
+    }
+    return out;
+}
+
+std::vector<std::pair<std::string, std::string>> VectorIndex::attribute_schema() const {
+    auto lock = read_lock();
+    std::vector<std::pair<std::string, std::string>> schema;
+    for (int c = 0; c < attributes_.num_columns(); c++)
+        schema.emplace_back(attributes_.column_name(c), attr_type_name(attributes_.column_type(c)));
+    return schema;
+}
+
+std::vector<int> VectorIndex::find_rows(const std::vector<AttrCondition>& filter,
+                                        int offset, int limit) const
+{
+    auto lock = read_lock();
+    AttributeFilter compiled(attributes_, filter);
+    std::vector<int> rows;
+    // Rows past the attribute columns hold only nulls and never match a
+    // non-empty filter.
+    int end = compiled.empty() ? storage_.size() : attributes_.size();
+    for (int row = 0; row < end && (limit < 0 || static_cast<int>(rows.size()) < limit); row++) {
+        if (!compiled.matches(row)) continue;
+        if (offset > 0) offset--;
+        else            rows.push_back(row);
+    }
+    return rows;
+}
+
+int VectorIndex::count_rows(const std::vector<AttrCondition>& filter) const {
+    auto lock = read_lock();
+    AttributeFilter compiled(attributes_, filter);
+    if (compiled.empty()) return storage_.size();
+    int count = 0;
+    for (int row = 0; row < attributes_.size(); row++) count += compiled.matches(row);
+    return count;
+}
+
+void VectorIndex::save_attributes(const std::string& filename) {
+    auto lock = read_lock();
+    attributes_.save(filename);
+}
+
+void VectorIndex::load_attributes(const std::string& filename, bool use_mmap) {
+    auto lock = write_lock();
+    checkpoint_dir_.clear();
+    attributes_.load(filename, use_mmap);
+    if (attributes_.size() > storage_.size()) {
+        int rows = attributes_.size();
+        attributes_.clear();
+        throw std::runtime_error("Attribute file " + filename + " has " + std::to_string(rows) +
+                                 " rows, more than the " + std::to_string(storage_.size()) +
+                                 " stored vectors.");
+    }
+}
+
+std::vector<int> VectorIndex::attribute_columns(const std::vector<std::string>& fields) const {
+    std::vector<int> columns;
+    columns.reserve(fields.size());
+    for (const std::string& name : fields) {
+        int c = attributes_.find_column(name);
+        if (c < 0) throw std::runtime_error("Unknown attribute '" + name + "'.");
+        columns.push_back(c);
+    }
+    return columns;
+}
+
+// ---------------------------------------------------------------------------
+// search_filtered — a cheap sample decides between scanning the matching
+// rows exactly and letting the index skip non-matching candidates. The
+// index path is what keeps broad filters fast, but its candidate set is
+// bounded (nprobe lists, ef nodes), so with a narrow filter it could come
+// back short of k even though more matches exist; the exact scan covers
+// both that case and filters too selective to be worth the index.
+// ---------------------------------------------------------------------------
+std::vector<SearchHit> VectorIndex::search_filtered(
+    const std::vector<float>& query, int k, const std::vector<AttrCondition>& filter,
+    const std::vector<std::string>& fields, int nprobe, const std::string& metric,
+    int ef_search)
+{
+    auto lock = read_lock();
+    check_query_dim(query.size());
+    VELOX_TRACE_SCOPE("query.filtered");
+    std::vector<int> columns = attribute_columns(fields);
+    AttributeFilter compiled(attributes_, filter);
+    IndexParams params = search_params(nprobe, metric, ef_search);
+    if (!compiled.empty()) params.filter = &compiled;
+
+    bool indexed = algo_ && algo_->is_built();
+    bool exact = false;
+    if (params.filter != nullptr && indexed) {
+        int n = storage_.size();
+        int step = std::max(1, n / kFilterSampleRows);
+        int sampled = 0, matched = 0;
+        for (int row = 0; row < n; row += step, sampled++) matched += compiled.matches(row);
+        exact = !algo_->supports_filter() || matched < kExactFilterFraction * sampled;
+    }
+    std::vector<std::pair<int, float>> results = search_locked(query.data(), k, params, exact);
+    if (params.filter != nullptr && indexed && !exact && static_cast<int>(results.size()) < k)
+        results = search_locked(query.data(), k, params, /*exact=*/true);
+
+    std::vector<SearchHit> hits;
+    hits.reserve(results.size());
+    for (const auto& [row, d] : results) {
+        SearchHit& hit = hits.emplace_back(SearchHit{row, d, {}});
+        hit.fields.reserve(columns.size());
+        for (int c : columns) hit.fields.push_back(attributes_.get(c, row));
+    }
+    return hits;
+}
+
+// ---------------------------------------------------------------------------
+// knn_graph — every stored vector is a query. Rows are cut into tiles of
+// kKnnTile queries, each run as one batched search on the worker pool:
+// exact mode is brute_force_batch (stored rows visited in cache-sized
+// blocks, every query of the tile scored against a block before moving
+// on), approx mode the index's search_batch. Each query fetches one extra
+// result because it finds itself. Tiles are grouped into chunks so a
+// streaming sink only ever sees (and the process only holds) one chunk.
+// ---------------------------------------------------------------------------
+void VectorIndex::knn_graph_locked(int k, const std::string& mode, const IndexParams& params,
+                                   int num_threads, const KnnSink& sink) const
+{
+    VELOX_TRACE_SCOPE("knn_graph");
+    if (k <= 0) throw std::runtime_error("k must be positive.");
+    if (mode != "exact" && mode != "approx")
+        throw std::runtime_error("Unknown kNN graph mode: " + mode);
+    bool exact = (mode == "exact");
+    if (!exact && !(algo_ && algo_->is_built()))
+        throw std::runtime_error("Approximate kNN graph needs a built index.");
+
+    int n = storage_.size(), dim = storage_.dim();
+    bool rerank = rerank_ > 0 && storage_.encoding() != StorageEncoding::Float32 &&
+                  storage_.has_float_data();
+    int fetch = rerank ? std::max(k + 1, rerank_) : k + 1;
+    size_t threads = num_threads > 0 ? static_cast<size_t>(num_threads)
+                                     : std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+
+    constexpr int kKnnTile = 64;
+    constexpr int kKnnChunk = 64 * kKnnTile;
+    std::vector<int> ids;
+    std::vector<float> dists;
+    for (int begin = 0; begin < n; begin += kKnnChunk) {
+        int end = std::min(n, begin + kKnnChunk);
+        ids.assign(static_cast<size_t>(end - begin) * k, -1);
+        dists.assign(ids.size(), std::numeric_limits<float>::infinity());
+
+        std::vector<std::future<void>> pending;
+        for (int t = begin; t < end; t += kKnnTile) {
+            pending.push_back(pool.submit([&, t] {
+                int te = std::min(end, t + kKnnTile);
+                std::vector<float> rows(static_cast<size_t>(te - t) * dim);
+                std::vector<const float*> queries;
+                for (int i = t; i < te; i++)
+                    queries.push_back(storage_.float_vec(i, rows.data() + static_cast<size_t>(i - t) * dim));
+                auto results = exact ? brute_force_batch(queries, fetch, params.metric)
+                                     : algo_->search_batch(storage_, queries, fetch, params, use_simd_);
+                for (int i = t; i < te; i++) {
+                    auto& hits = results[i - t];
+                    if (rerank) rerank_exact(queries[i - t], hits, params.metric);
+                    size_t out = static_cast<size_t>(i - begin) * k;
+                    int filled = 0;
+                    for (const auto& [id, d] : hits) {
+                        if (id == i) continue;
+                        if (filled == k) break;
+                        ids[out + filled] = id;
+                        dists[out + filled] = d;
+                        filled++;
+                    }
+                }
+            }));
+        }
+        // Every task must finish before a failure unwinds the buffers they write.
+        for (auto& f : pending) f.wait();
+        for (auto& f : pending) f.get();
+        sink(begin, end, ids.data(), dists.data());
+    }
+}
+
+KnnGraph VectorIndex::knn_graph(int k, const std::string& mode, const std::string& metric,
+                                int nprobe, int ef_search, int num_threads) const
+{
+    auto lock = read_lock();
+    IndexParams params = search_params(nprobe, metric, ef_search);
+    params.pool = nullptr;  // already parallel across queries
+    KnnGraph graph;
+    graph.n = storage_.size();
+    graph.k = k;
+    if (k > 0) {
+        graph.ids.reserve(static_cast<size_t>(graph.n) * k);
+        graph.distances.reserve(graph.ids.capacity());
+    }
+    knn_graph_locked(k, mode, params, num_threads,
+                     [&](int begin, int end, const int* ids, const float* dists) {
+                         size_t cells = static_cast<size_t>(end - begin) * k;
+                         graph.ids.insert(graph.ids.end(), ids, ids + cells);
+                         graph.distances.insert(graph.distances.end(), dists, dists + cells);
+                     });
+    return graph;
+}
+
+int VectorIndex::write_knn_graph(const std::string& path, int k, const std::string& mode,
+                                 const std::string& metric, int nprobe, int ef_search,
+                                 int num_threads) const
+{
+    auto lock = read_lock();
+    IndexParams params = search_params(nprobe, metric, ef_search);
+    params.pool = nullptr;
+    int n = storage_.size();
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open kNN graph file for writing: " + path);
+    KnnFileHeader header{};
+    header.magic = KNN_MAGIC;
+    header.version = KNN_VERSION;
+    header.n = static_cast<uint64_t>(n);
+    header.k = static_cast<uint32_t>(std::max(k, 0));
+    header.ids_offset = sizeof(KnnFileHeader);
+    header.distances_offset = sizeof(KnnFileHeader) + header.n * header.k * sizeof(int32_t);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    try {
+        knn_graph_locked(k, mode, params, num_threads,
+                         [&](int begin, int end, const int* ids, const float* dists) {
+                             size_t cells = static_cast<size_t>(end - begin) * k;
+                             size_t first = static_cast<size_t>(begin) * k;
+                             out.seekp(header.ids_offset + first * sizeof(int32_t));
+                             out.write(reinterpret_cast<const char*>(ids), cells * sizeof(int32_t));
+                             out.seekp(header.distances_offset + first * sizeof(float));
+                             out.write(reinterpret_cast<const char*>(dists), cells * sizeof(float));
+                             if (!out) throw std::runtime_error("Failed to write kNN graph file: " + path);
+                         });
+    } catch (...) {
+        out.close();
+        std::remove(path.c_str());
+        throw;
+    }
+    return n;
+}
+
+void VectorIndex::prefetch(const std::vector<float>& query, int nprobe,
+                           const std::string& metric, bool lock)
+{
+    auto guard = read_lock();
+    check_query_dim(query.size());
+    if (algo_ && algo_->is_built())
+        algo_->prefetch(storage_, query.data(), search_params(nprobe, metric, -1), use_simd_, lock);
 }
 
 void VectorIndex::save_index(const std::string& filename) {
-    std::shared_lock lock(rw_mutex_);
+    auto lock = read_lock();
+    save_index_locked(filename);
+}
+
+void VectorIndex::save_index_locked(const std::string& filename) const {
+    VELOX_TRACE_SCOPE("save");
     if (!algo_ || !algo_->is_built())
         throw std::runtime_error("No index to save.");
 
@@ -130,20 +1001,35 @@ void VectorIndex::save_index(const std::string& filename) {
     out.write(reinterpret_cast<const char*>(&VELOX_MAGIC),   sizeof(uint32_t));
     out.write(reinterpret_cast<const char*>(&VELOX_VERSION), sizeof(uint16_t));
 
-    uint8_t type_id = (std::string(algo_->type_name()) == "hnsw") ? 1 : 0;
+    uint8_t type_id = type_id_for(algo_->type_name());
     out.write(reinterpret_cast<const char*>(&type_id), sizeof(uint8_t));
 
-    int dim = storage_.dim();
+    int dim = algo_dim_;
     out.write(reinterpret_cast<const char*>(&dim), sizeof(int));
 
-    algo_->save(out);
+    {
+        VELOX_TRACE_SCOPE("save.payload");
+        algo_->save(out);
+    }
+    {
+        VELOX_TRACE_SCOPE("save.external_ids");
+        uint64_t num_ids = external_ids_.size();
+        out.write(reinterpret_cast<const char*>(&num_ids), sizeof(uint64_t));
+        out.write(reinterpret_cast<const char*>(external_ids_.data()), num_ids * sizeof(int64_t));
+    }
 
     out.close();
+    if (!out) throw std::runtime_error("Failed to write " + filename);
     std::cout << "Index saved to " << filename << "\n";
 }
 
 void VectorIndex::load_index(const std::string& filename) {
-    std::unique_lock lock(rw_mutex_);
+    auto lock = write_lock();
+    load_index_locked(filename);
+}
+
+void VectorIndex::load_index_locked(const std::string& filename) {
+    VELOX_TRACE_SCOPE("load");
     std::ifstream in(filename, std::ios::binary);
     if (!in) throw std::runtime_error("Cannot open index file.");
 
@@ -171,12 +1057,15 @@ void VectorIndex::load_index(const std::string& filename) {
 
         auto ivf = std::make_unique<IVFIndex>();
         ivf->load_legacy_v1(in, num_clusters, loaded_dim);
+        check_index_size(*ivf);
+        ivf->bind_storage(storage_);
         algo_ = std::move(ivf);
+        algo_dim_ = loaded_dim;
         std::cout << "Index loaded (legacy v1): " << num_clusters << " clusters\n";
         return;
     }
 
-    if (version != VELOX_VERSION)
+    if (version < 2 || version > VELOX_VERSION)
         throw std::runtime_error("Unsupported index version: " + std::to_string(version));
 
     uint8_t type_id;
@@ -184,25 +1073,471 @@ void VectorIndex::load_index(const std::string& filename) {
     int loaded_dim;
     in.read(reinterpret_cast<char*>(&loaded_dim), sizeof(int));
 
-    if (loaded_dim == 0 || loaded_dim != storage_.dim())
+    // The disk graph carries its own vectors, so it may be loaded into an
+    // empty VectorIndex; every other type indexes the loaded storage.
+    bool standalone = (type_id == 2 && storage_.size() == 0);
+    if (loaded_dim == 0 || (!standalone && loaded_dim != storage_.dim()))
         throw std::runtime_error(
             "Dimension mismatch: data dim=" + std::to_string(storage_.dim()) +
             ", index dim=" + std::to_string(loaded_dim));
 
-    if (type_id == 1) {
-        auto hnsw = std::make_unique<HNSWIndex>();
-        hnsw->load(in, loaded_dim);
-        algo_ = std::move(hnsw);
-        std::cout << "Index loaded: hnsw\n";
+    std::unique_ptr<IndexAlgorithm> algo;
+    if (type_id == 1)      algo = std::make_unique<HNSWIndex>();
+    else if (type_id == 2) algo = std::make_unique<DiskIndex>();
+    else                   algo = std::make_unique<IVFIndex>();
+
+    {
+        VELOX_TRACE_SCOPE("load.payload");
+        algo->load(in, loaded_dim, version);
+    }
+    if (!standalone) {
+        VELOX_TRACE_SCOPE("load.bind_storage");
+        check_index_size(*algo);
+        algo->bind_storage(storage_);
+    }
+    if (version >= 7) {
+        VELOX_TRACE_SCOPE("load.external_ids");
+        uint64_t num_ids = 0;
+        in.read(reinterpret_cast<char*>(&num_ids), sizeof(uint64_t));
+        if (num_ids != 0 && num_ids != static_cast<uint64_t>(algo->size()))
+            throw std::runtime_error("Index/data mismatch: " + std::to_string(num_ids) +
+                                     " external ids for " + std::to_string(algo->size()) +
+                                     " vectors");
+        std::vector<int64_t> ids(num_ids);
+        in.read(reinterpret_cast<char*>(ids.data()), num_ids * sizeof(int64_t));
+        if (!in) throw std::runtime_error("Truncated index file (external ids).");
+        clear_external_ids();
+        for (size_t row = 0; row < ids.size(); row++)
+            rows_by_id_.emplace(ids[row], static_cast<int>(row));
+        external_ids_ = std::move(ids);
+    }
+    algo_ = std::move(algo);
+    algo_dim_ = loaded_dim;
+    std::cout << "Index loaded: " << algo_->type_name() << "\n";
+}
+
+// An index saved before vectors were added (or after some were lost) would
+// silently miss or, worse, dereference ids past the end of the storage.
+void VectorIndex::check_index_size(const IndexAlgorithm& algo) const {
+    if (algo.size() != storage_.size())
+        throw std::runtime_error(
+            "Index/data mismatch: index covers " + std::to_string(algo.size()) +
+            " vectors, storage holds " + std::to_string(storage_.size()));
+}
+
+// ---------------------------------------------------------------------------
+// open — restore a saved data directory in one native call: the vectors are
+// mmap'd (or bulk-read), the index file is loaded and validated against them,
+// checkpoint deltas are replayed on top, and on any failure the instance is
+// left empty. With a mapping, pages are faulted in by a background thread;
+// is_ready() flips once it is done. Rows from deltas are appended in RAM.
+// ---------------------------------------------------------------------------
+void VectorIndex::open(const std::string& dir, bool with_index, bool use_mmap, bool prefault) {
+    auto lock = write_lock();
+    if (storage_.size() > 0 || algo_)
+        throw std::runtime_error("open() needs an empty VectorIndex.");
+
+    std::string vectors_path = dir + "/" + kVectorsFile;
+    std::string index_path = dir + "/" + kIndexFile;
+    std::string attributes_path = dir + "/" + kAttributesFile;
+    VELOX_TRACE_SCOPE("open");
+    try {
+        if (use_mmap) storage_.load_fvecs(vectors_path);
+        else          storage_.read_fvecs(vectors_path);
+        if (binary_shortlist_ > 0) storage_.build_binary_codes();
+
+        bool has_index = std::ifstream(index_path).good();
+        if (with_index && has_index)
+            load_index_locked(index_path);
+        if (std::ifstream(attributes_path).good())
+            attributes_.load(attributes_path, use_mmap);
+
+        int deltas = 0;
+        while (std::ifstream(delta_path(dir, deltas + 1)).good()) {
+            apply_delta_locked(delta_path(dir, deltas + 1), with_index);
+            deltas++;
+        }
+        if (attributes_.size() > storage_.size())
+            throw std::runtime_error("Attribute/data mismatch: attributes cover " +
+                                     std::to_string(attributes_.size()) + " rows, storage holds " +
+                                     std::to_string(storage_.size()));
+        // Without the saved index the directory cannot take deltas of ours.
+        if (has_index && !algo_) checkpoint_dir_.clear();
+        else                     mark_checkpoint_locked(dir, deltas);
+    } catch (...) {
+        storage_.clear();
+        algo_.reset();
+        algo_dim_ = 0;
+        clear_external_ids();
+        attributes_.clear();
+        checkpoint_dir_.clear();
+        throw;
+    }
+
+    if (use_mmap && prefault) {
+        ready_ = false;
+        prefault_thread_ = std::thread([this] { prefault_storage(); });
+    }
+}
+
+// Touches the mapping a chunk at a time, taking the shared lock per chunk so
+// writers (e.g. an add_vector that copies the mapping into RAM) are not held
+// off for the whole pass.
+void VectorIndex::prefault_storage() {
+    constexpr int kChunkRows = 16384;
+    for (int begin = 0; !stop_prefault_; begin += kChunkRows) {
+        auto lock = read_lock();
+        if (!storage_.is_mmapped() || begin >= storage_.size()) break;
+        storage_.prefault(begin, std::min(storage_.size(), begin + kChunkRows));
+    }
+    ready_ = true;
+}
+
+bool VectorIndex::is_ready() const {
+    return ready_;
+}
+
+// ---------------------------------------------------------------------------
+// checkpoint — a delta needs the same directory as the last checkpoint and
+// an index that can describe its changes since then (see
+// IndexAlgorithm::can_save_delta); anything else gets a fresh base. Rows
+// are only ever appended, so the vector part of a delta is just the rows
+// past the last checkpoint. A delta always adds rows because open() tells
+// a delta the base already covers (left by an interrupted consolidation)
+// from a new one by its to_row; attribute updates alone therefore go into
+// a base.
+// ---------------------------------------------------------------------------
+std::string VectorIndex::checkpoint(const std::string& dir) {
+    auto lock = read_lock();
+    std::lock_guard guard(checkpoint_mutex_);
+    VELOX_TRACE_SCOPE("checkpoint");
+    bool index_delta = !algo_ || !algo_->is_built() || algo_->can_save_delta();
+    bool on_base = dir == checkpoint_dir_ && index_delta && attributes_.can_save_delta() &&
+                   storage_.size() >= checkpoint_rows_;
+    bool grew = storage_.size() > checkpoint_rows_;
+    if (on_base && !grew && external_ids_.size() == checkpoint_ids_ &&
+        !attributes_.changed_since_checkpoint())
+        return "none";
+    if (!on_base || !grew) {
+        write_base_locked(dir);
+        return "base";
+    }
+    write_delta_locked(delta_path(dir, checkpoint_deltas_ + 1));
+    mark_checkpoint_locked(dir, checkpoint_deltas_ + 1);
+    return "delta";
+}
+
+void VectorIndex::write_base_locked(const std::string& dir) {
+    VELOX_TRACE_SCOPE("checkpoint.base");
+    std::string index_path = dir + "/" + kIndexFile;
+    storage_.write_fvecs(dir + "/" + kVectorsFile);
+    if (algo_ && algo_->is_built()) {
+        std::string tmp = index_path + ".tmp";
+        try {
+            save_index_locked(tmp);
+        } catch (...) {
+            std::remove(tmp.c_str());
+            throw;
+        }
+        if (std::rename(tmp.c_str(), index_path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Failed to write " + index_path);
+        }
     } else {
-        auto ivf = std::make_unique<IVFIndex>();
-        ivf->load(in, loaded_dim);
-        algo_ = std::move(ivf);
-        std::cout << "Index loaded: ivf\n";
+        std::remove(index_path.c_str());
+    }
+    std::string attributes_path = dir + "/" + kAttributesFile;
+    if (attributes_.num_columns() > 0) attributes_.save(attributes_path);
+    else                               std::remove(attributes_path.c_str());
+    // Newest first: an interrupted cleanup leaves deltas 1..j, which the
+    // base already covers and open() skips.
+    int deltas = 0;
+    while (std::ifstream(delta_path(dir, deltas + 1)).good()) deltas++;
+    for (int n = deltas; n >= 1; n--) std::remove(delta_path(dir, n).c_str());
+    mark_checkpoint_locked(dir, 0);
+}
+
+void VectorIndex::write_delta_locked(const std::string& path) const {
+    VELOX_TRACE_SCOPE("checkpoint.delta");
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open output file.");
+
+    int dim = storage_.dim(), from_row = checkpoint_rows_, to_row = storage_.size();
+    uint64_t from_id = external_ids_.empty() ? 0 : checkpoint_ids_;
+    uint64_t num_ids = external_ids_.size() - from_id;
+    out.write(reinterpret_cast<const char*>(&VELOX_DELTA_MAGIC),   sizeof(uint32_t));
+    out.write(reinterpret_cast<const char*>(&VELOX_DELTA_VERSION), sizeof(uint16_t));
+    out.write(reinterpret_cast<const char*>(&dim),      sizeof(int));
+    out.write(reinterpret_cast<const char*>(&from_row), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&to_row),   sizeof(int));
+    std::vector<float> scratch(dim);
+    for (int row = from_row; row < to_row; row++)
+        out.write(reinterpret_cast<const char*>(storage_.float_vec(row, scratch.data())),
+                  dim * sizeof(float));
+    out.write(reinterpret_cast<const char*>(&from_id), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&num_ids), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(external_ids_.data() + from_id),
+              num_ids * sizeof(int64_t));
+    attributes_.save_delta(out);
+
+    bool indexed = algo_ && algo_->is_built();
+    uint8_t type_id = indexed ? type_id_for(algo_->type_name()) : kNoIndexDelta;
+    out.write(reinterpret_cast<const char*>(&type_id), sizeof(uint8_t));
+    if (indexed) algo_->save_delta(out);
+
+    out.close();
+    if (!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Failed to write " + path);
+    }
+    std::cout << "Checkpoint delta: " << to_row - from_row << " vectors to " << path << "\n";
+}
+
+void VectorIndex::mark_checkpoint_locked(const std::string& dir, int deltas) {
+    checkpoint_dir_ = dir;
+    checkpoint_rows_ = storage_.size();
+    checkpoint_ids_ = external_ids_.size();
+    checkpoint_deltas_ = deltas;
+    if (algo_ && algo_->is_built()) algo_->mark_checkpoint();
+    attributes_.mark_checkpoint();
+}
+
+bool VectorIndex::apply_delta_locked(const std::string& path, bool apply_index) {
+    VELOX_TRACE_SCOPE("open.delta");
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw std::runtime_error("Cannot open checkpoint file " + path);
+    uint32_t magic = 0;
+    uint16_t version = 0;
+    int dim = 0, from_row = 0, to_row = 0;
+    in.read(reinterpret_cast<char*>(&magic),    sizeof(uint32_t));
+    in.read(reinterpret_cast<char*>(&version),  sizeof(uint16_t));
+    in.read(reinterpret_cast<char*>(&dim),      sizeof(int));
+    in.read(reinterpret_cast<char*>(&from_row), sizeof(int));
+    in.read(reinterpret_cast<char*>(&to_row),   sizeof(int));
+    if (!in || magic != VELOX_DELTA_MAGIC)
+        throw std::runtime_error("Not a VeloxDB checkpoint delta: " + path);
+    if (version > VELOX_DELTA_VERSION)
+        throw std::runtime_error("Unsupported checkpoint delta version: " + std::to_string(version));
+    if (to_row <= storage_.size()) return false;
+    if (dim != storage_.dim() || from_row != storage_.size())
+        throw std::runtime_error("Checkpoint delta " + path + " does not follow the " +
+                                 std::to_string(storage_.size()) + " vectors before it.");
+
+    std::vector<float> row(dim);
+    for (int r = from_row; r < to_row; r++) {
+        in.read(reinterpret_cast<char*>(row.data()), dim * sizeof(float));
+        if (!in) throw std::runtime_error("Truncated checkpoint delta: " + path);
+        storage_.add_vector(row);
+    }
+
+    uint64_t from_id = 0, num_ids = 0;
+    in.read(reinterpret_cast<char*>(&from_id), sizeof(uint64_t));
+    in.read(reinterpret_cast<char*>(&num_ids), sizeof(uint64_t));
+    if (!in || (num_ids != 0 && (from_id != external_ids_.size() ||
+                                 from_id + num_ids != static_cast<uint64_t>(to_row))))
+        throw std::runtime_error("Checkpoint delta " + path + " has mismatched external ids.");
+    for (uint64_t i = 0; i < num_ids; i++) {
+        int64_t id;
+        in.read(reinterpret_cast<char*>(&id), sizeof(int64_t));
+        rows_by_id_.emplace(id, static_cast<int>(external_ids_.size()));
+        external_ids_.push_back(id);
     }
+    if (version >= 2) attributes_.load_delta(in);
+
+    uint8_t type_id = kNoIndexDelta;
+    in.read(reinterpret_cast<char*>(&type_id), sizeof(uint8_t));
+    if (!in) throw std::runtime_error("Truncated checkpoint delta: " + path);
+    bool indexed = algo_ && algo_->is_built();
+    if (apply_index && indexed) {
+        if (type_id != type_id_for(algo_->type_name()))
+            throw std::runtime_error("Checkpoint delta " + path + " is for a different index type.");
+        algo_->load_delta(in, storage_);
+    }
+    return true;
+}
+
+bool VectorIndex::consolidate_checkpoint(int min_deltas) {
+    auto lock = read_lock();
+    std::lock_guard guard(checkpoint_mutex_);
+    if (checkpoint_dir_.empty() || checkpoint_deltas_ < min_deltas) return false;
+    VELOX_TRACE_SCOPE("consolidate");
+    std::string dir = checkpoint_dir_;
+    write_base_locked(dir);
+    return true;
+}
+
+void VectorIndex::consolidate() {
+    if (!consolidate_checkpoint(0))
+        throw std::runtime_error("Nothing to consolidate: no checkpoint has been written or opened.");
+}
+
+void VectorIndex::start_consolidation(double interval_seconds, int min_deltas) {
+    if (interval_seconds <= 0)
+        throw std::runtime_error("Consolidation interval must be positive.");
+    stop_consolidation();
+    stop_consolidate_ = false;
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(interval_seconds));
+    min_deltas = std::max(1, min_deltas);
+    consolidate_thread_ = std::thread([this, period, min_deltas] {
+        std::unique_lock lock(consolidate_mutex_);
+        while (!consolidate_cv_.wait_for(lock, period, [this] { return stop_consolidate_; })) {
+            lock.unlock();
+            try {
+                consolidate_checkpoint(min_deltas);
+            } catch (const std::exception& e) {
+                std::cerr << "Background consolidation failed: " << e.what() << "\n";
+            }
+            lock.lock();
+        }
+    });
+}
+
+void VectorIndex::stop_consolidation() {
+    {
+        std::lock_guard lock(consolidate_mutex_);
+        stop_consolidate_ = true;
+    }
+    consolidate_cv_.notify_all();
+    if (consolidate_thread_.joinable()) consolidate_thread_.join();
+}
+
+int VectorIndex::size() const {
+    auto lock = read_lock();
+    return storage_.size();
+}
+
+ClusterStats VectorIndex::cluster_stats() const {
+    auto lock = read_lock();
+    if (!algo_ || !algo_->is_built())
+        throw std::runtime_error("No index built.");
+    return algo_->cluster_stats();
+}
+
+int VectorIndex::rebalance_index(float split_factor, float merge_factor, float drift_threshold) {
+    auto lock = write_lock();
+    if (!algo_ || !algo_->is_built())
+        throw std::runtime_error("No index built.");
+    IndexParams params;
+    params.use_simd = use_simd_;
+    params.split_factor = split_factor;
+    params.merge_factor = merge_factor;
+    params.drift_threshold = drift_threshold;
+    return algo_->rebalance(storage_, params);
+}
+
+void VectorIndex::merge(const VectorIndex& other, const std::string& metric) {
+    if (&other == this) throw std::runtime_error("Cannot merge an index into itself.");
+    auto locks = lock_with(other);
+    VELOX_TRACE_SCOPE("merge");
+
+    if (!algo_ || !algo_->is_built() || !other.algo_ || !other.algo_->is_built())
+        throw std::runtime_error("Both indexes must be built before merging.");
+    if (std::string(algo_->type_name()) != other.algo_->type_name())
+        throw std::runtime_error(std::string("Cannot merge a ") + other.algo_->type_name() +
+                                 " index into a " + algo_->type_name() + " index.");
+    if (storage_.dim() != other.storage_.dim())
+        throw std::runtime_error("Cannot merge indexes of different dimensions.");
+    if (algo_->size() != storage_.size() || other.algo_->size() != other.storage_.size())
+        throw std::runtime_error("Every vector must be indexed before merging; rebuild first.");
+    algo_->check_merge(*other.algo_);
+    if (external_ids_.empty() != other.external_ids_.empty())
+        throw std::runtime_error("Cannot merge an index with external ids and one without.");
+    for (int64_t id : other.external_ids_)
+        if (rows_by_id_.count(id))
+            throw std::runtime_error("Duplicate external id: " + std::to_string(id));
+    if (other.attributes_.num_columns() > 0 && !attributes_.same_schema(other.attributes_))
+        throw std::runtime_error("Cannot merge indexes with different attribute columns.");
+    int offset = storage_.size(), n_other = other.storage_.size();
+    if (n_other > VectorStorage::kMaxRows - offset)
+        throw std::runtime_error("Merged index would exceed " +
+                                 std::to_string(VectorStorage::kMaxRows) + " vectors.");
+
+    IndexParams params;
+    params.metric = metric;
+    params.use_simd = use_simd_;
+    params.memory_budget = build_headroom();
+    // Other's index structure and vectors (which arrive as floats, even
+    // from a mapped file), copied over about as they are.
+    MemoryUsage other_usage;
+    other.algo_->memory_usage(other_usage);
+    check_memory_budget(params, other_usage.heap_bytes() +
+                                std::max(other.storage_.heap_bytes(),
+                                         static_cast<size_t>(n_other) * storage_.dim() * sizeof(float)),
+                        "Merge");
+
+    // The algorithm merge reads other's rows from our storage, so they go in
+    // first; on failure they are dropped again so storage, ids and index
+    // stay in step (an index left half-merged is dropped too).
+    int dim = storage_.dim();
+    size_t ids_before = external_ids_.size();
+    try {
+        std::vector<float> row(dim);
+        for (int i = 0; i < n_other; i++) {
+            const float* v = other.storage_.float_vec(i, row.data());
+            storage_.add_vector(std::vector<float>(v, v + dim));
+        }
+        for (int i = 0; i < static_cast<int>(other.external_ids_.size()); i++) {
+            external_ids_.push_back(other.external_ids_[i]);
+            rows_by_id_[other.external_ids_[i]] = offset + i;
+        }
+        algo_->merge(storage_, *other.algo_, params);
+    } catch (...) {
+        storage_.truncate(offset);
+        for (size_t i = ids_before; i < external_ids_.size(); i++) rows_by_id_.erase(external_ids_[i]);
+        external_ids_.resize(ids_before);
+        if (algo_->size() != offset) {
+            algo_.reset();
+            algo_dim_ = 0;
+        }
+        throw;
+    }
+    if (other.attributes_.num_columns() > 0) attributes_.append(other.attributes_, offset);
+}
+
+GraphStats VectorIndex::graph_stats() const {
+    auto lock = read_lock();
+    if (!algo_ || !algo_->is_built())
+        throw std::runtime_error("No index built.");
+    return algo_->graph_stats();
+}
+
+MemoryUsage VectorIndex::memory_usage() const {
+    auto lock = read_lock();
+    MemoryUsage usage;
+    memory_usage_locked(usage);
+    return usage;
+}
+
+void VectorIndex::memory_usage_locked(MemoryUsage& usage) const {
+    storage_.memory_usage(usage);
+    if (algo_) algo_->memory_usage(usage);
+    attributes_.memory_usage(usage);
+    if (!external_ids_.empty()) {
+        // Vector plus hash map: a node (key, row, next pointer) per entry
+        // and a bucket pointer per bucket.
+        usage.add("external_ids",
+                  external_ids_.capacity() * sizeof(int64_t) +
+                  rows_by_id_.size() * (sizeof(std::pair<int64_t, int>) + sizeof(void*)) +
+                  rows_by_id_.bucket_count() * sizeof(void*));
+    }
+}
+
+void VectorIndex::set_memory_budget(size_t bytes) {
+    auto lock = write_lock();
+    memory_budget_ = bytes;
+}
+
+size_t VectorIndex::build_headroom() const {
+    if (memory_budget_ == 0) return std::numeric_limits<size_t>::max();
+    MemoryUsage usage;
+    memory_usage_locked(usage);
+    size_t held = usage.heap_bytes();
+    return memory_budget_ > held ? memory_budget_ - held : 0;
 }
 
 std::string VectorIndex::get_index_type() const {
-    std::shared_lock lock(rw_mutex_);
+    auto lock = read_lock();
     return algo_ ? algo_->type_name() : "none";
 }
@@ -6,17 +6,27 @@
 #include <random>
 #include <stdexcept>
 #include <iostream>
+#include <cstdint>
+#include "attribute_store.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
 
 // ---------------------------------------------------------------------------
 // build — K-Means IVF training.
 //
-// Pre-caches mmap-backed vectors into a flat buffer before training starts,
-// to avoid per-iteration page-fault + allocation overhead. In-memory storage
-// is already flat, so no copy is needed there.
+// Float data is read in place, whether in RAM or mmap'd: a mapped file is
+// streamed through the page cache once per epoch (map it with
+// MmapAdvice::Sequential or populate to make that cheap) rather than copied.
+// Storage that only holds compressed codes is decoded into a flat buffer —
+// unless that copy would break the memory budget, in which case each row
+// is decoded as it is visited (slower, but no copy).
 // ---------------------------------------------------------------------------
 void IVFIndex::build(const VectorStorage& storage, const IndexParams& params) {
+    VELOX_TRACE_SCOPE("ivf.build");
     int num_vectors = storage.size();
     dim_ = storage.dim();
+    kernels_ = &dist_kernels(dim_);
+    DistFn dist = select_dist(*kernels_, params.use_simd, params.metric == "cos");
     int num_clusters = params.num_clusters;
     int epochs = params.epochs;
 
@@ -24,22 +34,34 @@ void IVFIndex::build(const VectorStorage& storage, const IndexParams& params) {
         throw std::runtime_error("Not enough vectors to fill " +
                                  std::to_string(num_clusters) + " clusters.");
 
+    // Centroids (plus each epoch's accumulators and the running sums),
+    // shuffled indices, assignments and the lists themselves.
+    size_t n = static_cast<size_t>(num_vectors);
+    size_t need = static_cast<size_t>(num_clusters) * dim_ * (2 * sizeof(float) + sizeof(double)) +
+                  n * 3 * sizeof(int);
+    if (params.spill != "none") need += n * 2 * sizeof(int);
+    if (params.coarse_quantizer == "hnsw")
+        need += static_cast<size_t>(num_clusters) *
+                (dim_ * sizeof(float) + (2 * kQuantizerM + 2) * sizeof(int));
+    size_t copy = storage.has_float_data() ? 0 : n * dim_ * sizeof(float);
+    bool decode_rows = copy > 0 && need + copy > params.memory_budget;
+    check_memory_budget(params, decode_rows ? need : need + copy, "IVF build");
+
     std::cout << "Training IVF index: " << num_clusters
               << " clusters, " << epochs << " epochs.\n";
 
-    const float* raw_data;
-    std::vector<float> mmap_cache;
-
-    if (!storage.is_mmapped()) {
-        raw_data = storage.raw_vec_ptr(0);
-    } else {
-        mmap_cache.resize(static_cast<size_t>(num_vectors) * dim_);
-        for (int i = 0; i < num_vectors; i++) {
-            const float* src = storage.raw_vec_ptr(i);
-            std::copy(src, src + dim_, mmap_cache.data() + i * dim_);
-        }
-        raw_data = mmap_cache.data();
+    std::vector<float> decoded;
+    if (copy > 0 && !decode_rows) {
+        decoded.resize(n * dim_);
+        for (int i = 0; i < num_vectors; i++)
+            storage.float_vec(i, decoded.data() + static_cast<size_t>(i) * dim_);
     }
+    std::vector<float> scratch(dim_);
+    auto row = [&](int i) {
+        if (decode_rows) return storage.float_vec(i, scratch.data());
+        return decoded.empty() ? storage.raw_vec_ptr(i)
+                               : static_cast<const float*>(decoded.data() + static_cast<size_t>(i) * dim_);
+    };
 
     std::vector<int> indices(num_vectors);
     std::iota(indices.begin(), indices.end(), 0);
@@ -48,25 +70,27 @@ void IVFIndex::build(const VectorStorage& storage, const IndexParams& params) {
 
     centroids_.resize(num_clusters);
     for (int i = 0; i < num_clusters; i++) {
-        const float* src = raw_data + indices[i] * dim_;
+        const float* src = row(indices[i]);
         centroids_[i].assign(src, src + dim_);
     }
 
     std::vector<int> assignments(num_vectors);
+    metric_ = params.metric;
+    quantizer_ef_ = params.quantizer_ef;
+    bool graph = (params.coarse_quantizer == "hnsw");
+    if (!graph) quantizer_.reset();
 
     for (int it = 0; it < epochs; it++) {
+        VELOX_TRACE_SCOPE("ivf.kmeans_epoch");
         std::vector<float> new_centroids(num_clusters * dim_, 0.0f);
         std::vector<int> counts(num_clusters, 0);
+        // The assignment pass goes through a graph over this epoch's
+        // centroids instead of scoring all of them per vector.
+        if (graph) build_quantizer(params.use_simd);
 
         for (int i = 0; i < num_vectors; i++) {
-            const float* vec = raw_data + i * dim_;
-            float min_d = std::numeric_limits<float>::max();
-            int best_c = -1;
-
-            for (int c = 0; c < num_clusters; c++) {
-                float d = compute_dist(vec, centroids_[c].data(), dim_, params.use_simd, params.metric);
-                if (d < min_d) { min_d = d; best_c = c; }
-            }
+            const float* vec = row(i);
+            int best_c = graph ? assign(vec, params.use_simd) : nearest_centroid(vec, dist);
 
             assignments[i] = best_c;
             float* acc = new_centroids.data() + best_c * dim_;
@@ -90,46 +114,598 @@ void IVFIndex::build(const VectorStorage& storage, const IndexParams& params) {
     for (int i = 0; i < num_vectors; i++)
         inverted_lists_[assignments[i]].push_back(i);
 
+    if (graph) build_quantizer(params.use_simd);
+    spill_ = params.spill;
+    spill_ratio_ = params.spill_ratio;
+    assign_spills(storage, params.use_simd);
+    inserted_ = 0;
+    checkpoint_size_ = -1;
+    recompute_sums(storage);
+    packed_lists_.clear();
+    packed_ = false;
+    if (params.list_encoding == "packed") pack_lists();
     built_ = true;
     std::cout << "Indexing complete.\n";
 }
 
 // ---------------------------------------------------------------------------
-// search — score all centroids, probe the nprobe closest, top-k over their
-// inverted lists via a bounded max-heap.
+// build_from — skip training: take `trained`'s centroids and list settings
+// as they are and assign every vector to its nearest one. Partitions built
+// this way from one codebook have identical centroids, so merge() can
+// concatenate their lists.
 // ---------------------------------------------------------------------------
-std::vector<std::pair<int, float>> IVFIndex::search(
-    const VectorStorage& storage, const float* query, int k,
-    const IndexParams& params, bool use_simd) const
+void IVFIndex::build_from(const VectorStorage& storage, const IVFIndex& trained,
+                          const IndexParams& params)
 {
-    int dim = storage.dim();
-    std::vector<int> candidates;
+    VELOX_TRACE_SCOPE("ivf.build_from");
+    if (!trained.built_) throw std::runtime_error("The trained IVF index is not built.");
+    if (storage.dim() != trained.dim_)
+        throw std::runtime_error("Trained IVF index dimension mismatch.");
+    size_t num_clusters = trained.centroids_.size();
+    size_t need = num_clusters * trained.dim_ * (sizeof(float) + sizeof(double)) +
+                  static_cast<size_t>(storage.size()) * (trained.spill_ != "none" ? 3 : 1) * sizeof(int);
+    check_memory_budget(params, need, "IVF build");
+
+    dim_ = trained.dim_;
+    kernels_ = &dist_kernels(dim_);
+    centroids_ = trained.centroids_;
+    metric_ = trained.metric_;
+    quantizer_ef_ = trained.quantizer_ef_;
+    if (trained.quantizer_) build_quantizer(params.use_simd);
+    else quantizer_.reset();
+    spill_ = trained.spill_;
+    spill_ratio_ = trained.spill_ratio_;
+
+    inverted_lists_.assign(num_clusters, {});
+    packed_lists_.clear();
+    packed_ = false;
+    spill_ids_.assign(num_clusters, {});
+    spill_primary_.assign(num_clusters, {});
+    sums_.assign(num_clusters, std::vector<double>(dim_, 0.0));
+    for (int i = 0; i < storage.size(); i++) insert(storage, i, params.use_simd);
+    inserted_ = 0;
+    checkpoint_size_ = -1;
+    if (trained.packed_) pack_lists();
+    built_ = true;
+}
+
+int IVFIndex::nearest_centroid(const float* vec, DistFn dist) const {
+    float min_d = std::numeric_limits<float>::max();
+    int best_c = 0;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++) {
+        float d = dist(vec, centroids_[c].data(), dim_);
+        if (d < min_d) { min_d = d; best_c = c; }
+    }
+    return best_c;
+}
+
+int IVFIndex::assign(const float* vec, bool use_simd) const {
+    if (!quantizer_)
+        return nearest_centroid(vec, select_dist(*kernels_, use_simd, metric_ == "cos"));
+    IndexParams qp;
+    qp.metric = metric_;
+    qp.ef_search = quantizer_ef_;
+    auto hit = quantizer_->search(centroid_store_, vec, 1, qp, use_simd);
+    return hit.empty() ? 0 : hit.front().first;
+}
+
+void IVFIndex::build_quantizer(bool use_simd) {
+    centroid_store_.clear();
+    for (const auto& c : centroids_) centroid_store_.add_vector(c);
+    IndexParams qp;
+    qp.metric = metric_;
+    qp.use_simd = use_simd;
+    qp.M = kQuantizerM;
+    qp.ef_construction = kQuantizerEfConstruction;
+    if (!quantizer_) quantizer_ = std::make_unique<HNSWIndex>();
+    quantizer_->build(centroid_store_, qp);
+}
+
+// ---------------------------------------------------------------------------
+// pick_spill — "ratio" spills to the second-closest list when it is almost
+// as close as the primary. "soar" (Sun et al., 2023) spills every vector to
+// the candidate list c minimising d(x, c) + lambda * <r, x - c>^2 / |r|^2,
+// where r = x - primary centroid: it prefers lists whose residual points
+// away from r, i.e. the ones most likely to catch a query the primary
+// misses. SOAR scores only the kSpillCandidates nearest lists.
+// ---------------------------------------------------------------------------
+int IVFIndex::pick_spill(const float* vec, int primary, bool use_simd) const {
+    if (spill_ == "none" || centroids_.size() < 2) return -1;
+    auto cand = nearest_lists(vec, spill_ == "soar" ? kSpillCandidates + 1 : 2, use_simd, metric_);
+
+    if (spill_ == "ratio") {
+        DistFn dist = select_dist(*kernels_, use_simd, metric_ == "cos");
+        float d1 = dist(vec, centroids_[primary].data(), dim_);
+        for (const auto& [d, c] : cand)
+            if (c != primary) return d <= spill_ratio_ * d1 ? c : -1;
+        return -1;
+    }
+
+    const float* cp = centroids_[primary].data();
+    float rr = 0.0f;
+    for (int d = 0; d < dim_; d++) rr += (vec[d] - cp[d]) * (vec[d] - cp[d]);
+    int best = -1;
+    float best_score = std::numeric_limits<float>::max();
+    for (const auto& [dc, c] : cand) {
+        if (c == primary) continue;
+        const float* cc = centroids_[c].data();
+        float dot = 0.0f;
+        for (int d = 0; d < dim_; d++) dot += (vec[d] - cp[d]) * (vec[d] - cc[d]);
+        float score = dc + (rr > 0.0f ? kSoarLambda * dot * dot / rr : 0.0f);
+        if (score < best_score) { best_score = score; best = c; }
+    }
+    return best;
+}
+
+void IVFIndex::add_spill(int list, int id, int primary) {
+    spill_ids_[list].push_back(id);
+    spill_primary_[list].push_back(primary);
+}
+
+void IVFIndex::assign_spills(const VectorStorage& storage, bool use_simd) {
+    spill_ids_.assign(centroids_.size(), {});
+    spill_primary_.assign(centroids_.size(), {});
+    if (spill_ == "none") return;
+    std::vector<float> scratch(dim_);
+    std::vector<int> buf;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++) {
+        for (int vid : list_ids(c, buf)) {
+            int s = pick_spill(storage.float_vec(vid, scratch.data()), c, use_simd);
+            if (s >= 0) add_spill(s, vid, c);
+        }
+    }
+}
+
+void IVFIndex::accumulate(int c, const float* vec, double sign) {
+    auto& sum = sums_[c];
+    for (int d = 0; d < dim_; d++) sum[d] += sign * vec[d];
+}
+
+void IVFIndex::recompute_sums(const VectorStorage& storage) {
+    sums_.assign(centroids_.size(), std::vector<double>(dim_, 0.0));
+    std::vector<float> scratch(dim_);
+    std::vector<int> buf;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++)
+        for (int vid : list_ids(c, buf))
+            accumulate(c, storage.float_vec(vid, scratch.data()), 1.0);
+}
+
+const std::vector<int>& IVFIndex::list_ids(int c, std::vector<int>& buf) const {
+    if (!packed_) return inverted_lists_[c];
+    packed_lists_[c].decode(buf);
+    return buf;
+}
+
+size_t IVFIndex::list_size(int c) const {
+    return packed_ ? packed_lists_[c].size() : inverted_lists_[c].size();
+}
+
+void IVFIndex::pack_lists() {
+    packed_lists_.resize(inverted_lists_.size());
+    for (size_t c = 0; c < inverted_lists_.size(); c++)
+        packed_lists_[c].assign(std::move(inverted_lists_[c]));
+    inverted_lists_.clear();
+    inverted_lists_.shrink_to_fit();
+    packed_ = true;
+}
+
+void IVFIndex::unpack_lists() {
+    inverted_lists_.resize(packed_lists_.size());
+    for (size_t c = 0; c < packed_lists_.size(); c++)
+        packed_lists_[c].decode(inverted_lists_[c]);
+    packed_lists_.clear();
+    packed_ = false;
+}
+
+void IVFIndex::bind_storage(const VectorStorage& storage) {
+    recompute_sums(storage);
+}
+
+// ---------------------------------------------------------------------------
+// insert — place an appended vector in its nearest centroid's list (by the
+// metric the index was trained with) so it is searchable immediately. The
+// centroids themselves stay put; their drift is what cluster_stats reports.
+// ---------------------------------------------------------------------------
+bool IVFIndex::insert(const VectorStorage& storage, int id, bool use_simd) {
+    std::vector<float> scratch(dim_);
+    const float* vec = storage.float_vec(id, scratch.data());
+    int c = assign(vec, use_simd);
+    if (packed_) packed_lists_[c].push_back(id);
+    else         inverted_lists_[c].push_back(id);
+    accumulate(c, vec, 1.0);
+    int s = pick_spill(vec, c, use_simd);
+    if (s >= 0) add_spill(s, id, c);
+    inserted_++;
+    return true;
+}
+
+void IVFIndex::check_merge(const IndexAlgorithm& other_algo) const {
+    const auto* other = dynamic_cast<const IVFIndex*>(&other_algo);
+    if (!other || !other->built_)
+        throw std::runtime_error("Only a built IVF index can be merged into an IVF index.");
+    if (other->dim_ != dim_)
+        throw std::runtime_error("Cannot merge IVF indexes of different dimensions.");
+    if (other->metric_ != metric_)
+        throw std::runtime_error("Cannot merge IVF indexes trained with different metrics (" +
+                                 metric_ + " and " + other->metric_ + ").");
+}
+
+// ---------------------------------------------------------------------------
+// merge — with the same centroids, list c of the merged index is our list
+// c followed by other's list c (ids shifted by the rows we cover), and the
+// drift sums simply add. Spill entries carry over when both sides spill
+// the same way and are recomputed otherwise. With different centroids
+// there is nothing to line up, so other's vectors are inserted one by one
+// (nearest centroid, no k-means).
+// ---------------------------------------------------------------------------
+void IVFIndex::merge(const VectorStorage& storage, const IndexAlgorithm& other_algo,
+                     const IndexParams& params)
+{
+    VELOX_TRACE_SCOPE("ivf.merge");
+    check_merge(other_algo);
+    const auto& other = static_cast<const IVFIndex&>(other_algo);
+    int offset = size(), n_other = other.size();
+
+    if (other.centroids_ != centroids_) {
+        for (int i = 0; i < n_other; i++) insert(storage, offset + i, params.use_simd);
+        return;
+    }
+
+    bool same_spill = other.spill_ == spill_ && other.spill_ratio_ == spill_ratio_;
+    std::vector<float> scratch(dim_);
+    std::vector<int> buf;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++) {
+        for (int vid : other.list_ids(c, buf)) {
+            int id = offset + vid;
+            if (packed_) packed_lists_[c].push_back(id);
+            else         inverted_lists_[c].push_back(id);
+            if (!same_spill) {
+                int s = pick_spill(storage.float_vec(id, scratch.data()), c, params.use_simd);
+                if (s >= 0) add_spill(s, id, c);
+            }
+        }
+        if (same_spill) {
+            for (size_t i = 0; i < other.spill_ids_[c].size(); i++)
+                add_spill(c, offset + other.spill_ids_[c][i], other.spill_primary_[c][i]);
+        }
+        for (int d = 0; d < dim_; d++) sums_[c][d] += other.sums_[c][d];
+    }
+    inserted_ += other.inserted_;
+}
+
+ClusterStats IVFIndex::cluster_stats() const {
+    ClusterStats stats;
+    int num_lists = static_cast<int>(centroids_.size());
+    stats.num_lists = num_lists;
+    stats.num_vectors = size();
+    stats.inserted = inserted_;
+    for (const auto& ids : spill_ids_) stats.spilled += static_cast<int>(ids.size());
+    if (num_lists == 0) return stats;
+
+    DistFn dist = select_dist(*kernels_, true, metric_ == "cos");
+    std::vector<float> mean(dim_);
+    double sum_sq = 0.0;
+    stats.min_list = std::numeric_limits<int>::max();
+    for (int c = 0; c < num_lists; c++) {
+        int len = static_cast<int>(list_size(c));
+        stats.list_sizes.push_back(len);
+        stats.min_list = std::min(stats.min_list, len);
+        stats.max_list = std::max(stats.max_list, len);
+        sum_sq += static_cast<double>(len) * len;
+
+        float drift = 0.0f;
+        if (len > 0) {
+            for (int d = 0; d < dim_; d++) mean[d] = static_cast<float>(sums_[c][d] / len);
+            drift = dist(mean.data(), centroids_[c].data(), dim_);
+        }
+        stats.drift.push_back(drift);
+        stats.mean_drift += drift;
+        stats.max_drift = std::max(stats.max_drift, static_cast<double>(drift));
+    }
+    stats.mean_drift /= num_lists;
+    if (stats.num_vectors > 0)
+        stats.imbalance = num_lists * sum_sq /
+            (static_cast<double>(stats.num_vectors) * stats.num_vectors);
+    return stats;
+}
+
+bool IVFIndex::split_list(const VectorStorage& storage, int c, DistFn dist) {
+    std::vector<int> members = std::move(inverted_lists_[c]);
+    inverted_lists_[c].clear();
+    std::vector<float> scratch(dim_);
+    auto vec = [&](int vid) { return storage.float_vec(vid, scratch.data()); };
+
+    // Seed with the member farthest from the centroid and the member
+    // farthest from that one, then run a few Lloyd iterations.
+    auto farthest_from = [&](const float* ref) {
+        int best = members[0];
+        float best_d = -1.0f;
+        for (int vid : members) {
+            float d = dist(vec(vid), ref, dim_);
+            if (d > best_d) { best_d = d; best = vid; }
+        }
+        return std::make_pair(best, best_d);
+    };
+    int a = farthest_from(centroids_[c].data()).first;
+    std::vector<float> ca(vec(a), vec(a) + dim_);
+    auto [b, spread] = farthest_from(ca.data());
+    if (spread <= 0.0f) {
+        inverted_lists_[c] = std::move(members);
+        return false;
+    }
+    std::vector<float> cb(vec(b), vec(b) + dim_);
+
+    std::vector<char> side(members.size());
+    for (int it = 0; it < 5; it++) {
+        std::vector<double> sa(dim_, 0.0), sb(dim_, 0.0);
+        int na = 0, nb = 0;
+        for (size_t m = 0; m < members.size(); m++) {
+            const float* v = vec(members[m]);
+            side[m] = dist(v, cb.data(), dim_) < dist(v, ca.data(), dim_);
+            auto& s = side[m] ? sb : sa;
+            for (int d = 0; d < dim_; d++) s[d] += v[d];
+            (side[m] ? nb : na)++;
+        }
+        if (na == 0 || nb == 0) break;
+        for (int d = 0; d < dim_; d++) {
+            ca[d] = static_cast<float>(sa[d] / na);
+            cb[d] = static_cast<float>(sb[d] / nb);
+        }
+    }
+
+    size_t moved = std::count(side.begin(), side.end(), 1);
+    if (moved == 0 || moved == members.size()) {
+        inverted_lists_[c] = std::move(members);
+        return false;
+    }
+
+    int fresh = static_cast<int>(centroids_.size());
+    centroids_[c] = std::move(ca);
+    centroids_.push_back(std::move(cb));
+    inverted_lists_.emplace_back();
+    sums_[c].assign(dim_, 0.0);
+    sums_.emplace_back(dim_, 0.0);
+    for (size_t m = 0; m < members.size(); m++) {
+        int target = side[m] ? fresh : c;
+        inverted_lists_[target].push_back(members[m]);
+        accumulate(target, vec(members[m]), 1.0);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// rebalance — partial re-clustering. Overgrown lists are split with a local
+// 2-means, undersized lists are dissolved into their members' nearest
+// surviving centroids, and (when a drift threshold is given) centroids that
+// drifted past it move to their members' mean. Members are not reassigned
+// after such a move, so re-centering is opt-in. Lists that are none of
+// these are left untouched, so the cost scales with the damage rather than
+// the corpus. Packed lists are expanded for the duration and re-packed
+// afterwards.
+// ---------------------------------------------------------------------------
+int IVFIndex::rebalance(const VectorStorage& storage, const IndexParams& params) {
+    VELOX_TRACE_SCOPE("ivf.rebalance");
+    int num_lists = static_cast<int>(centroids_.size());
+    if (num_lists == 0) return 0;
+    DistFn dist = select_dist(*kernels_, params.use_simd, metric_ == "cos");
+    bool packed = packed_;
+    if (packed) unpack_lists();
+    double mean_len = static_cast<double>(size()) / num_lists;
+    int changed = 0;
+
+    // Merge: dissolve short lists, keeping at least one.
+    std::vector<char> dissolve(num_lists, 0);
+    int survivors = num_lists;
+    for (int c = 0; c < num_lists && survivors > 1; c++) {
+        if (inverted_lists_[c].size() < params.merge_factor * mean_len) {
+            dissolve[c] = 1;
+            survivors--;
+        }
+    }
+    std::vector<int> orphans;
+    std::vector<std::vector<float>> kept_centroids;
+    std::vector<std::vector<int>> kept_lists;
+    std::vector<std::vector<double>> kept_sums;
+    for (int c = 0; c < num_lists; c++) {
+        if (dissolve[c]) {
+            orphans.insert(orphans.end(), inverted_lists_[c].begin(), inverted_lists_[c].end());
+            changed++;
+            continue;
+        }
+        kept_centroids.push_back(std::move(centroids_[c]));
+        kept_lists.push_back(std::move(inverted_lists_[c]));
+        kept_sums.push_back(std::move(sums_[c]));
+    }
+    centroids_ = std::move(kept_centroids);
+    inverted_lists_ = std::move(kept_lists);
+    sums_ = std::move(kept_sums);
+    std::vector<float> scratch(dim_);
+    for (int vid : orphans) {
+        const float* v = storage.float_vec(vid, scratch.data());
+        int c = nearest_centroid(v, dist);
+        inverted_lists_[c].push_back(vid);
+        accumulate(c, v, 1.0);
+    }
+
+    // Split: overgrown lists (judged against the pre-merge mean).
+    int before_split = static_cast<int>(inverted_lists_.size());
+    for (int c = 0; c < before_split; c++)
+        if (inverted_lists_[c].size() > params.split_factor * mean_len &&
+            split_list(storage, c, dist))
+            changed++;
 
+    // Re-center drifted lists.
+    std::vector<float> mean(dim_);
+    if (params.drift_threshold > 0.0f) {
+        for (size_t c = 0; c < inverted_lists_.size(); c++) {
+            size_t len = inverted_lists_[c].size();
+            if (len == 0) continue;
+            for (int d = 0; d < dim_; d++) mean[d] = static_cast<float>(sums_[c][d] / len);
+            if (dist(mean.data(), centroids_[c].data(), dim_) > params.drift_threshold) {
+                centroids_[c] = mean;
+                changed++;
+            }
+        }
+    }
+
+    if (quantizer_) build_quantizer(params.use_simd);
+    assign_spills(storage, params.use_simd);
+    inserted_ = 0;
+    checkpoint_size_ = -1;
+    std::cout << "IVF rebalance: " << changed << " lists changed, "
+              << inverted_lists_.size() << " lists now.\n";
+    if (packed) pack_lists();
+    return changed;
+}
+
+void IVFIndex::memory_usage(MemoryUsage& usage) const {
+    size_t centroids = 0, sums = 0, lists = 0, spill = 0;
+    for (const auto& c : centroids_) centroids += c.capacity() * sizeof(float);
+    for (const auto& s : sums_) sums += s.capacity() * sizeof(double);
+    for (const auto& l : inverted_lists_) lists += l.capacity() * sizeof(int);
+    for (const auto& l : packed_lists_) lists += l.bytes();
+    for (size_t c = 0; c < spill_ids_.size(); c++)
+        spill += (spill_ids_[c].capacity() + spill_primary_[c].capacity()) * sizeof(int);
+    usage.add("ivf.centroids", centroids);
+    usage.add("ivf.sums", sums);
+    usage.add("ivf.lists", lists);
+    if (spill) usage.add("ivf.spill", spill);
+    if (quantizer_) {
+        MemoryUsage graph;
+        quantizer_->memory_usage(graph);
+        usage.add("ivf.quantizer", graph.heap_bytes() + centroid_store_.heap_bytes());
+    }
+}
+
+void IVFIndex::prefetch(const VectorStorage& storage, const float* query,
+                        const IndexParams& params, bool use_simd, bool lock) const
+{
+    std::vector<int> buf;
+    for (int list : probe_lists(query, params.nprobe, use_simd, params.metric)) {
+        const auto& ids = list_ids(list, buf);
+        storage.advise_rows(ids.data(), ids.size(), lock);
+        storage.advise_rows(spill_ids_[list].data(), spill_ids_[list].size(), lock);
+    }
+}
+
+int IVFIndex::size() const {
+    size_t total = 0;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++) total += list_size(c);
+    return static_cast<int>(total);
+}
+
+std::vector<std::pair<float, int>> IVFIndex::nearest_lists(
+    const float* vec, int m, bool use_simd, const std::string& metric) const
+{
     std::vector<std::pair<float, int>> cdists;
+    if (quantizer_) {
+        IndexParams qp;
+        qp.metric = metric;
+        qp.ef_search = std::max(quantizer_ef_, m);
+        for (const auto& [c, d] : quantizer_->search(centroid_store_, vec, m, qp, use_simd))
+            cdists.emplace_back(d, c);
+        return cdists;
+    }
+
+    DistFn dist = select_dist(*kernels_, use_simd, metric == "cos");
     cdists.reserve(centroids_.size());
     for (int c = 0; c < static_cast<int>(centroids_.size()); c++) {
-        float d = compute_dist(centroids_[c].data(), query, dim, use_simd, params.metric);
+        float d = dist(centroids_[c].data(), vec, dim_);
         cdists.emplace_back(d, c);
     }
 
-    int np = std::min(params.nprobe, static_cast<int>(centroids_.size()));
+    int np = std::min(m, static_cast<int>(centroids_.size()));
     std::partial_sort(cdists.begin(), cdists.begin() + np, cdists.end());
+    cdists.resize(np);
+    return cdists;
+}
+
+std::vector<int> IVFIndex::probe_lists(const float* query, int nprobe,
+                                       bool use_simd, const std::string& metric) const
+{
+    VELOX_TRACE_SCOPE("ivf.centroid_scoring");
+    std::vector<int> lists;
+    for (const auto& hit : nearest_lists(query, nprobe, use_simd, metric))
+        lists.push_back(hit.second);
+    return lists;
+}
+
+// ---------------------------------------------------------------------------
+// search — score all centroids, probe the nprobe closest, top-k over their
+// inverted lists via a bounded max-heap. With a shard pool, the probed lists
+// are spread across shards balanced by length (largest list to the lightest
+// shard) and the per-shard heaps are merged.
+// ---------------------------------------------------------------------------
+std::vector<std::pair<int, float>> IVFIndex::search(
+    const VectorStorage& storage, const float* query, int k,
+    const IndexParams& params, bool use_simd) const
+{
+    std::vector<int> lists = probe_lists(query, params.nprobe, use_simd, params.metric);
+    std::vector<int> probed = lists;
+    std::sort(probed.begin(), probed.end());
+
+    size_t total = 0;
+    for (int list : lists) total += list_size(list);
+    int shards = params.pool
+        ? std::min({params.num_shards, static_cast<int>(lists.size()),
+                    static_cast<int>(total / kMinShardVectors)})
+        : 1;
+    if (shards <= 1)
+        return scan_lists(storage, query, lists, probed, k, params, use_simd);
 
-    for (int i = 0; i < np; i++)
-        for (int vid : inverted_lists_[cdists[i].second])
-            candidates.push_back(vid);
+    std::sort(lists.begin(), lists.end(), [this](int a, int b) {
+        return list_size(a) > list_size(b);
+    });
+    std::vector<std::vector<int>> shard_lists(shards);
+    std::vector<size_t> shard_load(shards, 0);
+    for (int list : lists) {
+        int s = static_cast<int>(std::min_element(shard_load.begin(), shard_load.end()) - shard_load.begin());
+        shard_lists[s].push_back(list);
+        shard_load[s] += list_size(list);
+    }
 
+    std::vector<std::future<std::vector<std::pair<int, float>>>> pending;
+    pending.reserve(shards);
+    for (const auto& sl : shard_lists)
+        pending.push_back(params.pool->submit([&, sl] {
+            return scan_lists(storage, query, sl, probed, k, params, use_simd);
+        }));
+
+    std::vector<std::vector<std::pair<int, float>>> parts;
+    parts.reserve(shards);
+    for (auto& f : pending) parts.push_back(f.get());
+    VELOX_TRACE_SCOPE("ivf.heap_merge");
+    return merge_topk(parts, k);
+}
+
+std::vector<std::pair<int, float>> IVFIndex::scan_lists(
+    const VectorStorage& storage, const float* query, const std::vector<int>& lists,
+    const std::vector<int>& probed, int k, const IndexParams& params, bool use_simd) const
+{
+    VELOX_TRACE_SCOPE("ivf.list_scan");
+    QueryDistance dist_to(storage, query, use_simd, params.metric);
     using Entry = std::pair<float, int>;
     std::priority_queue<Entry> heap;
-
-    for (int vid : candidates) {
-        float d = compute_dist(storage.raw_vec_ptr(vid), query, dim, use_simd, params.metric);
+    const AttributeFilter* filter = params.filter;
+    auto offer = [&](int vid) {
+        if (filter != nullptr && !filter->matches(vid)) return;
+        float d = dist_to(vid);
         if (static_cast<int>(heap.size()) < k) {
             heap.emplace(d, vid);
         } else if (d < heap.top().first) {
             heap.pop();
             heap.emplace(d, vid);
         }
+    };
+
+    std::vector<int> buf;
+    for (int list : lists) {
+        for (int vid : list_ids(list, buf)) offer(vid);
+        // A spilled vector is scanned here only if its primary list is not.
+        const auto& ids = spill_ids_[list];
+        const auto& primaries = spill_primary_[list];
+        for (size_t i = 0; i < ids.size(); i++)
+            if (!std::binary_search(probed.begin(), probed.end(), primaries[i])) offer(ids[i]);
     }
 
     std::vector<std::pair<int, float>> results;
@@ -142,22 +718,161 @@ std::vector<std::pair<int, float>> IVFIndex::search(
     return results;
 }
 
+std::vector<std::vector<std::pair<int, float>>> IVFIndex::search_batch(
+    const VectorStorage& storage, const std::vector<const float*>& queries, int k,
+    const IndexParams& params, bool use_simd) const
+{
+    VELOX_TRACE_SCOPE("ivf.search_batch");
+    size_t nq = queries.size();
+    std::vector<std::vector<int>> probers(centroids_.size());  // list -> query ids
+    std::vector<std::vector<int>> probed(nq);                 // query -> sorted lists
+    std::vector<QueryDistance> dists;
+    dists.reserve(nq);
+    for (size_t q = 0; q < nq; q++) {
+        probed[q] = probe_lists(queries[q], params.nprobe, use_simd, params.metric);
+        for (int list : probed[q]) probers[list].push_back(static_cast<int>(q));
+        std::sort(probed[q].begin(), probed[q].end());
+        dists.emplace_back(storage, queries[q], use_simd, params.metric);
+    }
+
+    using Entry = std::pair<float, int>;
+    std::vector<std::priority_queue<Entry>> heaps(nq);
+
+    // Within each list, walk blocks of vectors so a block stays cache-hot
+    // while every query probing the list scores it.
+    constexpr size_t kBlock = 64;
+    std::vector<int> buf;
+    for (size_t list = 0; list < probers.size(); list++) {
+        if (probers[list].empty()) continue;
+        const auto& ids = list_ids(static_cast<int>(list), buf);
+        for (size_t b = 0; b < ids.size(); b += kBlock) {
+            size_t e = std::min(ids.size(), b + kBlock);
+            for (int q : probers[list]) {
+                auto& heap = heaps[q];
+                for (size_t i = b; i < e; i++) {
+                    float d = dists[q](ids[i]);
+                    if (static_cast<int>(heap.size()) < k) {
+                        heap.emplace(d, ids[i]);
+                    } else if (d < heap.top().first) {
+                        heap.pop();
+                        heap.emplace(d, ids[i]);
+                    }
+                }
+            }
+        }
+        const auto& spilled = spill_ids_[list];
+        const auto& primaries = spill_primary_[list];
+        for (int q : probers[list]) {
+            auto& heap = heaps[q];
+            for (size_t i = 0; i < spilled.size(); i++) {
+                if (std::binary_search(probed[q].begin(), probed[q].end(), primaries[i]))
+                    continue;
+                float d = dists[q](spilled[i]);
+                if (static_cast<int>(heap.size()) < k) {
+                    heap.emplace(d, spilled[i]);
+                } else if (d < heap.top().first) {
+                    heap.pop();
+                    heap.emplace(d, spilled[i]);
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<std::pair<int, float>>> out(nq);
+    for (size_t q = 0; q < nq; q++) {
+        auto& heap = heaps[q];
+        out[q].reserve(heap.size());
+        while (!heap.empty()) {
+            out[q].emplace_back(heap.top().second, heap.top().first);
+            heap.pop();
+        }
+        std::reverse(out[q].begin(), out[q].end());
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// range_search — same probing as search, but keeps every scanned vector
+// within the radius instead of maintaining a top-k heap.
+// ---------------------------------------------------------------------------
+std::vector<std::pair<int, float>> IVFIndex::range_search(
+    const VectorStorage& storage, const float* query, float radius,
+    const IndexParams& params, bool use_simd) const
+{
+    QueryDistance dist_to(storage, query, use_simd, params.metric);
+    std::vector<std::pair<int, float>> results;
+
+    std::vector<int> lists = probe_lists(query, params.nprobe, use_simd, params.metric);
+    std::vector<int> probed = lists;
+    std::sort(probed.begin(), probed.end());
+    std::vector<int> buf;
+    for (int list : lists) {
+        for (int vid : list_ids(list, buf)) {
+            float d = dist_to(vid);
+            if (d <= radius) results.emplace_back(vid, d);
+        }
+        const auto& spilled = spill_ids_[list];
+        for (size_t i = 0; i < spilled.size(); i++) {
+            if (std::binary_search(probed.begin(), probed.end(), spill_primary_[list][i]))
+                continue;
+            float d = dist_to(spilled[i]);
+            if (d <= radius) results.emplace_back(spilled[i], d);
+        }
+    }
+
+    std::sort(results.begin(), results.end(),
+              [](const auto& a, const auto& b) { return a.second < b.second; });
+    return results;
+}
+
 void IVFIndex::save(std::ofstream& out) const {
+    VELOX_TRACE_SCOPE("ivf.save");
     int num_clusters = static_cast<int>(centroids_.size());
     out.write(reinterpret_cast<const char*>(&num_clusters), sizeof(int));
 
     for (const auto& c : centroids_)
         out.write(reinterpret_cast<const char*>(c.data()), dim_ * sizeof(float));
 
-    for (const auto& lst : inverted_lists_) {
-        int sz = static_cast<int>(lst.size());
+    // Format v7: list encoding byte; packed lists are written as their blocks.
+    uint8_t packed = packed_;
+    out.write(reinterpret_cast<const char*>(&packed), sizeof(uint8_t));
+    if (packed_) {
+        for (const auto& lst : packed_lists_) lst.save(out);
+    } else {
+        for (const auto& lst : inverted_lists_) {
+            int sz = static_cast<int>(lst.size());
+            out.write(reinterpret_cast<const char*>(&sz), sizeof(int));
+            out.write(reinterpret_cast<const char*>(lst.data()), sz * sizeof(int));
+        }
+    }
+
+    uint8_t cosine = (metric_ == "cos");
+    out.write(reinterpret_cast<const char*>(&cosine), sizeof(uint8_t));
+
+    // Format v5: coarse quantizer graph, if any.
+    uint8_t graph = quantizer_ != nullptr;
+    out.write(reinterpret_cast<const char*>(&graph), sizeof(uint8_t));
+    if (graph) {
+        out.write(reinterpret_cast<const char*>(&quantizer_ef_), sizeof(int));
+        quantizer_->save(out);
+    }
+
+    // Format v6: spill mode and each list's secondary entries.
+    uint8_t mode = spill_ == "ratio" ? 1 : spill_ == "soar" ? 2 : 0;
+    out.write(reinterpret_cast<const char*>(&mode), sizeof(uint8_t));
+    out.write(reinterpret_cast<const char*>(&spill_ratio_), sizeof(float));
+    for (size_t i = 0; i < spill_ids_.size(); i++) {
+        int sz = static_cast<int>(spill_ids_[i].size());
         out.write(reinterpret_cast<const char*>(&sz), sizeof(int));
-        out.write(reinterpret_cast<const char*>(lst.data()), sz * sizeof(int));
+        out.write(reinterpret_cast<const char*>(spill_ids_[i].data()), sz * sizeof(int));
+        out.write(reinterpret_cast<const char*>(spill_primary_[i].data()), sz * sizeof(int));
     }
 }
 
-void IVFIndex::load(std::ifstream& in, int dim) {
+void IVFIndex::load(std::ifstream& in, int dim, int version) {
+    VELOX_TRACE_SCOPE("ivf.load");
     dim_ = dim;
+    kernels_ = &dist_kernels(dim_);
     int num_clusters;
     in.read(reinterpret_cast<char*>(&num_clusters), sizeof(int));
 
@@ -167,19 +882,71 @@ void IVFIndex::load(std::ifstream& in, int dim) {
         in.read(reinterpret_cast<char*>(centroids_[i].data()), dim_ * sizeof(float));
     }
 
-    inverted_lists_.resize(num_clusters);
-    for (int i = 0; i < num_clusters; i++) {
-        int sz;
-        in.read(reinterpret_cast<char*>(&sz), sizeof(int));
-        inverted_lists_[i].resize(sz);
-        in.read(reinterpret_cast<char*>(inverted_lists_[i].data()), sz * sizeof(int));
+    uint8_t packed = 0;
+    if (version >= 7) in.read(reinterpret_cast<char*>(&packed), sizeof(uint8_t));
+    packed_ = packed;
+    inverted_lists_.clear();
+    packed_lists_.clear();
+    if (packed_) {
+        packed_lists_.resize(num_clusters);
+        for (auto& lst : packed_lists_) lst.load(in);
+    } else {
+        inverted_lists_.resize(num_clusters);
+        for (int i = 0; i < num_clusters; i++) {
+            int sz;
+            in.read(reinterpret_cast<char*>(&sz), sizeof(int));
+            inverted_lists_[i].resize(sz);
+            in.read(reinterpret_cast<char*>(inverted_lists_[i].data()), sz * sizeof(int));
+        }
     }
 
+    // Format v4 records the training metric; older files were built by the
+    // facade's default.
+    metric_ = "eucl";
+    if (version >= 4) {
+        uint8_t cosine = 0;
+        in.read(reinterpret_cast<char*>(&cosine), sizeof(uint8_t));
+        metric_ = cosine ? "cos" : "eucl";
+    }
+    quantizer_.reset();
+    centroid_store_.clear();
+    if (version >= 5) {
+        uint8_t graph = 0;
+        in.read(reinterpret_cast<char*>(&graph), sizeof(uint8_t));
+        if (graph) {
+            in.read(reinterpret_cast<char*>(&quantizer_ef_), sizeof(int));
+            quantizer_ = std::make_unique<HNSWIndex>();
+            quantizer_->load(in, dim_, version);
+            for (const auto& c : centroids_) centroid_store_.add_vector(c);
+            if (quantizer_->size() != num_clusters)
+                throw std::runtime_error("Corrupt IVF coarse quantizer in index file.");
+        }
+    }
+    spill_ = "none";
+    spill_ids_.assign(num_clusters, {});
+    spill_primary_.assign(num_clusters, {});
+    if (version >= 6) {
+        uint8_t mode = 0;
+        in.read(reinterpret_cast<char*>(&mode), sizeof(uint8_t));
+        in.read(reinterpret_cast<char*>(&spill_ratio_), sizeof(float));
+        spill_ = mode == 1 ? "ratio" : mode == 2 ? "soar" : "none";
+        for (int i = 0; i < num_clusters; i++) {
+            int sz;
+            in.read(reinterpret_cast<char*>(&sz), sizeof(int));
+            spill_ids_[i].resize(sz);
+            spill_primary_[i].resize(sz);
+            in.read(reinterpret_cast<char*>(spill_ids_[i].data()), sz * sizeof(int));
+            in.read(reinterpret_cast<char*>(spill_primary_[i].data()), sz * sizeof(int));
+        }
+    }
+    inserted_ = 0;
+    checkpoint_size_ = -1;
     built_ = true;
 }
 
 void IVFIndex::load_legacy_v1(std::ifstream& in, int num_clusters, int dim) {
     dim_ = dim;
+    kernels_ = &dist_kernels(dim_);
 
     centroids_.resize(num_clusters);
     for (int i = 0; i < num_clusters; i++) {
@@ -195,5 +962,75 @@ void IVFIndex::load_legacy_v1(std::ifstream& in, int num_clusters, int dim) {
         in.read(reinterpret_cast<char*>(inverted_lists_[i].data()), sz * sizeof(int));
     }
 
+    metric_ = "eucl";
+    packed_ = false;
+    packed_lists_.clear();
+    spill_ = "none";
+    spill_ids_.assign(num_clusters, {});
+    spill_primary_.assign(num_clusters, {});
+    inserted_ = 0;
+    checkpoint_size_ = -1;
     built_ = true;
 }
+
+// ---------------------------------------------------------------------------
+// Delta — (list, id) for every primary entry whose id is past the marked
+// size, then (list, id, primary) for the matching spill entries. Entries
+// are only ever appended with new ids, so filtering on the id finds them
+// in raw and packed lists alike.
+// ---------------------------------------------------------------------------
+void IVFIndex::save_delta(std::ofstream& out) const {
+    VELOX_TRACE_SCOPE("ivf.save_delta");
+    std::vector<int> entries, spills, buf;
+    for (int c = 0; c < static_cast<int>(centroids_.size()); c++) {
+        for (int vid : list_ids(c, buf))
+            if (vid >= checkpoint_size_) entries.insert(entries.end(), {c, vid});
+        for (size_t i = 0; i < spill_ids_[c].size(); i++)
+            if (spill_ids_[c][i] >= checkpoint_size_)
+                spills.insert(spills.end(), {c, spill_ids_[c][i], spill_primary_[c][i]});
+    }
+    uint64_t num_entries = entries.size() / 2, num_spills = spills.size() / 3;
+    out.write(reinterpret_cast<const char*>(&num_entries), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(int));
+    out.write(reinterpret_cast<const char*>(&num_spills), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(spills.data()), spills.size() * sizeof(int));
+}
+
+void IVFIndex::load_delta(std::ifstream& in, const VectorStorage& storage) {
+    VELOX_TRACE_SCOPE("ivf.load_delta");
+    int num_lists = static_cast<int>(centroids_.size());
+    int first = size(), end = storage.size();
+    auto valid = [&](int list, int id) {
+        return list >= 0 && list < num_lists && id >= first && id < end;
+    };
+
+    uint64_t num_entries = 0;
+    in.read(reinterpret_cast<char*>(&num_entries), sizeof(uint64_t));
+    if (!in || num_entries > static_cast<uint64_t>(end - first))
+        throw std::runtime_error("Corrupt IVF delta in checkpoint file.");
+    std::vector<int> entries(num_entries * 2);
+    in.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(int));
+    uint64_t num_spills = 0;
+    in.read(reinterpret_cast<char*>(&num_spills), sizeof(uint64_t));
+    if (!in || num_spills > num_entries)
+        throw std::runtime_error("Corrupt IVF delta in checkpoint file.");
+    std::vector<int> spills(num_spills * 3);
+    in.read(reinterpret_cast<char*>(spills.data()), spills.size() * sizeof(int));
+    if (!in) throw std::runtime_error("Truncated IVF delta in checkpoint file.");
+    for (size_t i = 0; i < entries.size(); i += 2)
+        if (!valid(entries[i], entries[i + 1]))
+            throw std::runtime_error("Corrupt IVF delta in checkpoint file.");
+    for (size_t i = 0; i < spills.size(); i += 3)
+        if (!valid(spills[i], spills[i + 1]) || spills[i + 2] < 0 || spills[i + 2] >= num_lists)
+            throw std::runtime_error("Corrupt IVF delta in checkpoint file.");
+
+    std::vector<float> scratch(dim_);
+    for (size_t i = 0; i < entries.size(); i += 2) {
+        int c = entries[i], id = entries[i + 1];
+        if (packed_) packed_lists_[c].push_back(id);
+        else         inverted_lists_[c].push_back(id);
+        accumulate(c, storage.float_vec(id, scratch.data()), 1.0);
+    }
+    for (size_t i = 0; i < spills.size(); i += 3) add_spill(spills[i], spills[i + 1], spills[i + 2]);
+    inserted_ += static_cast<int>(num_entries);
+}
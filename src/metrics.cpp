@@ -1,6 +1,8 @@
 #include "metrics.hpp"
 #include <immintrin.h>
 #include <cmath>
+#include <cstring>
+#include <utility>
 
 float euclidean_dist(const float *a, const float *b, int n){
     float dist = 0.0f;
@@ -41,6 +43,109 @@ float euclidean_dist_simd(const float *a, const float *b, int n){
     return sum;
 }
 
+// ---------------------------------------------------------------------------
+// Dimension-specialised kernels — D is a compile-time multiple of 32, so the
+// loop has a constant trip count the compiler unrolls completely, with four
+// accumulators to keep several FMAs in flight.
+// ---------------------------------------------------------------------------
+static inline float hsum256(__m256 v){
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+template <int D>
+static float l2_fixed(const float *a, const float *b, int /*n*/){
+    static_assert(D % 32 == 0, "specialised dims must be multiples of 32");
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for(int i = 0; i < D; i += 32){
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i),      _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8),  _mm256_loadu_ps(b + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+        acc2 = _mm256_fmadd_ps(d2, d2, acc2);
+        acc3 = _mm256_fmadd_ps(d3, d3, acc3);
+    }
+    return hsum256(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+}
+
+template <int D>
+static float cosine_fixed(const float *a, const float *b, int /*n*/){
+    static_assert(D % 16 == 0, "specialised dims must be multiples of 16");
+    __m256 dot0 = _mm256_setzero_ps(), dot1 = _mm256_setzero_ps();
+    __m256 na0 = _mm256_setzero_ps(), na1 = _mm256_setzero_ps();
+    __m256 nb0 = _mm256_setzero_ps(), nb1 = _mm256_setzero_ps();
+    for(int i = 0; i < D; i += 16){
+        __m256 va0 = _mm256_loadu_ps(a + i), va1 = _mm256_loadu_ps(a + i + 8);
+        __m256 vb0 = _mm256_loadu_ps(b + i), vb1 = _mm256_loadu_ps(b + i + 8);
+        dot0 = _mm256_fmadd_ps(va0, vb0, dot0);
+        dot1 = _mm256_fmadd_ps(va1, vb1, dot1);
+        na0  = _mm256_fmadd_ps(va0, va0, na0);
+        na1  = _mm256_fmadd_ps(va1, va1, na1);
+        nb0  = _mm256_fmadd_ps(vb0, vb0, nb0);
+        nb1  = _mm256_fmadd_ps(vb1, vb1, nb1);
+    }
+    float sum_dot = hsum256(_mm256_add_ps(dot0, dot1));
+    float sum_a = hsum256(_mm256_add_ps(na0, na1));
+    float sum_b = hsum256(_mm256_add_ps(nb0, nb1));
+    if (sum_a == 0 || sum_b == 0) return 1.0f;
+    return 1 - (sum_dot / (std::sqrt(sum_a) * std::sqrt(sum_b)));
+}
+
+const DistKernels& dist_kernels(int dim){
+    static const DistKernels generic{euclidean_dist_simd, cosine_dist_simd, false};
+    static const std::pair<int, DistKernels> table[] = {
+        {128,  {l2_fixed<128>,  cosine_fixed<128>,  true}},
+        {256,  {l2_fixed<256>,  cosine_fixed<256>,  true}},
+        {384,  {l2_fixed<384>,  cosine_fixed<384>,  true}},
+        {512,  {l2_fixed<512>,  cosine_fixed<512>,  true}},
+        {768,  {l2_fixed<768>,  cosine_fixed<768>,  true}},
+        {1024, {l2_fixed<1024>, cosine_fixed<1024>, true}},
+        {1536, {l2_fixed<1536>, cosine_fixed<1536>, true}},
+    };
+    for(const auto& entry : table)
+        if(entry.first == dim) return entry.second;
+    return generic;
+}
+
+float l2_aligned_simd(const float *a, const float *b, int n){
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    for(int i = 0; i < n; i += 16){
+        __m256 d0 = _mm256_sub_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_load_ps(a + i + 8), _mm256_load_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+
+    float buffer[8];
+    _mm256_storeu_ps(buffer, _mm256_add_ps(acc0, acc1));
+    float sum = 0.0f;
+    for(int k = 0; k < 8; ++k) sum += buffer[k];
+    return sum;
+}
+
+float dot_aligned_simd(const float *a, const float *b, int n){
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    for(int i = 0; i < n; i += 16){
+        acc0 = _mm256_fmadd_ps(_mm256_load_ps(a + i), _mm256_load_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_load_ps(a + i + 8), _mm256_load_ps(b + i + 8), acc1);
+    }
+
+    float buffer[8];
+    _mm256_storeu_ps(buffer, _mm256_add_ps(acc0, acc1));
+    float sum = 0.0f;
+    for(int k = 0; k < 8; ++k) sum += buffer[k];
+    return sum;
+}
+
 float cosine_dist(const float *a, const float *b, int n){
     float dot = 0.0f, norm_a = 0.0f, norm_b = 0.0f;
 
@@ -93,4 +198,237 @@ float cosine_dist_simd(const float* a, const float *b, int n){
     if (sum_a == 0 || sum_b == 0) return 1.0f;
 
     return 1 - (sum_dot/(std::sqrt(sum_a) * std::sqrt(sum_b)));
-}
\ No newline at end of file
+}
+
+float half_to_float(uint16_t h){
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t bits;
+
+    if(exp == 0){
+        if(mant == 0){
+            bits = sign;
+        } else {
+            // Subnormal half: renormalise into a float exponent.
+            exp = 127 - 15 + 1;
+            while((mant & 0x400) == 0){ mant <<= 1; exp--; }
+            mant &= 0x3FF;
+            bits = sign | (exp << 23) | (mant << 13);
+        }
+    } else if(exp == 0x1F){
+        bits = sign | 0x7F800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+
+    float f;
+    std::memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+uint16_t float_to_half(float f){
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int32_t exp = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mant = bits & 0x7FFFFF;
+
+    if(((bits >> 23) & 0xFF) == 0xFF)
+        return sign | 0x7C00 | (mant ? 0x200 : 0);
+    if(exp >= 0x1F)
+        return sign | 0x7C00;
+    if(exp <= 0){
+        if(exp < -10) return sign;
+        mant |= 0x800000;
+        uint32_t shift = static_cast<uint32_t>(14 - exp);
+        uint32_t half_mant = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if(rem > halfway || (rem == halfway && (half_mant & 1))) half_mant++;
+        return sign | static_cast<uint16_t>(half_mant);
+    }
+
+    uint16_t h = sign | static_cast<uint16_t>(exp << 10) | static_cast<uint16_t>(mant >> 13);
+    uint32_t rem = mant & 0x1FFF;
+    if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return h;
+}
+
+float sq8_l2(const float *q_shift, const float *scale, const uint8_t *code, int n){
+    float dist = 0.0f;
+    for(int i = 0; i < n; i++){
+        float diff = q_shift[i] - code[i] * scale[i];
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+// Widens 8 codes at a time (u8 -> i32 -> f32) and decodes with one FMA, so
+// the query keeps full float precision (asymmetric distance).
+float sq8_l2_simd(const float *q_shift, const float *scale, const uint8_t *code, int n){
+    int i = 0;
+    __m256 sum_vec = _mm256_setzero_ps();
+
+    for(; i + 8 <= n; i += 8){
+        __m128i c8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code + i));
+        __m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c8));
+        __m256 diff = _mm256_fnmadd_ps(c, _mm256_loadu_ps(scale + i), _mm256_loadu_ps(q_shift + i));
+        sum_vec = _mm256_fmadd_ps(diff, diff, sum_vec);
+    }
+
+    float buffer[8];
+    _mm256_storeu_ps(buffer, sum_vec);
+    float sum = 0.0f;
+    for(int k = 0; k < 8; ++k) sum += buffer[k];
+
+    for(; i < n; i++){
+        float diff = q_shift[i] - code[i] * scale[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+float sq8_dot(const float *w, const uint8_t *code, int n){
+    float dot = 0.0f;
+    for(int i = 0; i < n; i++) dot += w[i] * code[i];
+    return dot;
+}
+
+float sq8_dot_simd(const float *w, const uint8_t *code, int n){
+    int i = 0;
+    __m256 dot_vec = _mm256_setzero_ps();
+
+    for(; i + 8 <= n; i += 8){
+        __m128i c8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code + i));
+        __m256 c = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(c8));
+        dot_vec = _mm256_fmadd_ps(c, _mm256_loadu_ps(w + i), dot_vec);
+    }
+
+    float buffer[8];
+    _mm256_storeu_ps(buffer, dot_vec);
+    float dot = 0.0f;
+    for(int k = 0; k < 8; ++k) dot += buffer[k];
+
+    for(; i < n; i++) dot += w[i] * code[i];
+    return dot;
+}
+
+float fp16_euclidean_dist(const float *q, const uint16_t *x, int n){
+    float dist = 0.0f;
+    for(int i = 0; i < n; i++){
+        float diff = q[i] - half_to_float(x[i]);
+        dist += diff * diff;
+    }
+    return dist;
+}
+
+// F16C widens 8 halves per instruction; the rest is the float kernel.
+float fp16_euclidean_dist_simd(const float *q, const uint16_t *x, int n){
+    int i = 0;
+    __m256 sum_vec = _mm256_setzero_ps();
+
+    for(; i + 8 <= n; i += 8){
+        __m256 vx = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+        __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(q + i), vx);
+        sum_vec = _mm256_fmadd_ps(diff, diff, sum_vec);
+    }
+
+    float buffer[8];
+    _mm256_storeu_ps(buffer, sum_vec);
+    float sum = 0.0f;
+    for(int k = 0; k < 8; ++k) sum += buffer[k];
+
+    for(; i < n; i++){
+        float diff = q[i] - half_to_float(x[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+float fp16_cosine_dist(const float *q, const uint16_t *x, int n){
+    float dot = 0.0f, norm_q = 0.0f, norm_x = 0.0f;
+    for(int i = 0; i < n; i++){
+        float xv = half_to_float(x[i]);
+        dot += q[i] * xv;
+        norm_q += q[i] * q[i];
+        norm_x += xv * xv;
+    }
+    if(norm_q == 0 || norm_x == 0) return 1.0f;
+    return 1 - (dot / (std::sqrt(norm_q) * std::sqrt(norm_x)));
+}
+
+float fp16_cosine_dist_simd(const float *q, const uint16_t *x, int n){
+    int i = 0;
+    __m256 dot_vec = _mm256_setzero_ps();
+    __m256 nq_vec = _mm256_setzero_ps();
+    __m256 nx_vec = _mm256_setzero_ps();
+
+    for(; i + 8 <= n; i += 8){
+        __m256 vq = _mm256_loadu_ps(q + i);
+        __m256 vx = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)));
+        dot_vec = _mm256_fmadd_ps(vq, vx, dot_vec);
+        nq_vec = _mm256_fmadd_ps(vq, vq, nq_vec);
+        nx_vec = _mm256_fmadd_ps(vx, vx, nx_vec);
+    }
+
+    float buf_dot[8], buf_q[8], buf_x[8];
+    _mm256_storeu_ps(buf_dot, dot_vec);
+    _mm256_storeu_ps(buf_q, nq_vec);
+    _mm256_storeu_ps(buf_x, nx_vec);
+    float sum_dot = 0.0f, sum_q = 0.0f, sum_x = 0.0f;
+    for(int k = 0; k < 8; k++){
+        sum_dot += buf_dot[k];
+        sum_q += buf_q[k];
+        sum_x += buf_x[k];
+    }
+
+    for(; i < n; i++){
+        float xv = half_to_float(x[i]);
+        sum_dot += q[i] * xv;
+        sum_q += q[i] * q[i];
+        sum_x += xv * xv;
+    }
+
+    if(sum_q == 0 || sum_x == 0) return 1.0f;
+    return 1 - (sum_dot / (std::sqrt(sum_q) * std::sqrt(sum_x)));
+}
+
+
+int hamming_dist(const uint64_t *a, const uint64_t *b, int words){
+    int dist = 0;
+    for(int i = 0; i < words; i++)
+        dist += static_cast<int>(_mm_popcnt_u64(a[i] ^ b[i]));
+    return dist;
+}
+
+int hamming_dist_simd(const uint64_t *a, const uint64_t *b, int words){
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+
+    int i = 0;
+    __m256i acc = _mm256_setzero_si256();
+
+    for(; i + 4 <= words; i += 4){
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i x = _mm256_xor_si256(va, vb);
+
+        __m256i lo = _mm256_and_si256(x, low_mask);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+        __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                      _mm256_shuffle_epi8(lookup, hi));
+        // Horizontal byte sums into four 64-bit lanes.
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    int dist = static_cast<int>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+
+    for(; i < words; i++)
+        dist += static_cast<int>(_mm_popcnt_u64(a[i] ^ b[i]));
+    return dist;
+}
@@ -0,0 +1,173 @@
+#include "packed_ids.hpp"
+#include <immintrin.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Block layout: int32 first id, uint8 gap width w, then the kBlock-1 gaps
+// packed LSB-first at w bits each, padded to a whole byte.
+static constexpr size_t kHeaderBytes = sizeof(int32_t) + sizeof(uint8_t);
+// Widest gap the AVX2 decoder handles: a 32-bit load at the gap's byte
+// offset must hold its up-to-7-bit shift plus w bits.
+static constexpr int kMaxSimdWidth = 25;
+
+size_t PackedIds::block_bytes(int width) {
+    return kHeaderBytes + (static_cast<size_t>(kBlock - 1) * width + 7) / 8;
+}
+
+void PackedIds::clear() {
+    data_.clear();
+    offsets_.clear();
+    tail_.clear();
+    size_ = 0;
+}
+
+void PackedIds::assign(std::vector<int> ids) {
+    clear();
+    std::sort(ids.begin(), ids.end());
+    size_t full = ids.size() / kBlock * kBlock;
+    for (size_t b = 0; b < full; b += kBlock) pack_block(ids.data() + b);
+    tail_.assign(ids.begin() + full, ids.end());
+    size_ = ids.size();
+}
+
+void PackedIds::push_back(int id) {
+    tail_.push_back(id);
+    size_++;
+    if (static_cast<int>(tail_.size()) == kBlock) {
+        pack_block(tail_.data());
+        tail_.clear();
+    }
+}
+
+void PackedIds::pack_block(int* ids) {
+    std::sort(ids, ids + kBlock);
+    uint32_t max_gap = 0;
+    for (int i = 1; i < kBlock; i++)
+        max_gap = std::max(max_gap, static_cast<uint32_t>(ids[i] - ids[i - 1]));
+    int width = max_gap ? 32 - __builtin_clz(max_gap) : 0;
+
+    size_t offset = data_.empty() ? 0 : data_.size() - kPad;
+    data_.resize(offset + block_bytes(width) + kPad, 0);
+    uint8_t* block = data_.data() + offset;
+    int32_t first = ids[0];
+    std::memcpy(block, &first, sizeof(first));
+    block[sizeof(first)] = static_cast<uint8_t>(width);
+
+    // OR each gap into the 64-bit word at its byte offset; the trailing pad
+    // keeps the last word in bounds.
+    uint8_t* bits = block + kHeaderBytes;
+    for (int i = 1; i < kBlock; i++) {
+        size_t bit = static_cast<size_t>(i - 1) * width;
+        uint64_t word;
+        std::memcpy(&word, bits + bit / 8, sizeof(word));
+        word |= static_cast<uint64_t>(ids[i] - ids[i - 1]) << (bit % 8);
+        std::memcpy(bits + bit / 8, &word, sizeof(word));
+    }
+    offsets_.push_back(offset);
+}
+
+// Inclusive prefix sum of eight int32 lanes.
+static inline __m256i prefix_sum8(__m256i x) {
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+    x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+    // Carry the low 128-bit lane's total into the high lane.
+    __m256i carry = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    carry = _mm256_permute2x128_si256(carry, carry, 0x08);
+    return _mm256_add_epi32(x, carry);
+}
+
+void PackedIds::unpack_block(size_t offset, int* out) const {
+    const uint8_t* block = data_.data() + offset;
+    int32_t first;
+    std::memcpy(&first, block, sizeof(first));
+    int width = block[sizeof(first)];
+    const uint8_t* bits = block + kHeaderBytes;
+    uint32_t mask = width == 32 ? ~0u : (1u << width) - 1;
+
+    out[0] = first;
+    int i = 0;  // gaps decoded so far; gap i yields out[i + 1]
+    if (width <= kMaxSimdWidth) {
+        // Eight gaps per step: gather the 32-bit word at each gap's byte
+        // offset, shift it into place and mask, then prefix-sum onto the
+        // last decoded id.
+        const __m256i lane_bits = _mm256_mullo_epi32(
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(width));
+        const __m256i vmask = _mm256_set1_epi32(static_cast<int>(mask));
+        const __m256i seven = _mm256_set1_epi32(7);
+        __m256i running = _mm256_set1_epi32(first);
+        for (; i + 8 <= kBlock - 1; i += 8) {
+            __m256i bit = _mm256_add_epi32(lane_bits, _mm256_set1_epi32(i * width));
+            __m256i words = _mm256_i32gather_epi32(reinterpret_cast<const int*>(bits),
+                                                   _mm256_srli_epi32(bit, 3), 1);
+            __m256i gaps = _mm256_and_si256(
+                _mm256_srlv_epi32(words, _mm256_and_si256(bit, seven)), vmask);
+            __m256i ids = _mm256_add_epi32(prefix_sum8(gaps), running);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 1), ids);
+            running = _mm256_permutevar8x32_epi32(ids, seven);
+        }
+    }
+    for (; i < kBlock - 1; i++) {
+        size_t bit = static_cast<size_t>(i) * width;
+        uint64_t word;
+        std::memcpy(&word, bits + bit / 8, sizeof(word));
+        out[i + 1] = out[i] + static_cast<int>((word >> (bit % 8)) & mask);
+    }
+}
+
+void PackedIds::decode(std::vector<int>& out) const {
+    out.resize(size_);
+    int* dst = out.data();
+    for (size_t offset : offsets_) {
+        unpack_block(offset, dst);
+        dst += kBlock;
+    }
+    std::copy(tail_.begin(), tail_.end(), dst);
+}
+
+size_t PackedIds::bytes() const {
+    return data_.capacity() + offsets_.capacity() * sizeof(size_t) +
+           tail_.capacity() * sizeof(int);
+}
+
+void PackedIds::save(std::ofstream& out) const {
+    uint64_t num_blocks = offsets_.size(), tail = tail_.size();
+    uint64_t data_bytes = data_.empty() ? 0 : data_.size() - kPad;
+    out.write(reinterpret_cast<const char*>(&num_blocks), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&tail), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(&data_bytes), sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(data_.data()), data_bytes);
+    out.write(reinterpret_cast<const char*>(tail_.data()), tail * sizeof(int));
+}
+
+void PackedIds::load(std::ifstream& in) {
+    clear();
+    uint64_t num_blocks = 0, tail = 0, data_bytes = 0;
+    in.read(reinterpret_cast<char*>(&num_blocks), sizeof(uint64_t));
+    in.read(reinterpret_cast<char*>(&tail), sizeof(uint64_t));
+    in.read(reinterpret_cast<char*>(&data_bytes), sizeof(uint64_t));
+    if (!in || tail >= static_cast<uint64_t>(kBlock) ||
+        data_bytes > num_blocks * block_bytes(32))
+        throw std::runtime_error("Corrupt packed inverted list in index file.");
+
+    if (data_bytes > 0) {
+        data_.assign(data_bytes + kPad, 0);
+        in.read(reinterpret_cast<char*>(data_.data()), data_bytes);
+    }
+    tail_.resize(tail);
+    in.read(reinterpret_cast<char*>(tail_.data()), tail * sizeof(int));
+
+    // Rebuild the block offsets by walking the headers.
+    size_t offset = 0;
+    for (uint64_t b = 0; b < num_blocks; b++) {
+        if (offset + kHeaderBytes > data_bytes)
+            throw std::runtime_error("Corrupt packed inverted list in index file.");
+        offsets_.push_back(offset);
+        int width = data_[offset + sizeof(int32_t)];
+        if (width > 32) throw std::runtime_error("Corrupt packed inverted list in index file.");
+        offset += block_bytes(width);
+    }
+    if (offset != data_bytes)
+        throw std::runtime_error("Corrupt packed inverted list in index file.");
+    size_ = num_blocks * kBlock + tail;
+}
@@ -0,0 +1,165 @@
+#include "quantizer.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+
+// ---------------------------------------------------------------------------
+// train — independent Lloyd's k-means in each subspace over a random sample.
+// Sub-quantizers are always trained in L2; cosine queries are served from
+// the same codebooks via dot-product tables.
+// ---------------------------------------------------------------------------
+void ProductQuantizer::train(const VectorStorage& storage, int m, int max_samples) {
+    int n = storage.size();
+    dim_ = storage.dim();
+    if (n == 0) throw std::runtime_error("Cannot train a product quantizer on empty storage.");
+
+    m_ = std::max(1, std::min(m, dim_));
+    ksub_ = std::min(256, n);
+
+    sub_offsets_.resize(m_ + 1);
+    for (int j = 0; j <= m_; j++)
+        sub_offsets_[j] = static_cast<int>(static_cast<long long>(j) * dim_ / m_);
+
+    std::vector<int> sample(n);
+    std::iota(sample.begin(), sample.end(), 0);
+    std::mt19937 rng(1234);
+    std::shuffle(sample.begin(), sample.end(), rng);
+    sample.resize(std::min(n, max_samples));
+    int ns = static_cast<int>(sample.size());
+
+    centroids_.assign(static_cast<size_t>(ksub_) * dim_, 0.0f);
+    std::vector<int> assign(ns);
+
+    for (int j = 0; j < m_; j++) {
+        int off = sub_offsets_[j];
+        int ds = sub_dim(j);
+        float* cent = centroids_.data() + static_cast<size_t>(ksub_) * off;
+
+        for (int c = 0; c < ksub_; c++) {
+            const float* src = storage.raw_vec_ptr(sample[c]) + off;
+            std::copy(src, src + ds, cent + static_cast<size_t>(c) * ds);
+        }
+
+        constexpr int kIters = 10;
+        for (int it = 0; it < kIters; it++) {
+            for (int s = 0; s < ns; s++) {
+                const float* v = storage.raw_vec_ptr(sample[s]) + off;
+                float best = std::numeric_limits<float>::max();
+                int best_c = 0;
+                for (int c = 0; c < ksub_; c++) {
+                    float d = euclidean_dist(v, cent + static_cast<size_t>(c) * ds, ds);
+                    if (d < best) { best = d; best_c = c; }
+                }
+                assign[s] = best_c;
+            }
+
+            std::vector<float> sums(static_cast<size_t>(ksub_) * ds, 0.0f);
+            std::vector<int> counts(ksub_, 0);
+            for (int s = 0; s < ns; s++) {
+                const float* v = storage.raw_vec_ptr(sample[s]) + off;
+                float* acc = sums.data() + static_cast<size_t>(assign[s]) * ds;
+                for (int d = 0; d < ds; d++) acc[d] += v[d];
+                counts[assign[s]]++;
+            }
+            for (int c = 0; c < ksub_; c++) {
+                float* dst = cent + static_cast<size_t>(c) * ds;
+                if (counts[c] == 0) {
+                    // Re-seed empty clusters from a random sample point.
+                    const float* src = storage.raw_vec_ptr(sample[rng() % ns]) + off;
+                    std::copy(src, src + ds, dst);
+                    continue;
+                }
+                float inv = 1.0f / counts[c];
+                const float* acc = sums.data() + static_cast<size_t>(c) * ds;
+                for (int d = 0; d < ds; d++) dst[d] = acc[d] * inv;
+            }
+        }
+    }
+
+    centroid_norms_.resize(static_cast<size_t>(m_) * ksub_);
+    for (int j = 0; j < m_; j++)
+        for (int c = 0; c < ksub_; c++) {
+            const float* cv = sub_centroid(j, c);
+            float s = 0.0f;
+            for (int d = 0; d < sub_dim(j); d++) s += cv[d] * cv[d];
+            centroid_norms_[static_cast<size_t>(j) * ksub_ + c] = s;
+        }
+}
+
+void ProductQuantizer::encode(const float* vec, uint8_t* code) const {
+    for (int j = 0; j < m_; j++) {
+        const float* v = vec + sub_offsets_[j];
+        float best = std::numeric_limits<float>::max();
+        int best_c = 0;
+        for (int c = 0; c < ksub_; c++) {
+            float d = euclidean_dist(v, sub_centroid(j, c), sub_dim(j));
+            if (d < best) { best = d; best_c = c; }
+        }
+        code[j] = static_cast<uint8_t>(best_c);
+    }
+}
+
+void ProductQuantizer::compute_tables(const float* query, const std::string& metric, Tables& t) const {
+    t.cosine = (metric == "cos");
+    t.table.resize(static_cast<size_t>(m_) * ksub_);
+    for (int j = 0; j < m_; j++) {
+        const float* q = query + sub_offsets_[j];
+        int ds = sub_dim(j);
+        for (int c = 0; c < ksub_; c++) {
+            const float* cv = sub_centroid(j, c);
+            float v = 0.0f;
+            if (t.cosine) {
+                for (int d = 0; d < ds; d++) v += q[d] * cv[d];
+            } else {
+                v = euclidean_dist(q, cv, ds);
+            }
+            t.table[static_cast<size_t>(j) * ksub_ + c] = v;
+        }
+    }
+    if (t.cosine) {
+        float s = 0.0f;
+        for (int d = 0; d < dim_; d++) s += query[d] * query[d];
+        t.query_norm = std::sqrt(s);
+    }
+}
+
+float ProductQuantizer::distance(const Tables& t, const uint8_t* code) const {
+    if (!t.cosine) {
+        float sum = 0.0f;
+        for (int j = 0; j < m_; j++) sum += t.table[static_cast<size_t>(j) * ksub_ + code[j]];
+        return sum;
+    }
+    float dot = 0.0f, norm = 0.0f;
+    for (int j = 0; j < m_; j++) {
+        size_t idx = static_cast<size_t>(j) * ksub_ + code[j];
+        dot += t.table[idx];
+        norm += centroid_norms_[idx];
+    }
+    if (norm == 0.0f || t.query_norm == 0.0f) return 1.0f;
+    return 1.0f - dot / (t.query_norm * std::sqrt(norm));
+}
+
+void ProductQuantizer::save(std::ofstream& out) const {
+    out.write(reinterpret_cast<const char*>(&dim_), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&m_), sizeof(int));
+    out.write(reinterpret_cast<const char*>(&ksub_), sizeof(int));
+    out.write(reinterpret_cast<const char*>(sub_offsets_.data()), sub_offsets_.size() * sizeof(int));
+    out.write(reinterpret_cast<const char*>(centroids_.data()), centroids_.size() * sizeof(float));
+    out.write(reinterpret_cast<const char*>(centroid_norms_.data()), centroid_norms_.size() * sizeof(float));
+}
+
+void ProductQuantizer::load(std::ifstream& in) {
+    in.read(reinterpret_cast<char*>(&dim_), sizeof(int));
+    in.read(reinterpret_cast<char*>(&m_), sizeof(int));
+    in.read(reinterpret_cast<char*>(&ksub_), sizeof(int));
+    sub_offsets_.resize(m_ + 1);
+    in.read(reinterpret_cast<char*>(sub_offsets_.data()), sub_offsets_.size() * sizeof(int));
+    centroids_.resize(static_cast<size_t>(ksub_) * dim_);
+    in.read(reinterpret_cast<char*>(centroids_.data()), centroids_.size() * sizeof(float));
+    centroid_norms_.resize(static_cast<size_t>(m_) * ksub_);
+    in.read(reinterpret_cast<char*>(centroid_norms_.data()), centroid_norms_.size() * sizeof(float));
+}
@@ -0,0 +1,79 @@
+#include "query_distance.hpp"
+#include "metrics.hpp"
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+QueryDistance::QueryDistance(const VectorStorage& storage, const float* query,
+                             bool use_simd, const std::string& metric)
+    : storage_(storage), query_(query), dim_(storage.dim()), use_simd_(use_simd),
+      cosine_(metric == "cos"), encoding_(storage.encoding())
+{
+    float_dist_ = select_dist(storage.kernels(), use_simd, cosine_);
+
+    if (encoding_ == StorageEncoding::Float32 && use_simd_ && storage.padded_dim() > 0) {
+        padded_dim_ = storage.padded_dim();
+        q_pad_.assign(padded_dim_ + 8, 0.0f);
+        float* p = q_pad_.data();
+        while (reinterpret_cast<uintptr_t>(p) % 32 != 0) p++;
+        std::copy(query, query + dim_, p);
+        q_aligned_ = p;
+        if (cosine_) {
+            float norm = 0.0f;
+            for (int d = 0; d < dim_; d++) norm += query[d] * query[d];
+            q_norm_ = std::sqrt(norm);
+        }
+        return;
+    }
+    if (encoding_ != StorageEncoding::SQ8) return;
+
+    const ScalarQuantizer& sq = storage.sq8_quantizer();
+    if (cosine_) {
+        q_scaled_.resize(dim_);
+        float norm = 0.0f;
+        for (int d = 0; d < dim_; d++) {
+            q_scaled_[d] = query[d] * sq.scale()[d];
+            q_bias_ += query[d] * sq.vmin()[d];
+            norm += query[d] * query[d];
+        }
+        q_norm_ = std::sqrt(norm);
+    } else {
+        q_shift_.resize(dim_);
+        for (int d = 0; d < dim_; d++) q_shift_[d] = query[d] - sq.vmin()[d];
+    }
+}
+
+float QueryDistance::operator()(int id) const {
+    switch (encoding_) {
+    case StorageEncoding::SQ8: {
+        const uint8_t* code = storage_.sq8_code(id);
+        if (!cosine_) {
+            const float* scale = storage_.sq8_quantizer().scale();
+            return use_simd_ ? sq8_l2_simd(q_shift_.data(), scale, code, dim_)
+                             : sq8_l2(q_shift_.data(), scale, code, dim_);
+        }
+        float norm_x = storage_.sq8_norm_sq(id);
+        if (q_norm_ == 0.0f || norm_x == 0.0f) return 1.0f;
+        float dot = q_bias_ + (use_simd_ ? sq8_dot_simd(q_scaled_.data(), code, dim_)
+                                         : sq8_dot(q_scaled_.data(), code, dim_));
+        return 1.0f - dot / (q_norm_ * std::sqrt(norm_x));
+    }
+    case StorageEncoding::FP16: {
+        const uint16_t* x = storage_.fp16_code(id);
+        if (cosine_)
+            return use_simd_ ? fp16_cosine_dist_simd(query_, x, dim_) : fp16_cosine_dist(query_, x, dim_);
+        return use_simd_ ? fp16_euclidean_dist_simd(query_, x, dim_) : fp16_euclidean_dist(query_, x, dim_);
+    }
+    default: {
+        const float* x = storage_.raw_vec_ptr(id);
+        if (q_aligned_) {
+            if (!cosine_) return l2_aligned_simd(x, q_aligned_, padded_dim_);
+            if (const float* norms = storage_.row_norms()) {
+                if (q_norm_ == 0.0f || norms[id] == 0.0f) return 1.0f;
+                return 1.0f - dot_aligned_simd(x, q_aligned_, padded_dim_) / (q_norm_ * norms[id]);
+            }
+        }
+        return float_dist_(x, query_, dim_);
+    }
+    }
+}
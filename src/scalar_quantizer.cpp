@@ -0,0 +1,38 @@
+#include "scalar_quantizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void ScalarQuantizer::reset(int dim) {
+    dim_ = dim;
+    vmin_.assign(dim, std::numeric_limits<float>::max());
+    vmax_.assign(dim, std::numeric_limits<float>::lowest());
+    scale_.assign(dim, 0.0f);
+}
+
+void ScalarQuantizer::update_range(const float* vec) {
+    for (int d = 0; d < dim_; d++) {
+        vmin_[d] = std::min(vmin_[d], vec[d]);
+        vmax_[d] = std::max(vmax_[d], vec[d]);
+    }
+}
+
+void ScalarQuantizer::finalize() {
+    for (int d = 0; d < dim_; d++) {
+        if (vmin_[d] > vmax_[d]) vmin_[d] = vmax_[d] = 0.0f;  // no data seen
+        scale_[d] = (vmax_[d] - vmin_[d]) / 255.0f;
+    }
+}
+
+void ScalarQuantizer::encode(const float* vec, uint8_t* code) const {
+    for (int d = 0; d < dim_; d++) {
+        if (scale_[d] == 0.0f) { code[d] = 0; continue; }
+        float q = std::round((vec[d] - vmin_[d]) / scale_[d]);
+        code[d] = static_cast<uint8_t>(std::clamp(q, 0.0f, 255.0f));
+    }
+}
+
+void ScalarQuantizer::decode(const uint8_t* code, float* out) const {
+    for (int d = 0; d < dim_; d++)
+        out[d] = vmin_[d] + code[d] * scale_[d];
+}
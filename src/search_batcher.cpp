@@ -0,0 +1,115 @@
+#include "search_batcher.hpp"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <tuple>
+
+SearchBatcher::SearchBatcher(VectorIndex& index, int max_batch, int max_wait_us, int num_workers)
+    : index_(index),
+      max_batch_(std::max(1, max_batch)),
+      max_wait_us_(std::max(0, max_wait_us))
+{
+    if (num_workers <= 0)
+        num_workers = std::max(1u, std::thread::hardware_concurrency());
+    workers_ = std::make_unique<ThreadPool>(num_workers);
+    dispatcher_ = std::thread([this] { dispatch_loop(); });
+}
+
+SearchBatcher::~SearchBatcher() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    dispatcher_.join();
+    workers_.reset();  // drains in-flight groups
+}
+
+std::future<SearchBatcher::Result> SearchBatcher::submit(
+    std::vector<float> query, int k, int nprobe, const std::string& metric, int ef_search)
+{
+    auto req = std::make_shared<Request>();
+    req->query = std::move(query);
+    req->k = k;
+    req->nprobe = nprobe;
+    req->metric = metric;
+    req->ef_search = ef_search;
+    std::future<Result> fut = req->promise.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        if (stop_) throw std::runtime_error("SearchBatcher is shutting down.");
+        queue_.push_back(std::move(req));
+    }
+    cv_.notify_one();
+    return fut;
+}
+
+SearchBatcher::Result SearchBatcher::search(
+    std::vector<float> query, int k, int nprobe, const std::string& metric, int ef_search)
+{
+    return submit(std::move(query), k, nprobe, metric, ef_search).get();
+}
+
+size_t SearchBatcher::batches_dispatched() const {
+    std::lock_guard<std::mutex> lock(mu_);
+    return batches_;
+}
+
+// ---------------------------------------------------------------------------
+// dispatch_loop — block until a request arrives, then keep collecting until
+// the batch is full or max_wait_us has passed since that first request.
+// ---------------------------------------------------------------------------
+void SearchBatcher::dispatch_loop() {
+    for (;;) {
+        std::vector<std::shared_ptr<Request>> batch;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_ && queue_.empty()) return;
+
+            auto deadline = std::chrono::steady_clock::now() +
+                            std::chrono::microseconds(max_wait_us_);
+            cv_.wait_until(lock, deadline, [this] {
+                return stop_ || static_cast<int>(queue_.size()) >= max_batch_;
+            });
+
+            int take = std::min(max_batch_, static_cast<int>(queue_.size()));
+            batch.assign(queue_.begin(), queue_.begin() + take);
+            queue_.erase(queue_.begin(), queue_.begin() + take);
+            batches_++;
+        }
+
+        // Only requests with identical search parameters can share a
+        // search_batch call.
+        std::map<std::tuple<int, int, std::string, int>, std::vector<std::shared_ptr<Request>>> groups;
+        for (auto& req : batch)
+            groups[{req->k, req->nprobe, req->metric, req->ef_search}].push_back(std::move(req));
+
+        for (auto& [key, group] : groups)
+            workers_->submit([this, g = std::move(group)]() mutable { run_group(std::move(g)); });
+    }
+}
+
+void SearchBatcher::run_group(std::vector<std::shared_ptr<Request>> group) {
+    const Request& first = *group.front();
+    std::vector<std::vector<float>> queries;
+    queries.reserve(group.size());
+    for (const auto& req : group) queries.push_back(req->query);
+
+    try {
+        auto results = index_.search_batch(queries, first.k, first.nprobe, first.metric, first.ef_search);
+        for (size_t i = 0; i < group.size(); i++)
+            group[i]->promise.set_value(std::move(results[i]));
+    } catch (...) {
+        // A bad query (e.g. wrong dim) fails the whole call; retry each
+        // request alone so only the offending ones see the exception.
+        for (auto& req : group) {
+            try {
+                req->promise.set_value(index_.search(req->query, req->k, req->nprobe,
+                                                     req->metric, req->ef_search));
+            } catch (...) {
+                req->promise.set_exception(std::current_exception());
+            }
+        }
+    }
+}
@@ -1,4 +1,6 @@
 #include "storage.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -6,41 +8,259 @@
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 VectorStorage::~VectorStorage() {
-    if (use_mmap_ && mmap_ptr_ != nullptr)
-        munmap(mmap_ptr_, mmap_size_);
+    unmap();  // also drops any mlock
 }
 
 const float* VectorStorage::raw_vec_ptr(int index) const {
     if (!use_mmap_)
-        return flat_database_.data() + index * dim_;
+        return flat_database_.data() + static_cast<size_t>(index) * dim_;
 
-    const char* base = static_cast<const char*>(mmap_ptr_);
-    size_t row_bytes = sizeof(int) + dim_ * sizeof(float);
-    return reinterpret_cast<const float*>(base + index * row_bytes + sizeof(int));
+    return reinterpret_cast<const float*>(static_cast<const char*>(mmap_ptr_) + row_offset(index));
+}
+
+// Row ids are ints (inverted lists and graphs store them as such), so a
+// file or buffer past kMaxRows is refused rather than silently wrapped.
+static std::runtime_error too_many_rows(const std::string& what, size_t rows) {
+    return std::runtime_error(what + " holds " + std::to_string(rows) +
+                              " vectors, more than the " +
+                              std::to_string(VectorStorage::kMaxRows) + " supported.");
 }
 
 std::vector<float> VectorStorage::get_vector(int index) const {
     if (index < 0 || index >= num_vectors_)
         throw std::out_of_range("Index out of bounds");
-    const float* p = raw_vec_ptr(index);
-    return std::vector<float>(p, p + dim_);
+    std::vector<float> out(dim_);
+    const float* p = float_vec(index, out.data());
+    if (p != out.data()) std::copy(p, p + dim_, out.begin());
+    return out;
+}
+
+const float* VectorStorage::float_vec(int index, float* scratch) const {
+    if (has_float_data()) return raw_vec_ptr(index);
+    if (encoding_ == StorageEncoding::SQ8) {
+        sq8_.decode(sq8_code(index), scratch);
+    } else {
+        const uint16_t* h = fp16_code(index);
+        for (int d = 0; d < dim_; d++) scratch[d] = half_to_float(h[d]);
+    }
+    return scratch;
 }
 
 void VectorStorage::add_vector(const std::vector<float>& vec) {
-    if (use_mmap_)
-        throw std::runtime_error("Cannot add vectors to a read-only mmap index.");
+    if (use_mmap_) {
+        if (static_cast<int>(vec.size()) != dim_)
+            throw std::runtime_error("Vector dimension mismatch.");
+        materialize();
+    }
     if (num_vectors_ == 0) {
-        dim_ = static_cast<int>(vec.size());
+        set_dim(static_cast<int>(vec.size()));
     } else if (static_cast<int>(vec.size()) != dim_) {
         throw std::runtime_error("Vector dimension mismatch.");
     }
-    flat_database_.insert(flat_database_.end(), vec.begin(), vec.end());
+    if (num_vectors_ == kMaxRows) throw too_many_rows("Storage", static_cast<size_t>(kMaxRows) + 1);
+    if (!float_dropped_)
+        flat_database_.insert(flat_database_.end(), vec.begin(), vec.end());
+    encode_row(vec.data());
+    if (has_binary_codes()) {
+        binary_codes_.resize(binary_codes_.size() + binary_words_);
+        encode_binary(vec.data(), binary_codes_.data() + binary_codes_.size() - binary_words_);
+    }
     num_vectors_++;
+    if (sq8_deferred_ && num_vectors_ >= kSq8TrainRows)
+        set_encoding(StorageEncoding::SQ8, keep_float_);
+}
+
+void VectorStorage::build_binary_codes() {
+    if (num_vectors_ == 0)
+        throw std::runtime_error("No vectors to build binary codes from.");
+
+    std::vector<double> mean(dim_, 0.0);
+    std::vector<float> scratch(dim_);
+    for (int i = 0; i < num_vectors_; i++) {
+        const float* v = float_vec(i, scratch.data());
+        for (int d = 0; d < dim_; d++) mean[d] += v[d];
+    }
+    binary_thresholds_.resize(dim_);
+    for (int d = 0; d < dim_; d++)
+        binary_thresholds_[d] = static_cast<float>(mean[d] / num_vectors_);
+
+    binary_words_ = (dim_ + 63) / 64;
+    binary_codes_.assign(static_cast<size_t>(num_vectors_) * binary_words_, 0);
+    for (int i = 0; i < num_vectors_; i++)
+        encode_binary(float_vec(i, scratch.data()),
+                      binary_codes_.data() + static_cast<size_t>(i) * binary_words_);
+}
+
+void VectorStorage::clear_binary_codes() {
+    binary_words_ = 0;
+    binary_thresholds_.clear();
+    binary_codes_.clear();
+    binary_codes_.shrink_to_fit();
+}
+
+void VectorStorage::encode_binary(const float* vec, uint64_t* out) const {
+    std::fill(out, out + binary_words_, 0);
+    for (int d = 0; d < dim_; d++)
+        if (vec[d] > binary_thresholds_[d])
+            out[d >> 6] |= uint64_t{1} << (d & 63);
+}
+
+void VectorStorage::encode_row(const float* vec) {
+    if (encoding_ == StorageEncoding::SQ8) {
+        size_t off = sq8_codes_.size();
+        sq8_codes_.resize(off + dim_);
+        uint8_t* code = sq8_codes_.data() + off;
+        sq8_.encode(vec, code);
+
+        // Norm of the decoded vector, computed straight from the code.
+        const float* vmin = sq8_.vmin();
+        const float* scale = sq8_.scale();
+        float norm = 0.0f;
+        for (int d = 0; d < dim_; d++) {
+            float v = vmin[d] + code[d] * scale[d];
+            norm += v * v;
+        }
+        sq8_norms_.push_back(norm);
+    } else if (encoding_ == StorageEncoding::FP16) {
+        for (int d = 0; d < dim_; d++) fp16_codes_.push_back(float_to_half(vec[d]));
+    }
+}
+
+void VectorStorage::set_encoding(StorageEncoding enc, bool keep_float) {
+    if (float_dropped_) {
+        // The codes were built from floats that are gone; keep them as is.
+        if (enc == encoding_) return;
+        throw std::runtime_error(
+            "Cannot re-encode storage after its float data was released.");
+    }
+    // Ranges trained on an empty (or nearly empty) storage would clamp
+    // every later vector: hold rows as float32 until kSq8TrainRows exist.
+    keep_float_ = keep_float;
+    sq8_deferred_ = enc == StorageEncoding::SQ8 && num_vectors_ == 0;
+    if (sq8_deferred_) enc = StorageEncoding::Float32;
+
+    encoding_ = enc;
+    sq8_codes_.clear();
+    sq8_norms_.clear();
+    fp16_codes_.clear();
+
+    if (enc == StorageEncoding::SQ8) {
+        sq8_.reset(dim_);
+        for (int i = 0; i < num_vectors_; i++) sq8_.update_range(raw_vec_ptr(i));
+        sq8_.finalize();
+        sq8_codes_.reserve(static_cast<size_t>(num_vectors_) * dim_);
+        sq8_norms_.reserve(num_vectors_);
+    } else if (enc == StorageEncoding::FP16) {
+        fp16_codes_.reserve(static_cast<size_t>(num_vectors_) * dim_);
+    }
+    for (int i = 0; i < num_vectors_; i++) encode_row(raw_vec_ptr(i));
+
+    if (!keep_float && enc != StorageEncoding::Float32 && !use_mmap_) {
+        flat_database_.clear();
+        flat_database_.shrink_to_fit();
+        float_dropped_ = true;
+    }
+}
+
+// Encodes rows that were just loaded in the selected encoding; the float
+// data is kept (a mapping is never dropped anyway).
+void VectorStorage::encode_loaded_rows() {
+    if (sq8_deferred_)
+        set_encoding(StorageEncoding::SQ8);
+    else if (encoding_ != StorageEncoding::Float32)
+        set_encoding(encoding_);
+}
+
+size_t VectorStorage::heap_bytes() const {
+    return flat_database_.capacity() * sizeof(float) + sq8_codes_.capacity() +
+           sq8_norms_.capacity() * sizeof(float) + fp16_codes_.capacity() * sizeof(uint16_t) +
+           binary_codes_.capacity() * sizeof(uint64_t) +
+           binary_thresholds_.capacity() * sizeof(float);
+}
+
+void VectorStorage::memory_usage(MemoryUsage& usage, const std::string& prefix) const {
+    usage.add(prefix + ".float", flat_database_.capacity() * sizeof(float));
+    if (!sq8_codes_.empty())
+        usage.add(prefix + ".sq8", sq8_codes_.capacity() + sq8_norms_.capacity() * sizeof(float));
+    if (!fp16_codes_.empty())
+        usage.add(prefix + ".fp16", fp16_codes_.capacity() * sizeof(uint16_t));
+    if (has_binary_codes())
+        usage.add(prefix + ".binary", binary_codes_.capacity() * sizeof(uint64_t) +
+                                      binary_thresholds_.capacity() * sizeof(float));
+    if (!use_mmap_) return;
+
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<unsigned char> resident((mmap_size_ + page - 1) / page);
+    usage.mapped_bytes += mmap_size_;
+    if (mincore(mmap_ptr_, mmap_size_, resident.data()) == 0) {
+        size_t pages = 0;
+        for (unsigned char r : resident) pages += r & 1;
+        usage.resident_bytes += std::min(mmap_size_, pages * page);
+    }
+}
+
+// Copies the mmap'd rows into flat_database_ and releases the mapping.
+void VectorStorage::materialize() {
+    flat_database_.resize(static_cast<size_t>(num_vectors_) * dim_);
+    for (int i = 0; i < num_vectors_; i++)
+        std::copy(raw_vec_ptr(i), raw_vec_ptr(i) + dim_,
+                  flat_database_.data() + static_cast<size_t>(i) * dim_);
+    unmap();
+}
+
+void VectorStorage::truncate(int rows) {
+    if (rows >= num_vectors_) return;
+    if (use_mmap_) materialize();
+    size_t n = static_cast<size_t>(rows);
+    if (!float_dropped_) flat_database_.resize(n * dim_);
+    if (encoding_ == StorageEncoding::SQ8) {
+        sq8_codes_.resize(n * dim_);
+        sq8_norms_.resize(n);
+    } else if (encoding_ == StorageEncoding::FP16) {
+        fp16_codes_.resize(n * dim_);
+    }
+    if (has_binary_codes()) binary_codes_.resize(n * binary_words_);
+    num_vectors_ = rows;
+}
+
+void VectorStorage::clear() {
+    unmap();
+    if (encoding_ == StorageEncoding::SQ8) {
+        encoding_ = StorageEncoding::Float32;
+        sq8_deferred_ = true;
+    }
+    float_dropped_ = false;
+    flat_database_ = {};
+    sq8_codes_ = {};
+    sq8_norms_ = {};
+    fp16_codes_ = {};
+    clear_binary_codes();
+    set_dim(0);
+    num_vectors_ = 0;
 }
 
-void VectorStorage::load_fvecs(const std::string& filename) {
+void VectorStorage::prefault(int begin, int end) const {
+    if (!use_mmap_ || begin >= end) return;
+
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const char* base = static_cast<const char*>(mmap_ptr_);
+    size_t first = row_offset(begin) & ~(page - 1);
+    size_t last = row_offset(end - 1) + static_cast<size_t>(dim_) * sizeof(float);
+
+    madvise(const_cast<char*>(base) + first, last - first, MADV_WILLNEED);
+    volatile char sink = 0;
+    for (size_t off = first; off < last; off += page) sink = sink + base[off];
+    (void)sink;
+}
+
+// Maps `filename` read-only and applies the MmapOptions hints. Format
+// parsing is left to the caller, which must unmap() on rejection.
+void VectorStorage::map_file(const std::string& filename, const MmapOptions& opts) {
     int fd = open(filename.c_str(), O_RDONLY);
     if (fd == -1)
         throw std::runtime_error("Could not open file: " + filename);
@@ -51,37 +271,201 @@ void VectorStorage::load_fvecs(const std::string& filename) {
         throw std::runtime_error("Could not stat file: " + filename);
     }
 
+    int flags = MAP_PRIVATE | (opts.populate ? MAP_POPULATE : 0);
     mmap_size_ = sb.st_size;
-    mmap_ptr_ = mmap(nullptr, mmap_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    mmap_ptr_ = mmap(nullptr, mmap_size_, PROT_READ, flags, fd, 0);
     close(fd);
 
-    if (mmap_ptr_ == MAP_FAILED)
+    if (mmap_ptr_ == MAP_FAILED) {
+        mmap_ptr_ = nullptr;
         throw std::runtime_error("mmap failed.");
+    }
+
+    // Hints are best-effort: an unsupported one leaves the mapping usable.
+#ifdef MADV_HUGEPAGE
+    if (opts.huge_pages) madvise(mmap_ptr_, mmap_size_, MADV_HUGEPAGE);
+#endif
+    switch (opts.advice) {
+        case MmapAdvice::Random:     madvise(mmap_ptr_, mmap_size_, MADV_RANDOM);     break;
+        case MmapAdvice::Sequential: madvise(mmap_ptr_, mmap_size_, MADV_SEQUENTIAL); break;
+        case MmapAdvice::WillNeed:   madvise(mmap_ptr_, mmap_size_, MADV_WILLNEED);   break;
+        case MmapAdvice::Normal:     break;
+    }
+    if (opts.lock) {
+        if (mlock(mmap_ptr_, mmap_size_) != 0)
+            std::cout << "[VeloxDB] mlock of " << mmap_size_
+                      << " bytes failed (RLIMIT_MEMLOCK?); continuing unlocked.\n";
+    }
+}
+
+void VectorStorage::unmap() {
+    if (mmap_ptr_ != nullptr) munmap(mmap_ptr_, mmap_size_);
+    mmap_ptr_ = nullptr;
+    mmap_size_ = 0;
+    mmap_data_offset_ = 0;
+    mmap_row_bytes_ = 0;
+    mmap_norms_ = nullptr;
+    padded_dim_ = 0;
+    use_mmap_ = false;
+}
+
+void VectorStorage::load_fvecs(const std::string& filename, const MmapOptions& opts) {
+    VELOX_TRACE_SCOPE("storage.load_fvecs");
+    clear();
+    map_file(filename, opts);
 
     const int* header = static_cast<const int*>(mmap_ptr_);
-    dim_ = header[0];
-    size_t row_bytes = sizeof(int) + dim_ * sizeof(float);
+    int dim = mmap_size_ >= sizeof(int) ? header[0] : 0;
+    size_t row_bytes = sizeof(int) + static_cast<size_t>(dim) * sizeof(float);
+    if (dim <= 0 || mmap_size_ % row_bytes != 0) {
+        unmap();
+        throw std::runtime_error("Not a valid .fvecs file (bad dim or truncated): " + filename);
+    }
+    if (mmap_size_ / row_bytes > static_cast<size_t>(kMaxRows)) {
+        unmap();
+        throw too_many_rows(filename, mmap_size_ / row_bytes);
+    }
+    set_dim(dim);
     num_vectors_ = static_cast<int>(mmap_size_ / row_bytes);
+    mmap_data_offset_ = sizeof(int);  // skip row 0's dim header
+    mmap_row_bytes_ = row_bytes;
     use_mmap_ = true;
+    encode_loaded_rows();
 
     std::cout << "[VeloxDB] Loaded " << num_vectors_
               << " vectors (dim=" << dim_ << ") via mmap.\n";
 }
 
+void VectorStorage::load_vxv(const std::string& filename, const MmapOptions& opts) {
+    VELOX_TRACE_SCOPE("storage.load_vxv");
+    clear();
+    map_file(filename, opts);
+
+    VxvHeader h{};
+    if (mmap_size_ >= sizeof(h)) std::memcpy(&h, mmap_ptr_, sizeof(h));
+    size_t row_bytes = static_cast<size_t>(h.padded_dim) * sizeof(float);
+    size_t data_end = h.data_offset + h.num_vectors * row_bytes;
+    bool ok = h.magic == VXV_MAGIC && h.version == VXV_VERSION && h.dim > 0 &&
+              h.padded_dim == static_cast<uint32_t>(vxv_padded_dim(h.dim)) &&
+              h.data_offset % 64 == 0 && data_end <= mmap_size_ &&
+              (h.norms_offset == 0 ||
+               h.norms_offset + h.num_vectors * sizeof(float) <= mmap_size_);
+    if (!ok) {
+        unmap();
+        throw std::runtime_error("Not a valid .vxv file (bad header or truncated): " + filename);
+    }
+    if (h.num_vectors > static_cast<uint64_t>(kMaxRows)) {
+        unmap();
+        throw too_many_rows(filename, h.num_vectors);
+    }
+
+    const char* base = static_cast<const char*>(mmap_ptr_);
+    set_dim(static_cast<int>(h.dim));
+    padded_dim_ = static_cast<int>(h.padded_dim);
+    num_vectors_ = static_cast<int>(h.num_vectors);
+    mmap_data_offset_ = h.data_offset;
+    mmap_row_bytes_ = row_bytes;
+    mmap_norms_ = h.norms_offset ? reinterpret_cast<const float*>(base + h.norms_offset) : nullptr;
+    use_mmap_ = true;
+    encode_loaded_rows();
+
+    std::cout << "[VeloxDB] Loaded " << num_vectors_ << " vectors (dim=" << dim_
+              << ", aligned rows of " << padded_dim_ << ") via mmap.\n";
+}
+
+void VectorStorage::advise_rows(const int* ids, size_t n, bool lock) const {
+    if (!use_mmap_ || n == 0) return;
+
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    std::vector<size_t> pages;
+    pages.reserve(n * 2);
+    for (size_t i = 0; i < n; i++) {
+        size_t first = row_offset(ids[i]);
+        size_t last = first + static_cast<size_t>(dim_) * sizeof(float) - 1;
+        for (size_t p = first / page; p <= last / page; p++) pages.push_back(p);
+    }
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    char* base = static_cast<char*>(mmap_ptr_);
+    for (size_t i = 0; i < pages.size();) {
+        size_t j = i + 1;
+        while (j < pages.size() && pages[j] == pages[j - 1] + 1) j++;
+        char* start = base + pages[i] * page;
+        size_t len = std::min((pages[j - 1] + 1) * page, mmap_size_) - pages[i] * page;
+        if (lock) mlock(start, len);
+        else      madvise(start, len, MADV_WILLNEED);
+        i = j;
+    }
+}
+
+void VectorStorage::read_fvecs(const std::string& filename) {
+    VELOX_TRACE_SCOPE("storage.read_fvecs");
+    if (use_mmap_ || num_vectors_ > 0)
+        throw std::runtime_error("read_fvecs needs empty storage.");
+
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    if (!in) throw std::runtime_error("Could not open file: " + filename);
+    size_t file_size = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+
+    int dim = 0;
+    if (file_size >= sizeof(int)) in.read(reinterpret_cast<char*>(&dim), sizeof(int));
+    size_t row_bytes = sizeof(int) + static_cast<size_t>(dim) * sizeof(float);
+    if (dim <= 0 || file_size % row_bytes != 0)
+        throw std::runtime_error("Not a valid .fvecs file (bad dim or truncated): " + filename);
+    in.seekg(0);
+
+    size_t rows = file_size / row_bytes;
+    if (rows > static_cast<size_t>(kMaxRows)) throw too_many_rows(filename, rows);
+    set_dim(dim);
+    flat_database_.resize(rows * dim_);
+
+    // Large sequential reads, then strip the per-row dim headers in place.
+    constexpr size_t kChunkRows = 8192;
+    std::vector<char> buf(kChunkRows * row_bytes);
+    for (size_t r = 0; r < rows; r += kChunkRows) {
+        size_t n = std::min(kChunkRows, rows - r);
+        in.read(buf.data(), n * row_bytes);
+        if (!in) throw std::runtime_error("Short read from " + filename);
+        for (size_t i = 0; i < n; i++) {
+            const char* row = buf.data() + i * row_bytes;
+            int row_dim;
+            std::copy(row, row + sizeof(int), reinterpret_cast<char*>(&row_dim));
+            if (row_dim != dim_) {
+                clear();
+                throw std::runtime_error("Inconsistent row dims in " + filename);
+            }
+            std::copy(row + sizeof(int), row + row_bytes,
+                      reinterpret_cast<char*>(flat_database_.data() + (r + i) * dim_));
+        }
+    }
+    num_vectors_ = static_cast<int>(rows);
+
+    encode_loaded_rows();
+    std::cout << "[VeloxDB] Read " << num_vectors_
+              << " vectors (dim=" << dim_ << ") into memory.\n";
+}
+
 void VectorStorage::write_fvecs(const std::string& filename) const {
-    if (use_mmap_)
-        throw std::runtime_error("Already using mmap; cannot export in-memory data.");
+    VELOX_TRACE_SCOPE("storage.write_fvecs");
     if (num_vectors_ == 0)
         throw std::runtime_error("No data to write.");
 
-    std::ofstream out(filename, std::ios::binary);
+    std::string tmp = filename + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
     if (!out) throw std::runtime_error("Cannot open output file.");
 
+    std::vector<float> scratch(dim_);
     for (int i = 0; i < num_vectors_; i++) {
         out.write(reinterpret_cast<const char*>(&dim_), sizeof(int));
-        out.write(reinterpret_cast<const char*>(flat_database_.data() + i * dim_),
+        out.write(reinterpret_cast<const char*>(float_vec(i, scratch.data())),
                   dim_ * sizeof(float));
     }
     out.close();
+    if (!out || std::rename(tmp.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Failed to write " + filename);
+    }
     std::cout << "Wrote " << num_vectors_ << " vectors to " << filename << "\n";
 }
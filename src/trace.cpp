@@ -0,0 +1,118 @@
+#include "trace.hpp"
+#include <unistd.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+namespace detail {
+
+std::atomic<bool> active{false};
+
+namespace {
+
+struct Event {
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+};
+
+// Each thread appends to its own buffer; the buffer's mutex is only ever
+// contended by stop() collecting it.
+struct ThreadBuffer {
+    std::mutex mu;
+    std::vector<Event> events;
+    size_t dropped = 0;
+    int tid = 0;
+};
+
+// Bounds a trace left running under heavy query load.
+constexpr size_t kMaxEventsPerThread = size_t{1} << 20;
+
+std::mutex registry_mu;
+// Buffers outlive their threads so spans from finished threads are kept.
+std::vector<std::shared_ptr<ThreadBuffer>> registry;
+uint64_t trace_start_ns = 0;
+
+ThreadBuffer& local_buffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto b = std::make_shared<ThreadBuffer>();
+        std::lock_guard lock(registry_mu);
+        b->tid = static_cast<int>(registry.size()) + 1;
+        registry.push_back(b);
+        return b;
+    }();
+    return *buffer;
+}
+
+// Names are literals chosen in this codebase; escape defensively anyway.
+void write_json_string(std::ofstream& out, const char* s) {
+    out << '"';
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') out << '\\';
+        out << *s;
+    }
+    out << '"';
+}
+
+}  // namespace
+
+void record(const char* name, uint64_t begin_ns, uint64_t end_ns) {
+    ThreadBuffer& buffer = local_buffer();
+    std::lock_guard lock(buffer.mu);
+    if (buffer.events.size() < kMaxEventsPerThread)
+        buffer.events.push_back({name, begin_ns, end_ns});
+    else
+        buffer.dropped++;
+}
+
+}  // namespace detail
+
+void start() {
+    using namespace detail;
+    std::lock_guard lock(registry_mu);
+    for (auto& buffer : registry) {
+        std::lock_guard buffer_lock(buffer->mu);
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+    trace_start_ns = now_ns();
+    detail::active.store(true, std::memory_order_relaxed);
+}
+
+size_t stop(const std::string& path) {
+    using namespace detail;
+    detail::active.store(false, std::memory_order_relaxed);
+
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("Cannot open trace output file: " + path);
+
+    // Complete ("X") events in microseconds since start(), one track per thread.
+    std::lock_guard lock(registry_mu);
+    long pid = static_cast<long>(getpid());
+    size_t written = 0, dropped = 0;
+    out << "{\"traceEvents\":[";
+    for (auto& buffer : registry) {
+        std::lock_guard buffer_lock(buffer->mu);
+        for (const Event& e : buffer->events) {
+            if (e.begin_ns < trace_start_ns) continue;  // began before start()
+            out << (written++ ? ",\n" : "\n") << "{\"name\":";
+            write_json_string(out, e.name);
+            out << ",\"ph\":\"X\",\"ts\":" << (e.begin_ns - trace_start_ns) / 1000.0
+                << ",\"dur\":" << (e.end_ns - e.begin_ns) / 1000.0
+                << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << "}";
+        }
+        dropped += buffer->dropped;
+        buffer->events.clear();
+        buffer->dropped = 0;
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_spans\":" << dropped << "}}\n";
+    if (!out) throw std::runtime_error("Failed to write trace file: " + path);
+    return written;
+}
+
+bool compiled_in() { return VELOX_TRACING != 0; }
+
+}  // namespace trace
@@ -0,0 +1,170 @@
+#include "vector_file.hpp"
+#include <fstream>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <iostream>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+size_t file_size(std::ifstream& in) {
+    in.seekg(0, std::ios::end);
+    size_t size = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+    return size;
+}
+
+// A source yields `count` rows of `dim` floats through `next`.
+struct RowSource {
+    int dim = 0;
+    size_t count = 0;
+    std::function<void(float*)> next;
+};
+
+// .fvecs / .bvecs: every row is an int32 dim followed by dim elements of
+// `elem_bytes` (4 = float32, 1 = uint8).
+RowSource open_xvecs(std::ifstream& in, const std::string& path, size_t elem_bytes) {
+    size_t size = file_size(in);
+    int dim = 0;
+    if (size >= sizeof(int)) in.read(reinterpret_cast<char*>(&dim), sizeof(int));
+    size_t row_bytes = sizeof(int) + static_cast<size_t>(dim) * elem_bytes;
+    if (dim <= 0 || size % row_bytes != 0)
+        throw std::runtime_error("Malformed vector file (bad dim or truncated): " + path);
+    in.seekg(0);
+
+    RowSource src;
+    src.dim = dim;
+    src.count = size / row_bytes;
+    auto buf = std::make_shared<std::vector<uint8_t>>(row_bytes);
+    src.next = [&in, path, dim, elem_bytes, row_bytes, buf](float* out) {
+        in.read(reinterpret_cast<char*>(buf->data()), row_bytes);
+        int row_dim;
+        std::memcpy(&row_dim, buf->data(), sizeof(int));
+        if (!in || row_dim != dim)
+            throw std::runtime_error("Inconsistent row in " + path);
+        const uint8_t* payload = buf->data() + sizeof(int);
+        if (elem_bytes == sizeof(float))
+            std::memcpy(out, payload, dim * sizeof(float));
+        else
+            for (int d = 0; d < dim; d++) out[d] = static_cast<float>(payload[d]);
+    };
+    return src;
+}
+
+// .npy v1-v3: magic, version, header length, then a Python dict literal
+// such as {'descr': '<f4', 'fortran_order': False, 'shape': (1000, 128), }.
+RowSource open_npy(std::ifstream& in, const std::string& path) {
+    char magic[8];
+    in.read(magic, 8);
+    if (!in || std::memcmp(magic, "\x93NUMPY", 6) != 0)
+        throw std::runtime_error("Not a .npy file: " + path);
+
+    uint32_t header_len = 0;
+    if (magic[6] == 1) {
+        uint16_t len16;
+        in.read(reinterpret_cast<char*>(&len16), sizeof(len16));
+        header_len = len16;
+    } else {
+        in.read(reinterpret_cast<char*>(&header_len), sizeof(header_len));
+    }
+    std::string header(header_len, '\0');
+    in.read(&header[0], header_len);
+    if (!in) throw std::runtime_error("Truncated .npy header: " + path);
+
+    auto field = [&](const std::string& key) {
+        size_t pos = header.find("'" + key + "'");
+        if (pos == std::string::npos)
+            throw std::runtime_error(".npy header lacks '" + key + "': " + path);
+        return header.substr(header.find(':', pos) + 1);
+    };
+
+    std::string descr = field("descr");
+    size_t elem_bytes;
+    if (descr.find("'<f4'") != std::string::npos)      elem_bytes = 4;
+    else if (descr.find("'|u1'") != std::string::npos) elem_bytes = 1;
+    else throw std::runtime_error("Unsupported .npy dtype (need <f4 or |u1): " + path);
+
+    std::string order = field("fortran_order");
+    if (order.compare(order.find_first_not_of(' '), 4, "True") == 0)
+        throw std::runtime_error("Fortran-ordered .npy arrays are not supported: " + path);
+
+    std::string shape = field("shape");
+    size_t open = shape.find('('), close = shape.find(')');
+    std::string dims = shape.substr(open + 1, close - open - 1);
+    size_t comma = dims.find(',');
+    if (comma == std::string::npos || dims.find_first_of("0123456789", comma) == std::string::npos)
+        throw std::runtime_error(".npy array must be 2-D: " + path);
+
+    RowSource src;
+    src.count = std::stoull(dims.substr(0, comma));
+    src.dim = std::stoi(dims.substr(comma + 1));
+    if (src.dim <= 0) throw std::runtime_error(".npy array has no columns: " + path);
+
+    int dim = src.dim;
+    auto buf = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(dim) * elem_bytes);
+    src.next = [&in, path, dim, elem_bytes, buf](float* out) {
+        in.read(reinterpret_cast<char*>(buf->data()), buf->size());
+        if (!in) throw std::runtime_error("Truncated .npy data: " + path);
+        if (elem_bytes == sizeof(float))
+            std::memcpy(out, buf->data(), dim * sizeof(float));
+        else
+            for (int d = 0; d < dim; d++) out[d] = static_cast<float>((*buf)[d]);
+    };
+    return src;
+}
+
+} // namespace
+
+size_t convert_to_vxv(const std::string& src_path, const std::string& dst_path, bool with_norms) {
+    std::ifstream in(src_path, std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open file: " + src_path);
+
+    RowSource src;
+    if (ends_with(src_path, ".fvecs"))     src = open_xvecs(in, src_path, sizeof(float));
+    else if (ends_with(src_path, ".bvecs")) src = open_xvecs(in, src_path, 1);
+    else if (ends_with(src_path, ".npy"))   src = open_npy(in, src_path);
+    else throw std::runtime_error("Unknown vector file type (expected .fvecs, .bvecs or .npy): " + src_path);
+
+    VxvHeader h{};
+    h.magic = VXV_MAGIC;
+    h.version = VXV_VERSION;
+    h.dim = static_cast<uint32_t>(src.dim);
+    h.padded_dim = static_cast<uint32_t>(vxv_padded_dim(src.dim));
+    h.num_vectors = src.count;
+    h.data_offset = sizeof(VxvHeader);
+    h.norms_offset = with_norms ? h.data_offset + src.count * h.padded_dim * sizeof(float) : 0;
+
+    std::ofstream out(dst_path, std::ios::binary);
+    if (!out) throw std::runtime_error("Cannot open output file: " + dst_path);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+
+    std::vector<float> row(h.padded_dim, 0.0f);
+    std::vector<float> norms;
+    if (with_norms) norms.reserve(src.count);
+    for (size_t i = 0; i < src.count; i++) {
+        src.next(row.data());
+        out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+        if (with_norms) {
+            float sq = 0.0f;
+            for (int d = 0; d < src.dim; d++) sq += row[d] * row[d];
+            norms.push_back(std::sqrt(sq));
+        }
+    }
+    if (with_norms)
+        out.write(reinterpret_cast<const char*>(norms.data()), norms.size() * sizeof(float));
+
+    out.close();
+    if (!out) throw std::runtime_error("Failed to write " + dst_path);
+    std::cout << "Converted " << src.count << " vectors (dim=" << src.dim
+              << ", padded to " << h.padded_dim << ") to " << dst_path << "\n";
+    return src.count;
+}
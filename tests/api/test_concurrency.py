@@ -0,0 +1,101 @@
+import os
+import sys
+import threading
+import time
+
+import numpy as np
+
+sys.path.append(os.path.abspath("build"))
+import veloxdb
+
+
+def test_threaded_search_during_build():
+    print("--- Multi-threaded stress check ---")
+
+    N, dim = 20000, 32
+    rng = np.random.default_rng(7)
+    data = rng.random((N, dim)).astype(np.float32)
+    queries = rng.random((64, dim)).astype(np.float32)
+
+    db = veloxdb.VectorIndex()
+    for i in range(N):
+        db.add_vector(data[i])
+
+    # Brute-force ground truth, computed before any index exists.
+    expected = [db.search(q, k=5) for q in queries]
+
+    errors = []
+    ticks = []
+    stop = threading.Event()
+
+    def searcher(seed):
+        local = np.random.default_rng(seed)
+        try:
+            while not stop.is_set():
+                qi = int(local.integers(len(queries)))
+                res = db.search(queries[qi], k=5, nprobe=64, ef_search=100)
+                assert len(res) == 5
+        except Exception as e:  # noqa: BLE001
+            errors.append(e)
+
+    def ticker():
+        # Pure-Python work: only makes progress if builds release the GIL.
+        while not stop.is_set():
+            ticks.append(time.perf_counter())
+            time.sleep(0.005)
+
+    threads = [threading.Thread(target=searcher, args=(s,)) for s in range(4)]
+    threads.append(threading.Thread(target=ticker))
+    for t in threads:
+        t.start()
+
+    build_start = time.perf_counter()
+    db.build_index(num_clusters=64, epochs=5)
+    db.build_index_hnsw(M=16, ef_construction=100)
+    build_end = time.perf_counter()
+
+    path = "/tmp/velox_concurrency_test.idx"
+    db.save_index(path)
+
+    stop.set()
+    for t in threads:
+        t.join()
+
+    assert not errors, errors
+    during_build = [t for t in ticks if build_start <= t <= build_end]
+    assert len(during_build) > 1, "Python threads starved while building"
+    print(f"python ticks during build: {len(during_build)}")
+
+    reloaded = veloxdb.VectorIndex()
+    for i in range(N):
+        reloaded.add_vector(data[i])
+    reloaded.load_index(path)
+    os.remove(path)
+    assert reloaded.get_index_type() == "hnsw"
+
+    # Concurrent batched searches agree with the single-threaded answers.
+    flat = veloxdb.VectorIndex()
+    for i in range(N):
+        flat.add_vector(data[i])
+    batcher = veloxdb.SearchBatcher(flat, max_batch=16, max_wait_us=500)
+    got = [None] * len(queries)
+
+    def batched(lo, hi):
+        for i in range(lo, hi):
+            got[i] = batcher.search(queries[i], k=5)
+
+    step = len(queries) // 8
+    workers = [threading.Thread(target=batched, args=(i, i + step))
+               for i in range(0, len(queries), step)]
+    for t in workers:
+        t.start()
+    for t in workers:
+        t.join()
+    assert got == expected
+    print(f"batcher: OK ({batcher.batches_dispatched()} batches)")
+
+    print("✅ All concurrency checks passed.")
+
+
+if __name__ == "__main__":
+    test_threaded_search_during_build()
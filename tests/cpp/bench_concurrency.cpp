@@ -0,0 +1,196 @@
+// Throughput and tail latency of a mixed search / insert / rebuild / save
+// workload driven from several threads against one VectorIndex, with the
+// time each operation spent blocked on the facade lock. Run:
+//   ./build/bench_concurrency [threads=8] [seconds=5] [n=20000] [dim=64]
+//                             [index=both|ivf|hnsw]
+//                             [mix=search:98,insert:1.9,build:0.05,save:0.05]
+// Mix weights are relative; each thread draws its next operation from them.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "vector_db.hpp"
+
+namespace {
+
+enum Op { kSearch, kInsert, kBuild, kSave, kNumOps };
+const char* const kOpNames[kNumOps] = {"search", "insert", "build", "save"};
+
+struct Config {
+    int threads = 8;
+    double seconds = 5.0;
+    int n = 20000;
+    int dim = 64;
+    std::string index = "both";
+    double mix[kNumOps] = {98.0, 1.9, 0.05, 0.05};
+};
+
+// Per-thread samples, merged after the run.
+struct Samples {
+    std::vector<uint64_t> latency_ns[kNumOps];
+    std::vector<uint64_t> wait_ns[kNumOps];
+};
+
+void parse_mix(const std::string& spec, double* mix) {
+    std::fill(mix, mix + kNumOps, 0.0);
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        size_t colon = item.find(':');
+        if (colon == std::string::npos) throw std::runtime_error("Bad mix entry: " + item);
+        std::string name = item.substr(0, colon);
+        auto it = std::find(kOpNames, kOpNames + kNumOps, name);
+        if (it == kOpNames + kNumOps) throw std::runtime_error("Unknown operation: " + name);
+        mix[it - kOpNames] = std::atof(item.c_str() + colon + 1);
+        pos = end + 1;
+    }
+}
+
+Config parse_args(int argc, char** argv) {
+    Config cfg;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        if (eq == std::string::npos) throw std::runtime_error("Expected key=value: " + arg);
+        std::string key = arg.substr(0, eq), value = arg.substr(eq + 1);
+        if (key == "threads") cfg.threads = std::max(1, std::atoi(value.c_str()));
+        else if (key == "seconds") cfg.seconds = std::atof(value.c_str());
+        else if (key == "n") cfg.n = std::max(1, std::atoi(value.c_str()));
+        else if (key == "dim") cfg.dim = std::max(1, std::atoi(value.c_str()));
+        else if (key == "index") cfg.index = value;
+        else if (key == "mix") parse_mix(value, cfg.mix);
+        else throw std::runtime_error("Unknown option: " + key);
+    }
+    return cfg;
+}
+
+std::vector<float> random_vector(std::mt19937& rng, int dim) {
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> v(dim);
+    for (float& x : v) x = dist(rng);
+    return v;
+}
+
+void build(VectorIndex& db, const std::string& index, int n) {
+    if (index == "ivf")
+        db.build_index(std::max(1, static_cast<int>(std::sqrt(n))), /*epochs=*/5);
+    else
+        db.build_index_hnsw(/*M=*/16, /*ef_construction=*/100);
+}
+
+uint64_t percentile(std::vector<uint64_t>& v, double p) {
+    if (v.empty()) return 0;
+    size_t i = std::min(v.size() - 1, static_cast<size_t>(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + i, v.end());
+    return v[i];
+}
+
+void run(const Config& cfg, const std::string& index) {
+    VectorIndex db;
+    db.set_simd(true);
+    std::mt19937 rng(7);
+    for (int i = 0; i < cfg.n; i++) db.add_vector(random_vector(rng, cfg.dim));
+    build(db, index, cfg.n);
+    db.reset_lock_stats();
+
+    double total_weight = 0;
+    for (double w : cfg.mix) total_weight += w;
+    std::vector<Samples> samples(cfg.threads);
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                        std::chrono::duration<double>(cfg.seconds));
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < cfg.threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937 trng(100 + t);
+            std::uniform_real_distribution<double> pick(0.0, total_weight);
+            std::string save_path = "/tmp/velox_bench_concurrency_" + std::to_string(t) + ".idx";
+            Samples& out = samples[t];
+            while (std::chrono::steady_clock::now() < deadline) {
+                double r = pick(trng);
+                int op = 0;
+                while (op < kNumOps - 1 && r >= cfg.mix[op]) r -= cfg.mix[op++];
+                std::vector<float> v = random_vector(trng, cfg.dim);
+
+                uint64_t wait_before = VectorIndex::thread_lock_wait_ns();
+                auto start = std::chrono::steady_clock::now();
+                switch (op) {
+                    case kSearch: db.search(v, 10, /*nprobe=*/8, "eucl", /*ef_search=*/64); break;
+                    case kInsert: db.add_vector(v); break;
+                    case kBuild:  build(db, index, cfg.n); break;
+                    case kSave:   db.save_index(save_path); break;
+                }
+                auto end = std::chrono::steady_clock::now();
+                out.latency_ns[op].push_back(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+                out.wait_ns[op].push_back(VectorIndex::thread_lock_wait_ns() - wait_before);
+            }
+            std::remove(save_path.c_str());
+        });
+    }
+    for (auto& w : workers) w.join();
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::printf("\n%s: %d threads, %.1f s, %d initial vectors of dim %d, %d at the end\n",
+                index.c_str(), cfg.threads, elapsed, cfg.n, cfg.dim, db.size());
+    std::printf("%8s  %9s  %10s  %9s  %9s  %9s  %11s  %11s  %7s\n", "op", "count", "ops/s",
+                "p50 us", "p99 us", "max us", "mean wait", "p99 wait", "wait %");
+    for (int op = 0; op < kNumOps; op++) {
+        std::vector<uint64_t> lat, wait;
+        for (auto& s : samples) {
+            lat.insert(lat.end(), s.latency_ns[op].begin(), s.latency_ns[op].end());
+            wait.insert(wait.end(), s.wait_ns[op].begin(), s.wait_ns[op].end());
+        }
+        if (lat.empty()) continue;
+        double lat_sum = 0, wait_sum = 0;
+        for (uint64_t x : lat) lat_sum += x;
+        for (uint64_t x : wait) wait_sum += x;
+        uint64_t p50 = percentile(lat, 0.50), p99 = percentile(lat, 0.99);
+        uint64_t max = *std::max_element(lat.begin(), lat.end());
+        uint64_t wait_p99 = percentile(wait, 0.99);
+        std::printf("%8s  %9zu  %10.1f  %9.1f  %9.1f  %9.1f  %9.1fus  %9.1fus  %6.1f%%\n",
+                    kOpNames[op], lat.size(), lat.size() / elapsed, p50 / 1e3, p99 / 1e3,
+                    max / 1e3, wait_sum / wait.size() / 1e3, wait_p99 / 1e3,
+                    100.0 * wait_sum / lat_sum);
+    }
+
+    LockStats locks = db.lock_stats();
+    auto report = [](const char* mode, const LockWaitStats& s) {
+        std::printf("%9s lock: %llu acquisitions, %llu contended, %.1f ms waited, max %.1f ms\n",
+                    mode, static_cast<unsigned long long>(s.acquisitions),
+                    static_cast<unsigned long long>(s.contended), s.wait_ns / 1e6,
+                    s.max_wait_ns / 1e6);
+    };
+    report("shared", locks.shared);
+    report("exclusive", locks.exclusive);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Config cfg;
+    try {
+        cfg = parse_args(argc, argv);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    // Builds log their progress to std::cout; keep the report readable.
+    std::streambuf* log = std::cout.rdbuf(nullptr);
+    for (const char* index : {"ivf", "hnsw"})
+        if (cfg.index == "both" || cfg.index == index) run(cfg, index);
+    std::cout.rdbuf(log);
+    return 0;
+}
@@ -0,0 +1,48 @@
+// Per-distance cost of the generic AVX2 kernels versus the dimension-
+// specialised ones returned by dist_kernels(), at the embedding sizes we
+// ship. Run: ./build/bench_kernels [iterations]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "metrics.hpp"
+
+// Times `iters` distance calls over a pool of vectors larger than L1, so the
+// loop measures the kernel rather than a single hot cache line.
+static double ns_per_call(DistFn fn, const std::vector<float>& pool, const float* query,
+                          int dim, int iters) {
+    int rows = static_cast<int>(pool.size() / dim);
+    volatile float sink = 0.0f;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iters; i++)
+        sink = sink + fn(pool.data() + static_cast<size_t>(i % rows) * dim, query, dim);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iters;
+}
+
+int main(int argc, char** argv) {
+    int iters = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::printf("%6s  %8s  %12s  %12s  %8s\n", "dim", "metric", "generic ns", "special ns", "speedup");
+    for (int dim : {128, 256, 384, 512, 768, 1024, 1536}) {
+        std::vector<float> pool(static_cast<size_t>(256) * dim), query(dim);
+        for (float& x : pool) x = dist(rng);
+        for (float& x : query) x = dist(rng);
+
+        const DistKernels& k = dist_kernels(dim);
+        struct { const char* name; DistFn generic, special; } rows[] = {
+            {"eucl", euclidean_dist_simd, k.l2},
+            {"cos",  cosine_dist_simd,    k.cosine},
+        };
+        for (const auto& r : rows) {
+            ns_per_call(r.generic, pool, query.data(), dim, iters / 10);  // warm-up
+            double g = ns_per_call(r.generic, pool, query.data(), dim, iters);
+            double s = ns_per_call(r.special, pool, query.data(), dim, iters);
+            std::printf("%6d  %8s  %12.2f  %12.2f  %7.2fx\n", dim, r.name, g, s, g / s);
+        }
+    }
+    return 0;
+}
@@ -5,7 +5,19 @@
 #include <cstdio>
 #include <fstream>
 #include <cstdint>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <iterator>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "vector_db.hpp"
+#include "search_batcher.hpp"
+#include "vector_file.hpp"
+#include "packed_ids.hpp"
+#include "trace.hpp"
 
 class VeloxTest : public ::testing::Test {
 protected:
@@ -206,3 +218,1431 @@ TEST_F(VeloxTest, LegacyV1IndexLoads) {
     ASSERT_EQ(results.size(), 1u);
     EXPECT_TRUE(results[0].first == 0 || results[0].first == 1);
 }
+
+// Range search returns exactly the vectors inside the radius, nearest-first,
+// for the brute-force path and for both index algorithms.
+TEST_F(VeloxTest, RangeSearchMatchesBruteForce) {
+    for (int i = 0; i < 40; i++)
+        db.add_vector({static_cast<float>(i), 0.0f});
+
+    // Squared L2: radius 4.5 keeps x in {8..12} around the query at x=10.
+    auto brute = db.range_search({10.0f, 0.0f}, /*radius=*/4.5f);
+    ASSERT_EQ(brute.size(), 5u);
+    EXPECT_EQ(brute[0].first, 10);
+    for (size_t i = 1; i < brute.size(); i++)
+        EXPECT_LE(brute[i - 1].second, brute[i].second);
+
+    db.build_index(/*num_clusters=*/4, /*epochs=*/5, "eucl");
+    auto ivf = db.range_search({10.0f, 0.0f}, 4.5f, /*nprobe=*/4);
+    EXPECT_EQ(ivf.size(), brute.size());
+
+    db.build_index_hnsw(/*M=*/8, /*ef_construction=*/50, "eucl");
+    auto hnsw = db.range_search({10.0f, 0.0f}, 4.5f, /*nprobe=*/1, "eucl", /*ef_search=*/4);
+    std::unordered_set<int> ids;
+    for (auto& p : hnsw) ids.insert(p.first);
+    EXPECT_EQ(ids.size(), 5u);
+    for (int expected = 8; expected <= 12; expected++)
+        EXPECT_TRUE(ids.count(expected));
+}
+
+TEST_F(VeloxTest, RangeSearchBatchCsrLayout) {
+    for (int i = 0; i < 10; i++)
+        db.add_vector({static_cast<float>(i)});
+
+    auto r = db.range_search_batch({{0.0f}, {100.0f}, {5.0f}}, /*radius=*/1.0f);
+    ASSERT_EQ(r.lims.size(), 4u);
+    EXPECT_EQ(r.lims[1] - r.lims[0], 2u);  // {0, 1}
+    EXPECT_EQ(r.lims[2] - r.lims[1], 0u);  // nothing near 100
+    EXPECT_EQ(r.lims[3] - r.lims[2], 3u);  // {4, 5, 6}
+    EXPECT_EQ(r.ids[r.lims[2]], 5);
+    EXPECT_EQ(r.ids.size(), r.distances.size());
+}
+
+// The on-disk graph should reach HNSW-like recall and, once saved, serve
+// queries from a VectorIndex that has no vectors loaded at all.
+TEST_F(VeloxTest, DiskIndexRecallAndStandaloneLoad) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    constexpr int kNumVectors = 500;
+    constexpr int kDim = 32;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query(kDim);
+    for (int d = 0; d < kDim; d++) query[d] = dist(rng);
+
+    auto brute = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+
+    const char* graph_path = "/tmp/velox_disk_graph_test.vxg";
+    const char* index_path = "/tmp/velox_disk_index_test.idx";
+    db.build_index_disk(graph_path, /*R=*/16, /*L=*/50, /*alpha=*/1.2f, "eucl");
+    EXPECT_EQ(db.get_index_type(), "disk");
+    auto approx = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/60);
+    db.save_index(index_path);
+
+    std::unordered_set<int> brute_ids;
+    for (auto& p : brute) brute_ids.insert(p.first);
+    int overlap = 0;
+    for (auto& p : approx)
+        if (brute_ids.count(p.first)) overlap++;
+    EXPECT_GE(overlap, 8);
+
+    VectorIndex standalone;
+    standalone.set_simd(true);
+    standalone.load_index(index_path);
+    auto reloaded = standalone.search(query, /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/60);
+    std::remove(index_path);
+    std::remove(graph_path);
+
+    ASSERT_EQ(reloaded.size(), approx.size());
+    for (size_t i = 0; i < approx.size(); i++) {
+        EXPECT_EQ(reloaded[i].first, approx[i].first);
+        EXPECT_FLOAT_EQ(reloaded[i].second, approx[i].second);
+    }
+    EXPECT_THROW(standalone.search({1.0f}, 1), std::runtime_error);
+}
+
+// A graph file given by a relative path is still found when the index is
+// loaded from another working directory, and the saved beam width is used.
+TEST_F(VeloxTest, DiskIndexRelativeGraphPath) {
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16;
+    for (int i = 0; i < 300; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query = db.get_vector(17);
+
+    char cwd[4096];
+    ASSERT_NE(getcwd(cwd, sizeof(cwd)), nullptr);
+    const char* index_path = "/tmp/velox_disk_rel_index_test.idx";
+    ASSERT_EQ(chdir("/tmp"), 0);
+    db.build_index_disk("velox_disk_rel_graph_test.vxg", /*R=*/12, /*L=*/40, 1.2f, "eucl",
+                        /*beam_width=*/2);
+    db.save_index(index_path);
+    auto approx = db.search(query, /*k=*/5, 1, "eucl", /*ef_search=*/40);
+
+    ASSERT_EQ(chdir("/"), 0);
+    VectorIndex standalone;
+    standalone.set_simd(true);
+    standalone.load_index(index_path);
+    auto reloaded = standalone.search(query, /*k=*/5, 1, "eucl", /*ef_search=*/40);
+    ASSERT_EQ(chdir(cwd), 0);
+    std::remove(index_path);
+    std::remove("/tmp/velox_disk_rel_graph_test.vxg");
+
+    ASSERT_EQ(approx.size(), 5u);
+    EXPECT_EQ(approx[0].first, 17);
+    EXPECT_EQ(reloaded, approx);
+}
+
+// Compressed-storage kernels: SIMD and scalar variants must agree, and fp16
+// must round-trip typical embedding values closely.
+TEST(MetricsTest, CompressedKernelsMatchScalar) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> dist(-2.0f, 2.0f);
+    constexpr int kDim = 37;  // exercises the scalar tail
+
+    std::vector<float> q(kDim), x(kDim), scale(kDim);
+    std::vector<uint16_t> xh(kDim);
+    std::vector<uint8_t> code(kDim);
+    for (int d = 0; d < kDim; d++) {
+        q[d] = dist(rng);
+        x[d] = dist(rng);
+        xh[d] = float_to_half(x[d]);
+        EXPECT_NEAR(half_to_float(xh[d]), x[d], 1e-3f);
+        scale[d] = 0.01f + 0.001f * d;
+        code[d] = static_cast<uint8_t>(rng() % 256);
+    }
+
+    EXPECT_NEAR(fp16_euclidean_dist_simd(q.data(), xh.data(), kDim),
+                fp16_euclidean_dist(q.data(), xh.data(), kDim), 1e-3f);
+    EXPECT_NEAR(fp16_cosine_dist_simd(q.data(), xh.data(), kDim),
+                fp16_cosine_dist(q.data(), xh.data(), kDim), 1e-5f);
+    EXPECT_NEAR(sq8_l2_simd(q.data(), scale.data(), code.data(), kDim),
+                sq8_l2(q.data(), scale.data(), code.data(), kDim), 1e-2f);
+    EXPECT_NEAR(sq8_dot_simd(q.data(), code.data(), kDim),
+                sq8_dot(q.data(), code.data(), kDim), 1e-2f);
+}
+
+// SQ8 storage without the float copy should still give HNSW recall close to
+// exact brute force on the original floats.
+TEST_F(VeloxTest, SQ8StorageHNSWRecall) {
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 500;
+    constexpr int kDim = 32;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query(kDim);
+    for (int d = 0; d < kDim; d++) query[d] = dist(rng);
+    auto exact = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+    auto original = db.get_vector(5);
+
+    db.set_storage_encoding("sq8", /*keep_float=*/false);
+    auto decoded = db.get_vector(5);
+    for (int d = 0; d < kDim; d++) EXPECT_NEAR(decoded[d], original[d], 0.01f);
+    // The floats are gone: repeating the encoding is a no-op, changing it fails.
+    db.set_storage_encoding("sq8", /*keep_float=*/false);
+    EXPECT_EQ(db.get_vector(5), decoded);
+    EXPECT_THROW(db.set_storage_encoding("fp16"), std::runtime_error);
+
+    db.build_index_hnsw(/*M=*/16, /*ef_construction=*/200, "eucl");
+    auto approx = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/100);
+
+    std::unordered_set<int> exact_ids;
+    for (auto& p : exact) exact_ids.insert(p.first);
+    int overlap = 0;
+    for (auto& p : approx)
+        if (exact_ids.count(p.first)) overlap++;
+    EXPECT_GE(overlap, 8);
+}
+
+// SQ8 selected before any vector is added trains once enough rows exist,
+// instead of on the first vector (which would clamp all later ones).
+TEST_F(VeloxTest, SQ8SelectedOnEmptyStorageTrainsLater) {
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16;
+    db.set_storage_encoding("sq8", /*keep_float=*/false);
+    auto component = [this](const std::string& name) {
+        for (const auto& [n, bytes] : db.memory_usage().components) if (n == name) return bytes;
+        return size_t{0};
+    };
+    for (int i = 0; i < 2 * VectorStorage::kSq8TrainRows; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+        if (i == 10) {
+            // Still float32: searches are exact.
+            auto hits = db.search(db.get_vector(3), /*k=*/1, 1, "eucl");
+            EXPECT_EQ(hits[0].first, 3);
+            EXPECT_EQ(hits[0].second, 0.0f);
+            EXPECT_EQ(component("storage.sq8"), 0u);
+        }
+    }
+    EXPECT_GT(component("storage.sq8"), 0u);
+    EXPECT_EQ(component("storage.float"), 0u);
+
+    // Every row is encoded against the trained ranges, not clamped.
+    for (int i : {0, 700, 1500, 2000}) {
+        auto hits = db.search(db.get_vector(i), /*k=*/2, 1, "eucl");
+        EXPECT_EQ(hits[0].first, i);
+        EXPECT_LT(hits[0].second, hits[1].second);
+    }
+}
+
+// With the float copy kept, re-ranking returns exact float distances.
+TEST_F(VeloxTest, FP16StorageIVFWithRerankIsExact) {
+    for (int i = 0; i < 40; i++)
+        db.add_vector({static_cast<float>(i) * 0.1f, 1.0f / (i + 1)});
+    auto exact = db.search({0.73f, 0.2f}, /*k=*/3, /*nprobe=*/1, "eucl");
+
+    db.set_storage_encoding("fp16");
+    db.set_rerank(10);
+    db.build_index(/*num_clusters=*/2, /*epochs=*/5, "eucl");
+    auto reranked = db.search({0.73f, 0.2f}, /*k=*/3, /*nprobe=*/2, "eucl");
+
+    ASSERT_EQ(reranked.size(), exact.size());
+    for (size_t i = 0; i < exact.size(); i++) {
+        EXPECT_EQ(reranked[i].first, exact[i].first);
+        EXPECT_FLOAT_EQ(reranked[i].second, exact[i].second);
+    }
+    EXPECT_THROW(db.set_storage_encoding("int4"), std::runtime_error);
+}
+
+// Mapping a new file replaces the codes built for the previous data: the
+// file's rows are encoded too, and re-ranking over the mapped floats gives
+// the float32 results.
+TEST_F(VeloxTest, LoadAfterStorageEncodingReencodes) {
+    const std::string path = "/tmp/velox_load_encoded_test.fvecs";
+    std::mt19937 rng(43);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16;
+    VectorIndex source;
+    for (int i = 0; i < 600; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        source.add_vector(v);
+    }
+    source.write_fvecs(path);
+    std::vector<float> query(kDim, 0.1f);
+    auto exact = source.search(query, /*k=*/10, 1, "eucl");
+
+    for (int i = 0; i < 40; i++) db.add_vector(std::vector<float>(kDim, i * 0.01f));
+    db.set_storage_encoding("sq8", /*keep_float=*/false);
+    db.set_rerank(100);
+    db.load_fvecs(path);
+    EXPECT_EQ(db.size(), 600);
+    auto reranked = db.search(query, 10, 1, "eucl");
+    ASSERT_EQ(reranked.size(), exact.size());
+    for (size_t i = 0; i < exact.size(); i++) {
+        EXPECT_EQ(reranked[i].first, exact[i].first);
+        EXPECT_NEAR(reranked[i].second, exact[i].second, 1e-4f);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST(MetricsTest, HammingSimdMatchesScalar) {
+    std::mt19937_64 rng(5);
+    std::vector<uint64_t> a(7), b(7);  // 4-word SIMD block + scalar tail
+    for (int i = 0; i < 7; i++) { a[i] = rng(); b[i] = rng(); }
+    EXPECT_EQ(hamming_dist_simd(a.data(), b.data(), 7), hamming_dist(a.data(), b.data(), 7));
+    EXPECT_EQ(hamming_dist(a.data(), a.data(), 7), 0);
+}
+
+// Binary pre-filtering of the brute-force path should keep most of the
+// exact top-10 when the shortlist is generous, and return exact distances.
+TEST_F(VeloxTest, BinaryPrefilterRecall) {
+    std::mt19937 rng(13);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    constexpr int kNumVectors = 2000;
+    constexpr int kDim = 128;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query = db.get_vector(42);
+    for (int d = 0; d < kDim; d++) query[d] += 0.3f * dist(rng);
+
+    auto exact = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+    db.set_binary_prefilter(/*shortlist=*/400);
+    auto filtered = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+
+    ASSERT_EQ(filtered.size(), 10u);
+    EXPECT_EQ(filtered[0].first, 42);
+    EXPECT_FLOAT_EQ(filtered[0].second, exact[0].second);
+
+    std::unordered_set<int> exact_ids;
+    for (auto& p : exact) exact_ids.insert(p.first);
+    int overlap = 0;
+    for (auto& p : filtered)
+        if (exact_ids.count(p.first)) overlap++;
+    EXPECT_GE(overlap, 7);
+
+    // Loading a file into an index with the pre-filter on rebuilds the codes
+    // for the new rows (the old ones covered only 50).
+    const std::string path = "/tmp/velox_binary_load_test.fvecs";
+    db.write_fvecs(path);
+    VectorIndex loaded;
+    loaded.set_simd(true);
+    for (int i = 0; i < 50; i++) loaded.add_vector(std::vector<float>(kDim, dist(rng)));
+    loaded.set_binary_prefilter(/*shortlist=*/400);
+    loaded.load_fvecs(path);
+    EXPECT_EQ(loaded.search(query, 10, 1, "eucl"), filtered);
+    std::remove(path.c_str());
+}
+
+// Sharded scatter-gather must return exactly the unsharded results.
+TEST_F(VeloxTest, ShardedSearchMatchesSingleThreaded) {
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 20000;
+    constexpr int kDim = 8;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query(kDim, 0.1f);
+
+    auto single_bf = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+    db.build_index(/*num_clusters=*/4, /*epochs=*/3, "eucl");
+    auto single_ivf = db.search(query, /*k=*/10, /*nprobe=*/4, "eucl");
+
+    db.set_search_shards(4);
+    auto sharded_ivf = db.search(query, /*k=*/10, /*nprobe=*/4, "eucl");
+    EXPECT_EQ(sharded_ivf, single_ivf);
+
+    VectorIndex flat;
+    flat.set_simd(true);
+    for (int i = 0; i < kNumVectors; i++) flat.add_vector(db.get_vector(i));
+    flat.set_search_shards(4);
+    EXPECT_EQ(flat.search(query, /*k=*/10, /*nprobe=*/1, "eucl"), single_bf);
+}
+
+TEST_F(VeloxTest, SearchBatchMatchesPerQuerySearch) {
+    std::mt19937 rng(23);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 12;
+    for (int i = 0; i < 3000; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<std::vector<float>> queries(40, std::vector<float>(kDim));
+    for (auto& q : queries)
+        for (float& x : q) x = dist(rng);
+
+    auto bf = db.search_batch(queries, /*k=*/5, /*nprobe=*/1, "eucl");
+    ASSERT_EQ(bf.size(), queries.size());
+    for (size_t i = 0; i < queries.size(); i++)
+        EXPECT_EQ(bf[i], db.search(queries[i], 5, 1, "eucl"));
+
+    db.build_index(/*num_clusters=*/16, /*epochs=*/3, "eucl");
+    auto ivf = db.search_batch(queries, /*k=*/5, /*nprobe=*/4, "eucl");
+    for (size_t i = 0; i < queries.size(); i++)
+        EXPECT_EQ(ivf[i], db.search(queries[i], 5, 4, "eucl"));
+}
+
+TEST_F(VeloxTest, SearchBatcherCoalescesConcurrentQueries) {
+    std::mt19937 rng(29);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 8;
+    for (int i = 0; i < 2000; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+
+    constexpr int kThreads = 8, kPerThread = 25;
+    std::vector<std::vector<float>> queries(kThreads * kPerThread, std::vector<float>(kDim));
+    for (auto& q : queries)
+        for (float& x : q) x = dist(rng);
+
+    SearchBatcher batcher(db, /*max_batch=*/16, /*max_wait_us=*/500, /*num_workers=*/2);
+    std::vector<std::vector<std::pair<int, float>>> got(queries.size());
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++)
+        threads.emplace_back([&, t] {
+            for (int j = 0; j < kPerThread; j++) {
+                size_t i = static_cast<size_t>(t) * kPerThread + j;
+                // Alternate k so batches hold more than one parameter group.
+                got[i] = batcher.search(queries[i], (i % 2) ? 3 : 4, 1, "eucl");
+            }
+        });
+    for (auto& th : threads) th.join();
+
+    for (size_t i = 0; i < queries.size(); i++)
+        EXPECT_EQ(got[i], db.search(queries[i], (i % 2) ? 3 : 4, 1, "eucl"));
+    EXPECT_LT(batcher.batches_dispatched(), queries.size());
+
+    EXPECT_THROW(batcher.search(std::vector<float>(kDim + 1, 0.0f), 1), std::runtime_error);
+}
+
+TEST_F(VeloxTest, OpenRestoresSavedDirectory) {
+    const std::string dir = "/tmp/velox_open_test";
+    mkdir(dir.c_str(), 0755);
+    const std::string vectors = dir + "/" + VectorIndex::kVectorsFile;
+    const std::string index = dir + "/" + VectorIndex::kIndexFile;
+
+    std::mt19937 rng(31);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 8;
+    for (int i = 0; i < 3000; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    db.build_index_hnsw(/*M=*/8, /*ef_construction=*/64, "eucl");
+    db.write_fvecs(vectors);
+    db.save_index(index);
+    std::vector<float> query(kDim, 0.2f);
+    auto expected = db.search(query, /*k=*/5, 1, "eucl", /*ef_search=*/64);
+
+    VectorIndex opened;
+    opened.set_simd(true);
+    opened.open(dir);
+    EXPECT_EQ(opened.size(), 3000);
+    EXPECT_EQ(opened.get_index_type(), "hnsw");
+    EXPECT_EQ(opened.search(query, 5, 1, "eucl", 64), expected);
+    for (int i = 0; i < 1000 && !opened.is_ready(); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_TRUE(opened.is_ready());
+
+    // Appending copies the mapping into RAM, so the file can be rewritten.
+    opened.add_vector(std::vector<float>(kDim, 0.0f));
+    EXPECT_EQ(opened.size(), 3001);
+    opened.write_fvecs(vectors);
+
+    // The index now covers fewer vectors than the file: rejected, and the
+    // failed open leaves the instance empty and reusable.
+    VectorIndex stale;
+    EXPECT_THROW(stale.open(dir), std::runtime_error);
+    EXPECT_EQ(stale.size(), 0);
+    stale.open(dir, /*with_index=*/false, /*use_mmap=*/false);
+    EXPECT_EQ(stale.size(), 3001);
+    EXPECT_EQ(stale.get_index_type(), "none");
+    EXPECT_EQ(stale.get_vector(42), db.get_vector(42));
+
+    std::remove(vectors.c_str());
+    std::remove(index.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_F(VeloxTest, MmapOptionsAndIVFPrefetch) {
+    const std::string path = "/tmp/velox_mmap_opts_test.fvecs";
+    std::mt19937 rng(37);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16;
+    for (int i = 0; i < 4000; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    db.write_fvecs(path);
+    std::vector<float> query(kDim, 0.05f);
+    auto exact = db.search(query, /*k=*/10, 1, "eucl");
+
+    VectorIndex mapped;
+    mapped.set_simd(true);
+    EXPECT_THROW(mapped.load_fvecs(path, false, "sideways"), std::runtime_error);
+    mapped.load_fvecs(path, /*populate=*/true, "random", /*huge_pages=*/true, /*lock=*/false);
+    EXPECT_EQ(mapped.search(query, 10, 1, "eucl"), exact);
+
+    // k-means reads the mapping in place; probing every list is exhaustive.
+    mapped.build_index(/*num_clusters=*/8, /*epochs=*/3, "eucl");
+    mapped.prefetch(query, /*nprobe=*/8, "eucl");
+    mapped.prefetch(query, /*nprobe=*/2, "eucl", /*lock=*/true);
+    EXPECT_EQ(mapped.search(query, 10, /*nprobe=*/8, "eucl"), exact);
+    EXPECT_THROW(mapped.prefetch(std::vector<float>(kDim + 1, 0.0f)), std::runtime_error);
+
+    std::remove(path.c_str());
+}
+
+TEST(MetricsTest, AlignedKernelsMatchScalar) {
+    alignas(32) float a[48], b[48];
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int i = 0; i < 48; i++) { a[i] = dist(rng); b[i] = dist(rng); }
+    EXPECT_NEAR(l2_aligned_simd(a, b, 48), euclidean_dist(a, b, 48), 1e-4f);
+    float dot = 0.0f;
+    for (int i = 0; i < 48; i++) dot += a[i] * b[i];
+    EXPECT_NEAR(dot_aligned_simd(a, b, 48), dot, 1e-4f);
+}
+
+// Converting to the aligned .vxv format (from .fvecs, .bvecs and .npy) and
+// mapping it must give the same neighbours as the source data.
+TEST_F(VeloxTest, AlignedVectorFileRoundTrip) {
+    const std::string fvecs = "/tmp/velox_vxv_test.fvecs";
+    const std::string vxv = "/tmp/velox_vxv_test.vxv";
+    std::mt19937 rng(43);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 20;  // padded to 32
+    for (int i = 0; i < 1500; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    db.write_fvecs(fvecs);
+    EXPECT_EQ(convert_to_vxv(fvecs, vxv), 1500u);
+
+    VectorIndex mapped;
+    mapped.set_simd(true);
+    mapped.load_vxv(vxv);
+    EXPECT_EQ(mapped.get_vector(7), db.get_vector(7));
+
+    std::vector<float> query(kDim, 0.1f);
+    for (const char* metric : {"eucl", "cos"}) {
+        auto want = db.search(query, 10, 1, metric);
+        auto got = mapped.search(query, 10, 1, metric);
+        ASSERT_EQ(got.size(), want.size());
+        for (size_t i = 0; i < want.size(); i++) {
+            EXPECT_EQ(got[i].first, want[i].first);
+            EXPECT_NEAR(got[i].second, want[i].second, 1e-4f);
+        }
+    }
+
+    // uint8 sources: a 3x5 .bvecs and the same data as a '|u1' .npy.
+    const std::string bvecs = "/tmp/velox_vxv_test.bvecs";
+    const std::string npy = "/tmp/velox_vxv_test.npy";
+    {
+        std::ofstream out(bvecs, std::ios::binary);
+        int d = 5;
+        for (uint8_t r = 0; r < 3; r++) {
+            out.write(reinterpret_cast<const char*>(&d), sizeof(int));
+            for (uint8_t c = 0; c < 5; c++) { uint8_t v = r * 10 + c; out.put(static_cast<char>(v)); }
+        }
+    }
+    {
+        std::string header = "{'descr': '|u1', 'fortran_order': False, 'shape': (3, 5), }";
+        header.append(128 - 10 - header.size() - 1, ' ');  // pad to 128 bytes
+        header.push_back('\n');
+        std::ofstream out(npy, std::ios::binary);
+        out.write("\x93NUMPY\x01\x00", 8);
+        uint16_t len = static_cast<uint16_t>(header.size());
+        out.write(reinterpret_cast<const char*>(&len), sizeof(len));
+        out << header;
+        for (uint8_t r = 0; r < 3; r++)
+            for (uint8_t c = 0; c < 5; c++) out.put(static_cast<char>(r * 10 + c));
+    }
+    for (const std::string& src : {bvecs, npy}) {
+        EXPECT_EQ(convert_to_vxv(src, vxv, /*with_norms=*/false), 3u);
+        VectorIndex small;
+        small.load_vxv(vxv);
+        EXPECT_EQ(small.get_vector(2), (std::vector<float>{20, 21, 22, 23, 24}));
+    }
+    EXPECT_THROW(convert_to_vxv(vxv, fvecs), std::runtime_error);
+
+    for (const std::string& p : {fvecs, vxv, bvecs, npy}) std::remove(p.c_str());
+}
+
+TEST(MetricsTest, SpecializedKernelsMatchGeneric) {
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int dim : {384, 768, 1536}) {
+        const DistKernels& k = dist_kernels(dim);
+        EXPECT_TRUE(k.specialized);
+        std::vector<float> a(dim), b(dim);
+        for (int i = 0; i < dim; i++) { a[i] = dist(rng); b[i] = dist(rng); }
+        float l2 = euclidean_dist(a.data(), b.data(), dim);
+        EXPECT_NEAR(k.l2(a.data(), b.data(), dim), l2, 1e-4f * l2);
+        EXPECT_NEAR(k.cosine(a.data(), b.data(), dim), cosine_dist(a.data(), b.data(), dim), 1e-5f);
+    }
+    EXPECT_FALSE(dist_kernels(100).specialized);
+    EXPECT_EQ(dist_kernels(100).l2, &euclidean_dist_simd);
+}
+
+// A reordered graph searches a relabelled copy of the vectors but must still
+// report storage ids (distance matches the stored vector), keep recall, and
+// survive a save/load, which rebuilds the copy from the storage.
+TEST_F(VeloxTest, HNSWReorderKeepsExternalIds) {
+    std::mt19937 rng(37);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 600;
+    constexpr int kDim = 16;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (int d = 0; d < kDim; d++) v[d] = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<float> query(kDim);
+    for (int d = 0; d < kDim; d++) query[d] = dist(rng);
+    auto brute = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl");
+    std::unordered_set<int> brute_ids;
+    for (auto& p : brute) brute_ids.insert(p.first);
+
+    EXPECT_THROW(db.build_index_hnsw(16, 100, "eucl", "gorder"), std::runtime_error);
+
+    const char* path = "/tmp/velox_hnsw_reorder_test.idx";
+    for (const char* method : {"bfs", "rcm"}) {
+        db.build_index_hnsw(/*M=*/16, /*ef_construction=*/100, "eucl", method);
+        auto approx = db.search(query, /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/100);
+        int overlap = 0;
+        for (auto& p : approx) {
+            if (brute_ids.count(p.first)) overlap++;
+            auto v = db.get_vector(p.first);
+            EXPECT_NEAR(p.second, euclidean_dist(v.data(), query.data(), kDim), 1e-4f);
+        }
+        EXPECT_GE(overlap, 8) << method;
+
+        db.save_index(path);
+        VectorIndex reloaded;
+        reloaded.set_simd(true);
+        for (int i = 0; i < kNumVectors; i++) reloaded.add_vector(db.get_vector(i));
+        reloaded.load_index(path);
+        auto after = reloaded.search(query, /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/100);
+        ASSERT_EQ(after.size(), approx.size());
+        for (size_t i = 0; i < after.size(); i++) EXPECT_EQ(after[i].first, approx[i].first);
+    }
+    std::remove(path);
+}
+
+// On tightly clustered data, closest-M pruning wires each cluster to itself;
+// the diversity heuristic keeps long edges, so the graph stays connected
+// and recall at a small ef_search is much higher.
+TEST_F(VeloxTest, HNSWHeuristicSelectionConnectsClusteredData) {
+    std::mt19937 rng(39);
+    std::normal_distribution<float> dist(0.0f, 1.0f);
+    constexpr int kDim = 16, kClusters = 40, kNumVectors = 3000;
+    std::vector<std::vector<float>> centers(kClusters, std::vector<float>(kDim));
+    for (auto& c : centers) for (float& x : c) x = 5.0f * dist(rng);
+    auto sample = [&]() {
+        auto v = centers[rng() % kClusters];
+        for (float& x : v) x += 0.3f * dist(rng);
+        return v;
+    };
+    for (int i = 0; i < kNumVectors; i++) db.add_vector(sample());
+    std::vector<std::vector<float>> queries;
+    std::vector<std::unordered_set<int>> truth;
+    for (int q = 0; q < 50; q++) {
+        queries.push_back(sample());
+        std::unordered_set<int> ids;
+        for (auto& p : db.search(queries.back(), /*k=*/10)) ids.insert(p.first);
+        truth.push_back(ids);
+    }
+    auto recall = [&]() {
+        int hits = 0;
+        for (size_t q = 0; q < queries.size(); q++)
+            for (auto& p : db.search(queries[q], /*k=*/10, /*nprobe=*/1, "eucl", /*ef_search=*/20))
+                hits += truth[q].count(p.first);
+        return hits / (10.0 * queries.size());
+    };
+
+    EXPECT_THROW(db.graph_stats(), std::runtime_error);  // nothing built yet
+    db.build_index_hnsw(/*M=*/8, /*ef_construction=*/100, "eucl");
+    GraphStats simple = db.graph_stats();
+    double simple_recall = recall();
+
+    db.build_index_hnsw(/*M=*/8, /*ef_construction=*/100, "eucl", "none", "heuristic",
+                        /*extend_candidates=*/true);
+    GraphStats heuristic = db.graph_stats();
+    double heuristic_recall = recall();
+
+    EXPECT_EQ(heuristic.num_nodes, kNumVectors);
+    int histogram_total = 0;
+    for (int c : heuristic.degree_histogram) histogram_total += c;
+    EXPECT_EQ(histogram_total, kNumVectors);
+    EXPECT_EQ(heuristic.nodes_per_layer[0], kNumVectors);
+    EXPECT_LE(heuristic.mean_degree[0], 16.0);
+
+    EXPECT_LT(heuristic.unreachable.size(), simple.unreachable.size());
+    EXPECT_LT(heuristic.unreachable.size(), static_cast<size_t>(kNumVectors / 100));
+    EXPECT_GT(heuristic_recall, simple_recall);
+    EXPECT_GE(heuristic_recall, 0.9);
+}
+
+// Vectors added after an IVF build land in their nearest list and are found
+// straight away; a burst into one region shows up as imbalance and drift,
+// and a rebalance splits the overgrown list without losing any vector.
+TEST_F(VeloxTest, IVFIncrementalInsertAndRebalance) {
+    std::mt19937 rng(40);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int i = 0; i < 400; i++) db.add_vector({dist(rng) * 10, dist(rng) * 10});
+    db.build_index(/*num_clusters=*/8, /*epochs=*/10, "eucl");
+    ClusterStats built = db.cluster_stats();
+    EXPECT_EQ(built.num_vectors, 400);
+    EXPECT_EQ(built.inserted, 0);
+
+    // A tight burst far from every centroid.
+    for (int i = 0; i < 400; i++) db.add_vector({30.0f + dist(rng), 30.0f + dist(rng)});
+    auto hit = db.search({30.2f, 29.9f}, /*k=*/1, /*nprobe=*/1, "eucl");
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_GE(hit[0].first, 400);
+
+    ClusterStats grown = db.cluster_stats();
+    EXPECT_EQ(grown.num_vectors, 800);
+    EXPECT_EQ(grown.inserted, 400);
+    EXPECT_GT(grown.imbalance, built.imbalance);
+    EXPECT_GT(grown.max_drift, 1.0);
+
+    EXPECT_GT(db.rebalance_index(/*split_factor=*/2.0f, /*merge_factor=*/0.0f,
+                                 /*drift_threshold=*/0.5f), 0);
+    ClusterStats after = db.cluster_stats();
+    EXPECT_EQ(after.num_vectors, 800);
+    EXPECT_GT(after.num_lists, grown.num_lists);
+    EXPECT_LT(after.max_list, grown.max_list);
+    EXPECT_LE(after.max_drift, 0.5);
+    EXPECT_LT(after.imbalance, grown.imbalance);
+
+    // Still searchable, and the saved index round-trips with its metric.
+    const char* path = "/tmp/velox_ivf_rebalance_test.idx";
+    db.save_index(path);
+    VectorIndex reloaded;
+    for (int i = 0; i < 800; i++) reloaded.add_vector(db.get_vector(i));
+    reloaded.load_index(path);
+    std::remove(path);
+    reloaded.add_vector({30.0f, 30.0f});
+    EXPECT_EQ(reloaded.cluster_stats().num_vectors, 801);
+    EXPECT_EQ(reloaded.search({30.0f, 30.0f}, 1, 1, "eucl")[0].first, 800);
+}
+
+// Re-centering is opt-in: a default rebalance of a balanced index that took
+// a few more inserts changes nothing, since moving centroids without
+// reassigning members would only misplace them.
+TEST_F(VeloxTest, IVFDefaultRebalanceLeavesBalancedIndex) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 8;
+    auto add = [&](int n) {
+        for (int i = 0; i < n; i++) {
+            std::vector<float> v(kDim);
+            for (float& x : v) x = dist(rng);
+            db.add_vector(v);
+        }
+    };
+    add(4000);
+    db.build_index(/*num_clusters=*/16, /*epochs=*/10, "eucl");
+    add(40);
+    ClusterStats before = db.cluster_stats();
+    ASSERT_GT(before.max_drift, 0.0);
+
+    EXPECT_EQ(db.rebalance_index(), 0);
+    ClusterStats after = db.cluster_stats();
+    EXPECT_EQ(after.list_sizes, before.list_sizes);
+    EXPECT_EQ(after.drift, before.drift);
+}
+
+// The HNSW coarse quantizer should pick (nearly) the same lists as scoring
+// every centroid, so recall stays close to the flat quantizer's, and it must
+// survive a save/load.
+TEST_F(VeloxTest, IVFGraphQuantizerMatchesFlatRecall) {
+    std::mt19937 rng(41);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 4000, kDim = 16;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<std::vector<float>> queries(40, std::vector<float>(kDim));
+    std::vector<std::unordered_set<int>> truth;
+    for (auto& q : queries) {
+        for (float& x : q) x = dist(rng);
+        std::unordered_set<int> ids;
+        for (auto& p : db.search(q, /*k=*/10)) ids.insert(p.first);
+        truth.push_back(ids);
+    }
+    auto recall = [&](VectorIndex& index) {
+        int hits = 0;
+        for (size_t q = 0; q < queries.size(); q++)
+            for (auto& p : index.search(queries[q], /*k=*/10, /*nprobe=*/8, "eucl"))
+                hits += truth[q].count(p.first);
+        return hits / (10.0 * queries.size());
+    };
+
+    EXPECT_THROW(db.build_index(64, 5, "eucl", "ivfpq"), std::runtime_error);
+    db.build_index(/*num_clusters=*/64, /*epochs=*/5, "eucl");
+    double flat = recall(db);
+    db.build_index(/*num_clusters=*/64, /*epochs=*/5, "eucl", "hnsw", /*quantizer_ef=*/32);
+    double graph = recall(db);
+    EXPECT_GE(graph, flat - 0.1);
+    EXPECT_EQ(db.cluster_stats().num_vectors, kNumVectors);
+
+    const char* path = "/tmp/velox_ivf_graph_quantizer_test.idx";
+    db.save_index(path);
+    VectorIndex reloaded;
+    for (int i = 0; i < kNumVectors; i++) reloaded.add_vector(db.get_vector(i));
+    reloaded.load_index(path);
+    std::remove(path);
+    for (auto& q : queries) {
+        auto a = db.search(q, 10, 8, "eucl");
+        auto b = reloaded.search(q, 10, 8, "eucl");
+        ASSERT_EQ(a.size(), b.size());
+        for (size_t i = 0; i < a.size(); i++) EXPECT_EQ(a[i].first, b[i].first);
+    }
+}
+
+TEST_F(VeloxTest, IVFSpillRaisesRecallWithoutDuplicates) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 4000, kDim = 16;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        db.add_vector(v);
+    }
+    std::vector<std::vector<float>> queries(40, std::vector<float>(kDim));
+    std::vector<std::unordered_set<int>> truth;
+    for (auto& q : queries) {
+        for (float& x : q) x = dist(rng);
+        std::unordered_set<int> ids;
+        for (auto& p : db.search(q, /*k=*/10)) ids.insert(p.first);
+        truth.push_back(ids);
+    }
+    auto recall = [&](VectorIndex& index) {
+        int hits = 0;
+        for (size_t q = 0; q < queries.size(); q++) {
+            auto res = index.search(queries[q], /*k=*/10, /*nprobe=*/2, "eucl");
+            std::unordered_set<int> seen;
+            for (auto& p : res) {
+                EXPECT_TRUE(seen.insert(p.first).second) << "duplicate id " << p.first;
+                hits += truth[q].count(p.first);
+            }
+        }
+        return hits / (10.0 * queries.size());
+    };
+
+    EXPECT_THROW(db.build_index(64, 5, "eucl", "flat", 64, "twice"), std::runtime_error);
+    db.build_index(/*num_clusters=*/64, /*epochs=*/5, "eucl");
+    double none = recall(db);
+    EXPECT_EQ(db.cluster_stats().spilled, 0);
+    db.build_index(/*num_clusters=*/64, /*epochs=*/5, "eucl", "flat", 64, "ratio", 1.2f);
+    EXPECT_GT(db.cluster_stats().spilled, 0);
+    EXPECT_GE(recall(db), none);
+    db.build_index(/*num_clusters=*/64, /*epochs=*/5, "eucl", "flat", 64, "soar");
+    EXPECT_EQ(db.cluster_stats().spilled, kNumVectors);
+    EXPECT_GT(recall(db), none);
+
+    const char* path = "/tmp/velox_ivf_spill_test.idx";
+    db.save_index(path);
+    VectorIndex reloaded;
+    for (int i = 0; i < kNumVectors; i++) reloaded.add_vector(db.get_vector(i));
+    reloaded.load_index(path);
+    std::remove(path);
+    EXPECT_EQ(reloaded.cluster_stats().spilled, kNumVectors);
+    EXPECT_DOUBLE_EQ(recall(reloaded), recall(db));
+}
+
+// Every gap width (including the scalar path past 25 bits), appended tails
+// and a save/load round trip must decode to the same id set.
+TEST(PackedIdsTest, RoundTripsAllWidths) {
+    std::mt19937 rng(43);
+    for (int width : {0, 1, 7, 16, 25, 26, 31}) {
+        std::vector<int> ids;
+        int next = 5;
+        for (int i = 0; i < 3 * PackedIds::kBlock + 17; i++) {
+            ids.push_back(next);
+            next += 1 + (width ? static_cast<int>(rng() % (1u << std::min(width, 24))) : 0);
+            if (width > 25 && i % 50 == 0) next += 1 << (width - 1);
+            if (next < 0) break;
+        }
+        std::shuffle(ids.begin(), ids.end(), rng);
+
+        PackedIds packed;
+        packed.assign(std::vector<int>(ids.begin(), ids.begin() + ids.size() / 2));
+        for (size_t i = ids.size() / 2; i < ids.size(); i++) packed.push_back(ids[i]);
+        ASSERT_EQ(packed.size(), ids.size());
+
+        const char* path = "/tmp/velox_packed_ids_test.bin";
+        { std::ofstream out(path, std::ios::binary); packed.save(out); }
+        PackedIds reloaded;
+        { std::ifstream in(path, std::ios::binary); reloaded.load(in); }
+        std::remove(path);
+
+        std::sort(ids.begin(), ids.end());
+        for (const PackedIds* p : {&packed, &reloaded}) {
+            std::vector<int> out;
+            p->decode(out);
+            std::sort(out.begin(), out.end());
+            EXPECT_EQ(out, ids) << "width " << width;
+        }
+    }
+}
+
+TEST_F(VeloxTest, IVFPackedListsAndExternalIds) {
+    std::mt19937 rng(44);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 3000, kDim = 16;
+    constexpr int64_t kIdBase = int64_t{1} << 40;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        db.add_vector_with_id(v, kIdBase + 7 * i);
+    }
+    EXPECT_THROW(db.add_vector_with_id(db.get_vector(0), kIdBase), std::runtime_error);
+    EXPECT_THROW(db.add_vector(db.get_vector(0)), std::runtime_error);
+    EXPECT_EQ(db.internal_id(kIdBase + 7 * 42), 42);
+
+    std::vector<std::vector<float>> queries(20, std::vector<float>(kDim));
+    for (auto& q : queries) for (float& x : q) x = dist(rng);
+    EXPECT_THROW(db.build_index(32, 5, "eucl", "flat", 64, "none", 1.1f, "zip"),
+                 std::runtime_error);
+    std::vector<std::vector<std::pair<int, float>>> exact;
+    for (auto& q : queries) exact.push_back(db.search(q, 10));
+
+    // Probing every packed list must reproduce the exhaustive results.
+    db.build_index(/*num_clusters=*/32, /*epochs=*/5, "eucl", "flat", 64, "none", 1.1f, "packed");
+    for (size_t q = 0; q < queries.size(); q++) {
+        auto res = db.search(queries[q], 10, /*nprobe=*/32, "eucl");
+        ASSERT_EQ(res.size(), exact[q].size());
+        for (size_t i = 0; i < res.size(); i++) EXPECT_EQ(res[i].first, exact[q][i].first);
+    }
+    auto labelled = db.search_ids(queries[0], 10, 32, "eucl");
+    for (size_t i = 0; i < labelled.size(); i++)
+        EXPECT_EQ(labelled[i].first, kIdBase + 7 * exact[0][i].first);
+
+    // Appends land in the packed tails; save/load keeps lists and ids.
+    std::vector<float> extra(kDim, 0.5f);
+    db.add_vector_with_id(extra, -1);
+    EXPECT_EQ(db.cluster_stats().num_vectors, kNumVectors + 1);
+    EXPECT_EQ(db.search_ids(extra, 1, 1, "eucl").front().first, -1);
+
+    const char* path = "/tmp/velox_ivf_packed_test.idx";
+    db.save_index(path);
+    VectorIndex reloaded;
+    for (int i = 0; i <= kNumVectors; i++) reloaded.add_vector(db.get_vector(i));
+    reloaded.load_index(path);
+    std::remove(path);
+    EXPECT_EQ(reloaded.internal_id(-1), kNumVectors);
+    EXPECT_EQ(reloaded.search_ids(extra, 1, 1, "eucl").front().first, -1);
+    EXPECT_EQ(reloaded.cluster_stats().num_vectors, kNumVectors + 1);
+}
+
+TEST_F(VeloxTest, MemoryUsageAndBudget) {
+    std::mt19937 rng(45);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 2000, kDim = 32;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        db.add_vector(v);
+    }
+    auto component = [](const MemoryUsage& u, const std::string& name) {
+        for (const auto& [n, bytes] : u.components) if (n == name) return bytes;
+        return size_t{0};
+    };
+    EXPECT_GE(component(db.memory_usage(), "storage.float"), size_t{kNumVectors} * kDim * 4);
+
+    // Only SQ8 codes held: the decoded k-means copy (256 KB) does not fit,
+    // so the build decodes rows as it goes instead.
+    db.set_storage_encoding("sq8", /*keep_float=*/false);
+    size_t held = db.memory_usage().heap_bytes();
+    db.set_memory_budget(held + 100 * 1024);
+    db.build_index(/*num_clusters=*/16, /*epochs=*/3);
+    MemoryUsage usage = db.memory_usage();
+    EXPECT_EQ(component(usage, "storage.float"), 0u);
+    EXPECT_GT(component(usage, "ivf.lists"), 0u);
+    EXPECT_EQ(db.cluster_stats().num_vectors, kNumVectors);
+
+    db.set_memory_budget(usage.heap_bytes() + 1024);
+    EXPECT_THROW(db.build_index_hnsw(16, 50), std::runtime_error);
+    EXPECT_EQ(db.get_index_type(), "ivf");
+    db.set_memory_budget(0);
+
+    const char* path = "/tmp/velox_memory_usage_test.fvecs";
+    db.write_fvecs(path);
+    VectorIndex mapped;
+    mapped.load_fvecs(path, /*populate=*/true);
+    MemoryUsage m = mapped.memory_usage();
+    std::remove(path);
+    EXPECT_EQ(m.mapped_bytes, size_t{kNumVectors} * (kDim + 1) * 4);
+    EXPECT_GT(m.resident_bytes, 0u);
+    EXPECT_LE(m.resident_bytes, m.mapped_bytes);
+}
+
+TEST_F(VeloxTest, TraceRecordsBuildAndQueryStages) {
+    if (!trace::compiled_in()) GTEST_SKIP() << "built with VELOX_TRACING=0";
+    std::mt19937 rng(46);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    for (int i = 0; i < 500; i++) {
+        std::vector<float> v(8);
+        for (float& x : v) x = dist(rng);
+        db.add_vector(v);
+    }
+    // Spans recorded before start() are not part of the trace.
+    db.build_index(/*num_clusters=*/8, /*epochs=*/1);
+
+    trace::start();
+    db.build_index(/*num_clusters=*/8, /*epochs=*/3);
+    db.search({0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f}, 5, 2);
+    const char* path = "/tmp/velox_trace_test.json";
+    size_t spans = trace::stop(path);
+    db.search({0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f, 0.7f, 0.8f}, 5, 2);
+
+    std::ifstream in(path);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::remove(path);
+    EXPECT_GT(spans, 0u);
+    EXPECT_NE(json.find("\"traceEvents\""), std::string::npos);
+    EXPECT_NE(json.find("\"lock.unique\""), std::string::npos);
+    EXPECT_NE(json.find("\"lock.shared\""), std::string::npos);
+    EXPECT_NE(json.find("\"ivf.centroid_scoring\""), std::string::npos);
+    EXPECT_NE(json.find("\"ivf.list_scan\""), std::string::npos);
+    size_t epochs = 0;
+    for (size_t pos = json.find("\"ivf.kmeans_epoch\""); pos != std::string::npos;
+         pos = json.find("\"ivf.kmeans_epoch\"", pos + 1))
+        epochs++;
+    EXPECT_EQ(epochs, 3u);
+}
+
+TEST_F(VeloxTest, LockStatsCountContendedWaits) {
+    db.add_vector({1.0f, 0.0f});
+    db.add_vector({0.0f, 1.0f});
+    db.reset_lock_stats();
+    db.search({1.0f, 0.0f}, 1);
+    db.add_vector({1.0f, 1.0f});
+    LockStats s = db.lock_stats();
+    EXPECT_EQ(s.shared.acquisitions, 1u);
+    EXPECT_EQ(s.exclusive.acquisitions, 1u);
+    EXPECT_EQ(s.shared.contended + s.exclusive.contended, 0u);
+
+    // A search issued while a slow build holds the lock exclusively waits
+    // for it, and the wait is charged to the searching thread.
+    for (int i = 0; i < 20000; i++) db.add_vector({static_cast<float>(i % 97), static_cast<float>(i % 89)});
+    std::atomic<bool> started{false};
+    std::thread builder([&] {
+        started = true;
+        db.build_index_hnsw(/*M=*/16, /*ef_construction=*/200);
+    });
+    while (!started) std::this_thread::yield();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    uint64_t before = VectorIndex::thread_lock_wait_ns();
+    db.search({1.0f, 0.0f}, 1);
+    uint64_t waited = VectorIndex::thread_lock_wait_ns() - before;
+    builder.join();
+    s = db.lock_stats();
+    EXPECT_GE(s.shared.contended, 1u);
+    EXPECT_GT(waited, 0u);
+    EXPECT_LE(waited, s.shared.wait_ns);
+    EXPECT_GE(s.shared.max_wait_ns, s.shared.wait_ns / s.shared.contended);
+}
+
+// Partitions indexed against one frozen codebook merge into exactly the
+// lists a single build over all their vectors produces; HNSW partitions
+// merge into one connected graph with rebuild-level recall.
+TEST_F(VeloxTest, MergeIndependentlyBuiltPartitions) {
+    std::mt19937 rng(47);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16, kA = 3000, kB = 1000;
+    auto random_vec = [&] {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        return v;
+    };
+    VectorIndex a, b, all;
+    for (int i = 0; i < kA; i++) { auto v = random_vec(); a.add_vector(v); all.add_vector(v); }
+    for (int i = 0; i < kB; i++) { auto v = random_vec(); b.add_vector(v); all.add_vector(v); }
+
+    // The codebook, trained on a sample.
+    for (int i = 0; i < 1000; i++) db.add_vector(random_vec());
+    db.build_index(/*num_clusters=*/32, /*epochs=*/5, "eucl", "flat", 64, "ratio");
+    a.build_index_from(db);
+    b.build_index_from(db);
+    all.build_index_from(db);
+    EXPECT_THROW(b.merge(b), std::runtime_error);
+    a.merge(b);
+    EXPECT_EQ(a.size(), kA + kB);
+    EXPECT_EQ(a.cluster_stats().list_sizes, all.cluster_stats().list_sizes);
+    EXPECT_EQ(a.cluster_stats().spilled, all.cluster_stats().spilled);
+    std::vector<float> q = b.get_vector(7);
+    auto hit = a.search(q, 1, /*nprobe=*/32);
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_EQ(hit[0].first, kA + 7);
+
+    // HNSW: the smaller graph is linked into the larger one.
+    VectorIndex a2, b2;
+    for (int i = 0; i < kA + kB; i++) (i < kA ? a2 : b2).add_vector(all.get_vector(i));
+    a2.build_index_hnsw(/*M=*/12, /*ef_construction=*/100);
+    EXPECT_THROW(a2.merge(b2), std::runtime_error);  // b2 not built yet
+    b2.build_index(/*num_clusters=*/8, /*epochs=*/2);
+    EXPECT_THROW(a2.merge(b2), std::runtime_error);  // different index kinds
+    EXPECT_EQ(a2.size(), kA);
+    b2.build_index_hnsw(/*M=*/12, /*ef_construction=*/100);
+    a2.merge(b2);
+    ASSERT_EQ(a2.size(), kA + kB);
+    // A fresh build strands a handful of nodes too.
+    EXPECT_LE(a2.graph_stats().unreachable.size(), 10u);
+
+    int hits = 0;
+    constexpr int kQueries = 50;
+    for (int t = 0; t < kQueries; t++) {
+        auto query = random_vec();
+        std::unordered_set<int> truth;
+        for (auto& p : all.search(query, 10, /*nprobe=*/32)) truth.insert(p.first);
+        for (auto& p : a2.search(query, 10, 1, "eucl", /*ef_search=*/64)) hits += truth.count(p.first);
+    }
+    EXPECT_GE(hits / (10.0 * kQueries), 0.9);
+}
+
+// A merge that fails leaves the target's vectors, ids and index as they
+// were, and a later merge still lines up.
+TEST_F(VeloxTest, FailedMergeLeavesIndexUnchanged) {
+    std::mt19937 rng(49);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 8;
+    auto random_vec = [&] {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        return v;
+    };
+    VectorIndex a, cos_trained, ok;
+    for (int i = 0; i < 500; i++) a.add_vector_with_id(random_vec(), 1000 + i);
+    for (int i = 0; i < 200; i++) cos_trained.add_vector_with_id(random_vec(), 2000 + i);
+    for (int i = 0; i < 200; i++) ok.add_vector_with_id(random_vec(), 3000 + i);
+    a.build_index(/*num_clusters=*/8, /*epochs=*/3, "eucl");
+    cos_trained.build_index(/*num_clusters=*/8, /*epochs=*/3, "cos");
+    ok.build_index(/*num_clusters=*/4, /*epochs=*/3, "eucl");
+
+    std::vector<float> q = random_vec();
+    auto before = a.search(q, 10, /*nprobe=*/8);
+    EXPECT_THROW(a.merge(cos_trained), std::runtime_error);
+    EXPECT_EQ(a.size(), 500);
+    EXPECT_EQ(a.cluster_stats().num_vectors, 500);
+    EXPECT_THROW(a.internal_id(2000), std::out_of_range);
+    EXPECT_EQ(a.search(q, 10, /*nprobe=*/8), before);
+
+    a.merge(ok);
+    EXPECT_EQ(a.size(), 700);
+    EXPECT_EQ(a.internal_id(3007), 507);
+    auto hit = a.search(ok.get_vector(7), 1, /*nprobe=*/8);
+    ASSERT_EQ(hit.size(), 1u);
+    EXPECT_EQ(hit[0].first, 507);
+}
+
+TEST_F(VeloxTest, KnnGraphExactApproxAndStreamed) {
+    std::mt19937 rng(48);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kNumVectors = 1500, kDim = 12, kK = 8;
+    for (int i = 0; i < kNumVectors; i++) {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        db.add_vector(v);
+    }
+
+    KnnGraph exact = db.knn_graph(kK, "exact", "eucl", 1, -1, /*num_threads=*/4);
+    ASSERT_EQ(exact.n, kNumVectors);
+    ASSERT_EQ(exact.ids.size(), size_t{kNumVectors} * kK);
+    for (int i : {0, 63, 64, 777, kNumVectors - 1}) {
+        auto truth = db.search(db.get_vector(i), kK + 1);  // includes i itself
+        ASSERT_EQ(truth[0].first, i);
+        for (int j = 0; j < kK; j++) {
+            EXPECT_EQ(exact.ids[static_cast<size_t>(i) * kK + j], truth[j + 1].first);
+            EXPECT_FLOAT_EQ(exact.distances[static_cast<size_t>(i) * kK + j], truth[j + 1].second);
+        }
+    }
+
+    EXPECT_THROW(db.knn_graph(kK, "approx"), std::runtime_error);  // no index yet
+    db.build_index_hnsw(/*M=*/16, /*ef_construction=*/100);
+    KnnGraph approx = db.knn_graph(kK, "approx", "eucl", 1, /*ef_search=*/64);
+    int hits = 0;
+    for (int i = 0; i < kNumVectors; i++) {
+        const int* row = exact.ids.data() + static_cast<size_t>(i) * kK;
+        for (int j = 0; j < kK; j++) {
+            int id = approx.ids[static_cast<size_t>(i) * kK + j];
+            EXPECT_NE(id, i);
+            hits += std::count(row, row + kK, id);
+        }
+    }
+    EXPECT_GE(hits / double(kNumVectors * kK), 0.9);
+
+    const char* path = "/tmp/velox_knn_graph_test.knn";
+    EXPECT_EQ(db.write_knn_graph(path, kK, "exact"), kNumVectors);
+    std::ifstream in(path, std::ios::binary);
+    KnnFileHeader h{};
+    in.read(reinterpret_cast<char*>(&h), sizeof(h));
+    EXPECT_EQ(h.magic, KNN_MAGIC);
+    ASSERT_EQ(h.n, uint64_t{kNumVectors});
+    ASSERT_EQ(h.k, uint32_t{kK});
+    std::vector<int> ids(exact.ids.size());
+    std::vector<float> dists(exact.distances.size());
+    in.seekg(h.ids_offset);
+    in.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(int));
+    in.seekg(h.distances_offset);
+    in.read(reinterpret_cast<char*>(dists.data()), dists.size() * sizeof(float));
+    in.close();
+    std::remove(path);
+    EXPECT_EQ(ids, exact.ids);
+    EXPECT_EQ(dists, exact.distances);
+
+    // Fewer than k other vectors: the row is padded.
+    VectorIndex tiny;
+    tiny.add_vector({0.0f, 0.0f});
+    tiny.add_vector({1.0f, 0.0f});
+    KnnGraph g = tiny.knn_graph(3);
+    EXPECT_EQ(g.ids, (std::vector<int>{1, -1, -1, 0, -1, -1}));
+    EXPECT_TRUE(std::isinf(g.distances[1]));
+}
+
+TEST_F(VeloxTest, CheckpointDeltasReplayOnOpen) {
+    const std::string dir = "/tmp/velox_checkpoint_test";
+    mkdir(dir.c_str(), 0755);
+    const std::string vectors = dir + "/" + VectorIndex::kVectorsFile;
+    const std::string index = dir + "/" + VectorIndex::kIndexFile;
+    const std::string delta1 = dir + "/delta-1.vxd", delta2 = dir + "/delta-2.vxd";
+    auto exists = [](const std::string& path) { return std::ifstream(path).good(); };
+    auto file_size = [](const std::string& path) {
+        return std::ifstream(path, std::ios::binary | std::ios::ate).tellg();
+    };
+
+    std::mt19937 rng(49);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kDim = 16;
+    auto random_vec = [&] {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        return v;
+    };
+    for (int i = 0; i < 3000; i++) db.add_vector_with_id(random_vec(), 10 * i);
+    db.build_index(/*num_clusters=*/32, /*epochs=*/5, "eucl", "flat", 64, "ratio", 1.1f, "packed");
+    EXPECT_EQ(db.checkpoint(dir), "base");
+    for (int i = 3000; i < 3200; i++) db.add_vector_with_id(random_vec(), 10 * i);
+    EXPECT_EQ(db.checkpoint(dir), "delta");
+    EXPECT_EQ(db.checkpoint(dir), "none");
+    for (int i = 3200; i < 3300; i++) db.add_vector_with_id(random_vec(), 10 * i);
+    EXPECT_EQ(db.checkpoint(dir), "delta");
+    ASSERT_TRUE(exists(delta2));
+    // 200 of 3200 vectors changed: the delta is a fraction of the base.
+    EXPECT_LT(file_size(delta1) * 10, file_size(vectors) + file_size(index));
+
+    VectorIndex opened;
+    opened.set_simd(true);
+    opened.open(dir, true, /*use_mmap=*/false);
+    EXPECT_EQ(opened.size(), 3300);
+    EXPECT_EQ(opened.internal_id(10 * 3250), 3250);
+    EXPECT_EQ(opened.cluster_stats().list_sizes, db.cluster_stats().list_sizes);
+    EXPECT_EQ(opened.cluster_stats().spilled, db.cluster_stats().spilled);
+    std::vector<float> q = random_vec();
+    EXPECT_EQ(opened.search_ids(q, 10, /*nprobe=*/4), db.search_ids(q, 10, 4));
+    // The opened instance continues the sequence; a rebalance needs a base.
+    opened.add_vector_with_id(random_vec(), -1);
+    EXPECT_EQ(opened.checkpoint(dir), "delta");
+    EXPECT_TRUE(exists(dir + "/delta-3.vxd"));
+    opened.rebalance_index(/*split_factor=*/1.5f);
+    EXPECT_EQ(opened.checkpoint(dir), "base");
+    EXPECT_FALSE(exists(delta1));
+
+    // HNSW: a merge adds nodes and rewires some existing ones.
+    VectorIndex a, b;
+    for (int i = 0; i < 2000; i++) (i < 1500 ? a : b).add_vector(random_vec());
+    a.build_index_hnsw(/*M=*/12, /*ef_construction=*/100);
+    b.build_index_hnsw(/*M=*/12, /*ef_construction=*/100);
+    EXPECT_EQ(a.checkpoint(dir), "base");
+    a.merge(b);
+    EXPECT_EQ(a.checkpoint(dir), "delta");
+    VectorIndex reopened;
+    reopened.open(dir, true, /*use_mmap=*/false);
+    EXPECT_EQ(reopened.size(), 2000);
+    EXPECT_EQ(reopened.graph_stats().degree_histogram, a.graph_stats().degree_histogram);
+    EXPECT_EQ(reopened.search(q, 10, 1, "eucl", 64), a.search(q, 10, 1, "eucl", 64));
+
+    // Background consolidation folds the delta into a new base.
+    a.add_vector(random_vec());
+    EXPECT_EQ(a.checkpoint(dir), "delta");
+    a.start_consolidation(/*interval_seconds=*/0.01);
+    for (int i = 0; i < 2000 && exists(delta1); i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    a.stop_consolidation();
+    EXPECT_FALSE(exists(delta1));
+    VectorIndex consolidated;
+    consolidated.open(dir, /*with_index=*/false, /*use_mmap=*/false);
+    EXPECT_EQ(consolidated.size(), 2001);
+
+    std::remove(vectors.c_str());
+    std::remove(index.c_str());
+    rmdir(dir.c_str());
+}
+
+TEST_F(VeloxTest, FilteredSearchMatchesExactScan) {
+    std::mt19937 rng(50);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    constexpr int kN = 4000, kDim = 16;
+    auto random_vec = [&] {
+        std::vector<float> v(kDim);
+        for (float& x : v) x = dist(rng);
+        return v;
+    };
+    const std::string kColors[] = {"red", "green", "blue", "gold"};
+    for (int i = 0; i < kN; i++) db.add_vector(random_vec());
+    db.add_attribute("color", "tag");
+    db.add_attribute("price", "int");
+    db.add_attribute("title", "text");
+    for (int i = 0; i < kN; i++)
+        db.set_attributes(i, {{"color", kColors[i % 4]},
+                              {"price", int64_t{i}},
+                              {"title", "item " + std::to_string(i)}});
+
+    std::vector<AttrCondition> broad = {{"color", "in", {std::string("red"), std::string("blue")}},
+                                        {"price", ">=", {int64_t{1000}}}};
+    std::vector<AttrCondition> narrow = {{"color", "==", {std::string("gold")}},
+                                         {"price", "<", {int64_t{20}}}};
+    std::vector<float> q = random_vec();
+    auto ids = [](const std::vector<SearchHit>& hits) {
+        std::vector<int> out;
+        for (const auto& h : hits) out.push_back(h.id);
+        return out;
+    };
+    // Without an index, every matching row is scanned.
+    std::vector<SearchHit> exact = db.search_filtered(q, 10, broad, {"color", "title"});
+    ASSERT_EQ(exact.size(), 10u);
+    for (const auto& h : exact) {
+        EXPECT_TRUE(h.id % 4 == 0 || h.id % 4 == 2);
+        EXPECT_GE(h.id, 1000);
+        EXPECT_EQ(h.fields[0], AttrValue(kColors[h.id % 4]));
+        EXPECT_EQ(h.fields[1], AttrValue("item " + std::to_string(h.id)));
+    }
+
+    // IVF probing every list skips non-matching ids and finds the same hits.
+    db.build_index(/*num_clusters=*/32, /*epochs=*/5);
+    EXPECT_EQ(ids(db.search_filtered(q, 10, broad, {}, /*nprobe=*/32)), ids(exact));
+    // Too selective for the index: the five matching rows, found exactly.
+    std::vector<int> gold = ids(db.search_filtered(q, 10, narrow, {}, /*nprobe=*/1));
+    std::sort(gold.begin(), gold.end());
+    EXPECT_EQ(gold, (std::vector<int>{3, 7, 11, 15, 19}));
+    EXPECT_EQ(db.count_rows(narrow), 5);
+    EXPECT_EQ(db.find_rows(narrow, /*offset=*/1, /*limit=*/2), (std::vector<int>{7, 11}));
+
+    // HNSW keeps walking through non-matching nodes until ef matches are found.
+    db.build_index_hnsw(/*M=*/16, /*ef_construction=*/100);
+    std::vector<SearchHit> graph = db.search_filtered(q, 10, broad, {}, 1, "eucl", /*ef_search=*/200);
+    ASSERT_EQ(graph.size(), 10u);
+    int found = 0;
+    for (const auto& h : graph) {
+        EXPECT_TRUE((h.id % 4 == 0 || h.id % 4 == 2) && h.id >= 1000);
+        for (const auto& e : exact) found += e.id == h.id;
+    }
+    EXPECT_GE(found, 8);
+
+    EXPECT_THROW(db.search_filtered(q, 10, {{"size", "==", {int64_t{1}}}}), std::runtime_error);
+    EXPECT_THROW(db.search_filtered(q, 10, {{"color", "<", {std::string("red")}}}), std::runtime_error);
+    EXPECT_THROW(db.search_filtered(q, 10, {{"price", "==", {std::string("1")}}}), std::runtime_error);
+    EXPECT_THROW(db.set_attributes(0, {{"price", std::string("cheap")}}), std::runtime_error);
+}
+
+TEST_F(VeloxTest, AttributesPersistWithCheckpoints) {
+    const std::string dir = "/tmp/velox_attribute_test";
+    mkdir(dir.c_str(), 0755);
+    const std::string attributes = dir + "/" + VectorIndex::kAttributesFile;
+    auto exists = [](const std::string& path) { return std::ifstream(path).good(); };
+
+    std::mt19937 rng(51);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    auto random_vec = [&] {
+        std::vector<float> v(8);
+        for (float& x : v) x = dist(rng);
+        return v;
+    };
+    auto add = [&](int n) {
+        for (int i = 0; i < n; i++) {
+            db.add_vector(random_vec());
+            int row = db.size() - 1;
+            std::vector<std::pair<std::string, AttrValue>> values = {
+                {"category", "c" + std::to_string(row % 3)}, {"ts", int64_t{1000} + row}};
+            if (row % 2 == 0) values.emplace_back("note", "note " + std::to_string(row));
+            db.set_attributes(row, values);
+        }
+    };
+    db.add_attribute("category", "tag");
+    db.add_attribute("ts", "timestamp");
+    db.add_attribute("note", "text");
+    add(1000);
+    db.build_index(/*num_clusters=*/8, /*epochs=*/3);
+    EXPECT_EQ(db.checkpoint(dir), "base");
+    EXPECT_TRUE(exists(attributes));
+    add(100);
+    db.set_attributes(1, {{"note", std::string("updated")}});
+    EXPECT_EQ(db.checkpoint(dir), "delta");
+    // Attribute updates alone are folded into a base.
+    db.set_attributes(2, {{"note", std::monostate{}}});
+    EXPECT_EQ(db.checkpoint(dir), "base");
+    EXPECT_EQ(db.checkpoint(dir), "none");
+    add(10);
+    db.set_attributes(3, {{"ts", int64_t{-5}}});
+    EXPECT_EQ(db.checkpoint(dir), "delta");
+
+    std::vector<int> rows(db.size());
+    for (int i = 0; i < db.size(); i++) rows[i] = i;
+    std::vector<std::string> fields = {"note", "category", "ts"};
+    VectorIndex opened;
+    opened.open(dir, true, /*use_mmap=*/true, /*prefault=*/false);
+    EXPECT_EQ(opened.attribute_schema(), db.attribute_schema());
+    EXPECT_EQ(opened.get_attributes(rows, fields), db.get_attributes(rows, fields));
+    EXPECT_EQ(opened.get_attributes({1, 2, 3}, {"note", "ts"}),
+              (std::vector<std::vector<AttrValue>>{{std::string("updated"), int64_t{1001}},
+                                                   {std::monostate{}, int64_t{1002}},
+                                                   {std::monostate{}, int64_t{-5}}}));
+    std::vector<AttrCondition> c1 = {{"category", "==", {std::string("c1")}},
+                                     {"note", "contains", {std::string("10")}}};
+    EXPECT_EQ(opened.find_rows(c1), db.find_rows(c1));
+    bool listed = false;
+    for (const auto& [name, bytes] : opened.memory_usage().components)
+        listed |= name == "attributes.note";
+    EXPECT_TRUE(listed);
+
+    // A standalone attribute file maps back in and is copied on first write.
+    const std::string standalone = dir + "/standalone.vxa";
+    opened.save_attributes(standalone);
+    VectorIndex reloaded;
+    for (int i = 0; i < opened.size(); i++) reloaded.add_vector(opened.get_vector(i));
+    reloaded.load_attributes(standalone);
+    EXPECT_EQ(reloaded.get_attributes(rows, fields), db.get_attributes(rows, fields));
+    reloaded.set_attributes(4, {{"category", std::string("new")}});
+    EXPECT_EQ(reloaded.get_attributes({4, 5}, {"category"}),
+              (std::vector<std::vector<AttrValue>>{{std::string("new")}, {std::string("c2")}}));
+
+    for (const std::string& f : {standalone, attributes, dir + "/delta-1.vxd",
+                                 dir + "/" + VectorIndex::kVectorsFile,
+                                 dir + "/" + VectorIndex::kIndexFile})
+        std::remove(f.c_str());
+    rmdir(dir.c_str());
+}